@@ -0,0 +1,39 @@
+# Writes the SPIR-V of the shaders into a C++ source file, as arrays of words,
+# so the engine finds them without looking at the working directory
+#   OUTPUT:  the source file
+#   HEADER:  engine/Vulkan/EmbeddedShaders.h, which declares the table
+#   SHADERS: the compiled shaders separated by |, named shaders/<file name> in the table
+string(REPLACE "|" ";" SHADERS "${SHADERS}")
+
+set(source "// Generated by cmake/EmbedShaders.cmake from the compiled shaders, do not edit\n\n")
+string(APPEND source "#include \"${HEADER}\"\n\nnamespace engine {\n\nnamespace {\n\n")
+set(table "")
+foreach(shader ${SHADERS})
+    get_filename_component(name ${shader} NAME)
+    string(MAKE_C_IDENTIFIER ${name} identifier)
+    file(READ ${shader} hex HEX)
+    string(LENGTH "${hex}" length)
+    math(EXPR remainder "${length} % 8")
+    if (length EQUAL 0 OR NOT remainder EQUAL 0)
+        message(FATAL_ERROR "${shader} is no SPIR-V, its size is no multiple of 4 bytes")
+    endif()
+    # the words are little endian in the file, glslangValidator writes them in the byte order of the host
+    string(REGEX REPLACE "(..)(..)(..)(..)" "0x\\4\\3\\2\\1u, " words "${hex}")
+    # eight words per line
+    set(word "0x[0-9a-f]+u, ")
+    string(REGEX REPLACE "(${word}${word}${word}${word}${word}${word}${word}${word})" "\\1\n" words "${words}")
+    string(REGEX REPLACE " \n" "\n  " words "${words}")
+    string(REGEX REPLACE "[ \n]+$" "" words "${words}")
+    string(APPEND source "alignas(4) constexpr uint32_t ${identifier}[] = {\n  ${words}\n};\n\n")
+    string(APPEND table "  {\"shaders/${name}\", ${identifier}, sizeof(${identifier})},\n")
+endforeach()
+string(APPEND source "}\n\nconst EmbeddedShader embedded_shaders[] = {\n${table}};\n\n")
+string(APPEND source "const size_t embedded_shader_count = sizeof(embedded_shaders) / sizeof(embedded_shaders[0]);\n\n}\n")
+
+# only touched if it changed, so relinking the engine is all a shader edit costs
+if (EXISTS ${OUTPUT})
+    file(READ ${OUTPUT} previous)
+endif()
+if (NOT "${previous}" STREQUAL "${source}")
+    file(WRITE ${OUTPUT} "${source}")
+endif()
@@ -0,0 +1,225 @@
+#include "Log.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace engine {
+namespace log {
+
+namespace {
+
+// messages the sink pops before writing them out with one flush
+const size_t sink_batch = 64;
+
+const char level_tags[] = {'D', 'I', 'W', 'E'};
+
+}
+
+Logger& Logger::instance() {
+  static Logger logger;
+  return logger;
+}
+
+Logger::Logger()
+        : start_(std::chrono::steady_clock::now()) {
+  for (size_t i = 0; i < capacity; i++) {
+    slots_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+Logger::~Logger() {
+  running_ = false;
+  wake();
+  if (sink_.joinable()) {
+    sink_.join();
+  }
+}
+
+bool Logger::push(Message const& message) {
+  std::call_once(started_, [this] {
+    running_ = true;
+    sink_ = std::thread(&Logger::run, this);
+  });
+
+  // claim a slot: the one at enqueue_pos_ if the consumer is done with it
+  size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+  Slot* slot;
+  for (;;) {
+    slot = &slots_[pos % capacity];
+    size_t sequence = slot->sequence.load(std::memory_order_acquire);
+    intptr_t diff = intptr_t(sequence) - intptr_t(pos);
+    if (diff == 0) {
+      if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      // full, the sink can't keep up
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    } else {
+      pos = enqueue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+
+  Message& target = slot->message;
+  target.level = message.level;
+  target.thread = message.thread;
+  target.time_ms = message.time_ms;
+  target.length = std::min<uint32_t>(message.length, Message::max_length);
+  memcpy(target.text, message.text, target.length);
+  slot->sequence.store(pos + 1, std::memory_order_release);
+  pushed_.fetch_add(1, std::memory_order_release);
+
+  // the message is visible before we look at the flag, the sink sets it before it looks at the ring
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (sleeping_.load(std::memory_order_relaxed) && sleeping_.exchange(false)) {
+    wake();
+  }
+  return true;
+}
+
+bool Logger::pop(Message& message) {
+  Slot& slot = slots_[dequeue_pos_ % capacity];
+  if (slot.sequence.load(std::memory_order_acquire) != dequeue_pos_ + 1) {
+    return false;
+  }
+  message.level = slot.message.level;
+  message.thread = slot.message.thread;
+  message.time_ms = slot.message.time_ms;
+  message.length = slot.message.length;
+  memcpy(message.text, slot.message.text, message.length);
+  // free for the producer one lap later
+  slot.sequence.store(dequeue_pos_ + capacity, std::memory_order_release);
+  dequeue_pos_++;
+  return true;
+}
+
+bool Logger::ready() const {
+  return slots_[dequeue_pos_ % capacity].sequence.load(std::memory_order_acquire) == dequeue_pos_ + 1;
+}
+
+void Logger::wake() {
+  // between its check and its wait the sink holds the mutex, so it can't miss the notification
+  { std::lock_guard<std::mutex> lock(mutex_); }
+  wake_.notify_one();
+}
+
+void Logger::flush() {
+  uint64_t target = pushed_.load(std::memory_order_acquire);
+  std::unique_lock<std::mutex> lock(mutex_);
+  flushing_++;
+  written_changed_.wait(lock, [this, target] {
+    return !running_ || written_.load(std::memory_order_acquire) >= target;
+  });
+  flushing_--;
+}
+
+double Logger::elapsedMs() const {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_).count();
+}
+
+uint32_t Logger::threadIndex() {
+  static std::atomic<uint32_t> next_index{0};
+  thread_local uint32_t index = next_index++;
+  return index;
+}
+
+void Logger::run() {
+  // popped first, so the slots are free again before the terminal is written to
+  Message batch[sink_batch];
+  uint64_t reported_drops = 0;
+
+  for (;;) {
+    size_t count = 0;
+    while (count < sink_batch && pop(batch[count])) {
+      count++;
+    }
+    for (size_t i = 0; i < count; i++) {
+      Message const& message = batch[i];
+      FILE* out = message.level >= Level::Warning ? stderr : stdout;
+      fprintf(out, "[%10.3f] [%c] [%u] %.*s\n", message.time_ms, level_tags[int(message.level)], message.thread,
+              int(message.length), message.text);
+    }
+
+    uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+    if (dropped != reported_drops) {
+      fprintf(stderr, "[log] %llu messages dropped, the log can't keep up\n",
+              (unsigned long long) (dropped - reported_drops));
+      reported_drops = dropped;
+    }
+
+    if (count > 0) {
+      fflush(stdout);
+      // before looking for someone flushing, who looks at it after announcing themselves
+      written_.fetch_add(count);
+      if (flushing_.load() > 0) {
+        { std::lock_guard<std::mutex> lock(mutex_); }
+        written_changed_.notify_all();
+      }
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    sleeping_.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // a message pushed before the flag was set didn't wake us
+    bool pending = ready();
+    if (!pending && !running_) {
+      // everything pushed before the shutdown is written
+      written_changed_.notify_all();
+      break;
+    }
+    if (!pending) {
+      wake_.wait(lock);
+    }
+    sleeping_.store(false, std::memory_order_relaxed);
+  }
+}
+
+Line::Line(Level level)
+        : buffer_(message_.text, Message::max_length),
+          stream_(&buffer_) {
+  message_.level = level;
+  message_.thread = Logger::threadIndex();
+  message_.time_ms = Logger::instance().elapsedMs();
+}
+
+Line::~Line() {
+  message_.length = buffer_.length();
+  Logger::instance().push(message_);
+}
+
+MessageFilter::MessageFilter(uint32_t max_per_second)
+        : max_per_second_(max_per_second),
+          tokens_(max_per_second),
+          last_refill_(std::chrono::steady_clock::now()) {
+}
+
+bool MessageFilter::pass(uint64_t key, uint64_t& count) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  count = ++counts_[key];
+
+  // 1, 10, 100, ...
+  uint64_t n = count;
+  while (n % 10 == 0) {
+    n /= 10;
+  }
+  if (n != 1) {
+    return false;
+  }
+
+  auto now = std::chrono::steady_clock::now();
+  double elapsed = std::chrono::duration<double>(now - last_refill_).count();
+  tokens_ = std::min(double(max_per_second_), tokens_ + elapsed * max_per_second_);
+  last_refill_ = now;
+  if (tokens_ < 1.0) {
+    suppressed_++;
+    return false;
+  }
+  tokens_ -= 1.0;
+  return true;
+}
+
+}
+}
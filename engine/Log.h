@@ -0,0 +1,179 @@
+#ifndef VULKAN_ENGINE_LOG_H
+#define VULKAN_ENGINE_LOG_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <thread>
+
+// Lowest level which is compiled in: 0 debug, 1 info, 2 warning, 3 error
+// Everything below it costs nothing, not even the formatting of the arguments.
+#ifndef ENGINE_LOG_LEVEL
+#ifdef NDEBUG
+#define ENGINE_LOG_LEVEL 1
+#else
+#define ENGINE_LOG_LEVEL 0
+#endif
+#endif
+
+// LOG_INFO("created " << count << " buffers"), no newline needed
+#define ENGINE_LOG(level, expr) \
+  do { \
+    if (int(level) >= ENGINE_LOG_LEVEL) { \
+      ::engine::log::Line log_line_(level); \
+      log_line_.stream() << expr; \
+    } \
+  } while (0)
+
+#define LOG_DEBUG(expr) ENGINE_LOG(::engine::log::Level::Debug, expr)
+#define LOG_INFO(expr) ENGINE_LOG(::engine::log::Level::Info, expr)
+#define LOG_WARNING(expr) ENGINE_LOG(::engine::log::Level::Warning, expr)
+#define LOG_ERROR(expr) ENGINE_LOG(::engine::log::Level::Error, expr)
+
+namespace engine {
+namespace log {
+
+enum class Level {
+  Debug = 0,
+  Info = 1,
+  Warning = 2,
+  Error = 3,
+};
+
+// one log line, longer ones are cut off
+struct Message {
+  static const size_t max_length = 480;
+
+  Level level;
+  uint32_t thread;
+  double time_ms;
+  uint32_t length;
+  char text[max_length];
+};
+
+/*
+ * Hands the messages of any thread to a background thread which writes them out
+ *
+ * Producers never wait for the sink and never allocate: they claim a slot of a
+ * bounded ring buffer with one atomic operation and copy their message into it.
+ * If the ring is full the message is dropped (and counted) instead of waiting for
+ * the terminal. The sink thread starts with the first message, writes them out in
+ * batches and parks while the ring is empty; only the first message after that
+ * takes its mutex, to wake it. Everything is written out before the program exits.
+ */
+class Logger {
+  public:
+    static Logger& instance();
+
+    ~Logger();
+
+    // false if the message was dropped
+    bool push(Message const& message);
+
+    // wait until everything pushed so far is written, e.g. before crashing
+    void flush();
+
+    double elapsedMs() const;
+
+    // small number for the calling thread, stable for its lifetime
+    static uint32_t threadIndex();
+
+  private:
+    static const size_t capacity = 1024;
+
+    // Vyukov's bounded queue: the sequence tells whose turn it is on a slot
+    struct Slot {
+      std::atomic<size_t> sequence;
+      Message message;
+    };
+
+    Logger();
+
+    void run();
+
+    bool pop(Message& message);
+
+    // if there is a message to pop, for the sink
+    bool ready() const;
+
+    // the sink is parked or about to, it checks the ring again under the mutex
+    void wake();
+
+    Slot slots_[capacity];
+    alignas(64) std::atomic<size_t> enqueue_pos_{0};
+    alignas(64) size_t dequeue_pos_ = 0;
+    alignas(64) std::atomic<uint64_t> dropped_{0};
+    std::atomic<uint64_t> written_{0};
+    std::atomic<uint64_t> pushed_{0};
+
+    // the sink parks on wake_ while the ring is empty, flush() waits on written_changed_
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable written_changed_;
+    alignas(64) std::atomic<bool> sleeping_{false};
+    std::atomic<uint32_t> flushing_{0};
+
+    std::chrono::steady_clock::time_point start_;
+    std::atomic<bool> running_{false};
+    std::once_flag started_;
+    std::thread sink_;
+};
+
+// fixed buffer on the stack behind the stream of a Line
+class LineBuffer : public std::streambuf {
+  public:
+    LineBuffer(char* begin, size_t size) { setp(begin, begin + size); }
+
+    size_t length() const { return pptr() - pbase(); }
+};
+
+// Formats one message on the stack and pushes it when it goes out of scope
+class Line {
+  public:
+    explicit Line(Level level);
+
+    ~Line();
+
+    std::ostream& stream() { return stream_; }
+
+  private:
+    Message message_;
+    LineBuffer buffer_;
+    std::ostream stream_;
+};
+
+/*
+ * Keeps floods of the same message out of the log
+ *
+ * The first occurrence of a message passes, repeats only at 10, 100, 1000, ...
+ * occurrences; on top of that at most max_per_second messages pass in total.
+ */
+class MessageFilter {
+  public:
+    explicit MessageFilter(uint32_t max_per_second);
+
+    // count is how often the message with this key was seen, including this time
+    bool pass(uint64_t key, uint64_t& count);
+
+    // messages swallowed by the rate limit so far
+    uint64_t suppressed() const { return suppressed_; }
+
+  private:
+    std::mutex mutex_;
+    std::map<uint64_t, uint64_t> counts_;
+    uint32_t max_per_second_;
+    double tokens_;
+    std::chrono::steady_clock::time_point last_refill_;
+    std::atomic<uint64_t> suppressed_{0};
+};
+
+}
+}
+
+#endif //VULKAN_ENGINE_LOG_H
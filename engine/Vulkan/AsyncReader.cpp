@@ -0,0 +1,313 @@
+#include "AsyncReader.h"
+#include "../Log.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+// io_uring without liburing: the system calls and the rings as the kernel headers describe them
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define ENGINE_HAS_IO_URING 1
+#endif
+#endif
+#endif
+
+namespace engine {
+
+AsyncReader::~AsyncReader() {
+  close();
+}
+
+void AsyncReader::open(std::string const& path, uint32_t queue_depth, uint32_t threads, bool force_threads) {
+  close();
+  file_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (file_ < 0) {
+    throw std::runtime_error("Failed to open " + path + ": " + strerror(errno));
+  }
+  queue_depth_ = std::max(1u, queue_depth);
+  if (!force_threads && openRing(queue_depth_)) {
+    LOG_INFO("Reading " << path << " with io_uring, " << queue_depth_ << " reads in flight.");
+    return;
+  }
+
+  stopping_ = false;
+  queued_.reserve(queue_depth_);
+  pending_.reserve(queue_depth_);
+  completed_.reserve(queue_depth_);
+  for (uint32_t i = 0; i < std::max(1u, threads); i++) {
+    threads_.emplace_back(&AsyncReader::runThread, this);
+  }
+  LOG_INFO("Reading " << path << " on " << threads_.size() << " threads, " << queue_depth_ << " reads in flight.");
+}
+
+void AsyncReader::close() {
+  if (!threads_.empty()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+    threads_.clear();
+    queued_.clear();
+    pending_.clear();
+    completed_.clear();
+  }
+  closeRing();
+  if (file_ >= 0) {
+    ::close(file_);
+    file_ = -1;
+  }
+  in_flight_ = 0;
+}
+
+bool AsyncReader::openRing(uint32_t queue_depth) {
+#ifdef ENGINE_HAS_IO_URING
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int ring = int(syscall(__NR_io_uring_setup, queue_depth, &params));
+  if (ring < 0) {
+    LOG_INFO("No io_uring (" << strerror(errno) << "), falling back to threads.");
+    return false;
+  }
+  ring_ = ring;
+
+  sq_memory_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_memory_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  bool single_mmap = false;
+#ifdef IORING_FEAT_SINGLE_MMAP
+  // both rings in one mapping since Linux 5.4
+  single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+#endif
+  if (single_mmap) {
+    sq_memory_size_ = std::max(sq_memory_size_, cq_memory_size_);
+  }
+  sq_memory_ = mmap(nullptr, sq_memory_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_,
+                    IORING_OFF_SQ_RING);
+  if (sq_memory_ == MAP_FAILED) {
+    sq_memory_ = nullptr;
+    closeRing();
+    return false;
+  }
+  if (single_mmap) {
+    cq_memory_ = sq_memory_;
+  } else {
+    cq_memory_ = mmap(nullptr, cq_memory_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_,
+                      IORING_OFF_CQ_RING);
+    if (cq_memory_ == MAP_FAILED) {
+      cq_memory_ = nullptr;
+      closeRing();
+      return false;
+    }
+  }
+  sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  sqes_ = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_, IORING_OFF_SQES);
+  if (sqes_ == MAP_FAILED) {
+    sqes_ = nullptr;
+    closeRing();
+    return false;
+  }
+
+  char* sq = static_cast<char*>(sq_memory_);
+  sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+  sq_mask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+  sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+  char* cq = static_cast<char*>(cq_memory_);
+  cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+  cq_mask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+  cqes_ = cq + params.cq_off.cqes;
+
+  // the kernel may round the entries up, we keep to the queue depth (the completion ring has twice
+  // as many entries, so it can't overflow)
+  iovecs_.assign(queue_depth, iovec());
+  slot_users_.assign(queue_depth, 0);
+  free_slots_.clear();
+  for (uint32_t slot = queue_depth; slot > 0; slot--) {
+    free_slots_.push_back(slot - 1);
+  }
+  unsubmitted_ = 0;
+  return true;
+#else
+  (void) queue_depth;
+  return false;
+#endif
+}
+
+void AsyncReader::closeRing() {
+#ifdef ENGINE_HAS_IO_URING
+  if (ring_ < 0) {
+    return;
+  }
+  // the kernel would finish the reads after the ring is gone, into memory which may be freed by then
+  while (in_flight_ > unsubmitted_) {
+    if (syscall(__NR_io_uring_enter, ring_, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR) {
+      break;
+    }
+    ReadCompletion completion;
+    while (complete(completion)) {
+    }
+  }
+  if (sqes_ != nullptr) {
+    munmap(sqes_, sqes_size_);
+  }
+  if (cq_memory_ != nullptr && cq_memory_ != sq_memory_) {
+    munmap(cq_memory_, cq_memory_size_);
+  }
+  if (sq_memory_ != nullptr) {
+    munmap(sq_memory_, sq_memory_size_);
+  }
+  sqes_ = nullptr;
+  cq_memory_ = nullptr;
+  sq_memory_ = nullptr;
+  ::close(ring_);
+  ring_ = -1;
+#endif
+}
+
+bool AsyncReader::read(ReadRequest const& request) {
+  if (in_flight_ >= queue_depth_) {
+    return false;
+  }
+  in_flight_++;
+  reads_++;
+  if (ring_ < 0) {
+    queued_.push_back(request);
+    return true;
+  }
+
+#ifdef ENGINE_HAS_IO_URING
+  uint32_t slot = free_slots_.back();
+  free_slots_.pop_back();
+  iovecs_[slot].iov_base = request.data;
+  iovecs_[slot].iov_len = request.size;
+  slot_users_[slot] = request.user;
+
+  // only we write the tail, the kernel reads it once we submit
+  unsigned tail = *sq_tail_;
+  unsigned index = tail & *sq_mask_;
+  io_uring_sqe* sqe = static_cast<io_uring_sqe*>(sqes_) + index;
+  memset(sqe, 0, sizeof(*sqe));
+  // READV is there since the first io_uring (Linux 5.1), READ only since 5.6
+  sqe->opcode = IORING_OP_READV;
+  sqe->fd = file_;
+  sqe->off = request.offset;
+  sqe->addr = reinterpret_cast<uint64_t>(&iovecs_[slot]);
+  sqe->len = 1;
+  sqe->user_data = slot;
+  sq_array_[index] = index;
+  __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+  unsubmitted_++;
+#endif
+  return true;
+}
+
+void AsyncReader::submit() {
+  if (ring_ < 0) {
+    if (queued_.empty()) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      pending_.insert(pending_.end(), queued_.begin(), queued_.end());
+    }
+    queued_.clear();
+    wake_.notify_all();
+    submits_++;
+    return;
+  }
+
+#ifdef ENGINE_HAS_IO_URING
+  if (unsubmitted_ == 0) {
+    return;
+  }
+  // without IORING_ENTER_GETEVENTS this doesn't wait, reads which would block go to the workers of the kernel
+  int submitted = int(syscall(__NR_io_uring_enter, ring_, unsubmitted_, 0, 0, nullptr, 0));
+  submits_++;
+  if (submitted < 0) {
+    // out of kernel resources for now, the reads stay queued for the next submit
+    if (errno == EAGAIN || errno == EBUSY || errno == EINTR) {
+      return;
+    }
+    throw std::runtime_error(std::string("Failed to submit reads to io_uring: ") + strerror(errno));
+  }
+  unsubmitted_ -= uint32_t(submitted);
+#endif
+}
+
+bool AsyncReader::complete(ReadCompletion& completion) {
+  if (ring_ < 0) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (completed_.empty()) {
+      return false;
+    }
+    completion = completed_.front();
+    completed_.erase(completed_.begin());
+    in_flight_--;
+    return true;
+  }
+
+#ifdef ENGINE_HAS_IO_URING
+  unsigned head = *cq_head_;
+  if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+    return false;
+  }
+  io_uring_cqe const& cqe = static_cast<io_uring_cqe*>(cqes_)[head & *cq_mask_];
+  uint32_t slot = uint32_t(cqe.user_data);
+  completion.user = slot_users_[slot];
+  completion.result = cqe.res;
+  free_slots_.push_back(slot);
+  __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+  in_flight_--;
+  return true;
+#else
+  return false;
+#endif
+}
+
+void AsyncReader::runThread() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    wake_.wait(lock, [this] { return stopping_ || !pending_.empty(); });
+    if (stopping_) {
+      return;
+    }
+    ReadRequest request = pending_.front();
+    pending_.erase(pending_.begin());
+    lock.unlock();
+
+    ReadCompletion completion = {request.user, 0};
+    while (completion.result < int64_t(request.size)) {
+      ssize_t bytes = pread(file_, request.data + completion.result, request.size - completion.result,
+                            off_t(request.offset + completion.result));
+      if (bytes < 0 && errno == EINTR) {
+        continue;
+      }
+      if (bytes < 0) {
+        completion.result = -errno;
+        break;
+      }
+      // the end of the file, a short read
+      if (bytes == 0) {
+        break;
+      }
+      completion.result += bytes;
+    }
+
+    lock.lock();
+    completed_.push_back(completion);
+  }
+}
+
+}
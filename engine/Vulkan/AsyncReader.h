@@ -0,0 +1,120 @@
+#ifndef VULKAN_ENGINE_ASYNCREADER_H
+#define VULKAN_ENGINE_ASYNCREADER_H
+
+#include <sys/uio.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace engine {
+
+// A read of a part of the file into memory of the caller, which has to stay valid until it completes
+struct ReadRequest {
+  uint64_t offset;
+  uint32_t size;
+  char* data;
+  // handed back with the completion
+  uint64_t user;
+};
+
+struct ReadCompletion {
+  uint64_t user;
+  // bytes read, or a negative errno
+  int64_t result;
+};
+
+/*
+ * Reads parts of one file in the background, for a thread which must never block on I/O
+ *
+ * With io_uring (Linux 5.1 and later) the reads queued in a frame go to the
+ * kernel with a single system call and their completions are picked up from
+ * the completion ring without any. Where io_uring is missing or not allowed
+ * (older kernels, containers filtering the system calls) a few threads read
+ * with pread instead. Only for one thread, the one calling read, submit and
+ * complete.
+ */
+class AsyncReader {
+  public:
+    ~AsyncReader();
+
+    // up to queue_depth reads in flight, threads is the size of the fallback
+    void open(std::string const& path, uint32_t queue_depth, uint32_t threads, bool force_threads);
+
+    // drops the reads still in flight, waiting for them
+    void close();
+
+    bool isOpen() const { return file_ >= 0; }
+
+    bool usesIoUring() const { return ring_ >= 0; }
+
+    // false if queue_depth reads are in flight already, the read starts with the next submit
+    bool read(ReadRequest const& request);
+
+    // start the queued reads
+    void submit();
+
+    // a finished read, never blocks
+    bool complete(ReadCompletion& completion);
+
+    uint32_t inFlight() const { return in_flight_; }
+
+    uint32_t capacity() const { return queue_depth_; }
+
+    // system calls (or wakeups of the threads) which started reads, and the reads
+    uint64_t submits() const { return submits_; }
+
+    uint64_t reads() const { return reads_; }
+
+  private:
+    int file_ = -1;
+    uint32_t queue_depth_ = 0;
+    uint32_t in_flight_ = 0;
+    uint64_t submits_ = 0;
+    uint64_t reads_ = 0;
+
+    // io_uring: the mapped rings and the requests by their slot, which is the user data of the kernel
+    int ring_ = -1;
+    void* sq_memory_ = nullptr;
+    size_t sq_memory_size_ = 0;
+    void* cq_memory_ = nullptr;
+    size_t cq_memory_size_ = 0;
+    void* sqes_ = nullptr;
+    size_t sqes_size_ = 0;
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_mask_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned* cq_mask_ = nullptr;
+    void* cqes_ = nullptr;
+    // queued since the last submit
+    uint32_t unsubmitted_ = 0;
+    // an iovec each, the kernel may read them until the read completes
+    std::vector<iovec> iovecs_;
+    std::vector<uint64_t> slot_users_;
+    std::vector<uint32_t> free_slots_;
+
+    // the fallback
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stopping_ = false;
+    // reserved for the queue depth, reading doesn't allocate
+    std::vector<ReadRequest> queued_;
+    std::vector<ReadRequest> pending_;
+    std::vector<ReadCompletion> completed_;
+
+    bool openRing(uint32_t queue_depth);
+
+    void closeRing();
+
+    void runThread();
+};
+
+}
+
+#endif //VULKAN_ENGINE_ASYNCREADER_H
@@ -0,0 +1,288 @@
+#include "Capture.h"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace engine {
+
+namespace {
+
+const char capture_magic[8] = {'V', 'K', 'E', 'C', 'A', 'P', 'T', 'R'};
+// bump when the layout of the file changes
+const uint32_t capture_version = 1;
+
+class Writer {
+  public:
+    explicit Writer(std::string const& path) : file_(path, std::ios::binary) {
+      if (!file_.is_open()) {
+        throw std::runtime_error("failed to open capture file " + path);
+      }
+    }
+
+    void put(const void* values, size_t size) {
+      file_.write(static_cast<const char*>(values), size);
+    }
+
+    template <typename T>
+    void put(T const& value) { put(&value, sizeof(T)); }
+
+    template <typename T>
+    void putVector(std::vector<T> const& values) {
+      put(uint32_t(values.size()));
+      put(values.data(), values.size() * sizeof(T));
+    }
+
+    void putString(std::string const& value) {
+      put(uint32_t(value.size()));
+      put(value.data(), value.size());
+    }
+
+    bool good() const { return file_.good(); }
+
+  private:
+    std::ofstream file_;
+};
+
+class Reader {
+  public:
+    explicit Reader(std::string const& path) : file_(path, std::ios::binary) {
+      if (!file_.is_open()) {
+        throw std::runtime_error("failed to open capture file " + path);
+      }
+    }
+
+    void get(void* values, size_t size) {
+      if (!file_.read(static_cast<char*>(values), size)) {
+        throw std::runtime_error("capture file is truncated");
+      }
+    }
+
+    template <typename T>
+    T get() {
+      T value;
+      get(&value, sizeof(T));
+      return value;
+    }
+
+    // counts are checked against a sane limit, so a broken file doesn't allocate all memory
+    uint32_t getCount(uint32_t limit) {
+      uint32_t count = get<uint32_t>();
+      if (count > limit) {
+        throw std::runtime_error("capture file is corrupt");
+      }
+      return count;
+    }
+
+    template <typename T>
+    std::vector<T> getVector(uint32_t limit) {
+      std::vector<T> values(getCount(limit));
+      get(values.data(), values.size() * sizeof(T));
+      return values;
+    }
+
+    std::string getString() {
+      std::string value(getCount(4096), '\0');
+      get(&value[0], value.size());
+      return value;
+    }
+
+  private:
+    std::ifstream file_;
+};
+
+// shaders, buffer contents and command streams
+const uint32_t max_blob_size = 256u << 20;
+const uint32_t max_objects = 1u << 16;
+
+}
+
+CapturePipeline describePipeline(VkGraphicsPipelineCreateInfo const& info, std::string const& vertex_shader,
+                                 std::string const& fragment_shader, uint32_t set_bindings) {
+  CapturePipeline pipeline;
+  pipeline.bind_point = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  pipeline.vertex_shader = vertex_shader;
+  pipeline.fragment_shader = fragment_shader;
+  pipeline.subpass = info.subpass;
+  pipeline.topology = info.pInputAssemblyState->topology;
+  pipeline.cull_mode = info.pRasterizationState->cullMode;
+  pipeline.front_face = info.pRasterizationState->frontFace;
+  pipeline.samples = info.pMultisampleState->rasterizationSamples;
+  if (info.pDepthStencilState) {
+    pipeline.depth_test = info.pDepthStencilState->depthTestEnable;
+    pipeline.depth_write = info.pDepthStencilState->depthWriteEnable;
+    pipeline.depth_compare = info.pDepthStencilState->depthCompareOp;
+  }
+  pipeline.color_attachments = info.pColorBlendState ? info.pColorBlendState->attachmentCount : 0;
+  pipeline.set_bindings = set_bindings;
+  return pipeline;
+}
+
+CaptureRenderPass describeRenderPass(VkRenderPassCreateInfo const& info) {
+  CaptureRenderPass renderpass;
+  renderpass.attachments.assign(info.pAttachments, info.pAttachments + info.attachmentCount);
+  renderpass.dependencies.assign(info.pDependencies, info.pDependencies + info.dependencyCount);
+  for (uint32_t i = 0; i < info.subpassCount; i++) {
+    VkSubpassDescription const& description = info.pSubpasses[i];
+    CaptureSubpass subpass;
+    subpass.colors.assign(description.pColorAttachments,
+                          description.pColorAttachments + description.colorAttachmentCount);
+    if (description.pResolveAttachments) {
+      subpass.resolves.assign(description.pResolveAttachments,
+                              description.pResolveAttachments + description.colorAttachmentCount);
+    }
+    if (description.pDepthStencilAttachment) {
+      subpass.has_depth = true;
+      subpass.depth = *description.pDepthStencilAttachment;
+    }
+    renderpass.subpasses.push_back(subpass);
+  }
+  return renderpass;
+}
+
+void writeFrameCapture(std::string const& path, FrameCapture const& capture) {
+  Writer out(path);
+  out.put(capture_magic);
+  out.put(capture_version);
+  out.put(capture.extent);
+
+  out.put(uint32_t(capture.shaders.size()));
+  for (auto const& shader : capture.shaders) {
+    out.putString(shader.first);
+    out.putVector(shader.second);
+  }
+
+  out.put(uint32_t(capture.buffers.size()));
+  for (auto const& buffer : capture.buffers) {
+    out.put(uint64_t(buffer.size));
+    out.put(buffer.usage);
+    out.putVector(buffer.data);
+  }
+
+  out.put(uint32_t(capture.descriptor_sets.size()));
+  for (auto const& set : capture.descriptor_sets) {
+    out.putVector(set.buffers);
+  }
+
+  out.put(uint32_t(capture.pipelines.size()));
+  for (auto const& pipeline : capture.pipelines) {
+    out.put(pipeline.bind_point);
+    out.putString(pipeline.vertex_shader);
+    out.putString(pipeline.fragment_shader);
+    out.putString(pipeline.compute_shader);
+    out.put(pipeline.subpass);
+    out.put(pipeline.topology);
+    out.put(pipeline.cull_mode);
+    out.put(pipeline.front_face);
+    out.put(pipeline.samples);
+    out.put(pipeline.depth_test);
+    out.put(pipeline.depth_write);
+    out.put(pipeline.depth_compare);
+    out.put(pipeline.color_attachments);
+    out.put(pipeline.set_bindings);
+    out.put(pipeline.push_constant_stages);
+    out.put(pipeline.push_constant_size);
+  }
+
+  out.putVector(capture.renderpass.attachments);
+  out.put(uint32_t(capture.renderpass.subpasses.size()));
+  for (auto const& subpass : capture.renderpass.subpasses) {
+    out.putVector(subpass.colors);
+    out.putVector(subpass.resolves);
+    out.put(uint32_t(subpass.has_depth));
+    out.put(subpass.depth);
+  }
+  out.putVector(capture.renderpass.dependencies);
+  out.putVector(capture.renderpass.clear_values);
+
+  out.put(uint32_t(capture.passes.size()));
+  for (auto const& pass : capture.passes) {
+    out.putString(pass.name);
+    out.put(uint32_t(pass.renderpass));
+    out.put(uint32_t(pass.streams.size()));
+    for (auto const& stream : pass.streams) {
+      out.putVector(stream.data());
+    }
+  }
+
+  if (!out.good()) {
+    throw std::runtime_error("failed to write capture file " + path);
+  }
+}
+
+FrameCapture readFrameCapture(std::string const& path) {
+  Reader in(path);
+  char magic[sizeof(capture_magic)];
+  in.get(magic, sizeof(magic));
+  if (memcmp(magic, capture_magic, sizeof(magic)) != 0) {
+    throw std::runtime_error(path + " is no frame capture");
+  }
+  if (in.get<uint32_t>() != capture_version) {
+    throw std::runtime_error(path + " is a capture of another engine version");
+  }
+
+  FrameCapture capture;
+  capture.extent = in.get<VkExtent2D>();
+
+  capture.shaders.resize(in.getCount(max_objects));
+  for (auto& shader : capture.shaders) {
+    shader.first = in.getString();
+    shader.second = in.getVector<char>(max_blob_size);
+  }
+
+  capture.buffers.resize(in.getCount(max_objects));
+  for (auto& buffer : capture.buffers) {
+    buffer.size = in.get<uint64_t>();
+    buffer.usage = in.get<VkBufferUsageFlags>();
+    buffer.data = in.getVector<char>(max_blob_size);
+  }
+
+  capture.descriptor_sets.resize(in.getCount(max_objects));
+  for (auto& set : capture.descriptor_sets) {
+    set.buffers = in.getVector<uint32_t>(max_objects);
+  }
+
+  capture.pipelines.resize(in.getCount(max_objects));
+  for (auto& pipeline : capture.pipelines) {
+    pipeline.bind_point = in.get<VkPipelineBindPoint>();
+    pipeline.vertex_shader = in.getString();
+    pipeline.fragment_shader = in.getString();
+    pipeline.compute_shader = in.getString();
+    pipeline.subpass = in.get<uint32_t>();
+    pipeline.topology = in.get<VkPrimitiveTopology>();
+    pipeline.cull_mode = in.get<VkCullModeFlags>();
+    pipeline.front_face = in.get<VkFrontFace>();
+    pipeline.samples = in.get<VkSampleCountFlagBits>();
+    pipeline.depth_test = in.get<VkBool32>();
+    pipeline.depth_write = in.get<VkBool32>();
+    pipeline.depth_compare = in.get<VkCompareOp>();
+    pipeline.color_attachments = in.get<uint32_t>();
+    pipeline.set_bindings = in.get<uint32_t>();
+    pipeline.push_constant_stages = in.get<VkShaderStageFlags>();
+    pipeline.push_constant_size = in.get<uint32_t>();
+  }
+
+  capture.renderpass.attachments = in.getVector<VkAttachmentDescription>(max_objects);
+  capture.renderpass.subpasses.resize(in.getCount(max_objects));
+  for (auto& subpass : capture.renderpass.subpasses) {
+    subpass.colors = in.getVector<VkAttachmentReference>(max_objects);
+    subpass.resolves = in.getVector<VkAttachmentReference>(max_objects);
+    subpass.has_depth = in.get<uint32_t>() != 0;
+    subpass.depth = in.get<VkAttachmentReference>();
+  }
+  capture.renderpass.dependencies = in.getVector<VkSubpassDependency>(max_objects);
+  capture.renderpass.clear_values = in.getVector<VkClearValue>(max_objects);
+
+  capture.passes.resize(in.getCount(max_objects));
+  for (auto& pass : capture.passes) {
+    pass.name = in.getString();
+    pass.renderpass = in.get<uint32_t>() != 0;
+    pass.streams.resize(in.getCount(max_objects));
+    for (auto& stream : pass.streams) {
+      stream = CommandStream::fromData(in.getVector<uint8_t>(max_blob_size));
+    }
+  }
+  return capture;
+}
+
+}
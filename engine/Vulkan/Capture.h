@@ -0,0 +1,103 @@
+#ifndef VULKAN_ENGINE_CAPTURE_H
+#define VULKAN_ENGINE_CAPTURE_H
+
+#include "CommandStream.h"
+
+#include <vulkan/vulkan.h>
+
+#include <string>
+#include <vector>
+
+namespace engine {
+
+// A buffer with its contents at the start of the frame, empty data means zeros
+struct CaptureBuffer {
+  VkDeviceSize size = 0;
+  VkBufferUsageFlags usage = 0;
+  std::vector<char> data;
+};
+
+// A descriptor set with one storage buffer per binding, visible to all stages
+struct CaptureDescriptorSet {
+  std::vector<uint32_t> buffers;
+};
+
+// The pipeline state the engine varies, everything else is the engine's default
+struct CapturePipeline {
+  VkPipelineBindPoint bind_point = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  // names of the shaders in the capture, empty if the stage is unused
+  std::string vertex_shader;
+  std::string fragment_shader;
+  std::string compute_shader;
+
+  uint32_t subpass = 0;
+  VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+  VkCullModeFlags cull_mode = VK_CULL_MODE_NONE;
+  VkFrontFace front_face = VK_FRONT_FACE_CLOCKWISE;
+  VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+  VkBool32 depth_test = VK_FALSE;
+  VkBool32 depth_write = VK_FALSE;
+  VkCompareOp depth_compare = VK_COMPARE_OP_ALWAYS;
+  uint32_t color_attachments = 0;
+
+  // storage buffers in the only descriptor set, 0 for no descriptor set
+  uint32_t set_bindings = 0;
+  VkShaderStageFlags push_constant_stages = 0;
+  uint32_t push_constant_size = 0;
+};
+
+struct CaptureSubpass {
+  std::vector<VkAttachmentReference> colors;
+  // empty or one per color attachment
+  std::vector<VkAttachmentReference> resolves;
+  bool has_depth = false;
+  VkAttachmentReference depth = {};
+};
+
+struct CaptureRenderPass {
+  std::vector<VkAttachmentDescription> attachments;
+  std::vector<CaptureSubpass> subpasses;
+  std::vector<VkSubpassDependency> dependencies;
+  // indexed like the attachments
+  std::vector<VkClearValue> clear_values;
+};
+
+// A pass of the frame: a compute pass with one stream, or the render pass with one stream per subpass
+struct CapturePass {
+  std::string name;
+  bool renderpass = false;
+  std::vector<CommandStream> streams;
+};
+
+/*
+ * Everything needed to execute a frame again without the engine
+ *
+ * The indices in the command streams refer to the pipelines, descriptor sets
+ * and buffers of the capture. Synchronization is not captured: the passes
+ * depend on each other in order, on a single queue.
+ */
+struct FrameCapture {
+  VkExtent2D extent = {0, 0};
+  std::vector<std::pair<std::string, std::vector<char>>> shaders;
+  std::vector<CaptureBuffer> buffers;
+  std::vector<CaptureDescriptorSet> descriptor_sets;
+  // pipelines which the frame doesn't use have no shaders
+  std::vector<CapturePipeline> pipelines;
+  CaptureRenderPass renderpass;
+  std::vector<CapturePass> passes;
+};
+
+CapturePipeline describePipeline(VkGraphicsPipelineCreateInfo const& info, std::string const& vertex_shader,
+                                 std::string const& fragment_shader, uint32_t set_bindings);
+
+CaptureRenderPass describeRenderPass(VkRenderPassCreateInfo const& info);
+
+// compact binary file, in the byte order of the machine
+void writeFrameCapture(std::string const& path, FrameCapture const& capture);
+
+// throws if the file is no capture or one of another version
+FrameCapture readFrameCapture(std::string const& path);
+
+}
+
+#endif //VULKAN_ENGINE_CAPTURE_H
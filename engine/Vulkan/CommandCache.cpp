@@ -0,0 +1,112 @@
+#include "CommandCache.h"
+
+#include <stdexcept>
+
+namespace engine {
+
+uint64_t CommandCache::hash(const void* data, size_t size, uint64_t seed) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < size; i++) {
+    seed = (seed ^ bytes[i]) * 1099511628211ull;
+  }
+  return seed;
+}
+
+void CommandCache::clear() {
+  buckets_.clear();
+  command_buffers_.clear();
+  hashes_.clear();
+  valid_.clear();
+}
+
+void CommandCache::addBucket(uint32_t subpass, RecordFn record, HashFn hash) {
+  if (!buckets_.empty() && subpass < buckets_.back().subpass) {
+    throw std::runtime_error("command cache: buckets out of subpass order");
+  }
+  buckets_.push_back(Bucket{subpass, record, hash});
+}
+
+void CommandCache::init(VkDevice device, VkCommandPool pool, VkRenderPass renderpass,
+                        std::vector<VkFramebuffer> const& framebuffers, uint32_t levels,
+                        VkQueryPipelineStatisticFlags statistics) {
+  device_ = device;
+  renderpass_ = renderpass;
+  framebuffers_ = framebuffers;
+  statistics_ = statistics;
+  command_buffers_.resize(levels * framebuffers_.size() * buckets_.size());
+  hashes_.assign(command_buffers_.size(), 0);
+  valid_.assign(command_buffers_.size(), 0);
+  if (command_buffers_.empty()) {
+    return;
+  }
+
+  VkCommandBufferAllocateInfo alloc_info = {};
+  alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  alloc_info.commandPool = pool;
+  alloc_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+  alloc_info.commandBufferCount = command_buffers_.size();
+  if (vkAllocateCommandBuffers(device_, &alloc_info, command_buffers_.data()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to allocate the command buffers of the buckets");
+  }
+}
+
+size_t CommandCache::index(uint32_t image, uint32_t level) const {
+  return (size_t(level) * framebuffers_.size() + image) * buckets_.size();
+}
+
+uint32_t CommandCache::update(uint32_t image, uint32_t level) {
+  uint32_t recorded = 0;
+  size_t first = index(image, level);
+  for (size_t b = 0; b < buckets_.size(); b++) {
+    Bucket const& bucket = buckets_[b];
+    uint64_t hash = bucket.hash(image);
+    if (valid_[first + b] && hashes_[first + b] == hash) {
+      continue;
+    }
+
+    VkCommandBufferInheritanceInfo inheritance = {};
+    inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritance.renderPass = renderpass_;
+    inheritance.subpass = bucket.subpass;
+    inheritance.framebuffer = framebuffers_[image];
+    inheritance.pipelineStatistics = statistics_;
+
+    // the caller waited for the last frame of the image, none of its command buffers are pending
+    VkCommandBuffer cmd = command_buffers_[first + b];
+    vkResetCommandBuffer(cmd, 0);
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT |
+                       VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+    begin_info.pInheritanceInfo = &inheritance;
+    if (vkBeginCommandBuffer(cmd, &begin_info) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to start recording a bucket");
+    }
+    bucket.record(cmd, image, level);
+    if (vkEndCommandBuffer(cmd) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to record a bucket");
+    }
+
+    hashes_[first + b] = hash;
+    valid_[first + b] = 1;
+    recorded++;
+  }
+  recorded_ += recorded;
+  return recorded;
+}
+
+void CommandCache::execute(VkCommandBuffer cmd, uint32_t image, uint32_t level, uint32_t subpass) const {
+  size_t begin = 0;
+  while (begin < buckets_.size() && buckets_[begin].subpass < subpass) {
+    begin++;
+  }
+  size_t end = begin;
+  while (end < buckets_.size() && buckets_[end].subpass == subpass) {
+    end++;
+  }
+  if (end > begin) {
+    vkCmdExecuteCommands(cmd, uint32_t(end - begin), &command_buffers_[index(image, level) + begin]);
+  }
+}
+
+}
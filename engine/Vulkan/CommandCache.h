@@ -0,0 +1,85 @@
+#ifndef VULKAN_ENGINE_COMMANDCACHE_H
+#define VULKAN_ENGINE_COMMANDCACHE_H
+
+#include <vulkan/vulkan.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace engine {
+
+/*
+ * Secondary command buffers of the buckets of a render pass, recorded again only when they change
+ *
+ * A bucket is a part of a subpass, e.g. a range of the sorted draws. It has a
+ * secondary command buffer per swapchain image and resolution level, and a hash
+ * of what it records: its draws, pipelines and bindings. update() records the
+ * buckets of an image again whose hash changed since, the others are executed as
+ * they are. Only for the thread rendering the frames.
+ */
+class CommandCache {
+  public:
+    // record the bucket into a secondary command buffer which inherits the subpass
+    typedef std::function<void(VkCommandBuffer cmd, uint32_t image, uint32_t level)> RecordFn;
+    // what the bucket records for the image, equal as long as nothing it depends on changed
+    typedef std::function<uint64_t(uint32_t image)> HashFn;
+
+    // FNV-1a, continuing from seed
+    static uint64_t hash(const void* data, size_t size, uint64_t seed = 14695981039346656037ull);
+
+    // the bytes of a value (a handle, a struct without padding) into the hash
+    template <typename T>
+    static uint64_t combine(uint64_t seed, T const& value) { return hash(&value, sizeof(T), seed); }
+
+    // drops the buckets, before they are added again
+    void clear();
+
+    // executed in the order they were added, which has to be the order of the subpasses
+    void addBucket(uint32_t subpass, RecordFn record, HashFn hash);
+
+    /*
+     * Allocate the command buffers from the pool (which resets single buffers), nothing is recorded yet.
+     * statistics: the pipeline statistics queried while the buckets are executed, 0 for none
+     */
+    void init(VkDevice device, VkCommandPool pool, VkRenderPass renderpass,
+              std::vector<VkFramebuffer> const& framebuffers, uint32_t levels,
+              VkQueryPipelineStatisticFlags statistics);
+
+    // record the changed buckets of the image at the level, the command buffers executing them are invalid then.
+    // The last frame of the image has to be done
+    uint32_t update(uint32_t image, uint32_t level);
+
+    // all buckets of the subpass, which was begun with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+    void execute(VkCommandBuffer cmd, uint32_t image, uint32_t level, uint32_t subpass) const;
+
+    uint32_t bucketCount() const { return uint32_t(buckets_.size()); }
+
+    // buckets recorded since the start, the first recording of each included
+    uint64_t recorded() const { return recorded_; }
+
+  private:
+    struct Bucket {
+      uint32_t subpass;
+      RecordFn record;
+      HashFn hash;
+    };
+
+    VkDevice device_ = VK_NULL_HANDLE;
+    VkRenderPass renderpass_ = VK_NULL_HANDLE;
+    std::vector<VkFramebuffer> framebuffers_;
+    VkQueryPipelineStatisticFlags statistics_ = 0;
+    std::vector<Bucket> buckets_;
+    // per level, image and bucket, the buckets of an image next to each other
+    std::vector<VkCommandBuffer> command_buffers_;
+    std::vector<uint64_t> hashes_;
+    std::vector<uint8_t> valid_;
+    uint64_t recorded_ = 0;
+
+    size_t index(uint32_t image, uint32_t level) const;
+};
+
+}
+
+#endif //VULKAN_ENGINE_COMMANDCACHE_H
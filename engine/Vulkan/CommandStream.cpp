@@ -0,0 +1,263 @@
+#include "CommandStream.h"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace engine {
+
+namespace {
+
+// the largest maxPushConstantsSize of the devices, recording doesn't allocate
+const size_t max_push_constants_size = 256;
+
+// sequential, bounds-checked access to the bytes of a stream
+class Reader {
+  public:
+    explicit Reader(std::vector<uint8_t> const& data) : data_(data) { }
+
+    bool done() const { return pos_ == data_.size(); }
+
+    void get(void* values, size_t size) {
+      if (size > data_.size() - pos_) {
+        throw std::runtime_error("command stream: truncated command");
+      }
+      memcpy(values, &data_[pos_], size);
+      pos_ += size;
+    }
+
+    void skip(size_t size) {
+      if (size > data_.size() - pos_) {
+        throw std::runtime_error("command stream: truncated command");
+      }
+      pos_ += size;
+    }
+
+    template <typename T>
+    T get() {
+      T value;
+      get(&value, sizeof(T));
+      return value;
+    }
+
+  private:
+    std::vector<uint8_t> const& data_;
+    size_t pos_ = 0;
+};
+
+template <typename T>
+T const& lookup(std::vector<T> const& table, uint32_t index) {
+  if (index >= table.size()) {
+    throw std::runtime_error("command stream: binding index out of range");
+  }
+  return table[index];
+}
+
+}
+
+void CommandStream::put(const void* values, size_t size) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(values);
+  data_.insert(data_.end(), bytes, bytes + size);
+}
+
+void CommandStream::bindPipeline(uint32_t pipeline) {
+  if (pipeline == bound_pipeline_) {
+    skipped_binds_++;
+    return;
+  }
+  bound_pipeline_ = pipeline;
+  put(Op::BindPipeline);
+  put(pipeline);
+  bind_count_++;
+}
+
+void CommandStream::bindDescriptorSet(uint32_t pipeline, uint32_t set_index, uint32_t descriptor_set) {
+  if (set_index >= bound_sets_.size()) {
+    bound_set_pipelines_.resize(set_index + 1, nothing_bound);
+    bound_sets_.resize(set_index + 1, nothing_bound);
+  }
+  if (bound_set_pipelines_[set_index] == pipeline && bound_sets_[set_index] == descriptor_set) {
+    skipped_binds_++;
+    return;
+  }
+  bound_set_pipelines_[set_index] = pipeline;
+  bound_sets_[set_index] = descriptor_set;
+  put(Op::BindDescriptorSet);
+  put(pipeline);
+  put(set_index);
+  put(descriptor_set);
+  bind_count_++;
+}
+
+void CommandStream::pushConstants(uint32_t pipeline, VkShaderStageFlags stages, uint32_t offset, uint32_t size,
+                                  const void* values) {
+  put(Op::PushConstants);
+  put(pipeline);
+  put(stages);
+  put(offset);
+  put(size);
+  put(values, size);
+}
+
+void CommandStream::draw(uint32_t vertex_count, uint32_t instance_count, uint32_t first_vertex,
+                         uint32_t first_instance) {
+  put(Op::Draw);
+  put(vertex_count);
+  put(instance_count);
+  put(first_vertex);
+  put(first_instance);
+  work_count_++;
+}
+
+void CommandStream::drawIndirect(uint32_t buffer, VkDeviceSize offset, uint32_t draw_count, uint32_t stride) {
+  put(Op::DrawIndirect);
+  put(buffer);
+  put(uint64_t(offset));
+  put(draw_count);
+  put(stride);
+  work_count_++;
+}
+
+void CommandStream::dispatch(uint32_t x, uint32_t y, uint32_t z) {
+  put(Op::Dispatch);
+  put(x);
+  put(y);
+  put(z);
+  work_count_++;
+}
+
+void CommandStream::fillBuffer(uint32_t buffer, VkDeviceSize offset, VkDeviceSize size, uint32_t value) {
+  put(Op::FillBuffer);
+  put(buffer);
+  put(uint64_t(offset));
+  put(uint64_t(size));
+  put(value);
+}
+
+void CommandStream::record(VkCommandBuffer cmd, CommandBindings const& bindings) const {
+  Reader reader(data_);
+  // push constants are copied out of the stream, which has no alignment
+  uint8_t values[max_push_constants_size];
+
+  while (!reader.done()) {
+    switch (reader.get<Op>()) {
+      case Op::BindPipeline: {
+        uint32_t pipeline = reader.get<uint32_t>();
+        vkCmdBindPipeline(cmd, lookup(bindings.bind_points, pipeline), lookup(bindings.pipelines, pipeline));
+        break;
+      }
+      case Op::BindDescriptorSet: {
+        uint32_t pipeline = reader.get<uint32_t>();
+        uint32_t set_index = reader.get<uint32_t>();
+        VkDescriptorSet set = lookup(bindings.descriptor_sets, reader.get<uint32_t>());
+        vkCmdBindDescriptorSets(cmd, lookup(bindings.bind_points, pipeline), lookup(bindings.layouts, pipeline),
+                                set_index, 1, &set, 0, nullptr);
+        break;
+      }
+      case Op::PushConstants: {
+        uint32_t pipeline = reader.get<uint32_t>();
+        VkShaderStageFlags stages = reader.get<VkShaderStageFlags>();
+        uint32_t offset = reader.get<uint32_t>();
+        uint32_t size = reader.get<uint32_t>();
+        if (size > sizeof(values)) {
+          throw std::runtime_error("command stream: push constants too large");
+        }
+        reader.get(values, size);
+        vkCmdPushConstants(cmd, lookup(bindings.layouts, pipeline), stages, offset, size, values);
+        break;
+      }
+      case Op::Draw: {
+        uint32_t vertex_count = reader.get<uint32_t>();
+        uint32_t instance_count = reader.get<uint32_t>();
+        uint32_t first_vertex = reader.get<uint32_t>();
+        uint32_t first_instance = reader.get<uint32_t>();
+        vkCmdDraw(cmd, vertex_count, instance_count, first_vertex, first_instance);
+        break;
+      }
+      case Op::DrawIndirect: {
+        VkBuffer buffer = lookup(bindings.buffers, reader.get<uint32_t>());
+        uint64_t offset = reader.get<uint64_t>();
+        uint32_t draw_count = reader.get<uint32_t>();
+        uint32_t stride = reader.get<uint32_t>();
+        vkCmdDrawIndirect(cmd, buffer, offset, draw_count, stride);
+        break;
+      }
+      case Op::Dispatch: {
+        uint32_t x = reader.get<uint32_t>();
+        uint32_t y = reader.get<uint32_t>();
+        uint32_t z = reader.get<uint32_t>();
+        vkCmdDispatch(cmd, x, y, z);
+        break;
+      }
+      case Op::FillBuffer: {
+        VkBuffer buffer = lookup(bindings.buffers, reader.get<uint32_t>());
+        uint64_t offset = reader.get<uint64_t>();
+        uint64_t size = reader.get<uint64_t>();
+        uint32_t value = reader.get<uint32_t>();
+        vkCmdFillBuffer(cmd, buffer, offset, size, value);
+        break;
+      }
+      default:
+        throw std::runtime_error("command stream: unknown command");
+    }
+  }
+}
+
+CommandStream CommandStream::fromData(std::vector<uint8_t> const& data) {
+  CommandStream stream;
+  stream.data_ = data;
+
+  // walk it once, so a broken stream is rejected before anything is recorded
+  Reader reader(stream.data_);
+  while (!reader.done()) {
+    switch (reader.get<Op>()) {
+      case Op::BindPipeline:
+        reader.get<uint32_t>();
+        stream.bind_count_++;
+        break;
+      case Op::BindDescriptorSet:
+        reader.get<uint32_t>();
+        reader.get<uint32_t>();
+        reader.get<uint32_t>();
+        stream.bind_count_++;
+        break;
+      case Op::PushConstants: {
+        reader.get<uint32_t>();
+        reader.get<VkShaderStageFlags>();
+        reader.get<uint32_t>();
+        reader.skip(reader.get<uint32_t>());
+        break;
+      }
+      case Op::Draw:
+        reader.get<uint32_t>();
+        reader.get<uint32_t>();
+        reader.get<uint32_t>();
+        reader.get<uint32_t>();
+        stream.work_count_++;
+        break;
+      case Op::DrawIndirect:
+        reader.get<uint32_t>();
+        reader.get<uint64_t>();
+        reader.get<uint32_t>();
+        reader.get<uint32_t>();
+        stream.work_count_++;
+        break;
+      case Op::Dispatch:
+        reader.get<uint32_t>();
+        reader.get<uint32_t>();
+        reader.get<uint32_t>();
+        stream.work_count_++;
+        break;
+      case Op::FillBuffer:
+        reader.get<uint32_t>();
+        reader.get<uint64_t>();
+        reader.get<uint64_t>();
+        reader.get<uint32_t>();
+        break;
+      default:
+        throw std::runtime_error("command stream: unknown command");
+    }
+  }
+  return stream;
+}
+
+}
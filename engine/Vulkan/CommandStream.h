@@ -0,0 +1,98 @@
+#ifndef VULKAN_ENGINE_COMMANDSTREAM_H
+#define VULKAN_ENGINE_COMMANDSTREAM_H
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace engine {
+
+// What the indices of a CommandStream refer to when it is recorded
+struct CommandBindings {
+  // per pipeline: the pipeline, its layout and where it binds
+  std::vector<VkPipeline> pipelines;
+  std::vector<VkPipelineLayout> layouts;
+  std::vector<VkPipelineBindPoint> bind_points;
+  std::vector<VkDescriptorSet> descriptor_sets;
+  std::vector<VkBuffer> buffers;
+};
+
+/*
+ * Draws and dispatches of one pass (or subpass) as a compact byte stream
+ *
+ * Objects are referenced by index into CommandBindings instead of by handle,
+ * so the same stream can be recorded for every swapchain image, written to a
+ * capture file and replayed by another process.
+ *
+ * Binds of what the stream has bound already are left out (and counted), so a
+ * sorted draw list can ask for its state before every draw. A stream never
+ * assumes anything bound before it.
+ */
+class CommandStream {
+  public:
+    void bindPipeline(uint32_t pipeline);
+
+    // the layout and the bind point are the ones of the pipeline
+    void bindDescriptorSet(uint32_t pipeline, uint32_t set_index, uint32_t descriptor_set);
+
+    void pushConstants(uint32_t pipeline, VkShaderStageFlags stages, uint32_t offset, uint32_t size,
+                       const void* values);
+
+    void draw(uint32_t vertex_count, uint32_t instance_count, uint32_t first_vertex, uint32_t first_instance);
+
+    void drawIndirect(uint32_t buffer, VkDeviceSize offset, uint32_t draw_count, uint32_t stride);
+
+    void dispatch(uint32_t x, uint32_t y, uint32_t z);
+
+    // outside of render passes, the size a multiple of 4 or VK_WHOLE_SIZE
+    void fillBuffer(uint32_t buffer, VkDeviceSize offset, VkDeviceSize size, uint32_t value);
+
+    // append the commands to a command buffer
+    void record(VkCommandBuffer cmd, CommandBindings const& bindings) const;
+
+    // draws and dispatches in the stream
+    uint32_t workCount() const { return work_count_; }
+
+    // pipeline and descriptor set binds in the stream, and the ones left out as redundant
+    uint32_t bindCount() const { return bind_count_; }
+    uint32_t skippedBinds() const { return skipped_binds_; }
+
+    std::vector<uint8_t> const& data() const { return data_; }
+
+    // the stream as read from a capture, throws if it is malformed
+    static CommandStream fromData(std::vector<uint8_t> const& data);
+
+  private:
+    enum class Op : uint8_t {
+      BindPipeline,
+      BindDescriptorSet,
+      PushConstants,
+      Draw,
+      DrawIndirect,
+      Dispatch,
+      FillBuffer,
+    };
+
+    static const uint32_t nothing_bound = ~0u;
+
+    std::vector<uint8_t> data_;
+    uint32_t work_count_ = 0;
+    uint32_t bind_count_ = 0;
+    uint32_t skipped_binds_ = 0;
+
+    // while the stream is built: the last pipeline, and per set index the pipeline
+    // and the descriptor set of its last bind (sets of another pipeline are bound again)
+    uint32_t bound_pipeline_ = nothing_bound;
+    std::vector<uint32_t> bound_set_pipelines_;
+    std::vector<uint32_t> bound_sets_;
+
+    void put(const void* values, size_t size);
+
+    template <typename T>
+    void put(T const& value) { put(&value, sizeof(T)); }
+};
+
+}
+
+#endif //VULKAN_ENGINE_COMMANDSTREAM_H
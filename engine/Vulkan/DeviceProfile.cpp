@@ -0,0 +1,114 @@
+#include "DeviceProfile.h"
+
+#include <sys/stat.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+
+namespace engine {
+
+std::string uuidString(const uint8_t uuid[VK_UUID_SIZE]) {
+  std::ostringstream out;
+  out << std::hex << std::setfill('0');
+  for (uint32_t i = 0; i < VK_UUID_SIZE; i++) {
+    out << std::setw(2) << uint32_t(uuid[i]);
+  }
+  return out.str();
+}
+
+/*
+ * $XDG_CACHE_HOME/vulkan-engine/ or ~/.cache/vulkan-engine/, created on the first call.
+ * Empty (the working directory) if there is no home or it can't be created
+ */
+std::string cacheDirectory() {
+  static const std::string directory = [] {
+    std::string base;
+    if (const char* cache = std::getenv("XDG_CACHE_HOME")) {
+      base = cache;
+    } else if (const char* home = std::getenv("HOME")) {
+      base = std::string(home) + "/.cache";
+    }
+    if (base.empty()) {
+      return std::string();
+    }
+    mkdir(base.c_str(), 0755);
+    std::string engine = base + "/vulkan-engine";
+    if (mkdir(engine.c_str(), 0755) != 0 && errno != EEXIST) {
+      return std::string();
+    }
+    return engine + "/";
+  }();
+  return directory;
+}
+
+std::string deviceProfilePath(VkPhysicalDeviceProperties const& properties) {
+  std::ostringstream path;
+  path << cacheDirectory() << "device-" << std::hex << std::setfill('0') << std::setw(4) << properties.vendorID
+       << "-" << std::setw(4) << properties.deviceID << std::dec << "-" << properties.driverVersion << ".profile";
+  return path.str();
+}
+
+std::string pipelineCachePath(VkPhysicalDeviceProperties const& properties) {
+  std::ostringstream path;
+  path << cacheDirectory() << "device-" << uuidString(properties.pipelineCacheUUID) << "-"
+       << properties.driverVersion << ".pipelines";
+  return path.str();
+}
+
+/*
+ * The cache is a plain text file with one key=value pair per line,
+ * so it can be tweaked by hand
+ */
+bool readDeviceProfile(std::string const& path, DeviceProfile& profile) {
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    return false;
+  }
+
+  std::string line;
+  while (std::getline(file, line)) {
+    size_t separator = line.find('=');
+    if (line.empty() || line[0] == '#' || separator == std::string::npos) {
+      continue;
+    }
+    std::string key = line.substr(0, separator);
+    std::istringstream value(line.substr(separator + 1));
+
+    if (key == "present_mode") {
+      uint32_t mode;
+      if (value >> mode) {
+        profile.present_mode = VkPresentModeKHR(mode);
+      }
+    } else if (key == "image_count") {
+      value >> profile.image_count;
+    } else if (key == "msaa_samples") {
+      value >> profile.msaa_samples;
+    } else if (key == "staging_budget") {
+      value >> profile.staging_budget;
+    } else if (key == "worker_threads") {
+      value >> profile.worker_threads;
+    }
+    // unknown keys are from newer versions, ignore them
+  }
+  return true;
+}
+
+bool writeDeviceProfile(std::string const& path, DeviceProfile const& profile) {
+  std::ofstream file(path);
+  if (!file.is_open()) {
+    return false;
+  }
+
+  file << "# vulkan-engine device profile, delete the file to calibrate again\n"
+       << "present_mode=" << uint32_t(profile.present_mode) << "\n"
+       << "image_count=" << profile.image_count << "\n"
+       << "msaa_samples=" << profile.msaa_samples << "\n"
+       << "staging_budget=" << profile.staging_budget << "\n"
+       << "worker_threads=" << profile.worker_threads << "\n";
+  return file.good();
+}
+
+}
@@ -0,0 +1,48 @@
+#ifndef VULKAN_ENGINE_DEVICEPROFILE_H
+#define VULKAN_ENGINE_DEVICEPROFILE_H
+
+#include <vulkan/vulkan.h>
+
+#include <string>
+
+namespace engine {
+
+// Tuning which depends on the GPU, derived from a short calibration run on the
+// first launch and cached on disk (one file per device and driver version)
+struct DeviceProfile {
+  // used if the surface supports it, FIFO otherwise
+  VkPresentModeKHR present_mode = VK_PRESENT_MODE_FIFO_KHR;
+
+  // swapchain images, at least the minimum of the surface + 1
+  uint32_t image_count = 3;
+
+  // highest sample count the GPU can fill at the window size without hurting the frame rate
+  uint32_t msaa_samples = 4;
+
+  // bytes per frame we upload through staging buffers, about a millisecond of transfers
+  VkDeviceSize staging_budget = 8 << 20;
+
+  // threads for CPU side work next to the main and the submit thread
+  uint32_t worker_threads = 1;
+};
+
+// hex string of a UUID, as printed when selecting the GPU
+std::string uuidString(const uint8_t uuid[VK_UUID_SIZE]);
+
+// where the profiles and the pipeline caches are kept, with a trailing slash
+std::string cacheDirectory();
+
+// cache file of the GPU model, a new driver gets a new profile
+std::string deviceProfilePath(VkPhysicalDeviceProperties const& properties);
+
+// cache file of the pipelines compiled for the device, by the pipelineCacheUUID the driver checks them against
+std::string pipelineCachePath(VkPhysicalDeviceProperties const& properties);
+
+// false if there is no (readable) cached profile, keys missing in the file keep their value
+bool readDeviceProfile(std::string const& path, DeviceProfile& profile);
+
+bool writeDeviceProfile(std::string const& path, DeviceProfile const& profile);
+
+}
+
+#endif //VULKAN_ENGINE_DEVICEPROFILE_H
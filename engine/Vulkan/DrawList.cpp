@@ -0,0 +1,48 @@
+#include "DrawList.h"
+
+#include <cstring>
+
+namespace engine {
+
+uint64_t DrawList::key(uint32_t pass, uint32_t pipeline, uint32_t material, float depth) {
+  // the bits of a float sort like the float once the negative ones are flipped
+  uint32_t bits;
+  memcpy(&bits, &depth, sizeof(bits));
+  bits = (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+  return uint64_t(pass & 0xff) << 56 | uint64_t(pipeline & 0xff) << 48 | uint64_t(material & 0xffff) << 32 | bits;
+}
+
+void DrawList::sort() {
+  if (draws_.size() < 2) {
+    return;
+  }
+
+  // the histograms of all bytes in one pass over the keys
+  uint32_t counts[8][256] = {};
+  for (auto const& draw : draws_) {
+    for (uint32_t b = 0; b < 8; b++) {
+      counts[b][(draw.key >> (8 * b)) & 0xff]++;
+    }
+  }
+
+  scratch_.resize(draws_.size());
+  for (uint32_t b = 0; b < 8; b++) {
+    uint32_t (&count)[256] = counts[b];
+    if (count[(draws_[0].key >> (8 * b)) & 0xff] == draws_.size()) {
+      continue;
+    }
+
+    uint32_t offsets[256];
+    uint32_t offset = 0;
+    for (uint32_t digit = 0; digit < 256; digit++) {
+      offsets[digit] = offset;
+      offset += count[digit];
+    }
+    for (auto const& draw : draws_) {
+      scratch_[offsets[(draw.key >> (8 * b)) & 0xff]++] = draw;
+    }
+    draws_.swap(scratch_);
+  }
+}
+
+}
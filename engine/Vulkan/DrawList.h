@@ -0,0 +1,51 @@
+#ifndef VULKAN_ENGINE_DRAWLIST_H
+#define VULKAN_ENGINE_DRAWLIST_H
+
+#include <cstdint>
+#include <vector>
+
+namespace engine {
+
+/*
+ * Draws ordered by a 64-bit key, so the ones sharing state end up next to each other
+ *
+ * From the most significant bits: the pass (8 bits), the pipeline (8 bits),
+ * the material (16 bits) and the depth (32 bits). Within a pass the draws are
+ * grouped by pipeline, then by material, and the groups are drawn front to back.
+ * What a pipeline and a material index means is up to whoever records the list.
+ */
+class DrawList {
+  public:
+    struct Draw {
+      uint64_t key;
+      // the draw of the caller
+      uint32_t index;
+    };
+
+    // depth in any range, smaller is closer
+    static uint64_t key(uint32_t pass, uint32_t pipeline, uint32_t material, float depth);
+
+    static uint32_t pass(uint64_t key) { return uint32_t(key >> 56); }
+    static uint32_t pipeline(uint64_t key) { return uint32_t(key >> 48) & 0xff; }
+    static uint32_t material(uint64_t key) { return uint32_t(key >> 32) & 0xffff; }
+
+    void clear() { draws_.clear(); }
+
+    void add(uint64_t key, uint32_t index) { draws_.push_back({key, index}); }
+
+    /*
+     * LSD radix sort, a byte per round, stable, so equal keys keep the order they
+     * were added in. Rounds of a byte which all keys share are skipped.
+     */
+    void sort();
+
+    std::vector<Draw> const& draws() const { return draws_; }
+
+  private:
+    std::vector<Draw> draws_;
+    std::vector<Draw> scratch_;
+};
+
+}
+
+#endif //VULKAN_ENGINE_DRAWLIST_H
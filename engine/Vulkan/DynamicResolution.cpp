@@ -0,0 +1,54 @@
+#include "DynamicResolution.h"
+
+namespace engine {
+
+namespace {
+
+// a higher resolution is only taken if it is expected to stay below this fraction of the target
+const double headroom = 0.85;
+
+}
+
+void ResolutionController::init(double target_ms, float min_scale, uint32_t interval) {
+  target_ms_ = target_ms;
+  min_scale_ = min_scale;
+  interval_ = interval > 0 ? interval : 1;
+  level_ = 0;
+  sum_ms_ = 0.0;
+  samples_ = 0;
+}
+
+bool ResolutionController::update(double gpu_ms, uint32_t level) {
+  if (level != level_) {
+    return false;
+  }
+  sum_ms_ += gpu_ms;
+  if (++samples_ < interval_) {
+    return false;
+  }
+  double average_ms = sum_ms_ / samples_;
+  sum_ms_ = 0.0;
+  samples_ = 0;
+
+  uint32_t next = level_;
+  if (average_ms > target_ms_ && level_ + 1 < levels) {
+    next++;
+  } else if (level_ > 0) {
+    double ratio = scale(level_ - 1) / scale(level_);
+    if (average_ms * ratio * ratio < target_ms_ * headroom) {
+      next--;
+    }
+  }
+  if (next == level_) {
+    return false;
+  }
+  level_ = next;
+  changes_++;
+  return true;
+}
+
+float ResolutionController::scale(uint32_t level) const {
+  return 1.0f - (1.0f - min_scale_) * level / (levels - 1);
+}
+
+}
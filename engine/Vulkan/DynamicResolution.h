@@ -0,0 +1,50 @@
+#ifndef VULKAN_ENGINE_DYNAMICRESOLUTION_H
+#define VULKAN_ENGINE_DYNAMICRESOLUTION_H
+
+#include <cstdint>
+
+namespace engine {
+
+/*
+ * Picks the resolution of the scene from the GPU time of the last frames
+ *
+ * The resolutions are a few fixed levels between the full size (level 0)
+ * and min_scale of it in both directions, for which the command buffers are
+ * recorded up front. Every interval frames the average GPU time is compared
+ * with the target: above it the next lower resolution is taken, and the next
+ * higher one once the time it would take (assumed to scale with the pixels)
+ * fits the target with some headroom, so the level doesn't flip back and forth.
+ */
+class ResolutionController {
+  public:
+    static const uint32_t levels = 6;
+
+    void init(double target_ms, float min_scale, uint32_t interval);
+
+    // the GPU time of a finished frame rendered at the level, true if the level changed
+    // frames still in flight from before a change are left out
+    bool update(double gpu_ms, uint32_t level);
+
+    uint32_t level() const { return level_; }
+
+    // fraction of the full size in both directions
+    float scale(uint32_t level) const;
+
+    float scale() const { return scale(level_); }
+
+    uint32_t changes() const { return changes_; }
+
+  private:
+    double target_ms_ = 0.0;
+    float min_scale_ = 1.0f;
+    uint32_t interval_ = 1;
+    uint32_t level_ = 0;
+
+    double sum_ms_ = 0.0;
+    uint32_t samples_ = 0;
+    uint32_t changes_ = 0;
+};
+
+}
+
+#endif //VULKAN_ENGINE_DYNAMICRESOLUTION_H
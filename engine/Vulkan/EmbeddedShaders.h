@@ -0,0 +1,25 @@
+#ifndef VULKAN_ENGINE_EMBEDDEDSHADERS_H
+#define VULKAN_ENGINE_EMBEDDEDSHADERS_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace engine {
+
+// SPIR-V compiled with the engine, see cmake/EmbedShaders.cmake
+struct EmbeddedShader {
+  // the compiled file, e.g. "shaders/first.vert.spv"
+  const char* name;
+  // word aligned, so it can be handed to vkCreateShaderModule as it is
+  const uint32_t* code;
+  // in bytes
+  size_t size;
+};
+
+// defined in the source file generated by the build
+extern const EmbeddedShader embedded_shaders[];
+extern const size_t embedded_shader_count;
+
+}
+
+#endif //VULKAN_ENGINE_EMBEDDEDSHADERS_H
@@ -0,0 +1,157 @@
+#include "FrameArena.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <utility>
+
+namespace {
+
+// enough for the temporaries of the frames, it grows if not
+const size_t scratch_arena_size = 256 * 1024;
+
+#if ENGINE_ALLOCATION_CHECK
+thread_local uint64_t heap_allocations = 0;
+
+// operator new, with its new handler but without the exception
+void* countedAllocation(std::size_t size) {
+  heap_allocations++;
+  if (size == 0) {
+    size = 1;
+  }
+  while (true) {
+    void* data = std::malloc(size);
+    if (data != nullptr) {
+      return data;
+    }
+    std::new_handler handler = std::get_new_handler();
+    if (handler == nullptr) {
+      return nullptr;
+    }
+    handler();
+  }
+}
+#endif
+
+}
+
+namespace engine {
+
+LinearArena::LinearArena(size_t capacity) : capacity_(capacity) {
+  if (capacity_ > 0) {
+    block_ = static_cast<char*>(::operator new(capacity_));
+  }
+}
+
+LinearArena::~LinearArena() {
+  for (void* data : overflow_) {
+    ::operator delete(data);
+  }
+  ::operator delete(block_);
+}
+
+LinearArena::LinearArena(LinearArena&& other)
+    : block_(other.block_), capacity_(other.capacity_), used_(other.used_), overflow_(std::move(other.overflow_)),
+      overflow_bytes_(other.overflow_bytes_), high_water_(other.high_water_), overflows_(other.overflows_) {
+  other.block_ = nullptr;
+  other.capacity_ = 0;
+  other.used_ = 0;
+  other.overflow_.clear();
+  other.overflow_bytes_ = 0;
+}
+
+void* LinearArena::allocate(size_t size, size_t alignment) {
+  uintptr_t base = reinterpret_cast<uintptr_t>(block_);
+  uintptr_t start = (base + used_ + alignment - 1) & ~uintptr_t(alignment - 1);
+  if (block_ != nullptr && start + size <= base + capacity_) {
+    used_ = start + size - base;
+    high_water_ = std::max(high_water_, used_ + overflow_bytes_);
+    return reinterpret_cast<void*>(start);
+  }
+
+  // aligned by hand, the heap only guarantees the alignment of the fundamental types
+  void* data = ::operator new(size + alignment);
+  overflow_.push_back(data);
+  overflow_bytes_ += size + alignment;
+  overflows_++;
+  high_water_ = std::max(high_water_, used_ + overflow_bytes_);
+  uintptr_t address = reinterpret_cast<uintptr_t>(data);
+  return reinterpret_cast<void*>((address + alignment - 1) & ~uintptr_t(alignment - 1));
+}
+
+void LinearArena::rewind(size_t mark) {
+  used_ = mark;
+  if (mark > 0) {
+    return;
+  }
+  for (void* data : overflow_) {
+    ::operator delete(data);
+  }
+  overflow_.clear();
+  overflow_bytes_ = 0;
+  if (high_water_ > capacity_) {
+    // with some room, the next round may need a bit more
+    ::operator delete(block_);
+    capacity_ = high_water_ + high_water_ / 2;
+    block_ = static_cast<char*>(::operator new(capacity_));
+  }
+}
+
+LinearArena& scratchArena() {
+  thread_local LinearArena arena(scratch_arena_size);
+  return arena;
+}
+
+uint64_t threadHeapAllocations() {
+#if ENGINE_ALLOCATION_CHECK
+  return heap_allocations;
+#else
+  return 0;
+#endif
+}
+
+}
+
+#if ENGINE_ALLOCATION_CHECK
+// The replaceable allocation functions, they count for the whole program and the libraries it loads
+
+void* operator new(std::size_t size) {
+  void* data = countedAllocation(size);
+  if (data == nullptr) {
+    throw std::bad_alloc();
+  }
+  return data;
+}
+
+void* operator new[](std::size_t size) {
+  return operator new(size);
+}
+
+void* operator new(std::size_t size, std::nothrow_t const&) noexcept {
+  try {
+    return countedAllocation(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void* operator new[](std::size_t size, std::nothrow_t const& nothrow) noexcept {
+  return operator new(size, nothrow);
+}
+
+void operator delete(void* data) noexcept {
+  std::free(data);
+}
+
+void operator delete[](void* data) noexcept {
+  std::free(data);
+}
+
+void operator delete(void* data, std::nothrow_t const&) noexcept {
+  std::free(data);
+}
+
+void operator delete[](void* data, std::nothrow_t const&) noexcept {
+  std::free(data);
+}
+#endif
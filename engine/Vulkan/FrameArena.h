@@ -0,0 +1,133 @@
+#ifndef VULKAN_ENGINE_FRAMEARENA_H
+#define VULKAN_ENGINE_FRAMEARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Count the heap allocations (operator new) of every thread, for the steady state checks of the frames
+// On in debug builds, -DENGINE_ALLOCATION_CHECK=1 turns it on in release builds too.
+#ifndef ENGINE_ALLOCATION_CHECK
+#ifdef NDEBUG
+#define ENGINE_ALLOCATION_CHECK 0
+#else
+#define ENGINE_ALLOCATION_CHECK 1
+#endif
+#endif
+
+namespace engine {
+
+/*
+ * Bump allocator for memory which is released all at once
+ *
+ * Allocating moves a pointer through one block, freeing single allocations
+ * does nothing. What doesn't fit into the block comes from the heap instead
+ * and is counted as an overflow, the next reset() replaces the block by one
+ * half again as large as the most ever used, so a workload which repeats stops
+ * touching the heap after its first round. Only for one thread at a time.
+ */
+class LinearArena {
+  public:
+    explicit LinearArena(size_t capacity = 0);
+
+    ~LinearArena();
+
+    LinearArena(LinearArena&& other);
+
+    LinearArena(LinearArena const&) = delete;
+
+    LinearArena& operator=(LinearArena const&) = delete;
+
+    // never null, alignment a power of two
+    void* allocate(size_t size, size_t alignment);
+
+    // releases everything, and grows the block if it overflowed
+    void reset() { rewind(0); }
+
+    // what is allocated now, rewind() releases everything allocated after it
+    size_t mark() const { return used_; }
+
+    // the overflows are only released by rewinding to 0
+    void rewind(size_t mark);
+
+    size_t capacity() const { return capacity_; }
+
+    // allocations which didn't fit into the block, since the start
+    uint64_t overflows() const { return overflows_; }
+
+  private:
+    char* block_ = nullptr;
+    size_t capacity_ = 0;
+    size_t used_ = 0;
+    // allocated from the heap since the last reset, and their bytes
+    std::vector<void*> overflow_;
+    size_t overflow_bytes_ = 0;
+    // the most ever used, block and overflows together
+    size_t high_water_ = 0;
+    uint64_t overflows_ = 0;
+};
+
+// Standard allocator on an arena, for the transient containers of a frame
+template <typename T>
+class ArenaAllocator {
+  public:
+    typedef T value_type;
+
+    ArenaAllocator(LinearArena& arena) : arena_(&arena) {}
+
+    template <typename U>
+    ArenaAllocator(ArenaAllocator<U> const& other) : arena_(other.arena()) {}
+
+    T* allocate(size_t count) { return static_cast<T*>(arena_->allocate(sizeof(T) * count, alignof(T))); }
+
+    // released with the arena
+    void deallocate(T*, size_t) {}
+
+    LinearArena* arena() const { return arena_; }
+
+  private:
+    LinearArena* arena_;
+};
+
+template <typename T, typename U>
+bool operator==(ArenaAllocator<T> const& a, ArenaAllocator<U> const& b) { return a.arena() == b.arena(); }
+
+template <typename T, typename U>
+bool operator!=(ArenaAllocator<T> const& a, ArenaAllocator<U> const& b) { return a.arena() != b.arena(); }
+
+// growing one leaves its old storage behind in the arena until it is released, reserve() what is known
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+// The arena of the calling thread for temporaries within one function, see ScratchScope
+LinearArena& scratchArena();
+
+/*
+ * Releases what was allocated from the scratch arena of the thread during its lifetime
+ *
+ * Scopes nest, the outermost one resets the arena. Containers on the scratch
+ * arena have to be declared after the scope, so they are gone before it rewinds.
+ */
+class ScratchScope {
+  public:
+    ScratchScope() : arena_(scratchArena()), mark_(arena_.mark()) {}
+
+    ~ScratchScope() { arena_.rewind(mark_); }
+
+    ScratchScope(ScratchScope const&) = delete;
+
+    ScratchScope& operator=(ScratchScope const&) = delete;
+
+    LinearArena& arena() { return arena_; }
+
+  private:
+    LinearArena& arena_;
+    size_t mark_;
+};
+
+// operator new calls of the calling thread since it started, always 0 without ENGINE_ALLOCATION_CHECK
+uint64_t threadHeapAllocations();
+
+}
+
+#endif //VULKAN_ENGINE_FRAMEARENA_H
@@ -0,0 +1,141 @@
+#include "InitScheduler.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <iomanip>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+namespace engine {
+
+InitScheduler::Step InitScheduler::add(const std::string& name, std::function<void()> fn,
+                                       std::vector<Step> const& dependencies, bool main_thread) {
+  Step step = steps_.size();
+  StepNode node;
+  node.name = name;
+  node.fn = fn;
+  node.main_thread = main_thread;
+  for (Step dependency : dependencies) {
+    // only earlier steps, so there can't be cycles
+    if (dependency >= step) {
+      throw std::runtime_error("init step " + name + " depends on a later step");
+    }
+    steps_[dependency].dependents.push_back(step);
+    node.missing++;
+  }
+  steps_.push_back(node);
+  return step;
+}
+
+void InitScheduler::run(uint32_t worker_threads) {
+  typedef std::chrono::steady_clock clock;
+  clock::time_point start = clock::now();
+  auto elapsed_ms = [start]() {
+    return std::chrono::duration<double, std::milli>(clock::now() - start).count();
+  };
+
+  std::mutex mutex;
+  std::condition_variable changed;
+  // kept sorted, so the steps start in the order they were added
+  std::vector<Step> ready;
+  std::vector<uint32_t> missing(steps_.size());
+  size_t remaining = steps_.size();
+  std::exception_ptr error;
+
+  for (Step step = 0; step < steps_.size(); step++) {
+    missing[step] = steps_[step].missing;
+    if (missing[step] == 0) {
+      ready.push_back(step);
+    }
+  }
+
+  auto work = [&](uint32_t thread) {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (remaining > 0 && !error) {
+      // the calling thread takes care of the main thread steps first
+      auto next = ready.end();
+      if (thread == 0) {
+        next = std::find_if(ready.begin(), ready.end(), [this](Step s) { return steps_[s].main_thread; });
+      }
+      if (next == ready.end()) {
+        next = std::find_if(ready.begin(), ready.end(), [this, thread](Step s) {
+          return thread == 0 || !steps_[s].main_thread;
+        });
+      }
+      if (next == ready.end()) {
+        changed.wait(lock);
+        continue;
+      }
+      Step step = *next;
+      ready.erase(next);
+
+      lock.unlock();
+      double begin = elapsed_ms();
+      std::exception_ptr step_error;
+      try {
+        steps_[step].fn();
+      } catch (...) {
+        step_error = std::current_exception();
+      }
+      double end = elapsed_ms();
+      lock.lock();
+
+      steps_[step].start_ms = begin;
+      steps_[step].end_ms = end;
+      steps_[step].thread = thread;
+      remaining--;
+      if (step_error && !error) {
+        error = step_error;
+      }
+      for (Step dependent : steps_[step].dependents) {
+        if (--missing[dependent] == 0) {
+          ready.insert(std::lower_bound(ready.begin(), ready.end(), dependent), dependent);
+        }
+      }
+      changed.notify_all();
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (uint32_t i = 1; i <= worker_threads; i++) {
+    workers.push_back(std::thread(work, i));
+  }
+  work(0);
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  total_ms_ = elapsed_ms();
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+void InitScheduler::printTimeline(std::ostream& out, std::string const& title) const {
+  const uint32_t width = 40;
+  size_t name_width = 0;
+  for (auto const& step : steps_) {
+    name_width = std::max(name_width, step.name.size());
+  }
+
+  std::ios::fmtflags flags = out.flags();
+  std::streamsize precision = out.precision();
+  out << title << " timeline, " << std::fixed << std::setprecision(1) << total_ms_ << " ms:\n";
+  for (auto const& step : steps_) {
+    uint32_t first = total_ms_ > 0.0 ? uint32_t(step.start_ms / total_ms_ * width) : 0;
+    uint32_t last = total_ms_ > 0.0 ? uint32_t(step.end_ms / total_ms_ * width) : 0;
+    std::string bar(width, ' ');
+    for (uint32_t i = std::min(first, width - 1); i <= std::min(last, width - 1); i++) {
+      bar[i] = '#';
+    }
+    out << "  " << std::left << std::setw(name_width) << step.name << std::right
+        << " " << std::setw(7) << step.start_ms << " - " << std::setw(7) << step.end_ms
+        << " ms  thread " << step.thread << "  |" << bar << "|\n";
+  }
+  out.flags(flags);
+  out.precision(precision);
+}
+
+}
@@ -0,0 +1,57 @@
+#ifndef VULKAN_ENGINE_INITSCHEDULER_H
+#define VULKAN_ENGINE_INITSCHEDULER_H
+
+#include <chrono>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace engine {
+
+/*
+ * Runs the initialization steps, as many at once as their dependencies allow
+ *
+ * Steps are added in a valid sequential order (dependencies first). run() hands
+ * ready steps to worker threads; the calling thread helps out and is the only
+ * one running main thread steps (GLFW insists on that). With no workers all
+ * steps run on the calling thread in the order they were added.
+ * After run() the timeline of the steps can be printed.
+ */
+class InitScheduler {
+  public:
+    typedef uint32_t Step;
+
+    Step add(const std::string& name, std::function<void()> fn, std::vector<Step> const& dependencies = {},
+             bool main_thread = false);
+
+    // rethrows the first exception of a step, after the running ones finished
+    void run(uint32_t worker_threads);
+
+    // when each step ran on which thread, relative to the start of run(), under "<title> timeline"
+    void printTimeline(std::ostream& out, std::string const& title = "Init") const;
+
+    double totalMs() const { return total_ms_; }
+
+  private:
+    struct StepNode {
+      std::string name;
+      std::function<void()> fn;
+      std::vector<Step> dependents;
+      uint32_t missing = 0;
+      bool main_thread = false;
+
+      // filled by run()
+      double start_ms = 0.0;
+      double end_ms = 0.0;
+      // 0 is the calling thread
+      uint32_t thread = 0;
+    };
+
+    std::vector<StepNode> steps_;
+    double total_ms_ = 0.0;
+};
+
+}
+
+#endif //VULKAN_ENGINE_INITSCHEDULER_H
@@ -0,0 +1,156 @@
+#include "MemoryBudget.h"
+#include "../Log.h"
+
+#include <algorithm>
+
+namespace engine {
+
+namespace {
+
+// fractions of the budget, evicting down to the low one
+const float high_watermark = 0.9f;
+const float low_watermark = 0.8f;
+
+}
+
+void MemoryBudget::init(VkInstance instance, VkPhysicalDevice physical_device, bool budget_extension) {
+  physical_device_ = physical_device;
+  if (budget_extension) {
+    get_properties2_ = (PFN_vkGetPhysicalDeviceMemoryProperties2KHR) vkGetInstanceProcAddr(
+            instance, "vkGetPhysicalDeviceMemoryProperties2KHR");
+  }
+
+  VkPhysicalDeviceMemoryProperties properties;
+  vkGetPhysicalDeviceMemoryProperties(physical_device, &properties);
+  for (uint32_t t = 0; t < properties.memoryTypeCount; t++) {
+    type_heaps_.push_back(properties.memoryTypes[t].heapIndex);
+  }
+  heaps_.resize(properties.memoryHeapCount);
+  for (uint32_t h = 0; h < properties.memoryHeapCount; h++) {
+    heaps_[h].size = properties.memoryHeaps[h].size;
+    heaps_[h].device_local = (properties.memoryHeaps[h].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+  }
+  for (auto& tracked : tracked_) {
+    tracked = 0;
+  }
+  sample();
+}
+
+void MemoryBudget::sample() {
+  if (!get_properties2_) {
+    for (uint32_t h = 0; h < heaps_.size(); h++) {
+      heaps_[h].budget = heaps_[h].size;
+      heaps_[h].usage = VkDeviceSize(std::max(int64_t(0), tracked_[h].load()));
+    }
+    return;
+  }
+
+  VkPhysicalDeviceMemoryBudgetPropertiesEXT budget = {};
+  budget.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+  VkPhysicalDeviceMemoryProperties2KHR properties = {};
+  properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+  properties.pNext = &budget;
+  get_properties2_(physical_device_, &properties);
+  for (uint32_t h = 0; h < heaps_.size(); h++) {
+    heaps_[h].budget = budget.heapBudget[h];
+    heaps_[h].usage = budget.heapUsage[h];
+  }
+}
+
+VkDeviceSize MemoryBudget::over(uint32_t heap, float fraction, VkDeviceSize more) const {
+  VkDeviceSize limit = VkDeviceSize(heaps_[heap].budget * double(fraction));
+  VkDeviceSize usage = heaps_[heap].usage + more;
+  return usage > limit ? usage - limit : 0;
+}
+
+ResidencyManager::Resource ResidencyManager::add(std::string const& name, uint32_t heap, VkDeviceSize size,
+                                                 std::function<bool()> const& load,
+                                                 std::function<void()> const& evict) {
+  Entry entry;
+  entry.name = name;
+  entry.heap = heap;
+  entry.size = size;
+  entry.load = load;
+  entry.evict = evict;
+  resources_.push_back(entry);
+  return resources_.size() - 1;
+}
+
+bool ResidencyManager::use(Resource resource, uint64_t frame) {
+  Entry& entry = resources_[resource];
+  if (!entry.resident) {
+    // room is only made from resources nobody used for a while, so the loads don't thrash
+    if (!evictFor(entry.heap, entry.size, high_watermark, frame, frames_in_flight_) || !entry.load()) {
+      refusals_++;
+      return false;
+    }
+    entry.resident = true;
+    budget_.track(entry.heap, int64_t(entry.size));
+    // the sampled usage only catches up with the next sample
+    if (budget_.initialized()) {
+      budget_.sample();
+    }
+  }
+  entry.last_used = frame;
+  return true;
+}
+
+void ResidencyManager::update(uint64_t frame, uint64_t frames_in_flight) {
+  frames_in_flight_ = frames_in_flight;
+  if (!budget_.initialized()) {
+    return;
+  }
+  budget_.sample();
+  for (uint32_t heap = 0; heap < budget_.heaps().size(); heap++) {
+    if (budget_.over(heap, high_watermark) > 0) {
+      evictFor(heap, 0, low_watermark, frame, frames_in_flight);
+    }
+  }
+}
+
+bool ResidencyManager::makeRoom(uint32_t heap, VkDeviceSize size, uint64_t frame, uint64_t frames_in_flight) {
+  if (!budget_.initialized()) {
+    return false;
+  }
+  budget_.sample();
+  return evictFor(heap, size, 1.0f, frame, frames_in_flight);
+}
+
+bool ResidencyManager::evictFor(uint32_t heap, VkDeviceSize bytes, float fraction, uint64_t frame,
+                                uint64_t frames_in_flight) {
+  if (!budget_.initialized()) {
+    return true;
+  }
+  VkDeviceSize excess = budget_.over(heap, fraction, bytes);
+  if (excess == 0) {
+    return true;
+  }
+
+  // least recently used first
+  std::vector<Entry*> candidates;
+  for (auto& entry : resources_) {
+    if (entry.resident && entry.heap == heap && entry.last_used + frames_in_flight < frame) {
+      candidates.push_back(&entry);
+    }
+  }
+  std::sort(candidates.begin(), candidates.end(), [](Entry const* a, Entry const* b) {
+    return a->last_used < b->last_used;
+  });
+
+  VkDeviceSize freed = 0;
+  for (Entry* entry : candidates) {
+    if (freed >= excess) {
+      break;
+    }
+    entry->evict();
+    entry->resident = false;
+    budget_.track(heap, -int64_t(entry->size));
+    freed += entry->size;
+    evictions_++;
+    LOG_DEBUG("Evicted " << entry->name << " (" << entry->size << " bytes) from heap " << heap << ".");
+  }
+  budget_.sample();
+  return freed >= excess;
+}
+
+}
@@ -0,0 +1,123 @@
+#ifndef VULKAN_ENGINE_MEMORYBUDGET_H
+#define VULKAN_ENGINE_MEMORYBUDGET_H
+
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace engine {
+
+struct HeapBudget {
+  VkDeviceSize size = 0;
+  // what the process may use of the heap without hurting itself or others
+  VkDeviceSize budget = 0;
+  VkDeviceSize usage = 0;
+  bool device_local = false;
+};
+
+/*
+ * Budget and usage of the memory heaps, sampled from VK_EXT_memory_budget
+ *
+ * Without the extension the budget is the size of the heap and the usage is
+ * what was tracked: the allocations of the engine and the resident
+ * streamable resources. track() may be called from any thread.
+ */
+class MemoryBudget {
+  public:
+    // budget_extension: VK_EXT_memory_budget is enabled, which needs VK_KHR_get_physical_device_properties2
+    void init(VkInstance instance, VkPhysicalDevice physical_device, bool budget_extension);
+
+    bool initialized() const { return !heaps_.empty(); }
+
+    // whether the usage comes from the driver, and includes other processes
+    bool exact() const { return get_properties2_ != nullptr; }
+
+    void sample();
+
+    std::vector<HeapBudget> const& heaps() const { return heaps_; }
+
+    uint32_t heapOfType(uint32_t memory_type) const { return type_heaps_[memory_type]; }
+
+    void track(uint32_t heap, int64_t bytes) { tracked_[heap] += bytes; }
+
+    // bytes by which the usage of the heap (with some more) is above the fraction of its budget
+    VkDeviceSize over(uint32_t heap, float fraction, VkDeviceSize more = 0) const;
+
+  private:
+    VkPhysicalDevice physical_device_ = VK_NULL_HANDLE;
+    PFN_vkGetPhysicalDeviceMemoryProperties2KHR get_properties2_ = nullptr;
+    std::vector<HeapBudget> heaps_;
+    std::vector<uint32_t> type_heaps_;
+    std::atomic<int64_t> tracked_[VK_MAX_MEMORY_HEAPS];
+};
+
+/*
+ * Keeps streamable resources resident as long as their heap has room
+ *
+ * Resources are loaded when they are used and there is room for them, so
+ * under memory pressure the caller falls back to a lower quality instead of
+ * failing an allocation. Heaps above 90% of their budget get their least
+ * recently used resources evicted, down to 80%, but never the ones a frame
+ * in flight may still read. Only for the thread running the frames.
+ */
+class ResidencyManager {
+  public:
+    typedef uint32_t Resource;
+
+    explicit ResidencyManager(MemoryBudget& budget) : budget_(budget) { }
+
+    // load allocates the size on the heap and returns false if it couldn't, evict frees it again
+    Resource add(std::string const& name, uint32_t heap, VkDeviceSize size,
+                 std::function<bool()> const& load, std::function<void()> const& evict);
+
+    /*
+     * The frame uses the resource: loads it if it isn't resident and it fits
+     * Returns whether it is resident, the caller degrades if it isn't
+     */
+    bool use(Resource resource, uint64_t frame);
+
+    bool resident(Resource resource) const { return resources_[resource].resident; }
+
+    // evict from the heaps above the high watermark, after sampling the budget
+    void update(uint64_t frame, uint64_t frames_in_flight);
+
+    /*
+     * Evict until the size fits below the budget of the heap, for an allocation
+     * which failed. Returns false if not enough could be evicted.
+     */
+    bool makeRoom(uint32_t heap, VkDeviceSize size, uint64_t frame, uint64_t frames_in_flight);
+
+    uint64_t evictions() const { return evictions_; }
+
+    // uses which found no room for the resource
+    uint64_t refusals() const { return refusals_; }
+
+  private:
+    struct Entry {
+      std::string name;
+      uint32_t heap;
+      VkDeviceSize size;
+      std::function<bool()> load;
+      std::function<void()> evict;
+      bool resident = false;
+      uint64_t last_used = 0;
+    };
+
+    MemoryBudget& budget_;
+    std::vector<Entry> resources_;
+    // of the last update, use() keeps those resources too
+    uint64_t frames_in_flight_ = 1;
+    uint64_t evictions_ = 0;
+    uint64_t refusals_ = 0;
+
+    // evict until the heap has the bytes below the fraction of its budget
+    bool evictFor(uint32_t heap, VkDeviceSize bytes, float fraction, uint64_t frame, uint64_t frames_in_flight);
+};
+
+}
+
+#endif //VULKAN_ENGINE_MEMORYBUDGET_H
@@ -0,0 +1,705 @@
+#include "Overlay.h"
+#include "FrameArena.h"
+#include "../Log.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace engine {
+
+namespace {
+
+/*
+ * The printable ASCII characters (32 to 126), 5 columns of 8 pixels each,
+ * the lowest bit is the top row and the last row is for descenders
+ */
+const uint8_t font_columns[95][5] = {
+        {0x00, 0x00, 0x00, 0x00, 0x00}, // space
+        {0x00, 0x00, 0x5F, 0x00, 0x00}, // !
+        {0x00, 0x07, 0x00, 0x07, 0x00}, // "
+        {0x14, 0x7F, 0x14, 0x7F, 0x14}, // #
+        {0x24, 0x2A, 0x7F, 0x2A, 0x12}, // $
+        {0x23, 0x13, 0x08, 0x64, 0x62}, // %
+        {0x36, 0x49, 0x56, 0x20, 0x50}, // &
+        {0x00, 0x08, 0x07, 0x03, 0x00}, // '
+        {0x00, 0x1C, 0x22, 0x41, 0x00}, // (
+        {0x00, 0x41, 0x22, 0x1C, 0x00}, // )
+        {0x2A, 0x1C, 0x7F, 0x1C, 0x2A}, // *
+        {0x08, 0x08, 0x3E, 0x08, 0x08}, // +
+        {0x00, 0x80, 0x70, 0x30, 0x00}, // ,
+        {0x08, 0x08, 0x08, 0x08, 0x08}, // -
+        {0x00, 0x00, 0x60, 0x60, 0x00}, // .
+        {0x20, 0x10, 0x08, 0x04, 0x02}, // /
+        {0x3E, 0x51, 0x49, 0x45, 0x3E}, // 0
+        {0x00, 0x42, 0x7F, 0x40, 0x00}, // 1
+        {0x72, 0x49, 0x49, 0x49, 0x46}, // 2
+        {0x21, 0x41, 0x49, 0x4D, 0x33}, // 3
+        {0x18, 0x14, 0x12, 0x7F, 0x10}, // 4
+        {0x27, 0x45, 0x45, 0x45, 0x39}, // 5
+        {0x3C, 0x4A, 0x49, 0x49, 0x31}, // 6
+        {0x41, 0x21, 0x11, 0x09, 0x07}, // 7
+        {0x36, 0x49, 0x49, 0x49, 0x36}, // 8
+        {0x46, 0x49, 0x49, 0x29, 0x1E}, // 9
+        {0x00, 0x00, 0x14, 0x00, 0x00}, // :
+        {0x00, 0x40, 0x34, 0x00, 0x00}, // ;
+        {0x00, 0x08, 0x14, 0x22, 0x41}, // <
+        {0x14, 0x14, 0x14, 0x14, 0x14}, // =
+        {0x00, 0x41, 0x22, 0x14, 0x08}, // >
+        {0x02, 0x01, 0x59, 0x09, 0x06}, // ?
+        {0x3E, 0x41, 0x5D, 0x59, 0x4E}, // @
+        {0x7C, 0x12, 0x11, 0x12, 0x7C}, // A
+        {0x7F, 0x49, 0x49, 0x49, 0x36}, // B
+        {0x3E, 0x41, 0x41, 0x41, 0x22}, // C
+        {0x7F, 0x41, 0x41, 0x41, 0x3E}, // D
+        {0x7F, 0x49, 0x49, 0x49, 0x41}, // E
+        {0x7F, 0x09, 0x09, 0x09, 0x01}, // F
+        {0x3E, 0x41, 0x41, 0x51, 0x73}, // G
+        {0x7F, 0x08, 0x08, 0x08, 0x7F}, // H
+        {0x00, 0x41, 0x7F, 0x41, 0x00}, // I
+        {0x20, 0x40, 0x41, 0x3F, 0x01}, // J
+        {0x7F, 0x08, 0x14, 0x22, 0x41}, // K
+        {0x7F, 0x40, 0x40, 0x40, 0x40}, // L
+        {0x7F, 0x02, 0x1C, 0x02, 0x7F}, // M
+        {0x7F, 0x04, 0x08, 0x10, 0x7F}, // N
+        {0x3E, 0x41, 0x41, 0x41, 0x3E}, // O
+        {0x7F, 0x09, 0x09, 0x09, 0x06}, // P
+        {0x3E, 0x41, 0x51, 0x21, 0x5E}, // Q
+        {0x7F, 0x09, 0x19, 0x29, 0x46}, // R
+        {0x26, 0x49, 0x49, 0x49, 0x32}, // S
+        {0x03, 0x01, 0x7F, 0x01, 0x03}, // T
+        {0x3F, 0x40, 0x40, 0x40, 0x3F}, // U
+        {0x1F, 0x20, 0x40, 0x20, 0x1F}, // V
+        {0x3F, 0x40, 0x38, 0x40, 0x3F}, // W
+        {0x63, 0x14, 0x08, 0x14, 0x63}, // X
+        {0x03, 0x04, 0x78, 0x04, 0x03}, // Y
+        {0x61, 0x59, 0x49, 0x4D, 0x43}, // Z
+        {0x00, 0x7F, 0x41, 0x41, 0x41}, // [
+        {0x02, 0x04, 0x08, 0x10, 0x20}, // backslash
+        {0x00, 0x41, 0x41, 0x41, 0x7F}, // ]
+        {0x04, 0x02, 0x01, 0x02, 0x04}, // ^
+        {0x40, 0x40, 0x40, 0x40, 0x40}, // _
+        {0x00, 0x03, 0x07, 0x08, 0x00}, // `
+        {0x20, 0x54, 0x54, 0x78, 0x40}, // a
+        {0x7F, 0x28, 0x44, 0x44, 0x38}, // b
+        {0x38, 0x44, 0x44, 0x44, 0x28}, // c
+        {0x38, 0x44, 0x44, 0x28, 0x7F}, // d
+        {0x38, 0x54, 0x54, 0x54, 0x18}, // e
+        {0x00, 0x08, 0x7E, 0x09, 0x02}, // f
+        {0x18, 0xA4, 0xA4, 0x9C, 0x78}, // g
+        {0x7F, 0x08, 0x04, 0x04, 0x78}, // h
+        {0x00, 0x44, 0x7D, 0x40, 0x00}, // i
+        {0x20, 0x40, 0x40, 0x3D, 0x00}, // j
+        {0x7F, 0x10, 0x28, 0x44, 0x00}, // k
+        {0x00, 0x41, 0x7F, 0x40, 0x00}, // l
+        {0x7C, 0x04, 0x78, 0x04, 0x78}, // m
+        {0x7C, 0x08, 0x04, 0x04, 0x78}, // n
+        {0x38, 0x44, 0x44, 0x44, 0x38}, // o
+        {0xFC, 0x18, 0x24, 0x24, 0x18}, // p
+        {0x18, 0x24, 0x24, 0x18, 0xFC}, // q
+        {0x7C, 0x08, 0x04, 0x04, 0x08}, // r
+        {0x48, 0x54, 0x54, 0x54, 0x24}, // s
+        {0x04, 0x04, 0x3F, 0x44, 0x24}, // t
+        {0x3C, 0x40, 0x40, 0x20, 0x7C}, // u
+        {0x1C, 0x20, 0x40, 0x20, 0x1C}, // v
+        {0x3C, 0x40, 0x30, 0x40, 0x3C}, // w
+        {0x44, 0x28, 0x10, 0x28, 0x44}, // x
+        {0x4C, 0x90, 0x90, 0x90, 0x7C}, // y
+        {0x44, 0x64, 0x54, 0x4C, 0x44}, // z
+        {0x00, 0x08, 0x36, 0x41, 0x00}, // {
+        {0x00, 0x00, 0x77, 0x00, 0x00}, // |
+        {0x00, 0x41, 0x36, 0x08, 0x00}, // }
+        {0x02, 0x01, 0x02, 0x04, 0x02}, // ~
+};
+
+const uint32_t first_char = 32;
+const uint32_t char_count = 95;
+// glyphs in rows of 16, 1 pixel apart so the filtering never reaches a neighbour
+const uint32_t glyphs_per_row = 16;
+const uint32_t cell_width = 7;
+const uint32_t cell_height = 10;
+const uint32_t font_atlas_width = 128;
+const uint32_t font_atlas_height = 64;
+
+// a HOST_VISIBLE memory type with the first properties of the list the type has
+uint32_t findMemoryType(VkPhysicalDevice physical_device, uint32_t type_bits,
+                        std::vector<VkMemoryPropertyFlags> const& preferred) {
+  VkPhysicalDeviceMemoryProperties memory_properties;
+  vkGetPhysicalDeviceMemoryProperties(physical_device, &memory_properties);
+  for (VkMemoryPropertyFlags properties : preferred) {
+    for (uint32_t t = 0; t < memory_properties.memoryTypeCount; t++) {
+      if ((type_bits & (1 << t)) && (memory_properties.memoryTypes[t].propertyFlags & properties) == properties) {
+        return t;
+      }
+    }
+  }
+  throw std::runtime_error("No suitable memory type for the overlay");
+}
+
+void allocate(VDeleter<VkDevice> const& device, VkPhysicalDevice physical_device, VkMemoryRequirements requirements,
+              std::vector<VkMemoryPropertyFlags> const& preferred, VDeleter<VkDeviceMemory>& memory) {
+  VkMemoryAllocateInfo info = {};
+  info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  info.allocationSize = requirements.size;
+  info.memoryTypeIndex = findMemoryType(physical_device, requirements.memoryTypeBits, preferred);
+  if (vkAllocateMemory(device, &info, nullptr, memory.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to allocate overlay memory");
+  }
+}
+
+}
+
+Overlay::Overlay(VDeleter<VkDevice> const& device)
+        : device_(device) {
+  createFontAtlas();
+}
+
+uint32_t Overlay::addAtlas(uint32_t width, uint32_t height, std::vector<uint8_t> const& pixels) {
+  if (initialized()) {
+    throw std::runtime_error("Overlay atlases have to be added before init");
+  }
+  if (pixels.size() != size_t(4) * width * height) {
+    throw std::runtime_error("Overlay atlas has the wrong size");
+  }
+  Atlas atlas = {width, height, pixels};
+  atlases_.push_back(atlas);
+  batches_.resize(atlases_.size());
+  return atlases_.size() - 1;
+}
+
+/*
+ * White glyphs with the coverage in alpha, so the vertex color tints them,
+ * and a white block in the bottom right corner for the untextured elements
+ */
+void Overlay::createFontAtlas() {
+  std::vector<uint8_t> pixels(4 * font_atlas_width * font_atlas_height, 0);
+  auto set = [&pixels](uint32_t x, uint32_t y) {
+    uint8_t* pixel = &pixels[4 * (y * font_atlas_width + x)];
+    pixel[0] = pixel[1] = pixel[2] = pixel[3] = 255;
+  };
+
+  for (uint32_t c = 0; c < char_count; c++) {
+    uint32_t x0 = (c % glyphs_per_row) * cell_width + 1;
+    uint32_t y0 = (c / glyphs_per_row) * cell_height + 1;
+    for (uint32_t column = 0; column < 5; column++) {
+      for (uint32_t row = 0; row < glyph_height; row++) {
+        if (font_columns[c][column] & (1 << row)) {
+          set(x0 + column, y0 + row);
+        }
+      }
+    }
+  }
+
+  for (uint32_t y = font_atlas_height - 4; y < font_atlas_height; y++) {
+    for (uint32_t x = font_atlas_width - 4; x < font_atlas_width; x++) {
+      set(x, y);
+    }
+  }
+  white_uv_[0] = (font_atlas_width - 2.0f) / font_atlas_width;
+  white_uv_[1] = (font_atlas_height - 2.0f) / font_atlas_height;
+
+  addAtlas(font_atlas_width, font_atlas_height, pixels);
+}
+
+void Overlay::init(VkPhysicalDevice physical_device, VkQueue queue, uint32_t queue_family, VkRenderPass renderpass,
+                   uint32_t subpass, VkSampleCountFlagBits samples, VkExtent2D extent, uint32_t images,
+                   std::vector<char> const& vertex_shader, std::vector<char> const& fragment_shader,
+                   VkPipelineCache pipeline_cache, uint32_t max_vertices) {
+  extent_ = extent;
+  max_vertices_ = max_vertices;
+  uploadAtlases(physical_device, queue, queue_family);
+
+  VkSamplerCreateInfo sampler_info = {};
+  sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  // text is drawn at whole multiples of its size, nearest keeps it sharp
+  sampler_info.magFilter = VK_FILTER_NEAREST;
+  sampler_info.minFilter = VK_FILTER_NEAREST;
+  sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  sampler_info.maxLod = 0.0f;
+  if (vkCreateSampler(device_, &sampler_info, nullptr, sampler_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create overlay sampler");
+  }
+
+  // the CPU writes them, preferably straight into device memory
+  args_offset_ = sizeof(OverlayVertex) * VkDeviceSize(max_vertices);
+  VkDeviceSize size = args_offset_ + sizeof(VkDrawIndirectCommand) * atlases_.size();
+  std::vector<VDeleter<VkBuffer>> buffers(images, VDeleter<VkBuffer>{device_, vkDestroyBuffer});
+  memory_.resize(images, VDeleter<VkDeviceMemory>{device_, vkFreeMemory});
+  mapped_.resize(images, nullptr);
+  image_generations_.assign(images, 0);
+  for (uint32_t i = 0; i < images; i++) {
+    VkBufferCreateInfo buffer_info = {};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.size = size;
+    buffer_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if (vkCreateBuffer(device_, &buffer_info, nullptr, buffers[i].replace()) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create overlay buffer");
+    }
+
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(device_, buffers[i], &requirements);
+    allocate(device_, physical_device, requirements, {
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+    }, memory_[i]);
+    vkBindBufferMemory(device_, buffers[i], memory_[i], 0);
+    vkMapMemory(device_, memory_[i], 0, VK_WHOLE_SIZE, 0, &mapped_[i]);
+  }
+
+  VkDescriptorSetLayoutBinding bindings[2] = {};
+  bindings[0].binding = 0;
+  bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  bindings[0].descriptorCount = 1;
+  bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  bindings[1].binding = 1;
+  bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  bindings[1].descriptorCount = 1;
+  bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+  VkDescriptorSetLayoutCreateInfo layout_info = {};
+  layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layout_info.bindingCount = 2;
+  layout_info.pBindings = bindings;
+  if (vkCreateDescriptorSetLayout(device_, &layout_info, nullptr, set_layout_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create overlay descriptor set layout");
+  }
+
+  uint32_t set_count = images * atlases_.size();
+  VkDescriptorPoolSize pool_sizes[2] = {};
+  pool_sizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  pool_sizes[0].descriptorCount = set_count;
+  pool_sizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  pool_sizes[1].descriptorCount = set_count;
+
+  VkDescriptorPoolCreateInfo pool_info = {};
+  pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  pool_info.maxSets = set_count;
+  pool_info.poolSizeCount = 2;
+  pool_info.pPoolSizes = pool_sizes;
+  if (vkCreateDescriptorPool(device_, &pool_info, nullptr, descriptor_pool_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create overlay descriptor pool");
+  }
+
+  std::vector<VkDescriptorSetLayout> layouts(set_count, set_layout_);
+  VkDescriptorSetAllocateInfo alloc_info = {};
+  alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  alloc_info.descriptorPool = descriptor_pool_;
+  alloc_info.descriptorSetCount = set_count;
+  alloc_info.pSetLayouts = layouts.data();
+  sets_.resize(set_count);
+  if (vkAllocateDescriptorSets(device_, &alloc_info, sets_.data()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to allocate overlay descriptor sets");
+  }
+
+  for (uint32_t i = 0; i < images; i++) {
+    for (uint32_t a = 0; a < atlases_.size(); a++) {
+      VkDescriptorBufferInfo buffer_info = {};
+      buffer_info.buffer = buffers[i];
+      buffer_info.range = args_offset_;
+      VkDescriptorImageInfo image_info = {};
+      image_info.sampler = sampler_;
+      image_info.imageView = views_[a];
+      image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+      VkWriteDescriptorSet writes[2] = {};
+      for (uint32_t b = 0; b < 2; b++) {
+        writes[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[b].dstSet = sets_[i * atlases_.size() + a];
+        writes[b].dstBinding = b;
+        writes[b].descriptorType = bindings[b].descriptorType;
+        writes[b].descriptorCount = 1;
+      }
+      writes[0].pBufferInfo = &buffer_info;
+      writes[1].pImageInfo = &image_info;
+      vkUpdateDescriptorSets(device_, 2, writes, 0, nullptr);
+    }
+  }
+
+  createPipeline(renderpass, subpass, samples, vertex_shader, fragment_shader, pipeline_cache);
+
+  // initialized() is true from here on
+  buffers_.swap(buffers);
+  LOG_INFO("Created overlay with " << atlases_.size() << " atlases and room for " << max_vertices
+           << " vertices per frame.");
+}
+
+/*
+ * Copy the atlases into sampled images, through one staging buffer and one submission
+ * Without a queue the command buffer and the staging buffer are kept for the caller to submit
+ */
+void Overlay::uploadAtlases(VkPhysicalDevice physical_device, VkQueue queue, uint32_t queue_family) {
+  VkDeviceSize staging_size = 0;
+  for (auto const& atlas : atlases_) {
+    staging_size += atlas.pixels.size();
+  }
+
+  VkBufferCreateInfo buffer_info = {};
+  buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  buffer_info.size = staging_size;
+  buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+  buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  if (vkCreateBuffer(device_, &buffer_info, nullptr, staging_buffer_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create overlay staging buffer");
+  }
+  VkMemoryRequirements requirements;
+  vkGetBufferMemoryRequirements(device_, staging_buffer_, &requirements);
+  allocate(device_, physical_device, requirements,
+           {VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT}, staging_memory_);
+  vkBindBufferMemory(device_, staging_buffer_, staging_memory_, 0);
+
+  void* data;
+  vkMapMemory(device_, staging_memory_, 0, staging_size, 0, &data);
+  VkDeviceSize offset = 0;
+  for (auto const& atlas : atlases_) {
+    memcpy(static_cast<char*>(data) + offset, atlas.pixels.data(), atlas.pixels.size());
+    offset += atlas.pixels.size();
+  }
+  vkUnmapMemory(device_, staging_memory_);
+
+  VkCommandPoolCreateInfo pool_info = {};
+  pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  pool_info.queueFamilyIndex = queue_family;
+  pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+  if (vkCreateCommandPool(device_, &pool_info, nullptr, upload_pool_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create overlay command pool");
+  }
+
+  VkCommandBuffer cmd;
+  VkCommandBufferAllocateInfo alloc_info = {};
+  alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  alloc_info.commandPool = upload_pool_;
+  alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  alloc_info.commandBufferCount = 1;
+  if (vkAllocateCommandBuffers(device_, &alloc_info, &cmd) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to allocate overlay command buffer");
+  }
+
+  VkCommandBufferBeginInfo begin_info = {};
+  begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  vkBeginCommandBuffer(cmd, &begin_info);
+
+  images_.resize(atlases_.size(), VDeleter<VkImage>{device_, vkDestroyImage});
+  image_memory_.resize(atlases_.size(), VDeleter<VkDeviceMemory>{device_, vkFreeMemory});
+  views_.resize(atlases_.size(), VDeleter<VkImageView>{device_, vkDestroyImageView});
+  offset = 0;
+  for (uint32_t a = 0; a < atlases_.size(); a++) {
+    Atlas const& atlas = atlases_[a];
+    VkImageCreateInfo image_info = {};
+    image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_info.imageType = VK_IMAGE_TYPE_2D;
+    image_info.format = VK_FORMAT_R8G8B8A8_UNORM;
+    image_info.extent = {atlas.width, atlas.height, 1};
+    image_info.mipLevels = 1;
+    image_info.arrayLayers = 1;
+    image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_info.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    if (vkCreateImage(device_, &image_info, nullptr, images_[a].replace()) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create overlay atlas");
+    }
+    VkMemoryRequirements image_requirements;
+    vkGetImageMemoryRequirements(device_, images_[a], &image_requirements);
+    allocate(device_, physical_device, image_requirements, {VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0},
+             image_memory_[a]);
+    vkBindImageMemory(device_, images_[a], image_memory_[a], 0);
+
+    VkImageViewCreateInfo view_info = {};
+    view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    view_info.image = images_[a];
+    view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    view_info.format = image_info.format;
+    view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    view_info.subresourceRange.levelCount = 1;
+    view_info.subresourceRange.layerCount = 1;
+    if (vkCreateImageView(device_, &view_info, nullptr, views_[a].replace()) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create overlay atlas view");
+    }
+
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = images_[a];
+    barrier.subresourceRange = view_info.subresourceRange;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                         0, nullptr, 0, nullptr, 1, &barrier);
+
+    VkBufferImageCopy region = {};
+    region.bufferOffset = offset;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = image_info.extent;
+    vkCmdCopyBufferToImage(cmd, staging_buffer_, images_[a], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+    offset += atlas.pixels.size();
+
+    // the frames drawing the overlay are submitted after it on the queue, the barrier orders their reads
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+                         0, nullptr, 0, nullptr, 1, &barrier);
+  }
+  vkEndCommandBuffer(cmd);
+  if (queue == VK_NULL_HANDLE) {
+    upload_ = cmd;
+    return;
+  }
+
+  VkSubmitInfo submit_info = {};
+  submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit_info.commandBufferCount = 1;
+  submit_info.pCommandBuffers = &cmd;
+  if (vkQueueSubmit(queue, 1, &submit_info, VK_NULL_HANDLE) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to submit overlay atlas upload");
+  }
+  vkQueueWaitIdle(queue);
+  upload_pool_ = VK_NULL_HANDLE;
+  staging_buffer_ = VK_NULL_HANDLE;
+  staging_memory_ = VK_NULL_HANDLE;
+}
+
+/*
+ * Alpha blended, no depth test, the vertices come from the storage buffer
+ */
+void Overlay::createPipeline(VkRenderPass renderpass, uint32_t subpass, VkSampleCountFlagBits samples,
+                             std::vector<char> const& vertex_shader, std::vector<char> const& fragment_shader,
+                             VkPipelineCache pipeline_cache) {
+  VDeleter<VkShaderModule> modules[2] = {{device_, vkDestroyShaderModule}, {device_, vkDestroyShaderModule}};
+  std::vector<char> const* code[2] = {&vertex_shader, &fragment_shader};
+  VkPipelineShaderStageCreateInfo stages[2] = {};
+  for (int i = 0; i < 2; i++) {
+    VkShaderModuleCreateInfo module_info = {};
+    module_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    module_info.codeSize = code[i]->size();
+    module_info.pCode = reinterpret_cast<const uint32_t*>(code[i]->data());
+    if (vkCreateShaderModule(device_, &module_info, nullptr, modules[i].replace()) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create overlay shader module");
+    }
+    stages[i].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stages[i].stage = i == 0 ? VK_SHADER_STAGE_VERTEX_BIT : VK_SHADER_STAGE_FRAGMENT_BIT;
+    stages[i].module = modules[i];
+    stages[i].pName = "main";
+  }
+
+  // pixels to normalized device coordinates
+  VkPushConstantRange push_constant_range = {};
+  push_constant_range.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  push_constant_range.size = 2 * sizeof(float);
+
+  VkPipelineLayoutCreateInfo layout_info = {};
+  layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  layout_info.setLayoutCount = 1;
+  layout_info.pSetLayouts = &set_layout_;
+  layout_info.pushConstantRangeCount = 1;
+  layout_info.pPushConstantRanges = &push_constant_range;
+  if (vkCreatePipelineLayout(device_, &layout_info, nullptr, pipeline_layout_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create overlay pipeline layout");
+  }
+
+  VkPipelineVertexInputStateCreateInfo vertex_input = {};
+  vertex_input.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+  VkPipelineInputAssemblyStateCreateInfo input_assembly = {};
+  input_assembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+  input_assembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+  VkViewport viewport = {};
+  viewport.width = float(extent_.width);
+  viewport.height = float(extent_.height);
+  viewport.maxDepth = 1.0f;
+  VkRect2D scissor = {};
+  scissor.extent = extent_;
+  VkPipelineViewportStateCreateInfo viewport_state = {};
+  viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+  viewport_state.viewportCount = 1;
+  viewport_state.pViewports = &viewport;
+  viewport_state.scissorCount = 1;
+  viewport_state.pScissors = &scissor;
+
+  VkPipelineRasterizationStateCreateInfo rasterizer = {};
+  rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+  rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+  rasterizer.cullMode = VK_CULL_MODE_NONE;
+  rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+  rasterizer.lineWidth = 1.0f;
+
+  VkPipelineMultisampleStateCreateInfo multisampling = {};
+  multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+  multisampling.rasterizationSamples = samples;
+  multisampling.minSampleShading = 1.0f;
+
+  // drawn over everything
+  VkPipelineDepthStencilStateCreateInfo depth_stencil = {};
+  depth_stencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+  depth_stencil.depthTestEnable = VK_FALSE;
+  depth_stencil.depthWriteEnable = VK_FALSE;
+  depth_stencil.depthCompareOp = VK_COMPARE_OP_ALWAYS;
+
+  VkPipelineColorBlendAttachmentState blend_attachment = {};
+  blend_attachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                                    VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+  blend_attachment.blendEnable = VK_TRUE;
+  blend_attachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+  blend_attachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+  blend_attachment.colorBlendOp = VK_BLEND_OP_ADD;
+  blend_attachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+  blend_attachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+  blend_attachment.alphaBlendOp = VK_BLEND_OP_ADD;
+  VkPipelineColorBlendStateCreateInfo color_blend = {};
+  color_blend.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+  color_blend.attachmentCount = 1;
+  color_blend.pAttachments = &blend_attachment;
+
+  VkGraphicsPipelineCreateInfo pipeline_info = {};
+  pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+  pipeline_info.stageCount = 2;
+  pipeline_info.pStages = stages;
+  pipeline_info.pVertexInputState = &vertex_input;
+  pipeline_info.pInputAssemblyState = &input_assembly;
+  pipeline_info.pViewportState = &viewport_state;
+  pipeline_info.pRasterizationState = &rasterizer;
+  pipeline_info.pMultisampleState = &multisampling;
+  pipeline_info.pDepthStencilState = &depth_stencil;
+  pipeline_info.pColorBlendState = &color_blend;
+  pipeline_info.layout = pipeline_layout_;
+  pipeline_info.renderPass = renderpass;
+  pipeline_info.subpass = subpass;
+  pipeline_info.basePipelineIndex = -1;
+  if (vkCreateGraphicsPipelines(device_, pipeline_cache, 1, &pipeline_info, nullptr,
+                                pipeline_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create overlay pipeline");
+  }
+}
+
+void Overlay::clear() {
+  for (auto& batch : batches_) {
+    batch.clear();
+  }
+  vertex_count_ = 0;
+  dropped_ = 0;
+  generation_++;
+}
+
+bool Overlay::reserve(uint32_t vertices) {
+  // without init there is no limit yet
+  if (max_vertices_ > 0 && vertex_count_ + vertices > max_vertices_) {
+    dropped_++;
+    return false;
+  }
+  vertex_count_ += vertices;
+  generation_++;
+  return true;
+}
+
+// two triangles, the corners clockwise from the top left
+void Overlay::quad(uint32_t atlas, float const (&corners)[4][2], float u0, float v0, float u1, float v1,
+                   uint32_t color) {
+  if (atlas >= batches_.size()) {
+    throw std::runtime_error("Overlay has no atlas " + std::to_string(atlas));
+  }
+  if (!reserve(6)) {
+    return;
+  }
+  const float uvs[4][2] = {{u0, v0}, {u1, v0}, {u1, v1}, {u0, v1}};
+  const int order[6] = {0, 1, 2, 0, 2, 3};
+  std::vector<OverlayVertex>& batch = batches_[atlas];
+  for (int i : order) {
+    OverlayVertex vertex = {{corners[i][0], corners[i][1]}, {uvs[i][0], uvs[i][1]}, color, 0};
+    batch.push_back(vertex);
+  }
+}
+
+void Overlay::rect(float x, float y, float width, float height, uint32_t color) {
+  const float corners[4][2] = {{x, y}, {x + width, y}, {x + width, y + height}, {x, y + height}};
+  quad(font_atlas, corners, white_uv_[0], white_uv_[1], white_uv_[0], white_uv_[1], color);
+}
+
+// a quad along the line, width pixels wide
+void Overlay::line(float x0, float y0, float x1, float y1, float width, uint32_t color) {
+  float dx = x1 - x0;
+  float dy = y1 - y0;
+  float length = std::sqrt(dx * dx + dy * dy);
+  if (length == 0.0f) {
+    return;
+  }
+  float nx = -dy / length * width * 0.5f;
+  float ny = dx / length * width * 0.5f;
+  const float corners[4][2] = {{x0 + nx, y0 + ny}, {x1 + nx, y1 + ny}, {x1 - nx, y1 - ny}, {x0 - nx, y0 - ny}};
+  quad(font_atlas, corners, white_uv_[0], white_uv_[1], white_uv_[0], white_uv_[1], color);
+}
+
+void Overlay::sprite(uint32_t atlas, float x, float y, float width, float height,
+                     float u0, float v0, float u1, float v1, uint32_t color) {
+  const float corners[4][2] = {{x, y}, {x + width, y}, {x + width, y + height}, {x, y + height}};
+  quad(atlas, corners, u0, v0, u1, v1, color);
+}
+
+float Overlay::text(float x, float y, std::string const& text, uint32_t color, float scale) {
+  float start = x;
+  for (char c : text) {
+    uint32_t index = uint8_t(c) - first_char;
+    // spaces take room but no vertices, unknown characters show as '?'
+    if (c != ' ') {
+      index = index < char_count ? index : '?' - first_char;
+      float u = float((index % glyphs_per_row) * cell_width + 1) / font_atlas_width;
+      float v = float((index / glyphs_per_row) * cell_height + 1) / font_atlas_height;
+      sprite(font_atlas, x, y, 5 * scale, glyph_height * scale,
+             u, v, u + 5.0f / font_atlas_width, v + float(glyph_height) / font_atlas_height, color);
+    }
+    x += glyph_width * scale;
+  }
+  return x - start;
+}
+
+void Overlay::update(uint32_t image) {
+  if (!initialized() || image_generations_[image] == generation_) {
+    return;
+  }
+  image_generations_[image] = generation_;
+
+  char* mapped = static_cast<char*>(mapped_[image]);
+  ScratchScope scratch;
+  ArenaVector<VkDrawIndirectCommand> draws(atlases_.size(), VkDrawIndirectCommand(), scratch.arena());
+  uint32_t first_vertex = 0;
+  for (uint32_t a = 0; a < atlases_.size(); a++) {
+    std::vector<OverlayVertex> const& batch = batches_[a];
+    memcpy(mapped + sizeof(OverlayVertex) * first_vertex, batch.data(), sizeof(OverlayVertex) * batch.size());
+    draws[a].vertexCount = batch.size();
+    draws[a].instanceCount = 1;
+    draws[a].firstVertex = first_vertex;
+    draws[a].firstInstance = 0;
+    first_vertex += batch.size();
+  }
+  memcpy(mapped + args_offset_, draws.data(), sizeof(VkDrawIndirectCommand) * draws.size());
+}
+
+void Overlay::record(VkCommandBuffer cmd, uint32_t image) const {
+  if (!initialized()) {
+    return;
+  }
+  const float scale[2] = {2.0f / extent_.width, 2.0f / extent_.height};
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_);
+  vkCmdPushConstants(cmd, pipeline_layout_, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(scale), scale);
+  for (uint32_t a = 0; a < atlases_.size(); a++) {
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout_, 0, 1,
+                            &sets_[image * atlases_.size() + a], 0, nullptr);
+    vkCmdDrawIndirect(cmd, buffers_[image], args_offset_ + sizeof(VkDrawIndirectCommand) * a, 1,
+                      sizeof(VkDrawIndirectCommand));
+  }
+}
+
+}
@@ -0,0 +1,153 @@
+#ifndef VULKAN_ENGINE_OVERLAY_H
+#define VULKAN_ENGINE_OVERLAY_H
+
+#include "VDeleter.h"
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace engine {
+
+// Read by overlay.vert from a storage buffer, keep the layouts in sync
+struct OverlayVertex {
+  // pixels from the top left corner
+  float position[2];
+  float uv[2];
+  // RGBA, red in the lowest byte
+  uint32_t color;
+  uint32_t padding;
+};
+
+/*
+ * Batched 2D rendering on top of the frame: rectangles, lines, sprites and text
+ *
+ * The elements are collected on the CPU, grouped by their atlas. update()
+ * copies them into the persistently mapped buffer of a swapchain image, together
+ * with one indirect draw per atlas, so the command buffers are recorded once
+ * and the overlay only costs a copy in the frames after it changed.
+ *
+ * Atlas 0 is the font, built at construction from a 5x8 pixel font, with a
+ * white texel which the untextured elements use. Not part of frame captures.
+ */
+class Overlay {
+  public:
+    static const uint32_t font_atlas = 0;
+    // pixels per character, before scaling
+    static const uint32_t glyph_width = 6;
+    static const uint32_t glyph_height = 8;
+
+    explicit Overlay(VDeleter<VkDevice> const& device);
+
+    // RGBA8 pixels, only before init, returns the atlas index
+    uint32_t addAtlas(uint32_t width, uint32_t height, std::vector<uint8_t> const& pixels);
+
+    /*
+     * Upload the atlases (on the queue, waiting for it) and create the pipeline
+     * for the subpass, shaders are the SPIR-V of overlay.vert and overlay.frag.
+     * Without a queue the upload is only recorded, see upload()
+     */
+    void init(VkPhysicalDevice physical_device, VkQueue queue, uint32_t queue_family, VkRenderPass renderpass,
+              uint32_t subpass, VkSampleCountFlagBits samples, VkExtent2D extent, uint32_t images,
+              std::vector<char> const& vertex_shader, std::vector<char> const& fragment_shader,
+              VkPipelineCache pipeline_cache, uint32_t max_vertices);
+
+    bool initialized() const { return !buffers_.empty(); }
+
+    // the upload init recorded without a queue, for a queue of queue_family before the first frame drawing
+    // the overlay. VK_NULL_HANDLE if init submitted it
+    VkCommandBuffer upload() const { return upload_; }
+
+    void clear();
+
+    void rect(float x, float y, float width, float height, uint32_t color);
+
+    void line(float x0, float y0, float x1, float y1, float width, uint32_t color);
+
+    // uv in [0, 1] of the atlas
+    void sprite(uint32_t atlas, float x, float y, float width, float height,
+                float u0, float v0, float u1, float v1, uint32_t color);
+
+    // ASCII, with the top left corner of the first character at x, y; returns the width
+    float text(float x, float y, std::string const& text, uint32_t color, float scale = 1.0f);
+
+    // copy the elements to the image if they changed since. The last frame of the image has to be done
+    // (its fence waited for), the buffer is written while nothing may draw from it
+    void update(uint32_t image);
+
+    // one indirect draw per atlas, inside the subpass given to init
+    void record(VkCommandBuffer cmd, uint32_t image) const;
+
+    uint32_t drawCount() const { return atlases_.size(); }
+
+    // elements which didn't fit into max_vertices since the last clear
+    uint32_t dropped() const { return dropped_; }
+
+    static uint32_t rgba(uint8_t r, uint8_t g, uint8_t b, uint8_t a = 255) {
+      return uint32_t(r) | uint32_t(g) << 8 | uint32_t(b) << 16 | uint32_t(a) << 24;
+    }
+
+  private:
+    struct Atlas {
+      uint32_t width;
+      uint32_t height;
+      std::vector<uint8_t> pixels;
+    };
+
+    VDeleter<VkDevice> const& device_;
+    VkExtent2D extent_ = {0, 0};
+    uint32_t max_vertices_ = 0;
+
+    std::vector<Atlas> atlases_;
+    // uv of the white texel of the font atlas
+    float white_uv_[2] = {0.0f, 0.0f};
+    // the vertices of each atlas
+    std::vector<std::vector<OverlayVertex>> batches_;
+    uint32_t vertex_count_ = 0;
+    uint32_t dropped_ = 0;
+    uint64_t generation_ = 1;
+
+    std::vector<VDeleter<VkImage>> images_;
+    std::vector<VDeleter<VkDeviceMemory>> image_memory_;
+    std::vector<VDeleter<VkImageView>> views_;
+    VDeleter<VkSampler> sampler_{device_, vkDestroySampler};
+    // kept until the upload is done, with the overlay if the caller submits it
+    VDeleter<VkBuffer> staging_buffer_{device_, vkDestroyBuffer};
+    VDeleter<VkDeviceMemory> staging_memory_{device_, vkFreeMemory};
+    VDeleter<VkCommandPool> upload_pool_{device_, vkDestroyCommandPool};
+    VkCommandBuffer upload_ = VK_NULL_HANDLE;
+
+    // per swapchain image: the vertices followed by the draws
+    std::vector<VDeleter<VkBuffer>> buffers_;
+    std::vector<VDeleter<VkDeviceMemory>> memory_;
+    std::vector<void*> mapped_;
+    std::vector<uint64_t> image_generations_;
+    VkDeviceSize args_offset_ = 0;
+
+    VDeleter<VkDescriptorSetLayout> set_layout_{device_, vkDestroyDescriptorSetLayout};
+    VDeleter<VkDescriptorPool> descriptor_pool_{device_, vkDestroyDescriptorPool};
+    // per swapchain image and atlas
+    std::vector<VkDescriptorSet> sets_;
+    VDeleter<VkPipelineLayout> pipeline_layout_{device_, vkDestroyPipelineLayout};
+    VDeleter<VkPipeline> pipeline_{device_, vkDestroyPipeline};
+
+    void createFontAtlas();
+
+    void uploadAtlases(VkPhysicalDevice physical_device, VkQueue queue, uint32_t queue_family);
+
+    void createPipeline(VkRenderPass renderpass, uint32_t subpass, VkSampleCountFlagBits samples,
+                        std::vector<char> const& vertex_shader, std::vector<char> const& fragment_shader,
+                        VkPipelineCache pipeline_cache);
+
+    // false if max_vertices is reached
+    bool reserve(uint32_t vertices);
+
+    void quad(uint32_t atlas, float const (&corners)[4][2], float u0, float v0, float u1, float v1,
+              uint32_t color);
+};
+
+}
+
+#endif //VULKAN_ENGINE_OVERLAY_H
@@ -0,0 +1,424 @@
+#include "Readback.h"
+#include "../Log.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+namespace engine {
+
+namespace {
+
+bool isBgra(VkFormat format) {
+  return format == VK_FORMAT_B8G8R8A8_UNORM || format == VK_FORMAT_B8G8R8A8_SRGB;
+}
+
+bool isRgba(VkFormat format) {
+  return format == VK_FORMAT_R8G8B8A8_UNORM || format == VK_FORMAT_R8G8B8A8_SRGB;
+}
+
+// tightly packed 8-bit RGB rows, what PPM and PNG want
+std::vector<uint8_t> toRgb(const uint8_t* pixels, VkExtent2D extent, VkFormat format) {
+  size_t count = size_t(extent.width) * extent.height;
+  std::vector<uint8_t> rgb(3 * count);
+  bool bgra = isBgra(format);
+  for (size_t i = 0; i < count; i++) {
+    rgb[3 * i + 0] = pixels[4 * i + (bgra ? 2 : 0)];
+    rgb[3 * i + 1] = pixels[4 * i + 1];
+    rgb[3 * i + 2] = pixels[4 * i + (bgra ? 0 : 2)];
+  }
+  return rgb;
+}
+
+void writePpm(std::ofstream& file, const uint8_t* pixels, VkExtent2D extent, VkFormat format) {
+  file << "P6\n" << extent.width << " " << extent.height << "\n255\n";
+  std::vector<uint8_t> rgb = toRgb(pixels, extent, format);
+  file.write(reinterpret_cast<const char*>(rgb.data()), rgb.size());
+}
+
+uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0) {
+  static uint32_t table[256];
+  static bool table_ready = [] {
+    for (uint32_t n = 0; n < 256; n++) {
+      uint32_t c = n;
+      for (int k = 0; k < 8; k++) {
+        c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      }
+      table[n] = c;
+    }
+    return true;
+  }();
+  (void) table_ready;
+
+  crc = ~crc;
+  for (size_t i = 0; i < size; i++) {
+    crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+void putBigEndian(std::vector<uint8_t>& out, uint32_t value) {
+  out.push_back(value >> 24);
+  out.push_back(value >> 16);
+  out.push_back(value >> 8);
+  out.push_back(value);
+}
+
+void writePngChunk(std::ofstream& file, const char type[4], std::vector<uint8_t> const& data) {
+  std::vector<uint8_t> chunk;
+  putBigEndian(chunk, data.size());
+  chunk.insert(chunk.end(), type, type + 4);
+  chunk.insert(chunk.end(), data.begin(), data.end());
+  putBigEndian(chunk, crc32(&chunk[4], chunk.size() - 4));
+  file.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+}
+
+/*
+ * PNG with stored (uncompressed) deflate blocks: as big as the raw image,
+ * but it needs no zlib and is written about as fast as the PPM
+ */
+void writePng(std::ofstream& file, const uint8_t* pixels, VkExtent2D extent, VkFormat format) {
+  static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+  file.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+
+  std::vector<uint8_t> header;
+  putBigEndian(header, extent.width);
+  putBigEndian(header, extent.height);
+  header.push_back(8); // bits per channel
+  header.push_back(2); // RGB
+  header.push_back(0); // deflate
+  header.push_back(0); // adaptive filtering
+  header.push_back(0); // no interlacing
+  writePngChunk(file, "IHDR", header);
+
+  // every row starts with its filter type, 0 is none
+  std::vector<uint8_t> rgb = toRgb(pixels, extent, format);
+  size_t row_size = 3 * size_t(extent.width);
+  std::vector<uint8_t> raw;
+  raw.reserve((row_size + 1) * extent.height);
+  for (uint32_t y = 0; y < extent.height; y++) {
+    raw.push_back(0);
+    raw.insert(raw.end(), rgb.begin() + y * row_size, rgb.begin() + (y + 1) * row_size);
+  }
+
+  std::vector<uint8_t> zlib = {0x78, 0x01};
+  const size_t max_block = 65535;
+  for (size_t pos = 0; pos < raw.size() || pos == 0; pos += max_block) {
+    size_t size = std::min(max_block, raw.size() - pos);
+    zlib.push_back(pos + size == raw.size() ? 1 : 0);
+    zlib.push_back(size & 0xff);
+    zlib.push_back(size >> 8);
+    zlib.push_back(~size & 0xff);
+    zlib.push_back((~size >> 8) & 0xff);
+    zlib.insert(zlib.end(), raw.begin() + pos, raw.begin() + pos + size);
+  }
+
+  uint32_t a = 1, b = 0;
+  for (uint8_t value : raw) {
+    a = (a + value) % 65521;
+    b = (b + a) % 65521;
+  }
+  putBigEndian(zlib, (b << 16) | a);
+  writePngChunk(file, "IDAT", zlib);
+  writePngChunk(file, "IEND", std::vector<uint8_t>());
+}
+
+const char* extension(ImageFileFormat format) {
+  switch (format) {
+    case ImageFileFormat::Ppm:
+      return "ppm";
+    case ImageFileFormat::Png:
+      return "png";
+    default:
+      return "raw";
+  }
+}
+
+}
+
+Readback::Readback(VDeleter<VkDevice> const& device)
+        : device_(device) {
+}
+
+Readback::~Readback() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+    jobs_.clear();
+    cv_.notify_all();
+  }
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+void Readback::init(VkPhysicalDevice physical_device, uint32_t queue_family, VkExtent2D extent, VkFormat format,
+                    uint32_t slots, ImageFileFormat file_format, std::string const& prefix,
+                    uint32_t worker_threads) {
+  if (!isBgra(format) && !isRgba(format)) {
+    throw std::runtime_error("Readback only supports 8-bit RGBA and BGRA images");
+  }
+  extent_ = extent;
+  format_ = format;
+  file_format_ = file_format;
+  prefix_ = prefix;
+  slot_size_ = VkDeviceSize(4) * extent.width * extent.height;
+
+  VkCommandPoolCreateInfo pool_info = {};
+  pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  pool_info.queueFamilyIndex = queue_family;
+  // every slot is re-recorded for each request
+  pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+  if (vkCreateCommandPool(device_, &pool_info, nullptr, command_pool_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create readback command pool");
+  }
+
+  std::vector<VkCommandBuffer> command_buffers(slots);
+  VkCommandBufferAllocateInfo alloc_info = {};
+  alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  alloc_info.commandPool = command_pool_;
+  alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  alloc_info.commandBufferCount = slots;
+  if (vkAllocateCommandBuffers(device_, &alloc_info, command_buffers.data()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to allocate readback command buffers");
+  }
+
+  VkPhysicalDeviceMemoryProperties memory_properties;
+  vkGetPhysicalDeviceMemoryProperties(physical_device, &memory_properties);
+
+  buffers_.resize(slots, VDeleter<VkBuffer>{device_, vkDestroyBuffer});
+  memory_.resize(slots, VDeleter<VkDeviceMemory>{device_, vkFreeMemory});
+  fences_.resize(slots, VDeleter<VkFence>{device_, vkDestroyFence});
+  slots_.resize(slots);
+  jobs_.reserve(slots);
+  states_ = std::vector<std::atomic<uint32_t>>(slots);
+
+  for (uint32_t i = 0; i < slots; i++) {
+    VkBufferCreateInfo buffer_info = {};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.size = slot_size_;
+    buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if (vkCreateBuffer(device_, &buffer_info, nullptr, buffers_[i].replace()) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create readback buffer");
+    }
+
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(device_, buffers_[i], &requirements);
+
+    // the CPU reads every byte, uncached memory would make that crawl
+    const VkMemoryPropertyFlags preferred[] = {
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+    };
+    uint32_t type_index = memory_properties.memoryTypeCount;
+    for (VkMemoryPropertyFlags properties : preferred) {
+      for (uint32_t t = 0; t < memory_properties.memoryTypeCount && type_index == memory_properties.memoryTypeCount; t++) {
+        if ((requirements.memoryTypeBits & (1 << t)) &&
+            (memory_properties.memoryTypes[t].propertyFlags & properties) == properties) {
+          type_index = t;
+        }
+      }
+    }
+    if (type_index == memory_properties.memoryTypeCount) {
+      throw std::runtime_error("No host visible memory for the readback");
+    }
+    coherent_ = (memory_properties.memoryTypes[type_index].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+
+    VkMemoryAllocateInfo memory_info = {};
+    memory_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memory_info.allocationSize = requirements.size;
+    memory_info.memoryTypeIndex = type_index;
+    if (vkAllocateMemory(device_, &memory_info, nullptr, memory_[i].replace()) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to allocate readback memory");
+    }
+    vkBindBufferMemory(device_, buffers_[i], memory_[i], 0);
+    // mapped for the lifetime of the slot
+    vkMapMemory(device_, memory_[i], 0, VK_WHOLE_SIZE, 0, &slots_[i].mapped);
+
+    VkFenceCreateInfo fence_info = {};
+    fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    if (vkCreateFence(device_, &fence_info, nullptr, fences_[i].replace()) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create readback fence");
+    }
+
+    slots_[i].command_buffer = command_buffers[i];
+    states_[i].store(Free, std::memory_order_relaxed);
+  }
+
+  for (uint32_t i = 0; i < std::max(worker_threads, 1u); i++) {
+    workers_.push_back(std::thread(&Readback::work, this));
+  }
+  LOG_INFO("Readback of " << extent.width << "x" << extent.height << " frames to " << prefix << "-*."
+                          << extension(file_format) << " with " << slots << " slots ("
+                          << (coherent_ ? "coherent" : "host-cached") << " memory) and "
+                          << workers_.size() << " encoding threads.");
+}
+
+VkCommandBuffer Readback::request(VkImage image, VkImageLayout layout, uint64_t frame, VkFence& fence) {
+  // the oldest slot is the first to get free again
+  uint32_t slot = next_slot_;
+  if (states_[slot].load(std::memory_order_acquire) != Free) {
+    skipped_++;
+    return VK_NULL_HANDLE;
+  }
+  next_slot_ = (next_slot_ + 1) % slots_.size();
+
+  VkCommandBuffer cmd = slots_[slot].command_buffer;
+  slots_[slot].frame = frame;
+  vkResetFences(device_, 1, &fences_[slot]);
+  vkResetCommandBuffer(cmd, 0);
+
+  VkCommandBufferBeginInfo begin_info = {};
+  begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  vkBeginCommandBuffer(cmd, &begin_info);
+
+  // the submit waits for the rendering (semaphore or queue order), so everything before is visible
+  VkImageMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  barrier.oldLayout = layout;
+  barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image;
+  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  barrier.subresourceRange.levelCount = 1;
+  barrier.subresourceRange.layerCount = 1;
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                       0, nullptr, 0, nullptr, 1, &barrier);
+
+  VkBufferImageCopy region = {};
+  region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  region.imageSubresource.layerCount = 1;
+  region.imageExtent = {extent_.width, extent_.height, 1};
+  vkCmdCopyImageToBuffer(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffers_[slot], 1, &region);
+
+  // back to where it was, e.g. ready for presentation
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  barrier.dstAccessMask = 0;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  barrier.newLayout = layout;
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+                       0, nullptr, 0, nullptr, 1, &barrier);
+
+  VkBufferMemoryBarrier host_barrier = {};
+  host_barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  host_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  host_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  host_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  host_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  host_barrier.buffer = buffers_[slot];
+  host_barrier.size = VK_WHOLE_SIZE;
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+                       0, nullptr, 1, &host_barrier, 0, nullptr);
+
+  if (vkEndCommandBuffer(cmd) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to record readback command buffer");
+  }
+
+  states_[slot].store(Copying, std::memory_order_release);
+  fence = fences_[slot];
+  return cmd;
+}
+
+void Readback::poll() {
+  for (uint32_t i = 0; i < slots_.size(); i++) {
+    if (states_[i].load(std::memory_order_acquire) != Copying ||
+        vkGetFenceStatus(device_, fences_[i]) != VK_SUCCESS) {
+      continue;
+    }
+    states_[i].store(Encoding, std::memory_order_release);
+    std::lock_guard<std::mutex> lock(mutex_);
+    jobs_.push_back(i);
+    cv_.notify_one();
+  }
+}
+
+void Readback::finish() {
+  if (!initialized()) {
+    return;
+  }
+  poll();
+  for (auto& state : states_) {
+    uint32_t copying = Copying;
+    // never submitted, nothing to write
+    state.compare_exchange_strong(copying, Free);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+    cv_.notify_all();
+  }
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+  workers_.clear();
+}
+
+void Readback::work() {
+  for (;;) {
+    uint32_t slot;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+      // the queue is drained before stopping, unless the destructor cleared it
+      if (jobs_.empty()) {
+        return;
+      }
+      slot = jobs_.front();
+      jobs_.erase(jobs_.begin());
+    }
+
+    try {
+      encode(slot);
+      written_++;
+    } catch (std::exception const& e) {
+      LOG_ERROR("Readback of frame " << slots_[slot].frame << " failed: " << e.what());
+    }
+    states_[slot].store(Free, std::memory_order_release);
+  }
+}
+
+void Readback::encode(uint32_t slot) {
+  if (!coherent_) {
+    VkMappedMemoryRange range = {};
+    range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    range.memory = memory_[slot];
+    range.size = VK_WHOLE_SIZE;
+    vkInvalidateMappedMemoryRanges(device_, 1, &range);
+  }
+
+  std::ostringstream path;
+  path << prefix_ << "-" << std::setw(6) << std::setfill('0') << slots_[slot].frame << "."
+       << extension(file_format_);
+  std::ofstream file(path.str(), std::ios::binary);
+  if (!file.is_open()) {
+    throw std::runtime_error("failed to open " + path.str());
+  }
+
+  const uint8_t* pixels = static_cast<const uint8_t*>(slots_[slot].mapped);
+  switch (file_format_) {
+    case ImageFileFormat::Ppm:
+      writePpm(file, pixels, extent_, format_);
+      break;
+    case ImageFileFormat::Png:
+      writePng(file, pixels, extent_, format_);
+      break;
+    case ImageFileFormat::Raw:
+      // the bytes of the image as they are, in its format
+      file.write(reinterpret_cast<const char*>(pixels), slot_size_);
+      break;
+  }
+  if (!file.good()) {
+    throw std::runtime_error("failed to write " + path.str());
+  }
+}
+
+}
@@ -0,0 +1,110 @@
+#ifndef VULKAN_ENGINE_READBACK_H
+#define VULKAN_ENGINE_READBACK_H
+
+#include "VDeleter.h"
+#include "Settings.h"
+
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace engine {
+
+/*
+ * Copies rendered images to the host and writes them to files, without ever waiting
+ *
+ * Every request takes a slot of a ring of persistently mapped (host-cached if
+ * possible) buffers and returns a command buffer which copies the image into
+ * it. The caller submits it with the slot's fence, poll() hands slots whose
+ * fence is signaled to worker threads, which encode them and free the slot.
+ * If no slot is free the request fails and the frame is skipped.
+ *
+ * Only the thread calling request/poll/finish may use these, the workers
+ * only touch slots handed to them.
+ */
+class Readback {
+  public:
+    explicit Readback(VDeleter<VkDevice> const& device);
+
+    ~Readback();
+
+    // images of 8-bit RGBA or BGRA formats, copied on the queue family given here
+    void init(VkPhysicalDevice physical_device, uint32_t queue_family, VkExtent2D extent, VkFormat format,
+              uint32_t slots, ImageFileFormat file_format, std::string const& prefix, uint32_t worker_threads);
+
+    bool initialized() const { return !slots_.empty(); }
+
+    /*
+     * A command buffer copying the image (in layout, and left in it) into a free slot,
+     * it has to be submitted with the fence. VK_NULL_HANDLE if all slots are busy.
+     */
+    VkCommandBuffer request(VkImage image, VkImageLayout layout, uint64_t frame, VkFence& fence);
+
+    // hand the finished copies to the workers
+    void poll();
+
+    /*
+     * Write everything that was copied and stop the workers
+     * The device has to be idle, copies which were never submitted are dropped
+     */
+    void finish();
+
+    uint64_t written() const { return written_; }
+
+    // frames which were skipped because all slots were busy
+    uint64_t skipped() const { return skipped_; }
+
+  private:
+    enum SlotState : uint32_t {
+      Free,
+      // owned by the GPU until its fence is signaled
+      Copying,
+      // owned by a worker
+      Encoding,
+    };
+
+    struct Slot {
+      VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+      void* mapped = nullptr;
+      uint64_t frame = 0;
+    };
+
+    VDeleter<VkDevice> const& device_;
+    VkExtent2D extent_ = {0, 0};
+    VkFormat format_ = VK_FORMAT_UNDEFINED;
+    ImageFileFormat file_format_ = ImageFileFormat::Ppm;
+    std::string prefix_;
+    VkDeviceSize slot_size_ = 0;
+    bool coherent_ = true;
+
+    VDeleter<VkCommandPool> command_pool_{device_, vkDestroyCommandPool};
+    std::vector<VDeleter<VkBuffer>> buffers_;
+    std::vector<VDeleter<VkDeviceMemory>> memory_;
+    std::vector<VDeleter<VkFence>> fences_;
+    std::vector<Slot> slots_;
+    std::vector<std::atomic<uint32_t>> states_;
+    uint32_t next_slot_ = 0;
+
+    std::atomic<uint64_t> written_{0};
+    uint64_t skipped_ = 0;
+
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    // reserved for all slots, poll() runs in the frames and doesn't allocate
+    std::vector<uint32_t> jobs_;
+    bool stopping_ = false;
+
+    void work();
+
+    void encode(uint32_t slot);
+};
+
+}
+
+#endif //VULKAN_ENGINE_READBACK_H
@@ -0,0 +1,771 @@
+#include "RenderGraph.h"
+#include "FrameArena.h"
+#include "../Log.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace engine {
+
+namespace {
+
+// what a resource usage means for the synchronization
+struct UsageInfo {
+  VkPipelineStageFlags stages;
+  VkAccessFlags read_access;
+  VkAccessFlags write_access;
+  VkImageLayout layout;
+  VkImageUsageFlags image_usage;
+  bool attachment;
+};
+
+UsageInfo usageInfo(ResourceUsage usage) {
+  switch (usage) {
+    case ResourceUsage::ColorAttachment:
+      return {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+              VK_ACCESS_COLOR_ATTACHMENT_READ_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+              VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, true};
+    case ResourceUsage::DepthAttachment:
+      return {VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+              VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+              VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, true};
+    case ResourceUsage::InputAttachment:
+      return {VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+              VK_ACCESS_INPUT_ATTACHMENT_READ_BIT, 0,
+              VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT, true};
+    case ResourceUsage::SampledFragment:
+      return {VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+              VK_ACCESS_SHADER_READ_BIT, 0,
+              VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT, false};
+    case ResourceUsage::SampledCompute:
+      return {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+              VK_ACCESS_SHADER_READ_BIT, 0,
+              VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT, false};
+    case ResourceUsage::StorageCompute:
+      return {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+              VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+              VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT, false};
+    case ResourceUsage::StorageGraphics:
+      return {VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+              VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+              VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT, false};
+    case ResourceUsage::IndirectArgs:
+      return {VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+              VK_ACCESS_INDIRECT_COMMAND_READ_BIT, 0,
+              VK_IMAGE_LAYOUT_UNDEFINED, 0, false};
+    case ResourceUsage::VertexInput:
+      return {VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+              VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT, 0,
+              VK_IMAGE_LAYOUT_UNDEFINED, 0, false};
+    case ResourceUsage::TransferSrc:
+      return {VK_PIPELINE_STAGE_TRANSFER_BIT,
+              VK_ACCESS_TRANSFER_READ_BIT, 0,
+              VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT, false};
+    case ResourceUsage::TransferDst:
+      return {VK_PIPELINE_STAGE_TRANSFER_BIT,
+              0, VK_ACCESS_TRANSFER_WRITE_BIT,
+              VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT, false};
+  }
+  throw std::runtime_error("unknown resource usage");
+}
+
+VkImageAspectFlags aspectFor(VkFormat format) {
+  switch (format) {
+    case VK_FORMAT_D16_UNORM:
+    case VK_FORMAT_X8_D24_UNORM_PACK32:
+    case VK_FORMAT_D32_SFLOAT:
+      return VK_IMAGE_ASPECT_DEPTH_BIT;
+    case VK_FORMAT_D24_UNORM_S8_UINT:
+    case VK_FORMAT_D32_SFLOAT_S8_UINT:
+      return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+    default:
+      return VK_IMAGE_ASPECT_COLOR_BIT;
+  }
+}
+
+bool overlaps(uint32_t first_a, uint32_t last_a, uint32_t first_b, uint32_t last_b) {
+  return first_a <= last_b && first_b <= last_a;
+}
+
+}
+
+void RenderGraph::PassBuilder::read(Resource resource, ResourceUsage usage) {
+  graph_.addAccess(pass_, resource, usage, true, false);
+}
+
+void RenderGraph::PassBuilder::write(Resource resource, ResourceUsage usage) {
+  graph_.addAccess(pass_, resource, usage, false, true);
+}
+
+void RenderGraph::PassBuilder::sideEffect() {
+  graph_.passes_[pass_].side_effect = true;
+}
+
+RenderGraph::RenderGraph(const VDeleter<VkDevice>& device)
+        : device_(device) {
+
+}
+
+RenderGraph::Resource RenderGraph::createImage(const std::string& name, ImageDesc const& desc) {
+  ResourceNode node;
+  node.name = name;
+  node.desc = desc;
+  node.usage = desc.usage;
+  resources_.push_back(node);
+  return resources_.size() - 1;
+}
+
+RenderGraph::Resource RenderGraph::importImage(const std::string& name, ImageDesc const& desc,
+                                               std::vector<VkImage> const& images,
+                                               VkImageLayout initial_layout, VkImageLayout final_layout,
+                                               VkPipelineStageFlags wait_stage) {
+  ResourceNode node;
+  node.name = name;
+  node.desc = desc;
+  node.imported = true;
+  node.images = images;
+  node.initial_layout = initial_layout;
+  node.final_layout = final_layout;
+  node.wait_stage = wait_stage;
+  resources_.push_back(node);
+  return resources_.size() - 1;
+}
+
+RenderGraph::Resource RenderGraph::importBuffer(const std::string& name, std::vector<VkBuffer> const& buffers) {
+  ResourceNode node;
+  node.name = name;
+  node.is_buffer = true;
+  node.imported = true;
+  node.buffers = buffers;
+  resources_.push_back(node);
+  return resources_.size() - 1;
+}
+
+RenderGraph::Pass RenderGraph::addPass(const std::string& name, std::function<void(PassBuilder&)> setup,
+                                       ExecuteFn execute, QueueType queue) {
+  PassNode node;
+  node.name = name;
+  node.execute = execute;
+  node.queue = queue;
+  passes_.push_back(node);
+
+  PassBuilder builder(*this, passes_.size() - 1);
+  setup(builder);
+  return passes_.size() - 1;
+}
+
+void RenderGraph::addAccess(Pass pass, Resource resource, ResourceUsage usage, bool read, bool write) {
+  if (resource >= resources_.size()) {
+    throw std::runtime_error("render graph: pass " + passes_[pass].name + " uses an unknown resource");
+  }
+
+  for (auto& access : passes_[pass].accesses) {
+    if (access.resource == resource) {
+      if (access.usage != usage) {
+        throw std::runtime_error("render graph: pass " + passes_[pass].name + " uses " +
+                                 resources_[resource].name + " in two different ways");
+      }
+      access.read = access.read || read;
+      access.write = access.write || write;
+      return;
+    }
+  }
+
+  Access access;
+  access.resource = resource;
+  access.usage = usage;
+  access.read = read;
+  access.write = write;
+  passes_[pass].accesses.push_back(access);
+}
+
+void RenderGraph::setQueueFamilies(uint32_t graphics_family, uint32_t compute_family, bool async_compute) {
+  graphics_family_ = graphics_family;
+  compute_family_ = compute_family;
+  async_compute_ = async_compute;
+}
+
+void RenderGraph::compile(VkPhysicalDevice physical_device) {
+  if (!async_compute_) {
+    for (auto& pass : passes_) {
+      pass.queue = QueueType::Graphics;
+    }
+  }
+
+  cullPasses();
+  computeLifetimes();
+  createTransientImages(physical_device);
+  computeBarriers();
+
+  size_t live = 0;
+  for (auto const& pass : passes_) {
+    if (pass.culled) {
+      LOG_DEBUG("Render graph: culled pass " << pass.name);
+      continue;
+    }
+    live++;
+    LOG_DEBUG("Render graph: pass " << pass.name
+              << (pass.queue == QueueType::AsyncCompute ? " (async compute)" : "") << ": "
+              << pass.barriers.size() << " barriers"
+              << (pass.renderpass ? " (+ attachment transitions in the render pass)" : ""));
+  }
+  LOG_INFO("Compiled render graph with " << live << " of " << passes_.size() << " passes.");
+}
+
+/*
+ * Walk the passes backwards and keep only those which (transitively)
+ * contribute to an imported resource or have side effects
+ */
+void RenderGraph::cullPasses() {
+  std::vector<bool> needed(resources_.size(), false);
+  for (size_t i = 0; i < resources_.size(); i++) {
+    needed[i] = resources_[i].imported;
+  }
+
+  for (size_t i = passes_.size(); i-- > 0;) {
+    PassNode& pass = passes_[i];
+    bool live = pass.side_effect;
+    for (auto const& access : pass.accesses) {
+      live = live || (access.write && needed[access.resource]);
+    }
+    pass.culled = !live;
+    if (!live) {
+      continue;
+    }
+
+    // a pure write hides the earlier contents, a read needs them
+    for (auto const& access : pass.accesses) {
+      if (access.write && !access.read && !resources_[access.resource].imported) {
+        needed[access.resource] = false;
+      }
+    }
+    for (auto const& access : pass.accesses) {
+      if (access.read) {
+        needed[access.resource] = true;
+      }
+    }
+  }
+}
+
+void RenderGraph::computeLifetimes() {
+  for (uint32_t i = 0; i < passes_.size(); i++) {
+    PassNode& pass = passes_[i];
+    pass.renderpass = false;
+    if (pass.culled) {
+      continue;
+    }
+    for (auto const& access : pass.accesses) {
+      ResourceNode& resource = resources_[access.resource];
+      UsageInfo info = usageInfo(access.usage);
+      resource.first_pass = std::min(resource.first_pass, i);
+      resource.last_pass = std::max(resource.last_pass, i);
+      resource.usage |= info.image_usage;
+      pass.renderpass = pass.renderpass || info.attachment;
+    }
+  }
+}
+
+/*
+ * Create the transient images and assign them to memory blocks
+ * Images which are never alive at the same time share one block
+ */
+void RenderGraph::createTransientImages(VkPhysicalDevice physical_device) {
+  transient_images_.resize(resources_.size(), VDeleter<VkImage>{device_, vkDestroyImage});
+  transient_views_.resize(resources_.size(), VDeleter<VkImageView>{device_, vkDestroyImageView});
+
+  std::vector<Resource> transients;
+  std::vector<VkMemoryRequirements> requirements(resources_.size());
+  VkDeviceSize unaliased = 0;
+
+  for (Resource r = 0; r < resources_.size(); r++) {
+    ResourceNode& resource = resources_[r];
+    if (resource.imported || resource.is_buffer || resource.first_pass == ~0u) {
+      continue;
+    }
+
+    // attachments which live in a single render pass never need to be backed by memory on tilers
+    bool attachment_only = (resource.usage & ~(VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                                               VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+                                               VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT)) == 0;
+    if (attachment_only && resource.first_pass == resource.last_pass) {
+      resource.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+    }
+
+    VkImageCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    info.imageType = VK_IMAGE_TYPE_2D;
+    info.extent.width = resource.desc.extent.width;
+    info.extent.height = resource.desc.extent.height;
+    info.extent.depth = 1;
+    info.mipLevels = resource.desc.mip_levels;
+    info.arrayLayers = resource.desc.layers;
+    info.format = resource.desc.format;
+    info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    info.usage = resource.usage;
+    info.samples = resource.desc.samples;
+    info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    if (vkCreateImage(device_, &info, nullptr, transient_images_[r].replace()) != VK_SUCCESS) {
+      throw std::runtime_error("render graph: failed to create image " + resource.name);
+    }
+    vkGetImageMemoryRequirements(device_, transient_images_[r], &requirements[r]);
+    unaliased += requirements[r].size;
+    transients.push_back(r);
+  }
+
+  // biggest first, so the small ones fill up the blocks of the big ones
+  std::sort(transients.begin(), transients.end(), [&requirements](Resource a, Resource b) {
+    return requirements[a].size > requirements[b].size;
+  });
+
+  blocks_.clear();
+  for (Resource r : transients) {
+    ResourceNode& resource = resources_[r];
+    bool lazy = (resource.usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) != 0;
+
+    uint32_t chosen = ~0u;
+    for (uint32_t b = 0; b < blocks_.size() && chosen == ~0u; b++) {
+      MemoryBlock const& block = blocks_[b];
+      if (block.lazy != lazy || !(block.type_bits & requirements[r].memoryTypeBits)) {
+        continue;
+      }
+      bool free = true;
+      for (Resource other : block.resources) {
+        free = free && !overlaps(resource.first_pass, resource.last_pass,
+                                 resources_[other].first_pass, resources_[other].last_pass);
+      }
+      if (free) {
+        chosen = b;
+      }
+    }
+
+    if (chosen == ~0u) {
+      MemoryBlock block;
+      block.type_bits = requirements[r].memoryTypeBits;
+      block.lazy = lazy;
+      blocks_.push_back(block);
+      chosen = blocks_.size() - 1;
+    }
+
+    MemoryBlock& block = blocks_[chosen];
+    block.type_bits &= requirements[r].memoryTypeBits;
+    block.size = std::max(block.size, requirements[r].size);
+    block.resources.push_back(r);
+    resource.block = chosen;
+  }
+
+  VkPhysicalDeviceMemoryProperties memory_properties;
+  vkGetPhysicalDeviceMemoryProperties(physical_device, &memory_properties);
+
+  memory_.resize(blocks_.size(), VDeleter<VkDeviceMemory>{device_, vkFreeMemory});
+  transient_memory_ = 0;
+  for (uint32_t b = 0; b < blocks_.size(); b++) {
+    MemoryBlock const& block = blocks_[b];
+
+    // lazily allocated memory if possible, device local otherwise
+    uint32_t type_index = ~0u;
+    VkMemoryPropertyFlags wanted[] = {
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+    };
+    for (uint32_t w = block.lazy ? 0 : 1; w < 2 && type_index == ~0u; w++) {
+      for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++) {
+        if ((block.type_bits & (1 << i)) &&
+            (memory_properties.memoryTypes[i].propertyFlags & wanted[w]) == wanted[w]) {
+          type_index = i;
+          break;
+        }
+      }
+    }
+    if (type_index == ~0u) {
+      throw std::runtime_error("render graph: no memory type for transient images");
+    }
+
+    VkMemoryAllocateInfo alloc_info = {};
+    alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    alloc_info.allocationSize = block.size;
+    alloc_info.memoryTypeIndex = type_index;
+    if (vkAllocateMemory(device_, &alloc_info, nullptr, memory_[b].replace()) != VK_SUCCESS) {
+      throw std::runtime_error("render graph: failed to allocate transient memory");
+    }
+    transient_memory_ += block.size;
+
+    for (Resource r : block.resources) {
+      vkBindImageMemory(device_, transient_images_[r], memory_[b], 0);
+
+      ResourceNode const& resource = resources_[r];
+      VkImageViewCreateInfo info = {};
+      info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+      info.image = transient_images_[r];
+      info.viewType = resource.desc.layers > 1 ? VK_IMAGE_VIEW_TYPE_2D_ARRAY : VK_IMAGE_VIEW_TYPE_2D;
+      info.format = resource.desc.format;
+      info.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+      info.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+      info.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+      info.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+      info.subresourceRange.aspectMask = aspectFor(resource.desc.format);
+      info.subresourceRange.baseMipLevel = 0;
+      info.subresourceRange.levelCount = resource.desc.mip_levels;
+      info.subresourceRange.baseArrayLayer = 0;
+      info.subresourceRange.layerCount = resource.desc.layers;
+      if (vkCreateImageView(device_, &info, nullptr, transient_views_[r].replace()) != VK_SUCCESS) {
+        throw std::runtime_error("render graph: failed to create view for " + resource.name);
+      }
+    }
+  }
+
+  LOG_INFO("Render graph: " << transients.size() << " transient images in " << blocks_.size()
+           << " memory blocks, " << transient_memory_ / 1024 << " KiB (" << unaliased / 1024
+           << " KiB without aliasing)");
+}
+
+/*
+ * Simulate the frame and record which transitions and barriers each pass needs
+ *
+ * The frame is walked twice: the first walk only establishes the state
+ * the previous frame leaves behind, so hazards across frames are covered too.
+ */
+void RenderGraph::computeBarriers() {
+  std::vector<State> states(resources_.size());
+  std::vector<State> block_states(blocks_.size());
+
+  for (int walk = 0; walk < 2; walk++) {
+    bool record = walk == 1;
+    if (record) {
+      release_barriers_.clear();
+      release_src_stages_ = 0;
+      compute_wait_stages_ = 0;
+    }
+
+    for (Resource r = 0; r < resources_.size(); r++) {
+      ResourceNode& resource = resources_[r];
+      states[r].touched = false;
+      if (resource.imported && !resource.is_buffer) {
+        // handed over through a semaphore, which waits in wait_stage
+        states[r].layout = resource.initial_layout;
+        states[r].stages = resource.wait_stage;
+        states[r].writes = 0;
+        states[r].queue = QueueType::Graphics;
+      }
+      resource.final_in_renderpass = false;
+    }
+
+    for (uint32_t p = 0; p < passes_.size(); p++) {
+      PassNode& pass = passes_[p];
+      if (pass.culled) {
+        continue;
+      }
+      if (record) {
+        pass.barriers.clear();
+        pass.layouts.clear();
+        pass.src_stages = 0;
+        pass.dst_stages = 0;
+        pass.memory_src_access = 0;
+        pass.memory_dst_access = 0;
+        pass.dependency = VkSubpassDependency{};
+      }
+
+      for (auto const& access : pass.accesses) {
+        ResourceNode& resource = resources_[access.resource];
+        UsageInfo info = usageInfo(access.usage);
+        State& state = states[access.resource];
+
+        // an aliased image continues where the previous user of its memory stopped
+        State previous = state;
+        bool transient = !resource.imported && !resource.is_buffer;
+        if (transient && !state.touched) {
+          previous = block_states[resource.block];
+          previous.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        }
+
+        VkAccessFlags dst_access = (access.read ? info.read_access : 0) |
+                                   (access.write ? info.write_access : 0);
+        VkImageLayout new_layout = info.layout;
+        // if the contents are not needed, let the transition discard them
+        VkImageLayout old_layout = (access.read || previous.layout == new_layout) ?
+                                   previous.layout : VK_IMAGE_LAYOUT_UNDEFINED;
+
+        bool cross_queue = previous.stages != 0 && previous.queue != pass.queue;
+        bool ownership_transfer = false;
+        if (cross_queue && pass.queue == QueueType::AsyncCompute) {
+          // the compute work is submitted first, so it has to come first in the frame too
+          if (state.touched) {
+            throw std::runtime_error("render graph: async compute pass " + pass.name + " uses " + resource.name +
+                                     " after a graphics pass");
+          }
+          // ordered after the previous frame only through the image acquisition
+          if ((access.write || previous.writes) && instanceCount(access.resource) < 2) {
+            throw std::runtime_error("render graph: " + resource.name + " is shared by graphics and async "
+                                     "compute work of consecutive frames, import one instance per frame");
+          }
+          if (access.read && graphics_family_ != compute_family_) {
+            throw std::runtime_error("render graph: async compute pass " + pass.name + " reads " +
+                                     resource.name + " from the graphics queue");
+          }
+        } else if (cross_queue) {
+          // the semaphore makes the compute results available, the data only has to change hands
+          // if the families differ and the contents are needed
+          compute_wait_stages_ |= info.stages;
+          ownership_transfer = access.read && graphics_family_ != compute_family_;
+          if (ownership_transfer && pass.renderpass && info.attachment) {
+            throw std::runtime_error("render graph: attachment " + resource.name + " of pass " + pass.name +
+                                     " can't be handed over from the async compute queue");
+          }
+          if (record && ownership_transfer) {
+            Barrier release = {access.resource, previous.writes, 0, old_layout, new_layout,
+                               compute_family_, graphics_family_};
+            release_barriers_.push_back(release);
+            release_src_stages_ |= previous.stages;
+          }
+        }
+        if (cross_queue) {
+          // the semaphore wait covers the previous accesses,
+          // our barriers only have to chain to it
+          previous.stages = info.stages;
+          previous.writes = 0;
+        }
+
+        bool layout_change = !resource.is_buffer && old_layout != new_layout;
+        bool hazard = !cross_queue && (previous.writes != 0 || (access.write && previous.stages != 0));
+        bool synchronized = layout_change || hazard || ownership_transfer;
+
+        if (record && pass.renderpass && info.attachment) {
+          AttachmentLayouts layouts = {old_layout, new_layout};
+          if (resource.imported && resource.last_pass == p && resource.final_layout != VK_IMAGE_LAYOUT_UNDEFINED) {
+            layouts.final = resource.final_layout;
+            resource.final_in_renderpass = true;
+          }
+          pass.layouts.push_back(std::make_pair(access.resource, layouts));
+          if (synchronized) {
+            pass.dependency.srcStageMask |= previous.stages;
+            pass.dependency.srcAccessMask |= previous.writes;
+            pass.dependency.dstStageMask |= info.stages;
+            pass.dependency.dstAccessMask |= dst_access;
+          }
+        } else if (record && synchronized) {
+          pass.src_stages |= previous.stages;
+          pass.dst_stages |= info.stages;
+          if (resource.is_buffer && !ownership_transfer) {
+            pass.memory_src_access |= previous.writes;
+            pass.memory_dst_access |= dst_access;
+          } else {
+            Barrier barrier = {access.resource, previous.writes, dst_access, old_layout, new_layout,
+                               VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED};
+            if (ownership_transfer) {
+              barrier.src_family = compute_family_;
+              barrier.dst_family = graphics_family_;
+            }
+            pass.barriers.push_back(barrier);
+          }
+        }
+
+        if (access.write || synchronized) {
+          // everything before is covered by the barrier, only our accesses are pending now
+          state.stages = info.stages;
+          state.writes = access.write ? info.write_access : 0;
+        } else {
+          // concurrent readers, a later writer has to wait for all of them
+          state.stages = previous.stages | info.stages;
+          state.writes = 0;
+        }
+        state.layout = new_layout;
+        state.queue = pass.queue;
+        if (record && resource.final_in_renderpass && resource.last_pass == p) {
+          state.layout = resource.final_layout;
+        }
+        state.touched = true;
+
+        if (transient) {
+          block_states[resource.block] = state;
+        }
+      }
+
+      if (record && pass.renderpass) {
+        pass.dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+        pass.dependency.dstSubpass = 0;
+        if (pass.dependency.srcStageMask == 0) {
+          pass.dependency.srcStageMask = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+        }
+        if (pass.dependency.dstStageMask == 0) {
+          pass.dependency.dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+        }
+      }
+    }
+  }
+
+  // imported images which are not left in their final layout by a render pass
+  final_barriers_.clear();
+  final_src_stages_ = 0;
+  for (Resource r = 0; r < resources_.size(); r++) {
+    ResourceNode const& resource = resources_[r];
+    if (!resource.imported || resource.is_buffer || resource.final_layout == VK_IMAGE_LAYOUT_UNDEFINED ||
+        resource.final_in_renderpass || states[r].layout == resource.final_layout) {
+      continue;
+    }
+    if (states[r].queue != QueueType::Graphics) {
+      throw std::runtime_error("render graph: " + resource.name + " has to be left by a graphics pass");
+    }
+    Barrier barrier = {r, states[r].writes, 0, states[r].layout, resource.final_layout,
+                       VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED};
+    final_barriers_.push_back(barrier);
+    final_src_stages_ |= states[r].stages;
+  }
+}
+
+VkImageMemoryBarrier RenderGraph::imageBarrier(Barrier const& barrier, uint32_t instance) const {
+  ResourceNode const& resource = resources_[barrier.resource];
+
+  VkImageMemoryBarrier info = {};
+  info.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  info.srcAccessMask = barrier.src_access;
+  info.dstAccessMask = barrier.dst_access;
+  info.oldLayout = barrier.old_layout;
+  info.newLayout = barrier.new_layout;
+  info.srcQueueFamilyIndex = barrier.src_family;
+  info.dstQueueFamilyIndex = barrier.dst_family;
+  info.image = image(barrier.resource, instance);
+  info.subresourceRange.aspectMask = aspectFor(resource.desc.format);
+  info.subresourceRange.baseMipLevel = 0;
+  info.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+  info.subresourceRange.baseArrayLayer = 0;
+  info.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+  return info;
+}
+
+VkBufferMemoryBarrier RenderGraph::bufferBarrier(Barrier const& barrier, uint32_t instance) const {
+  VkBufferMemoryBarrier info = {};
+  info.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  info.srcAccessMask = barrier.src_access;
+  info.dstAccessMask = barrier.dst_access;
+  info.srcQueueFamilyIndex = barrier.src_family;
+  info.dstQueueFamilyIndex = barrier.dst_family;
+  info.buffer = buffer(barrier.resource, instance);
+  info.offset = 0;
+  info.size = VK_WHOLE_SIZE;
+  return info;
+}
+
+void RenderGraph::recordBarriers(VkCommandBuffer cmd, uint32_t instance, std::vector<Barrier> const& barriers,
+                                 VkPipelineStageFlags src_stages, VkPipelineStageFlags dst_stages,
+                                 VkAccessFlags memory_src_access, VkAccessFlags memory_dst_access) const {
+  // command buffers are recorded again in the frames, which don't allocate
+  ScratchScope scratch;
+  ArenaVector<VkImageMemoryBarrier> image_barriers(scratch.arena());
+  ArenaVector<VkBufferMemoryBarrier> buffer_barriers(scratch.arena());
+  image_barriers.reserve(barriers.size());
+  buffer_barriers.reserve(barriers.size());
+  for (auto const& barrier : barriers) {
+    if (resources_[barrier.resource].is_buffer) {
+      buffer_barriers.push_back(bufferBarrier(barrier, instance));
+    } else {
+      image_barriers.push_back(imageBarrier(barrier, instance));
+    }
+  }
+
+  VkMemoryBarrier memory_barrier = {};
+  memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  memory_barrier.srcAccessMask = memory_src_access;
+  memory_barrier.dstAccessMask = memory_dst_access;
+  uint32_t memory_barrier_count = (memory_src_access || memory_dst_access) ? 1 : 0;
+
+  vkCmdPipelineBarrier(cmd,
+                       src_stages ? src_stages : VkPipelineStageFlags(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT),
+                       dst_stages, 0,
+                       memory_barrier_count, &memory_barrier,
+                       buffer_barriers.size(), buffer_barriers.data(),
+                       image_barriers.size(), image_barriers.data());
+}
+
+void RenderGraph::execute(VkCommandBuffer cmd, uint32_t instance, QueueType queue) const {
+  for (auto const& pass : passes_) {
+    if (pass.culled || pass.queue != queue) {
+      continue;
+    }
+
+    if (pass.dst_stages != 0) {
+      recordBarriers(cmd, instance, pass.barriers, pass.src_stages, pass.dst_stages,
+                     pass.memory_src_access, pass.memory_dst_access);
+    }
+
+    pass.execute(cmd, instance);
+  }
+
+  if (queue == QueueType::AsyncCompute && !release_barriers_.empty()) {
+    recordBarriers(cmd, instance, release_barriers_, release_src_stages_, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                   0, 0);
+  }
+  if (queue == QueueType::Graphics && !final_barriers_.empty()) {
+    recordBarriers(cmd, instance, final_barriers_, final_src_stages_, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                   0, 0);
+  }
+}
+
+void RenderGraph::reset() {
+  transient_views_.clear();
+  transient_images_.clear();
+  memory_.clear();
+  blocks_.clear();
+  final_barriers_.clear();
+  release_barriers_.clear();
+  passes_.clear();
+  resources_.clear();
+  transient_memory_ = 0;
+}
+
+bool RenderGraph::isCulled(Pass pass) const {
+  return passes_[pass].culled;
+}
+
+VkImage RenderGraph::image(Resource resource, uint32_t instance) const {
+  ResourceNode const& node = resources_[resource];
+  if (node.imported) {
+    return node.images[instance % node.images.size()];
+  }
+  return transient_images_[resource];
+}
+
+VkBuffer RenderGraph::buffer(Resource resource, uint32_t instance) const {
+  ResourceNode const& node = resources_[resource];
+  return node.buffers[instance % node.buffers.size()];
+}
+
+uint32_t RenderGraph::instanceCount(Resource resource) const {
+  ResourceNode const& node = resources_[resource];
+  if (!node.imported) {
+    return 1;
+  }
+  return node.is_buffer ? node.buffers.size() : node.images.size();
+}
+
+bool RenderGraph::usesAsyncCompute() const {
+  for (auto const& pass : passes_) {
+    if (!pass.culled && pass.queue == QueueType::AsyncCompute) {
+      return true;
+    }
+  }
+  return false;
+}
+
+VkImageView RenderGraph::imageView(Resource resource) const {
+  if (resources_[resource].imported) {
+    throw std::runtime_error("render graph: no view for imported image " + resources_[resource].name);
+  }
+  return transient_views_[resource];
+}
+
+AttachmentLayouts RenderGraph::attachmentLayouts(Pass pass, Resource resource) const {
+  for (auto const& entry : passes_[pass].layouts) {
+    if (entry.first == resource) {
+      return entry.second;
+    }
+  }
+  throw std::runtime_error("render graph: " + resources_[resource].name + " is no attachment of pass " +
+                           passes_[pass].name);
+}
+
+VkSubpassDependency RenderGraph::externalDependency(Pass pass) const {
+  return passes_[pass].dependency;
+}
+
+}
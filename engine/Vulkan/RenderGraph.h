@@ -0,0 +1,273 @@
+#ifndef VULKAN_ENGINE_RENDERGRAPH_H
+#define VULKAN_ENGINE_RENDERGRAPH_H
+
+#include "VDeleter.h"
+
+#include <vulkan/vulkan.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace engine {
+
+// How a pass uses a resource
+// Determines the image layout, the pipeline stages and the access masks
+enum class ResourceUsage {
+  ColorAttachment,
+  DepthAttachment,
+  InputAttachment,
+  SampledFragment,
+  SampledCompute,
+  StorageCompute,
+  StorageGraphics,
+  IndirectArgs,
+  VertexInput,
+  TransferSrc,
+  TransferDst,
+};
+
+// Queue a pass is submitted to
+enum class QueueType {
+  Graphics,
+  // separate compute queue, submitted before the graphics work of the frame,
+  // so it can run concurrently with the graphics work of the previous frame
+  AsyncCompute,
+};
+
+struct ImageDesc {
+  VkFormat format = VK_FORMAT_UNDEFINED;
+  VkExtent2D extent = {0, 0};
+  VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+  uint32_t mip_levels = 1;
+  uint32_t layers = 1;
+  // besides what the passes declare, e.g. input attachments between the subpasses of one pass
+  VkImageUsageFlags usage = 0;
+};
+
+// Layouts for an attachment of a graph pass, used when creating its VkRenderPass
+struct AttachmentLayouts {
+  VkImageLayout initial;
+  VkImageLayout final;
+};
+
+/*
+ * Declarative description of the frame
+ *
+ * Passes declare which resources they read and write, in execution order.
+ * compile() then
+ *  - culls the passes which contribute nothing to the imported resources,
+ *  - derives the layout transitions and barriers between passes and batches
+ *    them into one vkCmdPipelineBarrier per pass,
+ *  - creates the transient images and lets images whose lifetimes don't
+ *    overlap share the same memory.
+ *
+ * Passes using attachments begin their own render pass, which has to be created
+ * with attachmentLayouts() and externalDependency() of the pass: transitions
+ * of attachments happen inside the render pass instead of separate barriers.
+ *
+ * AsyncCompute passes are recorded into their own command buffer, which has to
+ * be submitted before the graphics one. The graphics submission waits for it
+ * in computeWaitStages(); queue family ownership transfers are added where the
+ * families differ. Resources which are written by one queue and accessed by the
+ * other have to be imported with one instance per frame, the compute submission
+ * has to wait for the same semaphore as the graphics one (image acquisition)
+ * to be ordered after the previous use of the instance.
+ */
+class RenderGraph {
+  public:
+    typedef uint32_t Resource;
+    typedef uint32_t Pass;
+
+    // record the pass, the second parameter selects the instance of imported resources
+    typedef std::function<void(VkCommandBuffer, uint32_t)> ExecuteFn;
+
+    class PassBuilder {
+      public:
+        // the pass needs the current contents of the resource
+        void read(Resource resource, ResourceUsage usage);
+
+        // the pass (over)writes the resource
+        void write(Resource resource, ResourceUsage usage);
+
+        // never cull this pass, even if nobody uses its results
+        void sideEffect();
+
+      private:
+        friend class RenderGraph;
+        PassBuilder(RenderGraph& graph, Pass pass) : graph_(graph), pass_(pass) { }
+
+        RenderGraph& graph_;
+        Pass pass_;
+    };
+
+    explicit RenderGraph(const VDeleter<VkDevice>& device);
+
+    Resource createImage(const std::string& name, ImageDesc const& desc);
+
+    // one image per instance, e.g. the swapchain images
+    // wait_stage is the stage the images become available in (semaphore wait)
+    Resource importImage(const std::string& name, ImageDesc const& desc, std::vector<VkImage> const& images,
+                         VkImageLayout initial_layout, VkImageLayout final_layout,
+                         VkPipelineStageFlags wait_stage);
+
+    // one buffer per instance, or a single one shared by all
+    Resource importBuffer(const std::string& name, std::vector<VkBuffer> const& buffers);
+
+    Pass addPass(const std::string& name, std::function<void(PassBuilder&)> setup, ExecuteFn execute,
+                 QueueType queue = QueueType::Graphics);
+
+    // without async compute, AsyncCompute passes run on the graphics queue
+    void setQueueFamilies(uint32_t graphics_family, uint32_t compute_family, bool async_compute);
+
+    void compile(VkPhysicalDevice physical_device);
+
+    void execute(VkCommandBuffer cmd, uint32_t instance, QueueType queue = QueueType::Graphics) const;
+
+    // drop all passes and resources, e.g. before rebuilding for a new swapchain
+    void reset();
+
+    bool isCulled(Pass pass) const;
+
+    VkImage image(Resource resource, uint32_t instance = 0) const;
+
+    VkBuffer buffer(Resource resource, uint32_t instance = 0) const;
+
+    // only for transient images, views on the whole image
+    VkImageView imageView(Resource resource) const;
+
+    AttachmentLayouts attachmentLayouts(Pass pass, Resource resource) const;
+
+    // dependency from VK_SUBPASS_EXTERNAL to the first subpass (dstSubpass = 0)
+    VkSubpassDependency externalDependency(Pass pass) const;
+
+    VkDeviceSize transientMemorySize() const { return transient_memory_; }
+
+    // true if there are live passes on the async compute queue
+    bool usesAsyncCompute() const;
+
+    // stages of the graphics submission which wait for the async compute submission
+    VkPipelineStageFlags computeWaitStages() const { return compute_wait_stages_; }
+
+  private:
+    struct Access {
+      Resource resource;
+      ResourceUsage usage;
+      bool read = false;
+      bool write = false;
+    };
+
+    struct ResourceNode {
+      std::string name;
+      ImageDesc desc;
+      bool is_buffer = false;
+      bool imported = false;
+      std::vector<VkImage> images;
+      std::vector<VkBuffer> buffers;
+      VkImageLayout initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+      VkImageLayout final_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+      VkPipelineStageFlags wait_stage = 0;
+
+      // filled by compile()
+      VkImageUsageFlags usage = 0;
+      uint32_t first_pass = ~0u;
+      uint32_t last_pass = 0;
+      uint32_t block = ~0u;
+      bool final_in_renderpass = false;
+    };
+
+    struct Barrier {
+      Resource resource;
+      VkAccessFlags src_access;
+      VkAccessFlags dst_access;
+      VkImageLayout old_layout;
+      VkImageLayout new_layout;
+      // differ for queue family ownership transfers
+      uint32_t src_family;
+      uint32_t dst_family;
+    };
+
+    struct PassNode {
+      std::string name;
+      std::vector<Access> accesses;
+      ExecuteFn execute;
+      QueueType queue = QueueType::Graphics;
+      bool side_effect = false;
+      bool culled = false;
+
+      // filled by compile()
+      bool renderpass = false;
+      std::vector<Barrier> barriers;
+      VkPipelineStageFlags src_stages = 0;
+      VkPipelineStageFlags dst_stages = 0;
+      // buffers only need a global memory barrier
+      VkAccessFlags memory_src_access = 0;
+      VkAccessFlags memory_dst_access = 0;
+      std::vector<std::pair<Resource, AttachmentLayouts>> layouts;
+      VkSubpassDependency dependency = {};
+    };
+
+    // memory shared by transient images with disjoint lifetimes
+    struct MemoryBlock {
+      uint32_t type_bits;
+      bool lazy;
+      VkDeviceSize size = 0;
+      std::vector<Resource> resources;
+    };
+
+    // state of a resource (or of the memory block behind it) while walking the passes
+    struct State {
+      VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+      // stages which accessed the resource since the last barrier
+      VkPipelineStageFlags stages = 0;
+      // writes which are not yet made available
+      VkAccessFlags writes = 0;
+      QueueType queue = QueueType::Graphics;
+      bool touched = false;
+    };
+
+    const VDeleter<VkDevice>& device_;
+    std::vector<ResourceNode> resources_;
+    std::vector<PassNode> passes_;
+    std::vector<MemoryBlock> blocks_;
+
+    std::vector<VDeleter<VkImage>> transient_images_;
+    std::vector<VDeleter<VkImageView>> transient_views_;
+    std::vector<VDeleter<VkDeviceMemory>> memory_;
+    // transitions of imported images to their final layout after the last pass
+    std::vector<Barrier> final_barriers_;
+    VkPipelineStageFlags final_src_stages_ = 0;
+    VkDeviceSize transient_memory_ = 0;
+
+    uint32_t graphics_family_ = 0;
+    uint32_t compute_family_ = 0;
+    bool async_compute_ = false;
+    // ownership releases at the end of the async compute work
+    std::vector<Barrier> release_barriers_;
+    VkPipelineStageFlags release_src_stages_ = 0;
+    VkPipelineStageFlags compute_wait_stages_ = 0;
+
+    void addAccess(Pass pass, Resource resource, ResourceUsage usage, bool read, bool write);
+
+    void cullPasses();
+
+    void computeLifetimes();
+
+    void createTransientImages(VkPhysicalDevice physical_device);
+
+    void computeBarriers();
+
+    uint32_t instanceCount(Resource resource) const;
+
+    VkImageMemoryBarrier imageBarrier(Barrier const& barrier, uint32_t instance) const;
+
+    VkBufferMemoryBarrier bufferBarrier(Barrier const& barrier, uint32_t instance) const;
+
+    void recordBarriers(VkCommandBuffer cmd, uint32_t instance, std::vector<Barrier> const& barriers,
+                        VkPipelineStageFlags src_stages, VkPipelineStageFlags dst_stages,
+                        VkAccessFlags memory_src_access, VkAccessFlags memory_dst_access) const;
+};
+
+}
+
+#endif //VULKAN_ENGINE_RENDERGRAPH_H
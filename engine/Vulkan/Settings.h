@@ -0,0 +1,140 @@
+#ifndef VULKAN_ENGINE_SETTINGS_H
+#define VULKAN_ENGINE_SETTINGS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace engine {
+
+// Files the readback writes: binary PPM, uncompressed PNG or the bytes of the image
+enum class ImageFileFormat {
+  Ppm,
+  Png,
+  Raw,
+};
+
+// Effects after the shading, see Settings::post_effects
+enum class PostEffect {
+  // extended Reinhard on the luminance, from the 16 bit float target of the scene
+  Tonemap,
+  // contrast, saturation and a warm tint
+  ColorGrade,
+  // darkens towards the corners of a view
+  Vignette,
+  // FXAA, smooths the edges it finds in the luminance of the neighbouring pixels
+  Fxaa,
+};
+
+// Options which are fixed for the lifetime of the engine
+struct Settings {
+  // Use this GPU instead of the best scoring one: a part of its name
+  // or its device UUID, both are printed when selecting the GPU
+  std::string device;
+
+  // Measure the GPU again instead of using the cached device profile
+  bool recalibrate = false;
+
+  // Lay down depth in a depth-only subpass first, then shade with an EQUAL
+  // depth test so every pixel runs the fragment shader at most once
+  bool depth_prepass = true;
+
+  // Samples per pixel for anti-aliasing, 1 disables MSAA, 0 uses the device profile
+  // Clamped to what the GPU supports for color and depth attachments
+  uint32_t msaa_samples = 0;
+
+  // Run compute work (culling) on a separate queue if the GPU has one,
+  // otherwise it is recorded into the graphics command buffer
+  bool async_compute = true;
+
+  // Acquire, submit and present on a separate thread, so the main thread
+  // never blocks inside the driver
+  bool submit_thread = true;
+
+  // Run independent init steps on worker threads, and calibrate a new device
+  // at shutdown instead of before the first frame (with a guessed profile until then)
+  bool fast_startup = true;
+
+  // Cull what is hidden behind the drawables of the last frame with a depth pyramid,
+  // on the graphics queue instead of the frustum culling on the compute queue
+  bool occlusion_culling = true;
+
+  // Render the scene at a lower resolution while the GPU takes longer than
+  // frame_time_target (milliseconds) per frame, down to min_resolution_scale
+  // of the window size in both directions, and upscale it with a filtered blit.
+  // Needs timestamp queries to measure the GPU time
+  bool dynamic_resolution = false;
+  double frame_time_target = 16.0;
+  float min_resolution_scale = 0.5f;
+
+  // Viewpoints of the scene (2 for stereo), side by side in the window and view_separation
+  // apart in the scene. One recorded pass draws all of them: with VK_KHR_multiview the vertex
+  // shaders pick the camera of their view, without it every draw is instanced once per view into
+  // the layers of the targets (needs VK_EXT_shader_viewport_index_layer), else only one is drawn.
+  // The culling, the light clusters and the streamed world cover all of them at once
+  uint32_t views = 1;
+  float view_separation = 0.5f;
+
+  // Post-processing of the shaded scene. The effects of single pixels are applied in this order by
+  // subpasses of the scene render pass, each reading the result of the one before as an input attachment,
+  // so it can stay on chip on tiled GPUs; the scene is shaded into a 16 bit float target for them.
+  // Those which need the neighbouring pixels (FXAA) follow in render passes of their own, sampling it
+  std::vector<PostEffect> post_effects;
+
+  // Number of triangles in the test scene
+  uint32_t scene_triangles = 64;
+
+  // Capacity of the GPU particle system (0 disables it). Particles live up to
+  // particle_lifetime seconds and are refilled at the rate they die, so the
+  // pool stays about full. Emitted, simulated and drawn without the CPU
+  uint32_t particle_count = 1u << 20;
+  float particle_lifetime = 4.0f;
+
+  // Point lights of the test scene. A compute pass bins them into a grid of
+  // screen tiles and depth slices every frame, each fragment only loops over
+  // the lights of its cluster
+  uint32_t light_count = 256;
+
+  // Cascaded shadow maps of a directional light. The static scene is cached per
+  // cascade and only redrawn when the cascade moved too far from where it was
+  // drawn (F5 redraws them all), the particles are drawn into every frame
+  bool shadows = true;
+  // texels of each cascade in both directions
+  uint32_t shadow_map_size = 1024;
+
+  // A world of triangles in cells around the scene, streamed from world_path (generated there
+  // if it is missing, empty disables it) as the camera moves. The cells nearest to the path of
+  // the camera are read in the background with io_uring, or with threads if the kernel doesn't
+  // have it or world_threads is set. At most world_memory bytes of cells are on the GPU, the
+  // farthest are evicted for nearer ones
+  std::string world_path = "world.cells";
+  uint32_t world_memory = 2u << 20;
+  bool world_threads = false;
+
+  // Ticks per second of the simulation thread which moves the camera (arrow keys
+  // or WASD to pan, Q/E to zoom, R to reset), independent of the frame rate
+  double simulation_rate = 120.0;
+
+  // Fail the frame loop with an exception once a frame allocates from the heap after the warm-up,
+  // else the allocations are only counted and reported. Only debug builds and those with
+  // ENGINE_ALLOCATION_CHECK count them. Off by default: the driver, GLFW and the validation layers
+  // may allocate behind our calls
+  bool strict_allocations = false;
+
+  // Print the frame statistics every n seconds (0 disables the report)
+  double stats_interval = 1.0;
+
+  // Also draw them over the frame, with a graph of the recent frame rates
+  bool overlay = true;
+
+  // Read every n-th frame back and write it to <readback_prefix>-<frame>.<format>
+  // (0 disables the readback). The render loop never waits for it, frames are
+  // skipped while all readback buffers are busy
+  uint32_t readback_interval = 0;
+  ImageFileFormat readback_format = ImageFileFormat::Ppm;
+  std::string readback_prefix = "frame";
+};
+
+}
+
+#endif //VULKAN_ENGINE_SETTINGS_H
@@ -0,0 +1,42 @@
+#include "ShaderVariant.h"
+
+#include <cstring>
+
+namespace engine {
+
+ShaderVariant& ShaderVariant::set(uint32_t constant_id, uint32_t value) {
+  // set again, the last value wins
+  for (auto const& entry : entries_) {
+    if (entry.constantID == constant_id) {
+      data_[entry.offset / sizeof(uint32_t)] = value;
+      return *this;
+    }
+  }
+
+  VkSpecializationMapEntry entry = {};
+  entry.constantID = constant_id;
+  entry.offset = data_.size() * sizeof(uint32_t);
+  entry.size = sizeof(uint32_t);
+  entries_.push_back(entry);
+  data_.push_back(value);
+  return *this;
+}
+
+ShaderVariant& ShaderVariant::setFloat(uint32_t constant_id, float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return set(constant_id, bits);
+}
+
+VkSpecializationInfo const* ShaderVariant::info() {
+  if (entries_.empty()) {
+    return nullptr;
+  }
+  info_.mapEntryCount = entries_.size();
+  info_.pMapEntries = entries_.data();
+  info_.dataSize = data_.size() * sizeof(uint32_t);
+  info_.pData = data_.data();
+  return &info_;
+}
+
+}
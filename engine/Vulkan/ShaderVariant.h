@@ -0,0 +1,40 @@
+#ifndef VULKAN_ENGINE_SHADERVARIANT_H
+#define VULKAN_ENGINE_SHADERVARIANT_H
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace engine {
+
+/*
+ * Values for the specialization constants of a shader stage
+ *
+ * A toggle which would be a branch at runtime becomes a constant the driver
+ * folds away when it compiles the pipeline, so every combination in use is a
+ * pipeline of its own. Constants which aren't set keep the default the shader
+ * declares with layout(constant_id = ...).
+ */
+class ShaderVariant {
+  public:
+    // bool constants are set as 0 or 1
+    ShaderVariant& set(uint32_t constant_id, uint32_t value);
+
+    ShaderVariant& setFloat(uint32_t constant_id, float value);
+
+    /*
+     * For VkPipelineShaderStageCreateInfo::pSpecializationInfo, nullptr without constants
+     * Points into the variant, which has to stay unchanged until the pipeline is created
+     */
+    VkSpecializationInfo const* info();
+
+  private:
+    std::vector<VkSpecializationMapEntry> entries_;
+    std::vector<uint32_t> data_;
+    VkSpecializationInfo info_ = {};
+};
+
+}
+
+#endif //VULKAN_ENGINE_SHADERVARIANT_H
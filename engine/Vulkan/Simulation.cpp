@@ -0,0 +1,137 @@
+#include "Simulation.h"
+#include "../Log.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace engine {
+
+namespace {
+
+// scene units per second squared while a pan key is held, and the velocity lost per second
+const float pan_acceleration = 8.0f;
+const float pan_damping = 6.0f;
+// doublings of the zoom per second
+const float zoom_acceleration = 6.0f;
+const float zoom_damping = 6.0f;
+const float min_zoom = 0.25f;
+const float max_zoom = 16.0f;
+
+// ticks the simulation catches up at once after a stall, the rest are dropped
+const int max_catch_up = 5;
+
+const Camera initial_camera = {{0.0f, 0.0f}, 1.0f};
+
+Camera interpolate(Camera const& a, Camera const& b, float t) {
+  Camera camera;
+  camera.position[0] = a.position[0] + (b.position[0] - a.position[0]) * t;
+  camera.position[1] = a.position[1] + (b.position[1] - a.position[1]) * t;
+  // the zoom changes exponentially
+  camera.zoom = a.zoom * std::pow(b.zoom / a.zoom, t);
+  return camera;
+}
+
+}
+
+Simulation::~Simulation() {
+  stop();
+}
+
+void Simulation::start(double ticks_per_second) {
+  tick_ = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / ticks_per_second));
+  state_.camera = initial_camera;
+  Snapshot& snapshot = snapshots_.back();
+  snapshot.previous = initial_camera;
+  snapshot.current = initial_camera;
+  snapshot.time = Clock::now();
+  snapshots_.publish();
+
+  stopping_ = false;
+  thread_ = std::thread(&Simulation::run, this);
+}
+
+void Simulation::stop() {
+  if (!thread_.joinable()) {
+    return;
+  }
+  stopping_ = true;
+  thread_.join();
+}
+
+bool Simulation::input(InputEvent const& event) {
+  return input_.push(event);
+}
+
+Camera Simulation::camera() {
+  Snapshot const& snapshot = snapshots_.latest();
+  if (tick_ == Clock::duration::zero()) {
+    return snapshot.current;
+  }
+  // the time of the previous state is rendered now, a tick later the one of the current state
+  std::chrono::duration<float> since = Clock::now() - snapshot.time;
+  std::chrono::duration<float> tick = tick_;
+  float t = std::min(std::max(since.count() / tick.count(), 0.0f), 1.0f);
+  return interpolate(snapshot.previous, snapshot.current, t);
+}
+
+void Simulation::run() {
+  float seconds = std::chrono::duration<float>(tick_).count();
+  Clock::time_point next = Clock::now() + tick_;
+  while (!stopping_) {
+    std::this_thread::sleep_until(next);
+
+    Clock::time_point now = Clock::now();
+    int due = int((now - next) / tick_) + 1;
+    if (due > max_catch_up) {
+      dropped_ticks_ += due - max_catch_up;
+      next += tick_ * (due - max_catch_up);
+      due = max_catch_up;
+    }
+
+    for (int i = 0; i < due; i++) {
+      Camera previous = state_.camera;
+      InputEvent event;
+      while (input_.pop(event)) {
+        held_[uint32_t(event.control)] = event.pressed;
+        if (event.control == Control::Reset && event.pressed) {
+          state_ = {};
+          state_.camera = initial_camera;
+          previous = initial_camera;
+        }
+      }
+      step(seconds);
+
+      Snapshot& snapshot = snapshots_.back();
+      snapshot.previous = previous;
+      snapshot.current = state_.camera;
+      snapshot.time = next;
+      snapshots_.publish();
+      ticks_++;
+      next += tick_;
+    }
+  }
+  LOG_DEBUG("Simulation stopped after " << ticks_ << " ticks.");
+}
+
+/*
+ * Pan and zoom with some inertia, the pan is slower when zoomed in so it
+ * moves the same distance on the screen
+ */
+void Simulation::step(float seconds) {
+  float pan[2] = {float(held_[uint32_t(Control::PanRight)]) - float(held_[uint32_t(Control::PanLeft)]),
+                  float(held_[uint32_t(Control::PanDown)]) - float(held_[uint32_t(Control::PanUp)])};
+  float zoom = float(held_[uint32_t(Control::ZoomIn)]) - float(held_[uint32_t(Control::ZoomOut)]);
+
+  float pan_decay = std::exp(-pan_damping * seconds);
+  for (int i = 0; i < 2; i++) {
+    state_.velocity[i] = state_.velocity[i] * pan_decay + pan[i] * pan_acceleration / state_.camera.zoom * seconds;
+    state_.camera.position[i] += state_.velocity[i] * seconds;
+  }
+
+  state_.zoom_velocity = state_.zoom_velocity * std::exp(-zoom_damping * seconds) +
+                         zoom * zoom_acceleration * seconds;
+  state_.camera.zoom = std::min(std::max(state_.camera.zoom * std::exp2(state_.zoom_velocity * seconds),
+                                         min_zoom), max_zoom);
+}
+
+}
@@ -0,0 +1,107 @@
+#ifndef VULKAN_ENGINE_SIMULATION_H
+#define VULKAN_ENGINE_SIMULATION_H
+
+#include "SpscQueue.h"
+#include "TripleBuffer.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+namespace engine {
+
+// What the simulation controls, the keys are mapped to these by the engine
+enum class Control : uint32_t {
+  PanLeft,
+  PanRight,
+  PanUp,
+  PanDown,
+  ZoomIn,
+  ZoomOut,
+  Reset,
+};
+
+struct InputEvent {
+  Control control;
+  bool pressed;
+};
+
+// The view onto the scene
+struct Camera {
+  // the point of the scene in the center of the window
+  float position[2];
+  // 1 shows the scene from -1 to 1
+  float zoom;
+};
+
+/*
+ * The simulation of everything the CPU moves, on a thread of its own at a fixed rate
+ *
+ * Every tick first applies the input which arrived since the last one, so
+ * input is sampled as late as possible, then steps the state and publishes
+ * it together with the state of the tick before. The renderer interpolates
+ * between the two for the time it renders, one tick behind the simulation,
+ * so the motion stays smooth at any frame rate and neither thread waits for
+ * the other.
+ *
+ * input() is for one thread (the one polling the window), camera() for one
+ * other (the one rendering).
+ */
+class Simulation {
+  public:
+    ~Simulation();
+
+    void start(double ticks_per_second);
+
+    void stop();
+
+    bool running() const { return thread_.joinable(); }
+
+    // false if the queue is full and the event was dropped
+    bool input(InputEvent const& event);
+
+    // interpolated for now
+    Camera camera();
+
+    uint64_t ticks() const { return ticks_.load(std::memory_order_relaxed); }
+
+    // ticks skipped because the simulation fell too far behind
+    uint64_t droppedTicks() const { return dropped_ticks_.load(std::memory_order_relaxed); }
+
+  private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct State {
+      Camera camera;
+      float velocity[2];
+      float zoom_velocity;
+    };
+
+    struct Snapshot {
+      Camera previous;
+      Camera current;
+      // when the current state is due, the previous one is a tick earlier
+      Clock::time_point time;
+    };
+
+    // which controls are held, only touched by the simulation thread
+    bool held_[uint32_t(Control::Reset) + 1] = {};
+    State state_ = {};
+    Clock::duration tick_ = Clock::duration::zero();
+
+    SpscQueue<InputEvent, 256> input_;
+    TripleBuffer<Snapshot> snapshots_;
+    std::atomic<uint64_t> ticks_{0};
+    std::atomic<uint64_t> dropped_ticks_{0};
+    std::atomic<bool> stopping_{false};
+    std::thread thread_;
+
+    void run();
+
+    void step(float seconds);
+};
+
+}
+
+#endif //VULKAN_ENGINE_SIMULATION_H
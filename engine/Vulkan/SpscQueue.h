@@ -0,0 +1,54 @@
+#ifndef VULKAN_ENGINE_SPSCQUEUE_H
+#define VULKAN_ENGINE_SPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+
+namespace engine {
+
+/*
+ * Bounded lock-free queue for exactly one producer and one consumer thread
+ *
+ * Holds up to Capacity - 1 elements; push() and pop() never block but fail
+ * when the queue is full/empty. T should be cheap to copy.
+ */
+template <typename T, size_t Capacity>
+class SpscQueue {
+  public:
+    // producer only
+    bool push(T const& value) {
+      size_t head = head_.load(std::memory_order_relaxed);
+      size_t next = (head + 1) % Capacity;
+      if (next == tail_.load(std::memory_order_acquire)) {
+        return false;
+      }
+      items_[head] = value;
+      head_.store(next, std::memory_order_release);
+      return true;
+    }
+
+    // consumer only
+    bool pop(T& value) {
+      size_t tail = tail_.load(std::memory_order_relaxed);
+      if (tail == head_.load(std::memory_order_acquire)) {
+        return false;
+      }
+      value = items_[tail];
+      tail_.store((tail + 1) % Capacity, std::memory_order_release);
+      return true;
+    }
+
+    bool empty() const {
+      return tail_.load(std::memory_order_acquire) == head_.load(std::memory_order_acquire);
+    }
+
+  private:
+    T items_[Capacity];
+    // on separate cache lines, so producer and consumer don't fight over them
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+};
+
+}
+
+#endif //VULKAN_ENGINE_SPSCQUEUE_H
@@ -0,0 +1,233 @@
+#include "SubmitThread.h"
+#include "FrameArena.h"
+
+#include <limits>
+#include <stdexcept>
+
+namespace engine {
+
+SubmitThread::~SubmitThread() {
+  stop();
+}
+
+void SubmitThread::start(VkDevice device, VkSwapchainKHR swapchain, VkQueue present_queue,
+                         std::vector<VkSemaphore> const& acquire_semaphores, std::vector<VkFence> const& frame_fences,
+                         uint32_t max_acquired) {
+  if (acquire_semaphores.size() <= max_acquired || frame_fences.size() != acquire_semaphores.size()) {
+    throw std::runtime_error("submit thread: not enough acquire semaphores");
+  }
+  device_ = device;
+  swapchain_ = swapchain;
+  present_queue_ = present_queue;
+  acquire_semaphores_ = acquire_semaphores;
+  frame_fences_ = frame_fences;
+  max_acquired_ = max_acquired;
+
+  acquire_failed_ = false;
+  running_ = true;
+  thread_ = std::thread(&SubmitThread::run, this);
+}
+
+void SubmitThread::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_ = false;
+  }
+  work_.notify_one();
+  ready_.notify_one();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+bool SubmitThread::acquired(AcquiredImage& image) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  ready_.wait(lock, [this] { return !acquired_.empty() || !running_; });
+  return acquired_.pop(image);
+}
+
+void SubmitThread::submit(FrameSubmission const& frame) {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    // the thread holds at most max_acquired frames, so this hardly ever waits
+    ready_.wait(lock, [&] { return submissions_.push(frame) || !running_; });
+  }
+  work_.notify_one();
+}
+
+void SubmitThread::resume(VkSwapchainKHR swapchain) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    swapchain_ = swapchain;
+    acquire_failed_ = false;
+  }
+  work_.notify_one();
+}
+
+bool SubmitThread::result(FrameResult& result) {
+  return results_.pop(result);
+}
+
+void SubmitThread::run() {
+  // images acquired, but not submitted yet
+  uint32_t acquired_count = 0;
+  uint64_t next_semaphore = 0;
+
+  FrameSubmission batch[max_batch];
+  FrameResult results[max_batch];
+
+  while (true) {
+    VkSwapchainKHR swapchain;
+    {
+      // stay ahead, so the main thread never waits for the presentation engine
+      std::unique_lock<std::mutex> lock(mutex_);
+      work_.wait(lock, [&] {
+        return !running_ || !submissions_.empty() || (!acquire_failed_ && acquired_count < max_acquired_);
+      });
+      if (!running_) {
+        break;
+      }
+      swapchain = swapchain_;
+    }
+
+    // everything that is there goes into the same vkQueueSubmit calls, before acquiring more
+    size_t batch_size = 0;
+    while (batch_size < max_batch && submissions_.pop(batch[batch_size])) {
+      batch_size++;
+    }
+    if (batch_size > 0) {
+      submitFrames(present_queue_, swapchain, batch, batch_size, results);
+      for (size_t i = 0; i < batch_size; i++) {
+        // only statistics get lost if the main thread doesn't keep up
+        results_.push(results[i]);
+      }
+      acquired_count -= batch_size;
+      ready_.notify_one();
+      continue;
+    }
+
+    // nothing to submit, so there is room to acquire. The frame which last waited for the semaphore
+    // was submitted (there are more semaphores than images acquired ahead), once its fence is
+    // signaled the semaphore has no pending wait and may be signaled again
+    size_t slot = next_semaphore++ % acquire_semaphores_.size();
+    AcquiredImage image = {};
+    image.semaphore = acquire_semaphores_[slot];
+    image.fence = frame_fences_[slot];
+    image.result = vkWaitForFences(device_, 1, &image.fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+    if (image.result == VK_SUCCESS) {
+      // the images acquired ahead are at most what may be, so this returns
+      image.result = vkAcquireNextImageKHR(device_, swapchain, std::numeric_limits<uint64_t>::max(),
+                                           image.semaphore, VK_NULL_HANDLE, &image.image_index);
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (image.result == VK_SUCCESS || image.result == VK_SUBOPTIMAL_KHR) {
+        acquired_count++;
+      } else {
+        acquire_failed_ = true;
+      }
+      // the acquired queue holds more than max_acquired, so this never fails
+      acquired_.push(image);
+    }
+    ready_.notify_one();
+  }
+}
+
+void SubmitThread::submitFrames(VkQueue present_queue, VkSwapchainKHR swapchain, FrameSubmission const* frames,
+                                size_t frame_count, FrameResult* results) {
+  ScratchScope scratch;
+  size_t submit_count = 0;
+  for (size_t f = 0; f < frame_count; f++) {
+    submit_count += frames[f].submit_count;
+  }
+
+  // queues in the order they are first used, so signals are submitted before the waits
+  ArenaVector<VkQueue> queues(scratch.arena());
+  // the queue of each submit
+  ArenaVector<size_t> submit_queues(scratch.arena());
+  ArenaVector<VkSubmitInfo> submit_infos(scratch.arena());
+  ArenaVector<VkFence> fences(scratch.arena());
+  queues.reserve(submit_count);
+  submit_queues.reserve(submit_count);
+  submit_infos.reserve(submit_count);
+  fences.reserve(submit_count);
+
+  for (size_t f = 0; f < frame_count; f++) {
+    for (uint32_t s = 0; s < frames[f].submit_count; s++) {
+      QueueSubmit const& submit = frames[f].submits[s];
+      size_t q = 0;
+      while (q < queues.size() && queues[q] != submit.queue) {
+        q++;
+      }
+      if (q == queues.size()) {
+        queues.push_back(submit.queue);
+      }
+
+      VkSubmitInfo info = {};
+      info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+      info.commandBufferCount = 1;
+      info.pCommandBuffers = &submit.command_buffer;
+      if (submit.wait_semaphore != VK_NULL_HANDLE) {
+        info.waitSemaphoreCount = 1;
+        info.pWaitSemaphores = &submit.wait_semaphore;
+        info.pWaitDstStageMask = &submit.wait_stage;
+      }
+      if (submit.signal_semaphore != VK_NULL_HANDLE) {
+        info.signalSemaphoreCount = 1;
+        info.pSignalSemaphores = &submit.signal_semaphore;
+      }
+      submit_queues.push_back(q);
+      submit_infos.push_back(info);
+      fences.push_back(submit.fence);
+    }
+  }
+
+  // a submit with a fence ends the vkQueueSubmit call of its queue, the fence signals at its end
+  VkResult submit_result = VK_SUCCESS;
+  uint32_t queue_submits = 0;
+  ArenaVector<VkSubmitInfo> call(scratch.arena());
+  call.reserve(submit_count);
+  auto flush = [&](VkQueue queue, VkFence fence) {
+    VkResult result = vkQueueSubmit(queue, call.size(), call.data(), fence);
+    if (result != VK_SUCCESS) {
+      submit_result = result;
+    }
+    queue_submits++;
+    call.clear();
+  };
+  for (size_t q = 0; q < queues.size(); q++) {
+    for (size_t i = 0; i < submit_infos.size(); i++) {
+      if (submit_queues[i] != q) {
+        continue;
+      }
+      call.push_back(submit_infos[i]);
+      if (fences[i] != VK_NULL_HANDLE) {
+        flush(queues[q], fences[i]);
+      }
+    }
+    if (!call.empty()) {
+      flush(queues[q], VK_NULL_HANDLE);
+    }
+  }
+
+  for (size_t f = 0; f < frame_count; f++) {
+    FrameSubmission const& frame = frames[f];
+    VkPresentInfoKHR present_info = {};
+    present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+    present_info.waitSemaphoreCount = 1;
+    present_info.pWaitSemaphores = &frame.present_wait_semaphore;
+    present_info.swapchainCount = 1;
+    present_info.pSwapchains = &swapchain;
+    present_info.pImageIndices = &frame.image_index;
+
+    FrameResult& result = results[f];
+    result = FrameResult();
+    result.frame = frame.frame;
+    result.image_index = frame.image_index;
+    result.submit_result = submit_result;
+    result.present_result = vkQueuePresentKHR(present_queue, &present_info);
+    result.queue_submits = f == 0 ? queue_submits : 0;
+  }
+}
+
+}
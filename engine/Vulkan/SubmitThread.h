@@ -0,0 +1,133 @@
+#ifndef VULKAN_ENGINE_SUBMITTHREAD_H
+#define VULKAN_ENGINE_SUBMITTHREAD_H
+
+#include "SpscQueue.h"
+
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace engine {
+
+// One command buffer for one queue, waiting for and signaling at most one semaphore each
+struct QueueSubmit {
+  VkQueue queue;
+  VkCommandBuffer command_buffer;
+  VkSemaphore wait_semaphore;
+  VkPipelineStageFlags wait_stage;
+  VkSemaphore signal_semaphore;
+  // signaled when this and everything submitted before it on the queue is done
+  VkFence fence;
+};
+
+// Everything needed to submit and present one frame
+// Submits which signal a semaphore come before the ones waiting for it
+struct FrameSubmission {
+  uint64_t frame;
+  uint32_t image_index;
+  // compute, the uploads of the world and of the overlay, graphics and readback
+  QueueSubmit submits[5];
+  uint32_t submit_count;
+  VkSemaphore present_wait_semaphore;
+};
+
+// A swapchain image the main thread may render into
+struct AcquiredImage {
+  uint32_t image_index;
+  // signaled when the image can be written, the frame has to wait for it
+  VkSemaphore semaphore;
+  // of the semaphore: the frame resets it and hands it to its last submit
+  VkFence fence;
+  VkResult result;
+};
+
+// What happened to a frame after it was handed over
+struct FrameResult {
+  uint64_t frame;
+  uint32_t image_index;
+  VkResult submit_result;
+  VkResult present_result;
+  // vkQueueSubmit calls of the batch, counted at its first frame
+  uint32_t queue_submits;
+};
+
+/*
+ * Thread doing all the queue work: acquisition, submission and presentation
+ *
+ * It keeps images acquired ahead, so the main thread can pick one up without
+ * waiting for the presentation engine. Frames handed over with submit() are
+ * collected and submitted with one vkQueueSubmit per queue (a submit with a
+ * fence ends the call, as the fence belongs to the call), the results come
+ * back through result(). Nobody else may use the queues while it runs.
+ *
+ * It sleeps while there is nothing to submit and enough images are acquired,
+ * and blocks in the acquisition otherwise. An acquisition semaphore is only
+ * used again once the fence of the frame which waited for it is signaled.
+ */
+class SubmitThread {
+  public:
+    ~SubmitThread();
+
+    // acquire_semaphores are used round-robin, there must be more than max_acquired. Each comes with
+    // the fence of the frames waiting for it
+    void start(VkDevice device, VkSwapchainKHR swapchain, VkQueue present_queue,
+               std::vector<VkSemaphore> const& acquire_semaphores, std::vector<VkFence> const& frame_fences,
+               uint32_t max_acquired);
+
+    void stop();
+
+    bool running() const { return thread_.joinable(); }
+
+    // main thread: wait for an acquired image, false once the thread is stopped
+    bool acquired(AcquiredImage& image);
+
+    // main thread: hand over a frame, waits while the queue is full
+    void submit(FrameSubmission const& frame);
+
+    // main thread: acquire again after an acquisition failed (e.g. VK_ERROR_OUT_OF_DATE_KHR),
+    // from the recreated swapchain. No frames may be handed over until then
+    void resume(VkSwapchainKHR swapchain);
+
+    // main thread: results of submitted frames, in order
+    bool result(FrameResult& result);
+
+    // submit the frames with one vkQueueSubmit per queue and fence, then present them in order,
+    // a result per frame. Doesn't allocate, the temporaries are on the scratch arena of the thread
+    static void submitFrames(VkQueue present_queue, VkSwapchainKHR swapchain, FrameSubmission const* frames,
+                             size_t frame_count, FrameResult* results);
+
+  private:
+    VkDevice device_ = VK_NULL_HANDLE;
+    VkSwapchainKHR swapchain_ = VK_NULL_HANDLE;
+    VkQueue present_queue_ = VK_NULL_HANDLE;
+    std::vector<VkSemaphore> acquire_semaphores_;
+    std::vector<VkFence> frame_fences_;
+    uint32_t max_acquired_ = 1;
+
+    std::thread thread_;
+    std::atomic<bool> running_{false};
+
+    // the thread waits on work_ for frames or room to acquire, the main thread on ready_ for images or room
+    std::mutex mutex_;
+    std::condition_variable work_;
+    std::condition_variable ready_;
+    // no acquisitions after one failed, until resume()
+    bool acquire_failed_ = false;
+
+    // frames handed over and not picked up yet, at most one less
+    static const size_t max_batch = 8;
+
+    SpscQueue<AcquiredImage, max_batch> acquired_;
+    SpscQueue<FrameSubmission, max_batch> submissions_;
+    SpscQueue<FrameResult, 64> results_;
+
+    void run();
+};
+
+}
+
+#endif //VULKAN_ENGINE_SUBMITTHREAD_H
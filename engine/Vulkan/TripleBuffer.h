@@ -0,0 +1,55 @@
+#ifndef VULKAN_ENGINE_TRIPLEBUFFER_H
+#define VULKAN_ENGINE_TRIPLEBUFFER_H
+
+#include <atomic>
+#include <cstdint>
+
+namespace engine {
+
+/*
+ * Lock-free handover of the latest value from one writer to one reader thread
+ *
+ * The writer fills back() and publishes it, the reader gets the latest published
+ * value from latest(). Neither ever waits: they own a slot each and swap it with
+ * the third one, values the reader didn't get to are overwritten.
+ */
+template <typename T>
+class TripleBuffer {
+  public:
+    explicit TripleBuffer(T const& initial = T()) {
+      for (auto& slot : slots_) {
+        slot = initial;
+      }
+    }
+
+    // writer only
+    T& back() { return slots_[back_]; }
+
+    // writer only
+    void publish() {
+      back_ = middle_.exchange(back_ | fresh, std::memory_order_acq_rel) & index_mask;
+    }
+
+    // reader only, the same value as before if nothing was published since
+    T const& latest() {
+      if (middle_.load(std::memory_order_relaxed) & fresh) {
+        front_ = middle_.exchange(front_, std::memory_order_acq_rel) & index_mask;
+      }
+      return slots_[front_];
+    }
+
+  private:
+    // marks a slot in the middle the reader hasn't taken yet
+    static const uint32_t fresh = 4;
+    static const uint32_t index_mask = 3;
+
+    T slots_[3];
+    // on separate cache lines, so writer and reader don't fight over them
+    alignas(64) uint32_t back_ = 0;
+    alignas(64) std::atomic<uint32_t> middle_{1};
+    alignas(64) uint32_t front_ = 2;
+};
+
+}
+
+#endif //VULKAN_ENGINE_TRIPLEBUFFER_H
@@ -0,0 +1,59 @@
+#include "UploadRing.h"
+
+#include <cstddef>
+
+namespace engine {
+
+void UploadRing::init(void* memory, uint64_t size, uint64_t frame_budget) {
+  memory_ = static_cast<char*>(memory);
+  size_ = size;
+  frame_budget_ = frame_budget < size ? frame_budget : size;
+  head_ = 0;
+  tail_ = 0;
+  frames_.clear();
+}
+
+void UploadRing::begin(uint32_t image) {
+  // images aren't always rendered in order, the ring is only freed up to the oldest frame still in flight
+  for (auto& frame : frames_) {
+    if (frame.image == image) {
+      frame.retired = true;
+    }
+  }
+  size_t retired = 0;
+  while (retired < frames_.size() && frames_[retired].retired) {
+    tail_ = frames_[retired].end;
+    retired++;
+  }
+  frames_.erase(frames_.begin(), frames_.begin() + retired);
+  frame_start_ = head_;
+  frame_exhausted_ = false;
+}
+
+bool UploadRing::allocate(uint64_t size, uint64_t alignment, uint64_t& offset, void*& data) {
+  uint64_t position = head_ % size_;
+  uint64_t start = (position + alignment - 1) / alignment * alignment;
+  // allocations don't wrap around, the rest of the ring is skipped instead
+  if (start + size > size_) {
+    start = 0;
+  }
+  uint64_t skipped = start >= position ? start - position : size_ - position;
+  uint64_t end = head_ + skipped + size;
+  if (end - tail_ > size_ || end - frame_start_ > frame_budget_) {
+    if (!frame_exhausted_) {
+      frame_exhausted_ = true;
+      exhausted_++;
+    }
+    return false;
+  }
+  head_ = end;
+  offset = start;
+  data = memory_ + start;
+  return true;
+}
+
+void UploadRing::end(uint32_t image) {
+  frames_.push_back(Frame{image, head_, false});
+}
+
+}
@@ -0,0 +1,60 @@
+#ifndef VULKAN_ENGINE_UPLOADRING_H
+#define VULKAN_ENGINE_UPLOADRING_H
+
+#include <cstdint>
+#include <vector>
+
+namespace engine {
+
+/*
+ * Suballocates persistently mapped staging memory to the uploads of the frames, as a ring
+ *
+ * Each frame allocates between begin() and end() for its swapchain image, at
+ * most the budget per frame. What it allocated is only reused once the last
+ * frame of the image is done and everything allocated before it was freed, so
+ * the copies of frames in flight never read memory which is written meanwhile.
+ * Only for the thread rendering the frames.
+ */
+class UploadRing {
+  public:
+    void init(void* memory, uint64_t size, uint64_t frame_budget);
+
+    bool initialized() const { return memory_ != nullptr; }
+
+    // the last frame of the image is done (its fence was waited for): frees what it allocated
+    void begin(uint32_t image);
+
+    // false if the ring or the budget of the frame is full, the caller tries again next frame
+    bool allocate(uint64_t size, uint64_t alignment, uint64_t& offset, void*& data);
+
+    void end(uint32_t image);
+
+    uint64_t size() const { return size_; }
+
+    // frames which ran out of the ring or their budget
+    uint64_t exhausted() const { return exhausted_; }
+
+  private:
+    struct Frame {
+      uint32_t image;
+      // head_ at its end
+      uint64_t end;
+      bool retired;
+    };
+
+    char* memory_ = nullptr;
+    uint64_t size_ = 0;
+    uint64_t frame_budget_ = 0;
+    // bytes ever allocated and freed, the positions in the ring modulo its size
+    uint64_t head_ = 0;
+    uint64_t tail_ = 0;
+    uint64_t frame_start_ = 0;
+    bool frame_exhausted_ = false;
+    uint64_t exhausted_ = 0;
+    // oldest first, keeps its capacity once every image was in flight
+    std::vector<Frame> frames_;
+};
+
+}
+
+#endif //VULKAN_ENGINE_UPLOADRING_H
@@ -3,40 +3,336 @@
 //
 
 #include <set>
+#include <map>
 #include <limits>
+#include <memory>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <chrono>
+#include <sstream>
+#include <fstream>
 #include "Vulkan.h"
-#include "../util.h"
+#include "InitScheduler.h"
+#include "EmbeddedShaders.h"
+#include "ShaderVariant.h"
 
 
 namespace engine {
 
-Vulkan::Vulkan() {
+namespace {
+
+// indices of the objects in the command streams and the frame capture
+const uint32_t cull_pipeline_index = 0;
+const uint32_t prepass_pipeline_index = 1;
+const uint32_t scene_pipeline_index = 2;
+const uint32_t drawable_buffer_index = 0;
+const uint32_t draw_command_buffer_index = 1;
+const uint32_t view_buffer_index = 2;
+const uint32_t cull_set_index = 0;
+const uint32_t view_set_index = 1;
+const uint32_t light_buffer_index = 3;
+const uint32_t light_grid_buffer_index = 4;
+const uint32_t light_index_buffer_index = 5;
+const uint32_t light_counter_buffer_index = 6;
+const uint32_t light_set_index = 2;
+const uint32_t particle_emit_pipeline_index = 3;
+const uint32_t particle_simulate_pipeline_index = 4;
+const uint32_t particle_draw_pipeline_index = 5;
+const uint32_t particle_buffer_index = 7;
+const uint32_t particle_counter_buffer_index = 8;
+const uint32_t collision_depth_buffer_index = 9;
+const uint32_t particle_vertex_buffer_index = 10;
+const uint32_t particle_args_buffer_index = 11;
+const uint32_t particle_set_index = 3;
+const uint32_t light_cull_pipeline_index = 6;
+
+// compute begin/end, graphics begin/end, particles begin/end, light culling begin/end
+const uint32_t timestamps_per_image = 8;
+
+// see Particle in particle_emit.comp, and the vertices written by particle_simulate.comp
+const VkDeviceSize particle_size = 32;
+const VkDeviceSize particle_vertex_size = 16;
+// the particles advance by a fixed step every frame
+const float particle_time_step = 1.0f / 60.0f;
+// the cluster grid of the lights: screen tiles and depth slices, see lights.comp and first.frag
+const uint32_t light_tiles_x = 16;
+const uint32_t light_tiles_y = 16;
+const uint32_t light_slices = 16;
+// light indices per cluster on average, the list of a swapchain image is shared by all clusters
+const uint32_t average_cluster_lights = 32;
+// the sun, pointing into the scene (to larger depths), see lighting.glsl
+const float sun_direction[3] = {0.35f, -0.5f, 1.0f};
+// half extent of the finest shadow cascade in the scene, each further one is twice as large
+const float shadow_base_extent = 0.5f;
+// the part of its half extent the camera may move away from the center of a cascade before it is redrawn
+const float shadow_move_threshold = 0.25f;
+// the generated world: cells in both directions, their size in the scene and the triangles of the fullest one
+const uint32_t world_cells = 64;
+const float world_cell_size = 0.5f;
+const uint32_t world_cell_drawables = 64;
+// reads of world cells in flight
+const uint32_t world_queue_depth = 32;
+// the frame arena of a swapchain image to start with, it grows to what the frames need
+const size_t frame_arena_size = 64 * 1024;
+// frames until the arenas and the containers reused by the frames have grown to their steady state,
+// the ones after must not allocate from the heap any more
+const uint64_t allocation_warmup_frames = 120;
+// buckets of the sorted draws per subpass of the scene, each recorded again only when it changes
+const uint32_t scene_buckets = 8;
+// frames of GPU time averaged before the resolution changes
+const uint32_t resolution_interval = 8;
+// the passes of the draw list, and its material for draws without a descriptor set
+// (the others are the index of their set plus one)
+const uint32_t prepass_draw_pass = 0;
+const uint32_t scene_draw_pass = 1;
+const uint32_t no_material = 0;
+// cells of the collision depth map in both directions
+const uint32_t collision_depth_size = 256;
+// room for a few thousand characters, per swapchain image
+const uint32_t overlay_max_vertices = 6 * 8192;
+// reports shown in the frame rate graph
+const size_t overlay_history = 120;
+// seconds between the samples of the memory budget
+const double memory_sample_interval = 0.25;
+
+// specialization constants, see the constant_id of the shaders
+const uint32_t occlusion_phase_constant = 0;
+const uint32_t shadow_clear_constant = 0;
+// views per draw in the layered vertex shaders, instances per visible drawable in the culling
+const uint32_t view_count_constant = 1;
+// the PostEffect of post.frag
+const uint32_t post_effect_constant = 0;
+
+// what the view buffers start out with, until the first frame writes the camera
+const View identity_view = {{0.0f, 0.0f}, 1.0f, 0.0f};
+
+View toView(Camera const& camera) {
+  View view = {{camera.position[0], camera.position[1]}, camera.zoom, 0.0f};
+  return view;
+}
+
+// the handles a stream is recorded with
+uint64_t hashBindings(CommandBindings const& bindings) {
+  uint64_t hash = CommandCache::hash(bindings.pipelines.data(), sizeof(VkPipeline) * bindings.pipelines.size());
+  hash = CommandCache::hash(bindings.layouts.data(), sizeof(VkPipelineLayout) * bindings.layouts.size(), hash);
+  hash = CommandCache::hash(bindings.bind_points.data(), sizeof(VkPipelineBindPoint) * bindings.bind_points.size(),
+                            hash);
+  hash = CommandCache::hash(bindings.descriptor_sets.data(),
+                            sizeof(VkDescriptorSet) * bindings.descriptor_sets.size(), hash);
+  return CommandCache::hash(bindings.buffers.data(), sizeof(VkBuffer) * bindings.buffers.size(), hash);
+}
+
+void logTimeline(InitScheduler const& scheduler, std::string const& title) {
+  std::stringstream timeline;
+  scheduler.printTimeline(timeline, title);
+  std::string line;
+  while (std::getline(timeline, line)) {
+    LOG_INFO(line);
+  }
+}
+
+}
 
+Vulkan::Vulkan(Settings const& settings)
+        : settings_(settings) {
+  // one per pipeline, so the pipelines can be described while they are created in parallel
+  frame_capture_.pipelines.resize(7);
+}
+
+Vulkan::~Vulkan() {
+  // e.g. the init failed, it still uses the device
+  if (background_init_.joinable()) {
+    background_init_.join();
+  }
 }
 
 void Vulkan::init() {
-  initWindow();
+  init_start_ = std::chrono::steady_clock::now();
   initVulkan();
 }
 
 
 /*
- * Initialize the Vulkan subsystem
+ * Initialize the window and the Vulkan subsystem
+ *
+ * The steps only wait for the ones they really need, e.g. the instance is
+ * created while GLFW opens the window and the shaders are read while the
+ * device is created. The two pipelines compile at the same time.
+ * With a fast startup the readback and the overlay follow in the background.
  */
 void Vulkan::initVulkan() {
-  createInstance();
-  setupDebugCallback();
-  createSurface();
-  selectPhysicalDevice();
-  createLogicalDevice();
-  createSwapChain();
-  createImageViews();
-  createRenderpass();
-  createGraphicsPipeline();
-  createFramebuffers();
-  createCommandPool();
-  createCommandBuffers();
-  createSemaphores();
+  InitScheduler scheduler;
+  typedef InitScheduler::Step Step;
+
+  // GLFW wants to be called from the main thread
+  Step glfw = scheduler.add("glfw", [] { glfwInit(); }, {}, true);
+  Step window = scheduler.add("window", [this] { initWindow(); }, {glfw}, true);
+  Step instance = scheduler.add("instance", [this] {
+    createInstance();
+    setupDebugCallback();
+  }, {glfw});
+  Step shaders = scheduler.add("shaders", [this] { loadShaders(); });
+  Step scene = scheduler.add("scene", [this] { createScene(); });
+  Step surface = scheduler.add("surface", [this] { createSurface(); }, {window, instance});
+  Step device = scheduler.add("device", [this] {
+    selectPhysicalDevice();
+    createLogicalDevice();
+  }, {surface});
+  Step profile = scheduler.add("device profile", [this] { loadDeviceProfile(); }, {device});
+  Step cache = scheduler.add("pipeline cache", [this] { createPipelineCache(); }, {device});
+  // only the index of the world is read before the first frame
+  Step world = scheduler.add("world", [this] { createWorld(); }, {profile});
+  Step swapchain = scheduler.add("swapchain", [this] {
+    createSwapChain();
+    createImageViews();
+    chooseViews();
+  }, {profile});
+  // uploads on the transfer queue, after the calibration is done with the queues
+  Step buffers = scheduler.add("scene buffers", [this] {
+    createSceneBuffers();
+    createLightBuffers();
+    createParticleBuffers();
+    createOcclusionBuffers();
+    createWorldBuffers();
+    createDescriptorSets();
+  }, {scene, world, swapchain});
+  Step compute = scheduler.add("compute pipeline", [this] { createComputePipeline(); }, {shaders, cache, buffers});
+  // the shadow cache is transitioned on the graphics queue, which nothing else uses meanwhile
+  Step graph = scheduler.add("render graph", [this] {
+    createShadowMaps();
+    createRenderGraph();
+    createRenderpass();
+    createShadowRenderpass();
+  }, {buffers});
+  Step graphics = scheduler.add("graphics pipeline", [this] { createGraphicsPipeline(); }, {shaders, cache, graph});
+  // shares the layout of the scene pipelines
+  Step occlusion = scheduler.add("occlusion culling", [this] { createOcclusionCulling(); },
+                                 {shaders, cache, graphics});
+  Step framebuffers = scheduler.add("framebuffers", [this] {
+    createFramebuffers();
+    createShadowFramebuffers();
+  }, {graph});
+  Step semaphores = scheduler.add("semaphores", [this] { createSemaphores(); }, {swapchain});
+  Step post = scheduler.add("post-processing", [this] { createPostProcessing(); }, {shaders, cache, graph});
+  std::vector<Step> recorded = {compute, graphics, occlusion, framebuffers, semaphores, post};
+  // the first frame can do without the readback and the overlay, with a fast startup they are
+  // created in the background while the first frames render, see collectBackgroundInit
+  if (!settings_.fast_startup) {
+    scheduler.add("readback", [this] {
+      createReadback();
+      readback_enabled_ = readback_.initialized();
+    }, {swapchain});
+    recorded.push_back(scheduler.add("overlay", [this] {
+      createOverlay(graphics_queue_);
+      overlay_enabled_ = overlay_.initialized();
+    }, {shaders, cache, graph}));
+  }
+  scheduler.add("command buffers", [this] {
+    createCommandPool();
+    createQueryPool();
+    createCommandStreams();
+    createCommandBuckets();
+    createCommandBuffers();
+  }, recorded);
+
+  uint32_t cores = std::thread::hardware_concurrency();
+  uint32_t workers = settings_.fast_startup ? std::min(3u, cores > 1 ? cores - 1 : 1) : 0;
+  scheduler.run(workers);
+  logTimeline(scheduler, "Init");
+  if (!settings_.fast_startup) {
+    return;
+  }
+
+  // they don't touch the queues, the frames submit the upload of the overlay
+  background_init_ = std::thread([this] {
+    InitScheduler background;
+    background.add("readback", [this] { createReadback(); });
+    background.add("overlay", [this] { createOverlay(VK_NULL_HANDLE); });
+    try {
+      background.run(1);
+      logTimeline(background, "Background init");
+    } catch (...) {
+      background_error_ = std::current_exception();
+    }
+    background_done_.store(true, std::memory_order_release);
+  });
+}
+
+/*
+ * Hand the readback and the overlay created in the background over to the frames. The buckets and
+ * command buffers drawing the overlay are recorded again by the next frame of their image
+ */
+void Vulkan::collectBackgroundInit() {
+  background_init_.join();
+  if (background_error_) {
+    std::rethrow_exception(background_error_);
+  }
+  readback_enabled_ = readback_.initialized();
+  overlay_enabled_ = overlay_.initialized();
+  if (overlay_enabled_) {
+    overlay_upload_ = overlay_.upload();
+    frame_stats_.draw_calls += overlay_.drawCount();
+  }
+  LOG_INFO("Background init done after " << frame_stats_.frames << " frames.");
+}
+
+/*
+ * Look up the SPIR-V of all shaders, which the build compiled into the engine
+ * They can't go missing or get out of date with their GLSL, whatever the working directory is.
+ */
+void Vulkan::loadShaders() {
+  for (size_t i = 0; i < embedded_shader_count; i++) {
+    EmbeddedShader const& shader = embedded_shaders[i];
+    const char* code = reinterpret_cast<const char*>(shader.code);
+    shader_code_[shader.name].assign(code, code + shader.size);
+  }
+}
+
+/*
+ * Create the pipeline cache, filled with the data of the last run if there is one
+ * The driver checks the header itself and ignores data of other devices or drivers.
+ */
+void Vulkan::createPipelineCache() {
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physical_device_, &properties);
+
+  std::vector<char> data;
+  std::ifstream file(pipelineCachePath(properties), std::ios::ate | std::ios::binary);
+  if (file.is_open()) {
+    data.resize(size_t(file.tellg()));
+    file.seekg(0);
+    file.read(data.data(), data.size());
+  }
+
+  VkPipelineCacheCreateInfo info = {};
+  info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  info.initialDataSize = data.size();
+  info.pInitialData = data.empty() ? nullptr : data.data();
+  if (vkCreatePipelineCache(device_, &info, nullptr, pipeline_cache_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create pipeline cache");
+  }
+  LOG_INFO("Created pipeline cache with " << data.size() << " bytes of cached pipelines.");
+}
+
+/*
+ * Write the pipeline cache back for the next launch
+ */
+void Vulkan::savePipelineCache() {
+  size_t size = 0;
+  if (vkGetPipelineCacheData(device_, pipeline_cache_, &size, nullptr) != VK_SUCCESS) {
+    return;
+  }
+  std::vector<char> data(size);
+  if (vkGetPipelineCacheData(device_, pipeline_cache_, &size, data.data()) != VK_SUCCESS) {
+    return;
+  }
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physical_device_, &properties);
+  std::ofstream file(pipelineCachePath(properties), std::ios::binary);
+  file.write(data.data(), size);
 }
 
 /*
@@ -65,7 +361,8 @@ void Vulkan::createInstance() {
   if (enable_validation_ && checkValidationLayers()) {
     instance_info.enabledLayerCount = requested_validation_layers_.size();
     instance_info.ppEnabledLayerNames = requested_validation_layers_.data();
-    std::cout << "Enabled " << requested_validation_layers_.size() << " validation layers\n";
+    validation_enabled_ = true;
+    LOG_INFO("Enabled " << requested_validation_layers_.size() << " validation layers");
   }
 
   VkResult result = vkCreateInstance(&instance_info, nullptr, instance_.replace());
@@ -73,11 +370,11 @@ void Vulkan::createInstance() {
     throw std::runtime_error("Failed to create Vulkan instance");
   }
 
-  std::cout << "Initialized Vulkan instance successfully.\n";
+  LOG_INFO("Initialized Vulkan instance successfully.");
 }
 
 /*
- * Select a suitable vulkan-capable GPU
+ * Select the best suitable vulkan-capable GPU, or the one requested in the settings
  */
 void Vulkan::selectPhysicalDevice() {
   uint32_t device_count = 0;
@@ -90,19 +387,346 @@ void Vulkan::selectPhysicalDevice() {
   std::vector<VkPhysicalDevice> devices(device_count);
 
   vkEnumeratePhysicalDevices(instance_, &device_count, devices.data());
-  std::cout << "Number of Vulkan-capable GPUs found: " << devices.size() << "\n";
+  LOG_INFO("Number of Vulkan-capable GPUs found: " << devices.size());
 
+  uint64_t best_score = 0;
   for(uint32_t i = 0; i < devices.size(); i++) {
-    if (isDeviceSuitable(devices[i])) {
-      std::cout << "Found suitable physical device " << i << ".\n";
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(devices[i], &properties);
+    std::string uuid = deviceUuid(devices[i]);
+    uint64_t score = scoreDevice(devices[i]);
+    LOG_INFO("GPU " << i << ": " << properties.deviceName << " (" << (uuid.empty() ? "no UUID" : uuid)
+             << "), score " << score);
+
+    if (!settings_.device.empty()) {
+      // the override wins, as long as the device can run us at all
+      bool requested = (!uuid.empty() && uuid == settings_.device) ||
+                       std::string(properties.deviceName).find(settings_.device) != std::string::npos;
+      if (requested && score > 0 && physical_device_ == VK_NULL_HANDLE) {
+        physical_device_ = devices[i];
+      }
+    } else if (score > best_score) {
+      best_score = score;
       physical_device_ = devices[i];
-      break;
     }
   }
 
+  if (physical_device_ == VK_NULL_HANDLE && !settings_.device.empty()) {
+    throw std::runtime_error("Requested GPU \"" + settings_.device + "\" not found or not suitable.");
+  }
   if (physical_device_ == VK_NULL_HANDLE) {
     throw std::runtime_error("No suitable GPU found.");
   }
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physical_device_, &properties);
+  LOG_INFO("Using " << properties.deviceName << ".");
+}
+
+/*
+ * The deviceUUID of the GPU, the same for every driver version and process, empty without
+ * VK_KHR_external_memory_capabilities. Unlike the pipelineCacheUUID, which identical GPUs share
+ */
+std::string Vulkan::deviceUuid(VkPhysicalDevice device) {
+  if (!device_id_supported_) {
+    return std::string();
+  }
+  auto get_properties2 = (PFN_vkGetPhysicalDeviceProperties2KHR) vkGetInstanceProcAddr(
+          instance_, "vkGetPhysicalDeviceProperties2KHR");
+  if (get_properties2 == nullptr) {
+    return std::string();
+  }
+  VkPhysicalDeviceIDPropertiesKHR id_properties = {};
+  id_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES_KHR;
+  VkPhysicalDeviceProperties2KHR properties2 = {};
+  properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+  properties2.pNext = &id_properties;
+  get_properties2(device, &properties2);
+  return uuidString(id_properties.deviceUUID);
+}
+
+/*
+ * Rate how well a GPU suits us, 0 if it can't run us at all
+ *
+ * The device type dominates, so a discrete GPU always beats an integrated one;
+ * among the same type more VRAM, queues which run next to graphics and higher
+ * limits win.
+ */
+uint64_t Vulkan::scoreDevice(VkPhysicalDevice const& device) {
+  if (!isDeviceSuitable(device)) {
+    return 0;
+  }
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(device, &properties);
+  VkPhysicalDeviceMemoryProperties memory_properties;
+  vkGetPhysicalDeviceMemoryProperties(device, &memory_properties);
+
+  uint64_t score = 0;
+  switch (properties.deviceType) {
+    case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+      score += 1000000;
+      break;
+    case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+      score += 100000;
+      break;
+    case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+      score += 10000;
+      break;
+    default:
+      score += 1;
+      break;
+  }
+
+  // device local memory, in 64 MiB steps
+  for (uint32_t i = 0; i < memory_properties.memoryHeapCount; i++) {
+    if (memory_properties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+      score += memory_properties.memoryHeaps[i].size >> 26;
+    }
+  }
+
+  // async compute and transfers without stealing time from the graphics queue
+  QueueFamilyIndices indices = findQueueFamilies(device);
+  if (indices.compute_family != indices.graphics_family) {
+    score += 500;
+  }
+  if (indices.transfer_family != indices.graphics_family) {
+    score += 250;
+  }
+
+  score += properties.limits.maxImageDimension2D / 1024;
+  score += properties.limits.framebufferColorSampleCounts & properties.limits.framebufferDepthSampleCounts;
+  return score;
+}
+
+/*
+ * Load the tuning of the GPU from its cache file, or calibrate it on the first launch
+ * needs to be called *after* createLogicalDevice()
+ */
+void Vulkan::loadDeviceProfile() {
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physical_device_, &properties);
+  std::string path = deviceProfilePath(properties);
+
+  if (!settings_.recalibrate && readDeviceProfile(path, profile_)) {
+    LOG_INFO("Loaded device profile " << path << ".");
+  } else if (settings_.fast_startup) {
+    // measuring takes a while, do it when nobody waits for a frame
+    calibrateDevice(profile_, false);
+    calibration_pending_ = true;
+    LOG_INFO("No device profile yet, guessed one and calibrating at shutdown.");
+  } else {
+    auto start = std::chrono::steady_clock::now();
+    calibrateDevice(profile_, true);
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    LOG_INFO("Calibrated device in " << elapsed.count() << " ms.");
+
+    if (writeDeviceProfile(path, profile_)) {
+      LOG_INFO("Saved device profile " << path << ".");
+    } else {
+      LOG_WARNING("Failed to save device profile " << path << ", calibrating again next time.");
+    }
+  }
+  LOG_INFO("Device profile: present mode " << profile_.present_mode << ", " << profile_.image_count
+           << " images, " << profile_.msaa_samples << "x MSAA, staging budget " << (profile_.staging_budget >> 10)
+           << " KiB, " << profile_.worker_threads << " worker threads");
+
+  msaa_samples_ = chooseSampleCount(settings_.msaa_samples > 0 ? settings_.msaa_samples : profile_.msaa_samples);
+  LOG_INFO("Using " << msaa_samples_ << "x MSAA.");
+}
+
+/*
+ * Measure the GPU to derive its profile
+ *
+ * Uploads a buffer and clears a large image a few times on the graphics queue,
+ * timed with timestamps: the upload bandwidth sizes the staging budget, the
+ * clear rate (roughly the ROP throughput) decides how many samples per pixel
+ * we can afford. Everything else follows from the properties of the device.
+ */
+void Vulkan::calibrateDevice(DeviceProfile& profile, bool measure) {
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physical_device_, &properties);
+  bool discrete = properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU;
+
+  // mailbox renders at full speed without tearing, worth the extra image
+  SwapChainSupportDetails sc_support = querySwapChainSupport(physical_device_);
+  bool mailbox = std::find(sc_support.present_modes.begin(), sc_support.present_modes.end(),
+                           VK_PRESENT_MODE_MAILBOX_KHR) != sc_support.present_modes.end();
+  profile.present_mode = mailbox ? VK_PRESENT_MODE_MAILBOX_KHR : VK_PRESENT_MODE_FIFO_KHR;
+  // integrated GPUs share the memory bandwidth with the CPU, keep the latency low there
+  profile.image_count = mailbox || discrete ? 3 : 2;
+
+  // the main and the submit thread are busy already
+  uint32_t cores = std::thread::hardware_concurrency();
+  profile.worker_threads = cores > 3 ? cores - 2 : 1;
+
+  QueueFamilyIndices indices = findQueueFamilies(physical_device_);
+  uint32_t family_count = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(physical_device_, &family_count, nullptr);
+  std::vector<VkQueueFamilyProperties> families(family_count);
+  vkGetPhysicalDeviceQueueFamilyProperties(physical_device_, &family_count, families.data());
+  uint32_t timestamp_bits = families[indices.graphics_family].timestampValidBits;
+  if (!measure) {
+    return;
+  }
+  if (timestamp_bits == 0) {
+    LOG_INFO("No timestamps on the graphics queue, using the default MSAA level and staging budget.");
+    return;
+  }
+
+  const VkDeviceSize upload_size = 16 << 20;
+  const uint32_t clear_size = 2048;
+  const uint32_t clears = 8;
+
+  VDeleter<VkBuffer> staging{device_, vkDestroyBuffer};
+  VDeleter<VkDeviceMemory> staging_memory{device_, vkFreeMemory};
+  VDeleter<VkBuffer> target{device_, vkDestroyBuffer};
+  VDeleter<VkDeviceMemory> target_memory{device_, vkFreeMemory};
+  VDeleter<VkImage> image{device_, vkDestroyImage};
+  VDeleter<VkDeviceMemory> image_memory{device_, vkFreeMemory};
+  createBuffer(upload_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, false,
+               staging, staging_memory);
+  createBuffer(upload_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false,
+               target, target_memory);
+  createImage(clear_size, clear_size, VK_FORMAT_R8G8B8A8_UNORM, VK_SAMPLE_COUNT_1_BIT, VK_IMAGE_TILING_OPTIMAL,
+              VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, image_memory);
+
+  VDeleter<VkCommandPool> pool{device_, vkDestroyCommandPool};
+  VkCommandPoolCreateInfo pool_info = {};
+  pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  pool_info.queueFamilyIndex = indices.graphics_family;
+  pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+  if (vkCreateCommandPool(device_, &pool_info, nullptr, pool.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create calibration command pool");
+  }
+
+  VDeleter<VkQueryPool> queries{device_, vkDestroyQueryPool};
+  VkQueryPoolCreateInfo query_info = {};
+  query_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  query_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  query_info.queryCount = 4;
+  if (vkCreateQueryPool(device_, &query_info, nullptr, queries.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create calibration query pool");
+  }
+
+  VkCommandBuffer cmd;
+  VkCommandBufferAllocateInfo alloc_info = {};
+  alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  alloc_info.commandPool = pool;
+  alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  alloc_info.commandBufferCount = 1;
+  if (vkAllocateCommandBuffers(device_, &alloc_info, &cmd) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to allocate calibration command buffer");
+  }
+
+  VkCommandBufferBeginInfo begin_info = {};
+  begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  vkBeginCommandBuffer(cmd, &begin_info);
+  vkCmdResetQueryPool(cmd, queries, 0, 4);
+
+  vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queries, 0);
+  VkBufferCopy region = {0, 0, upload_size};
+  vkCmdCopyBuffer(cmd, staging, target, 1, &region);
+  vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, queries, 1);
+
+  VkImageMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.srcAccessMask = 0;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image;
+  barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                       0, nullptr, 0, nullptr, 1, &barrier);
+
+  vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, queries, 2);
+  VkClearColorValue color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+  for (uint32_t i = 0; i < clears; i++) {
+    if (i > 0) {
+      // every clear has to finish writing before the next one starts
+      VkMemoryBarrier memory_barrier = {};
+      memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+      memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      memory_barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                           1, &memory_barrier, 0, nullptr, 0, nullptr);
+    }
+    color.float32[0] = float(i) / clears;
+    vkCmdClearColorImage(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &color, 1, &barrier.subresourceRange);
+  }
+  vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, queries, 3);
+
+  if (vkEndCommandBuffer(cmd) != VK_SUCCESS) {
+    throw std::runtime_error("failed to record calibration command buffer");
+  }
+
+  VkSubmitInfo submit_info = {};
+  submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit_info.commandBufferCount = 1;
+  submit_info.pCommandBuffers = &cmd;
+  if (vkQueueSubmit(graphics_queue_, 1, &submit_info, VK_NULL_HANDLE) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to submit calibration command buffer");
+  }
+  vkQueueWaitIdle(graphics_queue_);
+
+  uint64_t timestamps[4] = {};
+  if (vkGetQueryPoolResults(device_, queries, 0, 4, sizeof(timestamps), timestamps, sizeof(uint64_t),
+                            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT) != VK_SUCCESS) {
+    LOG_WARNING("Failed to read the calibration timestamps, using the default MSAA level and staging budget.");
+    return;
+  }
+
+  uint64_t mask = timestamp_bits >= 64 ? ~0ull : (1ull << timestamp_bits) - 1;
+  double ms_per_tick = properties.limits.timestampPeriod / 1e6;
+  double upload_ms = std::max(((timestamps[1] - timestamps[0]) & mask) * ms_per_tick, 1e-3);
+  double clear_ms = std::max(((timestamps[3] - timestamps[2]) & mask) * ms_per_tick, 1e-3);
+
+  // spend at most about a millisecond of each frame on uploads
+  const VkDeviceSize min_budget = 1 << 20;
+  const VkDeviceSize max_budget = 64 << 20;
+  profile.staging_budget = std::min(std::max(VkDeviceSize(upload_size / upload_ms), min_budget), max_budget);
+
+  // the scene is shaded with some overdraw, which must fit into a fraction of a 60 Hz frame
+  const double overdraw = 3.0;
+  const double budget_ms = 2.0;
+  double samples_per_ms = double(clear_size) * clear_size * clears / clear_ms;
+  double pixels = double(width_) * height_;
+  profile.msaa_samples = 1;
+  for (uint32_t samples = 8; samples > 1; samples /= 2) {
+    if (pixels * samples * overdraw / samples_per_ms <= budget_ms) {
+      profile.msaa_samples = samples;
+      break;
+    }
+  }
+  LOG_INFO("Calibration: upload " << upload_size / upload_ms / 1e6 << " GB/s, fill rate "
+           << samples_per_ms / 1e6 << " Gsamples/s");
+}
+
+/*
+ * Clamp the requested sample count to the highest one
+ * which the GPU supports for both color and depth attachments
+ */
+VkSampleCountFlagBits Vulkan::chooseSampleCount(uint32_t requested) {
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physical_device_, &properties);
+  VkSampleCountFlags supported = properties.limits.framebufferColorSampleCounts &
+                                 properties.limits.framebufferDepthSampleCounts;
+
+  const VkSampleCountFlagBits counts[] = {
+          VK_SAMPLE_COUNT_64_BIT, VK_SAMPLE_COUNT_32_BIT, VK_SAMPLE_COUNT_16_BIT,
+          VK_SAMPLE_COUNT_8_BIT, VK_SAMPLE_COUNT_4_BIT, VK_SAMPLE_COUNT_2_BIT
+  };
+  for (auto count : counts) {
+    if (uint32_t(count) <= requested && (supported & count)) {
+      return count;
+    }
+  }
+  return VK_SAMPLE_COUNT_1_BIT;
 }
 
 /*
@@ -124,11 +748,11 @@ bool Vulkan::isDeviceSuitable(VkPhysicalDevice const& device) {
   // check swap chain support
   SwapChainSupportDetails swapchain_support = querySwapChainSupport(device);
   if (swapchain_support.formats.empty()) {
-    std::cout << "no formats\n";
+    LOG_DEBUG("no formats");
     return false;
   }
   if (swapchain_support.present_modes.empty()) {
-    std::cout << "no presentation modes\n";
+    LOG_DEBUG("no presentation modes");
     return false;
   }
 
@@ -161,25 +785,53 @@ bool Vulkan::checkDeviceExtensionsSupport(VkPhysicalDevice const& device) {
  */
 void Vulkan::createLogicalDevice() {
   QueueFamilyIndices indices = findQueueFamilies(physical_device_);
-  float queue_prio = 1.0f;
-  std::set<int> unique_queue_families = {
-          indices.graphics_family,
-          indices.presentation_family,
-  };
+  float queue_prios[] = {1.0f, 1.0f};
+
+  uint32_t family_count = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(physical_device_, &family_count, nullptr);
+  std::vector<VkQueueFamilyProperties> families(family_count);
+  vkGetPhysicalDeviceQueueFamilyProperties(physical_device_, &family_count, families.data());
+
+  // number of queues we need from each family
+  std::map<int, uint32_t> queue_counts;
+  queue_counts[indices.graphics_family] = 1;
+  queue_counts[indices.presentation_family] = 1;
+  queue_counts[indices.transfer_family] = 1;
+
+  // async compute needs a dedicated family or a second queue of the graphics family
+  uint32_t compute_queue_index = 0;
+  if (settings_.async_compute && indices.compute_family != indices.graphics_family) {
+    queue_counts[indices.compute_family] = 1;
+    async_compute_ = true;
+  } else if (settings_.async_compute && families[indices.graphics_family].queueCount > 1) {
+    queue_counts[indices.graphics_family] = 2;
+    compute_queue_index = 1;
+    async_compute_ = true;
+  }
+
   std::vector<VkDeviceQueueCreateInfo> queue_create_infos;
-  for(auto queue_family : unique_queue_families) {
+  for(auto const& queue_family : queue_counts) {
     VkDeviceQueueCreateInfo info = {};
     info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    info.queueFamilyIndex = queue_family;
-    info.queueCount = 1;
-    info.pQueuePriorities = &queue_prio;
+    info.queueFamilyIndex = queue_family.first;
+    info.queueCount = queue_family.second;
+    info.pQueuePriorities = queue_prios;
     queue_create_infos.push_back(info);
 
   }
 
 
   // Set the used device features
+  VkPhysicalDeviceFeatures supported_features;
+  vkGetPhysicalDeviceFeatures(physical_device_, &supported_features);
+
   VkPhysicalDeviceFeatures features = {};
+  // used to count the shaded fragments (overdraw statistics), optional. The query is active while the
+  // scene render pass executes its buckets, which needs the secondary command buffers to inherit it
+  features.pipelineStatisticsQuery = supported_features.pipelineStatisticsQuery;
+  features.inheritedQueries = supported_features.inheritedQueries;
+  pipeline_statistics_supported_ = supported_features.pipelineStatisticsQuery == VK_TRUE &&
+                                   supported_features.inheritedQueries == VK_TRUE;
 
 
   // create logical device
@@ -189,9 +841,62 @@ void Vulkan::createLogicalDevice() {
   create_info.queueCreateInfoCount = queue_create_infos.size();
   create_info.pEnabledFeatures = &features;
 
-  // required
-  create_info.enabledExtensionCount = required_device_extensions_.size();
-  create_info.ppEnabledExtensionNames = required_device_extensions_.data();
+  // required, and the optional ones the device has
+  std::vector<const char*> extensions = required_device_extensions_;
+  uint32_t count = 0;
+  vkEnumerateDeviceExtensionProperties(physical_device_, nullptr, &count, nullptr);
+  std::vector<VkExtensionProperties> available(count);
+  vkEnumerateDeviceExtensionProperties(physical_device_, nullptr, &count, available.data());
+  bool multiview_extension = false;
+  for (auto const& extension : available) {
+    if (properties2_supported_ && strcmp(extension.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0) {
+      extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+      memory_budget_supported_ = true;
+    }
+    // only asked for with several views
+    if (settings_.views > 1 && properties2_supported_ &&
+        strcmp(extension.extensionName, VK_KHR_MULTIVIEW_EXTENSION_NAME) == 0) {
+      multiview_extension = true;
+    }
+    if (settings_.views > 1 &&
+        strcmp(extension.extensionName, VK_EXT_SHADER_VIEWPORT_INDEX_LAYER_EXTENSION_NAME) == 0) {
+      extensions.push_back(VK_EXT_SHADER_VIEWPORT_INDEX_LAYER_EXTENSION_NAME);
+      layered_supported_ = true;
+    }
+  }
+
+  // the feature and the limit come through the properties2 entry points of the instance extension
+  VkPhysicalDeviceMultiviewFeaturesKHR multiview_features = {};
+  multiview_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_FEATURES_KHR;
+  if (multiview_extension) {
+    auto get_features2 = (PFN_vkGetPhysicalDeviceFeatures2KHR) vkGetInstanceProcAddr(
+            instance_, "vkGetPhysicalDeviceFeatures2KHR");
+    auto get_properties2 = (PFN_vkGetPhysicalDeviceProperties2KHR) vkGetInstanceProcAddr(
+            instance_, "vkGetPhysicalDeviceProperties2KHR");
+    VkPhysicalDeviceFeatures2KHR features2 = {};
+    features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+    features2.pNext = &multiview_features;
+    VkPhysicalDeviceMultiviewPropertiesKHR multiview_properties = {};
+    multiview_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_PROPERTIES_KHR;
+    VkPhysicalDeviceProperties2KHR properties2 = {};
+    properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+    properties2.pNext = &multiview_properties;
+    if (get_features2 != nullptr && get_properties2 != nullptr) {
+      get_features2(physical_device_, &features2);
+      get_properties2(physical_device_, &properties2);
+    }
+    if (multiview_features.multiview == VK_TRUE) {
+      // nothing else of the extension is used
+      multiview_features = {};
+      multiview_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_FEATURES_KHR;
+      multiview_features.multiview = VK_TRUE;
+      create_info.pNext = &multiview_features;
+      extensions.push_back(VK_KHR_MULTIVIEW_EXTENSION_NAME);
+      max_multiview_views_ = multiview_properties.maxMultiviewViewCount;
+    }
+  }
+  create_info.enabledExtensionCount = extensions.size();
+  create_info.ppEnabledExtensionNames = extensions.data();
 
   // Set the validation layers, if are on DEBUG
   if (enable_validation_) {
@@ -206,7 +911,24 @@ void Vulkan::createLogicalDevice() {
 
   vkGetDeviceQueue(device_, indices.graphics_family, 0, &graphics_queue_);
   vkGetDeviceQueue(device_, indices.presentation_family, 0, &presentation_queue_);
-  std::cout << "Logical device creation completed successfully.\n";
+  vkGetDeviceQueue(device_, indices.transfer_family, 0, &transfer_queue_);
+  if (async_compute_) {
+    vkGetDeviceQueue(device_, indices.compute_family, compute_queue_index, &compute_queue_);
+    LOG_INFO("Using async compute queue " << compute_queue_index << " of family " << indices.compute_family
+             << ".");
+  } else {
+    compute_queue_ = graphics_queue_;
+    LOG_INFO("No async compute queue, compute work runs on the graphics queue.");
+  }
+
+  memory_budget_.init(instance_, physical_device_, memory_budget_supported_);
+  for (uint32_t h = 0; h < memory_budget_.heaps().size(); h++) {
+    HeapBudget const& heap = memory_budget_.heaps()[h];
+    LOG_INFO("Memory heap " << h << (heap.device_local ? " (device local)" : "") << ": "
+             << heap.size / (1024 * 1024) << " MB, budget " << heap.budget / (1024 * 1024) << " MB"
+             << (memory_budget_.exact() ? "" : " (no VK_EXT_memory_budget, the heap size)") << ".");
+  }
+  LOG_INFO("Logical device creation completed successfully.");
 }
 
 void Vulkan::createSurface() {
@@ -223,8 +945,10 @@ void Vulkan::createSwapChain() {
   VkPresentModeKHR mode = chooseSwapPresentMode(sc_support.present_modes);
   VkExtent2D extent = chooseSwapExtent(sc_support.capabilities);
 
-  // We want triple-buffering (but respect the max numbers of images)
-  uint32_t image_count = sc_support.capabilities.minImageCount + 1;
+  // As many images as the device profile asks for, at least one more than the minimum (but respect the max numbers
+  // of images); the submit thread gets one more, so it can acquire the next image while the main thread uses one
+  uint32_t image_count = std::max(profile_.image_count, sc_support.capabilities.minImageCount + 1) +
+                         (settings_.submit_thread ? 1 : 0);
   if (sc_support.capabilities.maxImageCount > 0 && image_count > sc_support.capabilities.maxImageCount) {
     image_count = sc_support.capabilities.maxImageCount;
   }
@@ -239,6 +963,16 @@ void Vulkan::createSwapChain() {
   info.presentMode = mode;
   info.imageExtent = extent;
   info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+  // the readback copies the frames out of the swapchain images
+  if (settings_.readback_interval > 0 &&
+      (sc_support.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT)) {
+    info.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+  }
+  // the dynamic resolution and the views blit the scene into them
+  if ((settings_.dynamic_resolution || settings_.views > 1) &&
+      (sc_support.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT)) {
+    info.imageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+  }
   info.imageArrayLayers = 1; // amount of layers in each image
 
   // we don't want any transformation for now
@@ -271,13 +1005,17 @@ void Vulkan::createSwapChain() {
     throw std::runtime_error("failed to create swap chain!");
   }
 
-  std::cout << "Created swap chain successfully.\n";
+  LOG_INFO("Created swap chain successfully.");
   vkGetSwapchainImagesKHR(device_, swapchain_, &image_count, nullptr);
   swapchain_images_.resize(image_count);
   vkGetSwapchainImagesKHR(device_, swapchain_, &image_count, swapchain_images_.data());
 
   swapchain_format_ = format.format;
   swapchain_extent_ = extent;
+  swapchain_usage_ = info.imageUsage;
+
+  // acquiring more than that could block forever
+  max_acquired_images_ = std::max(1u, image_count - sc_support.capabilities.minImageCount);
 }
 
 
@@ -285,402 +1023,4032 @@ void Vulkan::createSwapChain() {
 void Vulkan::createImageViews() {
   sc_image_views_.resize(swapchain_images_.size(), VDeleter<VkImageView>{device_, vkDestroyImageView});
   for(size_t i = 0; i < swapchain_images_.size(); i++) {
-    VkImageViewCreateInfo info = {};
-    info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-    info.format = swapchain_format_;
-    info.image = swapchain_images_[i];
-    info.viewType = VK_IMAGE_VIEW_TYPE_2D;
-    // default mapping:
-    info.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-    info.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-    info.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-    info.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
-    info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    info.subresourceRange.baseMipLevel = 0;
-    info.subresourceRange.layerCount = 1;
-    info.subresourceRange.levelCount = 1;
-    info.subresourceRange.baseArrayLayer = 0;
-    if (vkCreateImageView(device_, &info, nullptr, sc_image_views_[i].replace()) != VK_SUCCESS) {
-      throw std::runtime_error("failed to create image views!");
-    }
+    createImageView(swapchain_images_[i], swapchain_format_, VK_IMAGE_ASPECT_COLOR_BIT, sc_image_views_[i]);
   }
-  std::cout << "Created " << swapchain_images_.size() << " image views successfully.\n";
+  LOG_INFO("Created " << swapchain_images_.size() << " image views successfully.");
 }
 
+bool Vulkan::canBlitToSwapchain() const {
+  VkFormatProperties format_properties;
+  vkGetPhysicalDeviceFormatProperties(physical_device_, swapchain_format_, &format_properties);
+  VkFormatFeatureFlags blit = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT;
+  return (swapchain_usage_ & VK_IMAGE_USAGE_TRANSFER_DST_BIT) &&
+         (format_properties.optimalTilingFeatures & blit) == blit;
+}
 
-void Vulkan::createGraphicsPipeline() {
-  auto vert_shader_source = util::readFile("shaders/vert.spv");
-  auto frag_shader_source = util::readFile("shaders/frag.spv");
+/*
+ * Decide how the views of the settings are rendered, before anything is sized for them:
+ * all in the views of a multiview render pass, instanced into the layers of the targets,
+ * or only one. They are rendered into layers either way, which are blitted side by side.
+ */
+void Vulkan::chooseViews() {
+  if (settings_.views <= 1) {
+    return;
+  }
+  if (!canBlitToSwapchain()) {
+    LOG_WARNING("Swapchain images can't be blitted to, rendering a single view.");
+    return;
+  }
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physical_device_, &properties);
+  // a view per bit of the view masks, and at least a pixel wide
+  uint32_t limit = std::min(32u, swapchain_extent_.width);
+  if (max_multiview_views_ > 1) {
+    views_ = std::min({settings_.views, max_multiview_views_, limit});
+    multiview_ = true;
+  } else if (layered_supported_) {
+    views_ = std::min({settings_.views, properties.limits.maxFramebufferLayers, properties.limits.maxImageArrayLayers,
+                       limit});
+    view_instances_ = views_;
+  } else {
+    LOG_WARNING("Neither VK_KHR_multiview nor VK_EXT_shader_viewport_index_layer, rendering a single view.");
+    return;
+  }
+  LOG_INFO("Rendering " << views_ << " views " << (multiview_ ? "with multiview" : "instanced into layers")
+           << (views_ < settings_.views ? ", the device has no more" : "") << ".");
+}
 
+/*
+ * create a 2D view on the whole image
+ */
+void Vulkan::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect,
+                             VDeleter<VkImageView>& view) {
+  VkImageViewCreateInfo info = {};
+  info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  info.format = format;
+  info.image = image;
+  info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  // default mapping:
+  info.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+  info.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+  info.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+  info.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+  info.subresourceRange.aspectMask = aspect;
+  info.subresourceRange.baseMipLevel = 0;
+  info.subresourceRange.layerCount = 1;
+  info.subresourceRange.levelCount = 1;
+  info.subresourceRange.baseArrayLayer = 0;
+  if (vkCreateImageView(device_, &info, nullptr, view.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create image views!");
+  }
+}
 
-  VDeleter<VkShaderModule> vert_shader_module{device_, vkDestroyShaderModule};
-  VDeleter<VkShaderModule> frag_shader_module{device_, vkDestroyShaderModule};
+/*
+ * create a 2D image and bind it to freshly allocated memory
+ */
+void Vulkan::createImage(uint32_t width, uint32_t height, VkFormat format, VkSampleCountFlagBits samples,
+                         VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties,
+                         VDeleter<VkImage>& image, VDeleter<VkDeviceMemory>& memory, uint32_t layers) {
+  VkImageCreateInfo info = {};
+  info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  info.imageType = VK_IMAGE_TYPE_2D;
+  info.extent.width = width;
+  info.extent.height = height;
+  info.extent.depth = 1;
+  info.mipLevels = 1;
+  info.arrayLayers = layers;
+  info.format = format;
+  info.tiling = tiling;
+  info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  info.usage = usage;
+  info.samples = samples;
+  info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  if (vkCreateImage(device_, &info, nullptr, image.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create image!");
+  }
 
-  createShaderModule(vert_shader_source, vert_shader_module);
-  createShaderModule(frag_shader_source, frag_shader_module);
+  VkMemoryRequirements requirements;
+  vkGetImageMemoryRequirements(device_, image, &requirements);
 
-  // specify shader module in graphics pipeline
-  VkPipelineShaderStageCreateInfo vert_stage_info = {};
-  vert_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-  vert_stage_info.module = vert_shader_module;
-  vert_stage_info.pName = "main";
-  vert_stage_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
+  VkMemoryAllocateInfo alloc_info = {};
+  alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  alloc_info.allocationSize = requirements.size;
 
-  // specify fragment shader in graphics pipeline
-  VkPipelineShaderStageCreateInfo frag_stage_info = {};
-  frag_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-  frag_stage_info.module = frag_shader_module;
-  frag_stage_info.pName = "main";
-  frag_stage_info.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+  // Transient attachments never leave the render pass, on tilers they can live
+  // in tile memory completely if we give them lazily allocated memory
+  if (!(usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) ||
+      !findMemoryType(requirements.memoryTypeBits, properties | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT,
+                      alloc_info.memoryTypeIndex)) {
+    alloc_info.memoryTypeIndex = findMemoryType(requirements.memoryTypeBits, properties);
+  }
 
-  VkPipelineShaderStageCreateInfo shader_stages[] = {vert_stage_info, frag_stage_info};
+  if (allocateMemory(alloc_info, memory) != VK_SUCCESS) {
+    throw std::runtime_error("failed to allocate image memory!");
+  }
 
+  vkBindImageMemory(device_, image, memory, 0);
+}
 
-  VkPipelineVertexInputStateCreateInfo vertex_input_info = {};
-  vertex_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+/*
+ * create a buffer and bind it to freshly allocated memory
+ * concurrent buffers can be used by all our queue families without ownership transfers
+ */
+void Vulkan::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
+                          bool concurrent, VDeleter<VkBuffer>& buffer, VDeleter<VkDeviceMemory>& memory) {
+  QueueFamilyIndices indices = findQueueFamilies(physical_device_);
+  std::set<uint32_t> unique_families = {
+          uint32_t(indices.graphics_family),
+          uint32_t(indices.compute_family),
+          uint32_t(indices.transfer_family),
+  };
+  std::vector<uint32_t> families(unique_families.begin(), unique_families.end());
+
+  VkBufferCreateInfo info = {};
+  info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  info.size = size;
+  info.usage = usage;
+  if (concurrent && families.size() > 1) {
+    info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+    info.queueFamilyIndexCount = families.size();
+    info.pQueueFamilyIndices = families.data();
+  } else {
+    info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  }
 
-  // We don't load vertex data for now, we specify directly in the shaders
-  // We'll change this later :)
-  vertex_input_info.vertexAttributeDescriptionCount = 0;
-  vertex_input_info.pVertexAttributeDescriptions = nullptr;
-  vertex_input_info.vertexBindingDescriptionCount = 0;
-  vertex_input_info.pVertexBindingDescriptions = nullptr;
+  if (vkCreateBuffer(device_, &info, nullptr, buffer.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create buffer!");
+  }
 
-  VkPipelineInputAssemblyStateCreateInfo input_assembly = {};
-  input_assembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-  input_assembly.primitiveRestartEnable = VK_FALSE; // used for element buffers
-  input_assembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST; // just triangles for now
+  VkMemoryRequirements requirements;
+  vkGetBufferMemoryRequirements(device_, buffer, &requirements);
+
+  VkMemoryAllocateInfo alloc_info = {};
+  alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  alloc_info.allocationSize = requirements.size;
+  alloc_info.memoryTypeIndex = findMemoryType(requirements.memoryTypeBits, properties);
+
+  VkResult result = allocateMemory(alloc_info, memory);
+  // slower, but better than failing: the buffer in any memory it can live in (with the other properties)
+  VkMemoryPropertyFlags fallback = properties & ~VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+  if (result == VK_ERROR_OUT_OF_DEVICE_MEMORY && fallback != properties &&
+      findMemoryType(requirements.memoryTypeBits, fallback, alloc_info.memoryTypeIndex)) {
+    LOG_WARNING("Out of device memory, a buffer of " << size << " bytes is placed in memory type "
+                << alloc_info.memoryTypeIndex << " instead.");
+    result = allocateMemory(alloc_info, memory);
+  }
+  if (result != VK_SUCCESS) {
+    throw std::runtime_error("failed to allocate buffer memory!");
+  }
 
+  vkBindBufferMemory(device_, buffer, memory, 0);
+}
 
-  VkViewport viewport = {};
-  viewport.x = 0;
-  viewport.y = 0;
-  viewport.width = float(swapchain_extent_.width);
-  viewport.height = float(swapchain_extent_.height);
-  viewport.minDepth = 0.0f;
-  viewport.maxDepth = 1.0f;
+/*
+ * vkAllocateMemory, evicting streamable resources and trying again if the heap is full
+ */
+VkResult Vulkan::allocateMemory(VkMemoryAllocateInfo const& info, VDeleter<VkDeviceMemory>& memory) {
+  uint32_t heap = memory_budget_.heapOfType(info.memoryTypeIndex);
+  VkResult result = vkAllocateMemory(device_, &info, nullptr, memory.replace());
+  if (result == VK_ERROR_OUT_OF_DEVICE_MEMORY) {
+    std::lock_guard<std::mutex> lock(residency_mutex_);
+    if (residency_.makeRoom(heap, info.allocationSize, frame_stats_.frames, swapchain_images_.size())) {
+      result = vkAllocateMemory(device_, &info, nullptr, memory.replace());
+    }
+  }
+  if (result == VK_SUCCESS) {
+    memory_budget_.track(heap, int64_t(info.allocationSize));
+  }
+  return result;
+}
 
-  // nothing special, draw the whole fb
-  VkRect2D scissor = {};
-  scissor.offset = {0, 0};
-  scissor.extent = swapchain_extent_;
+/*
+ * find a memory type which is allowed by type_filter and has all the properties
+ */
+uint32_t Vulkan::findMemoryType(uint32_t type_filter, VkMemoryPropertyFlags properties) {
+  uint32_t type_index;
+  if (!findMemoryType(type_filter, properties, type_index)) {
+    throw std::runtime_error("failed to find suitable memory type!");
+  }
+  return type_index;
+}
 
-  // we just use one viewport and one scissor, nothing fancy here
-  VkPipelineViewportStateCreateInfo viewport_state = {};
-  viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-  viewport_state.viewportCount = 1;
-  viewport_state.pViewports = &viewport;
-  viewport_state.scissorCount = 1;
-  viewport_state.pScissors = &scissor;
+/*
+ * same as above, but returns false instead of throwing if there is no such memory type
+ */
+bool Vulkan::findMemoryType(uint32_t type_filter, VkMemoryPropertyFlags properties, uint32_t& type_index) {
+  VkPhysicalDeviceMemoryProperties memory_properties;
+  vkGetPhysicalDeviceMemoryProperties(physical_device_, &memory_properties);
+
+  for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++) {
+    if ((type_filter & (1 << i)) &&
+        (memory_properties.memoryTypes[i].propertyFlags & properties) == properties) {
+      type_index = i;
+      return true;
+    }
+  }
+  return false;
+}
 
+/*
+ * return the first format of the candidates which supports the features
+ */
+VkFormat Vulkan::findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling,
+                                     VkFormatFeatureFlags features) {
+  for (VkFormat format : candidates) {
+    VkFormatProperties properties;
+    vkGetPhysicalDeviceFormatProperties(physical_device_, format, &properties);
 
-  // perform rasterization
-  VkPipelineRasterizationStateCreateInfo rasterizer_info = {};
-  rasterizer_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-  rasterizer_info.depthClampEnable = VK_FALSE; // clamp using near & far plane
-  rasterizer_info.rasterizerDiscardEnable = VK_FALSE;
-  // determine how fragments are generated for vertices:
-  // VK_POLYGON_MODE_FILL: fill the area of the polygon with fragments
-  // VK_POLYGON_MODE_LINE: draw polygon edges as lines (requires GPU feature)
-  // VK_POLYGON_MODE_POINT: polygon vertices are drawn as points (required GPU feature)
-  rasterizer_info.polygonMode = VK_POLYGON_MODE_FILL;
-  rasterizer_info.lineWidth = 1.0f;
-  rasterizer_info.cullMode = VK_CULL_MODE_BACK_BIT; // determine face culling
-  rasterizer_info.depthBiasEnable = VK_FALSE;
+    if (tiling == VK_IMAGE_TILING_LINEAR && (properties.linearTilingFeatures & features) == features) {
+      return format;
+    } else if (tiling == VK_IMAGE_TILING_OPTIMAL && (properties.optimalTilingFeatures & features) == features) {
+      return format;
+    }
+  }
+
+  throw std::runtime_error("failed to find supported format!");
+}
+
+/*
+ * pick the most precise depth format the GPU can render to
+ */
+VkFormat Vulkan::findDepthFormat() {
+  return findSupportedFormat(
+          {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT, VK_FORMAT_D16_UNORM},
+          VK_IMAGE_TILING_OPTIMAL,
+          VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
+}
+
+/*
+ * Describe the frame as a render graph
+ * The graph owns the depth buffer and the multisampled color target and
+ * derives the layouts and dependencies of the render pass from the declared accesses
+ */
+void Vulkan::createRenderGraph() {
+  bool msaa = msaa_samples_ != VK_SAMPLE_COUNT_1_BIT;
+  depth_format_ = findDepthFormat();
+
+  // the presentation engine hands the image over through image_available_
+  ImageDesc backbuffer_desc;
+  backbuffer_desc.format = swapchain_format_;
+  backbuffer_desc.extent = swapchain_extent_;
+  backbuffer_ = render_graph_.importImage("backbuffer", backbuffer_desc, swapchain_images_,
+                                          VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                                          VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+
+  // the targets of the scene have a layer per view, as large as a view's part of the swapchain images
+  ImageDesc depth_desc;
+  depth_desc.format = depth_format_;
+  depth_desc.extent = viewExtent();
+  depth_desc.samples = msaa_samples_;
+  depth_desc.layers = views_;
+  depth_ = render_graph_.createImage("depth", depth_desc);
+
+  ImageDesc scene_desc = backbuffer_desc;
+  scene_desc.extent = viewExtent();
+  scene_desc.layers = views_;
+
+  // the effects of single pixels are subpasses after the shading, the filters need the whole image
+  pixel_effects_.clear();
+  filter_effects_.clear();
+  for (PostEffect effect : settings_.post_effects) {
+    (effect == PostEffect::Fxaa ? filter_effects_ : pixel_effects_).push_back(effect);
+  }
+  post_target_count_ = std::min<uint32_t>(2, pixel_effects_.size());
+  if (!pixel_effects_.empty()) {
+    post_format_ = findSupportedFormat({VK_FORMAT_R16G16B16A16_SFLOAT, swapchain_format_}, VK_IMAGE_TILING_OPTIMAL,
+                                       VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT |
+                                       VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BLEND_BIT);
+  }
+
+  if (msaa) {
+    ImageDesc msaa_desc = scene_desc;
+    // resolved into the first post target with pixel effects
+    msaa_desc.format = pixel_effects_.empty() ? swapchain_format_ : post_format_;
+    msaa_desc.samples = msaa_samples_;
+    msaa_color_ = render_graph_.createImage("msaa color", msaa_desc);
+  }
+
+  dynamic_resolution_ = false;
+  if (settings_.dynamic_resolution) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physical_device_, &properties);
+    if (!canBlitToSwapchain()) {
+      LOG_WARNING("Swapchain images can't be blitted to, dynamic resolution is disabled.");
+    } else if (properties.limits.timestampComputeAndGraphics != VK_TRUE) {
+      LOG_WARNING("No timestamps to measure the GPU time, dynamic resolution is disabled.");
+    } else {
+      dynamic_resolution_ = true;
+      resolution_.init(settings_.frame_time_target, settings_.min_resolution_scale, resolution_interval);
+    }
+  }
+
+  // the scene gets its own target, which is blitted into the swapchain images
+  blit_scene_ = dynamic_resolution_ || views_ > 1;
+  if (blit_scene_) {
+    VkFormatProperties format_properties;
+    vkGetPhysicalDeviceFormatProperties(physical_device_, swapchain_format_, &format_properties);
+    upscale_filter_ = (format_properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) ?
+                      VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+    scene_color_ = render_graph_.createImage("scene color", scene_desc);
+  }
+  RenderGraph::Resource scene_target = blit_scene_ ? scene_color_ : backbuffer_;
+
+  // only used inside of the scene render pass, so a tiled GPU never writes them out
+  ImageDesc post_desc = scene_desc;
+  post_desc.format = post_format_;
+  post_desc.usage = VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+  for (uint32_t t = 0; t < post_target_count_; t++) {
+    post_targets_[t] = render_graph_.createImage("post target " + std::to_string(t), post_desc);
+  }
+  filter_inputs_.clear();
+  for (size_t f = 0; f < filter_effects_.size(); f++) {
+    filter_inputs_.push_back(render_graph_.createImage("filter input " + std::to_string(f), scene_desc));
+  }
+  scene_output_ = filter_inputs_.empty() ? scene_target : filter_inputs_[0];
+
+  // one set of draw commands per swapchain image, so culling the next frame
+  // on the compute queue doesn't have to wait for the draws of the current one
+  std::vector<VkBuffer> command_buffers;
+  for (auto const& buffer : draw_command_buffers_) {
+    command_buffers.push_back(buffer);
+  }
+  drawable_data_ = render_graph_.importBuffer("drawables", {drawable_buffer_});
+  draw_commands_ = render_graph_.importBuffer("draw commands", command_buffers);
+
+  QueueFamilyIndices indices = findQueueFamilies(physical_device_);
+  render_graph_.setQueueFamilies(indices.graphics_family,
+                                 async_compute_ ? indices.compute_family : indices.graphics_family,
+                                 async_compute_);
+
+  bool particles = settings_.particle_count > 0;
+  if (particles) {
+    // the state never leaves the compute queue, so a single instance is enough:
+    // the graph orders the passes after those of the previous frame on the same queue
+    std::vector<VkBuffer> vertex_buffers, args_buffers;
+    for (size_t i = 0; i < particle_vertex_buffers_.size(); i++) {
+      vertex_buffers.push_back(particle_vertex_buffers_[i]);
+      args_buffers.push_back(particle_args_buffers_[i]);
+    }
+    particle_state_ = render_graph_.importBuffer("particles", {particle_buffer_});
+    particle_counters_ = render_graph_.importBuffer("particle counters", {particle_counter_buffer_});
+    collision_depth_data_ = render_graph_.importBuffer("collision depth", {collision_depth_buffer_});
+    particle_vertices_ = render_graph_.importBuffer("particle vertices", vertex_buffers);
+    particle_args_ = render_graph_.importBuffer("particle draw", args_buffers);
+
+    particle_emit_pass_ = render_graph_.addPass("particle emit", [this](RenderGraph::PassBuilder& pass) {
+      pass.read(particle_counters_, ResourceUsage::StorageCompute);
+      // only some of the particles are replaced
+      pass.read(particle_state_, ResourceUsage::StorageCompute);
+      pass.write(particle_state_, ResourceUsage::StorageCompute);
+      pass.write(particle_args_, ResourceUsage::StorageCompute);
+    }, [this](VkCommandBuffer cmd, uint32_t image_index) {
+      recordParticleEmitPass(cmd, image_index);
+    }, QueueType::AsyncCompute);
+
+    particle_simulate_pass_ = render_graph_.addPass("particle simulate", [this](RenderGraph::PassBuilder& pass) {
+      pass.read(particle_state_, ResourceUsage::StorageCompute);
+      pass.write(particle_state_, ResourceUsage::StorageCompute);
+      pass.read(particle_counters_, ResourceUsage::StorageCompute);
+      pass.write(particle_counters_, ResourceUsage::StorageCompute);
+      pass.read(collision_depth_data_, ResourceUsage::StorageCompute);
+      pass.write(particle_vertices_, ResourceUsage::StorageCompute);
+      pass.read(particle_args_, ResourceUsage::StorageCompute);
+      pass.write(particle_args_, ResourceUsage::StorageCompute);
+    }, [this](VkCommandBuffer cmd, uint32_t image_index) {
+      recordParticleSimulatePass(cmd, image_index);
+    }, QueueType::AsyncCompute);
+  }
+
+  if (settings_.occlusion_culling) {
+    // the depth of the occluders is sampled, it can't live in the multisampled depth buffer of the scene
+    occlusion_depth_format_ = findSupportedFormat(
+            {VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32, VK_FORMAT_D16_UNORM}, VK_IMAGE_TILING_OPTIMAL,
+            VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT);
+    ImageDesc occlusion_depth_desc;
+    occlusion_depth_desc.format = occlusion_depth_format_;
+    occlusion_depth_desc.extent = swapchain_extent_;
+    occlusion_depth_ = render_graph_.createImage("occlusion depth", occlusion_depth_desc);
+
+    // the first level has half the size of the depth buffer, rounded up, the last one is 1x1
+    pyramid_extent_ = {(swapchain_extent_.width + 1) / 2, (swapchain_extent_.height + 1) / 2};
+    pyramid_levels_ = 1;
+    while (std::max(pyramid_extent_.width, pyramid_extent_.height) >> pyramid_levels_ > 0) {
+      pyramid_levels_++;
+    }
+    ImageDesc pyramid_desc;
+    pyramid_desc.format = VK_FORMAT_R32_SFLOAT;
+    pyramid_desc.extent = pyramid_extent_;
+    pyramid_desc.mip_levels = pyramid_levels_;
+    depth_pyramid_ = render_graph_.createImage("depth pyramid", pyramid_desc);
+
+    std::vector<VkBuffer> occluder_buffers, stats_buffers;
+    for (size_t i = 0; i < occluder_command_buffers_.size(); i++) {
+      occluder_buffers.push_back(occluder_command_buffers_[i]);
+      stats_buffers.push_back(occlusion_stats_buffers_[i]);
+    }
+    // only used on the graphics queue, one frame after the other
+    visibility_ = render_graph_.importBuffer("visibility", {visibility_buffer_});
+    occluder_commands_ = render_graph_.importBuffer("occluder commands", occluder_buffers);
+    occlusion_stats_ = render_graph_.importBuffer("occlusion stats", stats_buffers);
+
+    render_graph_.addPass("occluder commands", [this](RenderGraph::PassBuilder& pass) {
+      pass.read(drawable_data_, ResourceUsage::StorageCompute);
+      pass.read(visibility_, ResourceUsage::StorageCompute);
+      pass.write(occluder_commands_, ResourceUsage::StorageCompute);
+      pass.write(occlusion_stats_, ResourceUsage::StorageCompute);
+    }, [this](VkCommandBuffer cmd, uint32_t image_index) {
+      recordOcclusionPass(cmd, image_index, 0);
+    });
+
+    occluder_pass_ = render_graph_.addPass("occluders", [this](RenderGraph::PassBuilder& pass) {
+      pass.read(occluder_commands_, ResourceUsage::IndirectArgs);
+      pass.write(occlusion_depth_, ResourceUsage::DepthAttachment);
+    }, [this](VkCommandBuffer cmd, uint32_t image_index) {
+      recordOccluderPass(cmd, image_index);
+    });
+
+    render_graph_.addPass("depth pyramid", [this](RenderGraph::PassBuilder& pass) {
+      pass.read(occlusion_depth_, ResourceUsage::SampledCompute);
+      pass.write(depth_pyramid_, ResourceUsage::StorageCompute);
+    }, [this](VkCommandBuffer cmd, uint32_t) {
+      // the pyramid is a single transient image, the same for every swapchain image
+      recordDepthPyramidPass(cmd);
+    });
+
+    render_graph_.addPass("occlusion cull", [this](RenderGraph::PassBuilder& pass) {
+      pass.read(drawable_data_, ResourceUsage::StorageCompute);
+      pass.read(depth_pyramid_, ResourceUsage::SampledCompute);
+      pass.read(visibility_, ResourceUsage::StorageCompute);
+      pass.write(visibility_, ResourceUsage::StorageCompute);
+      pass.read(occlusion_stats_, ResourceUsage::StorageCompute);
+      pass.write(occlusion_stats_, ResourceUsage::StorageCompute);
+      pass.write(draw_commands_, ResourceUsage::StorageCompute);
+    }, [this](VkCommandBuffer cmd, uint32_t image_index) {
+      recordOcclusionPass(cmd, image_index, 1);
+    });
+  } else {
+    cull_pass_ = render_graph_.addPass("cull", [this](RenderGraph::PassBuilder& pass) {
+      pass.read(drawable_data_, ResourceUsage::StorageCompute);
+      pass.write(draw_commands_, ResourceUsage::StorageCompute);
+    }, [this](VkCommandBuffer cmd, uint32_t image_index) {
+      recordCullPass(cmd, image_index);
+    }, QueueType::AsyncCompute);
+  }
+
+  // the clusters follow the camera, so the lights are binned again every frame
+  std::vector<VkBuffer> grid_buffers, index_buffers, counter_buffers;
+  for (size_t i = 0; i < light_grid_buffers_.size(); i++) {
+    grid_buffers.push_back(light_grid_buffers_[i]);
+    index_buffers.push_back(light_index_buffers_[i]);
+    counter_buffers.push_back(light_counter_buffers_[i]);
+  }
+  light_data_ = render_graph_.importBuffer("lights", {light_buffer_});
+  light_grid_ = render_graph_.importBuffer("light grid", grid_buffers);
+  light_indices_ = render_graph_.importBuffer("light indices", index_buffers);
+  light_counters_ = render_graph_.importBuffer("light counters", counter_buffers);
+
+  render_graph_.addPass("light reset", [this](RenderGraph::PassBuilder& pass) {
+    pass.write(light_counters_, ResourceUsage::TransferDst);
+  }, [this](VkCommandBuffer cmd, uint32_t image_index) {
+    recordLightResetPass(cmd, image_index);
+  }, QueueType::AsyncCompute);
+
+  render_graph_.addPass("light cull", [this](RenderGraph::PassBuilder& pass) {
+    pass.read(light_data_, ResourceUsage::StorageCompute);
+    pass.read(light_counters_, ResourceUsage::StorageCompute);
+    pass.write(light_counters_, ResourceUsage::StorageCompute);
+    pass.write(light_grid_, ResourceUsage::StorageCompute);
+    pass.write(light_indices_, ResourceUsage::StorageCompute);
+  }, [this](VkCommandBuffer cmd, uint32_t image_index) {
+    recordLightCullPass(cmd, image_index);
+  }, QueueType::AsyncCompute);
+
+  if (settings_.shadows) {
+    ImageDesc shadow_desc;
+    shadow_desc.format = shadow_format_;
+    shadow_desc.extent = {settings_.shadow_map_size, settings_.shadow_map_size};
+    shadow_desc.layers = shadow_cascade_count;
+    // the graph would discard a transient image every frame, the cache is handed from frame to frame
+    // in the layout the shading leaves it in
+    shadow_cache_ = render_graph_.importImage("shadow cache", shadow_desc, {shadow_cache_image_},
+                                              VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                                              VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                                              VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+    dynamic_shadows_ = render_graph_.createImage("dynamic shadows", shadow_desc);
+
+    shadow_pass_ = render_graph_.addPass("shadows", [this, particles](RenderGraph::PassBuilder& pass) {
+      pass.read(drawable_data_, ResourceUsage::StorageGraphics);
+      if (particles) {
+        pass.read(particle_vertices_, ResourceUsage::StorageGraphics);
+        pass.read(particle_args_, ResourceUsage::IndirectArgs);
+      }
+      // the cascades which didn't move keep their layer
+      pass.read(shadow_cache_, ResourceUsage::DepthAttachment);
+      pass.write(shadow_cache_, ResourceUsage::DepthAttachment);
+      pass.write(dynamic_shadows_, ResourceUsage::DepthAttachment);
+    }, [this](VkCommandBuffer cmd, uint32_t image_index) {
+      recordShadowPass(cmd, image_index);
+    });
+  }
+
+  // depth pre-pass, shading and the pixel effects are subpasses of the same render pass
+  scene_pass_ = render_graph_.addPass("scene", [this, msaa, particles](RenderGraph::PassBuilder& pass) {
+    pass.read(draw_commands_, ResourceUsage::IndirectArgs);
+    pass.read(light_data_, ResourceUsage::StorageGraphics);
+    pass.read(light_grid_, ResourceUsage::StorageGraphics);
+    pass.read(light_indices_, ResourceUsage::StorageGraphics);
+    if (settings_.shadows) {
+      pass.read(shadow_cache_, ResourceUsage::SampledFragment);
+      pass.read(dynamic_shadows_, ResourceUsage::SampledFragment);
+    }
+    if (particles) {
+      pass.read(particle_vertices_, ResourceUsage::StorageGraphics);
+      pass.read(particle_args_, ResourceUsage::IndirectArgs);
+    }
+    pass.write(scene_output_, ResourceUsage::ColorAttachment);
+    pass.write(depth_, ResourceUsage::DepthAttachment);
+    if (msaa) {
+      pass.write(msaa_color_, ResourceUsage::ColorAttachment);
+    }
+    for (uint32_t t = 0; t < post_target_count_; t++) {
+      pass.write(post_targets_[t], ResourceUsage::ColorAttachment);
+    }
+  }, [this](VkCommandBuffer cmd, uint32_t image_index) {
+    recordScenePass(cmd, image_index);
+  });
+
+  // the filters sample the neighbours of a pixel, which a subpass can't, so each is a render pass of its own
+  filter_passes_.clear();
+  for (uint32_t f = 0; f < filter_effects_.size(); f++) {
+    filter_passes_.push_back(render_graph_.addPass("filter " + std::to_string(f), [this, f](
+            RenderGraph::PassBuilder& pass) {
+      pass.read(filter_inputs_[f], ResourceUsage::SampledFragment);
+      pass.write(filterOutput(f), ResourceUsage::ColorAttachment);
+    }, [this, f](VkCommandBuffer cmd, uint32_t image_index) {
+      recordFilterPass(cmd, image_index, f);
+    }));
+  }
+
+  if (blit_scene_) {
+    render_graph_.addPass(dynamic_resolution_ ? "upscale" : "views", [this](RenderGraph::PassBuilder& pass) {
+      pass.read(scene_color_, ResourceUsage::TransferSrc);
+      pass.write(backbuffer_, ResourceUsage::TransferDst);
+    }, [this](VkCommandBuffer cmd, uint32_t image_index) {
+      recordUpscalePass(cmd, image_index);
+    });
+
+    // the text stays sharp, whatever the resolution of the scene
+    if (settings_.overlay) {
+      overlay_pass_ = render_graph_.addPass("overlay", [this](RenderGraph::PassBuilder& pass) {
+        pass.read(backbuffer_, ResourceUsage::ColorAttachment);
+        pass.write(backbuffer_, ResourceUsage::ColorAttachment);
+      }, [this](VkCommandBuffer cmd, uint32_t image_index) {
+        recordOverlayPass(cmd, image_index);
+      });
+    }
+  }
+
+  render_graph_.compile(physical_device_);
+}
+
+
+/*
+ * Upload the scene through the transfer queue and create the buffers
+ * the culling pass writes the draw commands to
+ */
+void Vulkan::createSceneBuffers() {
+  VkDeviceSize size = sizeof(Drawable) * drawables_.size();
+
+  VDeleter<VkBuffer> staging_buffer{device_, vkDestroyBuffer};
+  VDeleter<VkDeviceMemory> staging_memory{device_, vkFreeMemory};
+  createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+               false, staging_buffer, staging_memory);
+
+  void* data;
+  vkMapMemory(device_, staging_memory, 0, size, 0, &data);
+  memcpy(data, drawables_.data(), size);
+  vkUnmapMemory(device_, staging_memory);
+
+  // written once and then only read, so sharing it between the queues costs nothing
+  createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true, drawable_buffer_, drawable_memory_);
+
+  submitTransfer([&](VkCommandBuffer cmd) {
+    VkBufferCopy region = {};
+    region.size = size;
+    vkCmdCopyBuffer(cmd, staging_buffer, drawable_buffer_, 1, &region);
+  }, "scene upload");
+
+  draw_command_buffers_.resize(swapchain_images_.size(), VDeleter<VkBuffer>{device_, vkDestroyBuffer});
+  draw_command_memory_.resize(swapchain_images_.size(), VDeleter<VkDeviceMemory>{device_, vkFreeMemory});
+  for (size_t i = 0; i < swapchain_images_.size(); i++) {
+    createBuffer(sizeof(VkDrawIndirectCommand) * drawables_.size(),
+                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false,
+                 draw_command_buffers_[i], draw_command_memory_[i]);
+  }
+
+  // small and rewritten every frame, read straight from host memory by both queues:
+  // the camera covering all views, then one per view
+  view_buffers_.resize(swapchain_images_.size(), VDeleter<VkBuffer>{device_, vkDestroyBuffer});
+  view_memory_.resize(swapchain_images_.size(), VDeleter<VkDeviceMemory>{device_, vkFreeMemory});
+  view_mapped_.resize(swapchain_images_.size());
+  VkDeviceSize view_size = sizeof(View) * (1 + views_);
+  for (size_t i = 0; i < swapchain_images_.size(); i++) {
+    createBuffer(view_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, true,
+                 view_buffers_[i], view_memory_[i]);
+    vkMapMemory(device_, view_memory_[i], 0, view_size, 0, &view_mapped_[i]);
+    for (uint32_t v = 0; v <= views_; v++) {
+      static_cast<View*>(view_mapped_[i])[v] = identity_view;
+    }
+  }
+
+  LOG_INFO("Uploaded scene on transfer queue family " << findQueueFamilies(physical_device_).transfer_family << ".");
+}
+
+/*
+ * Upload the lights like the scene and create the clusters and light index lists
+ * the light culling writes per swapchain image
+ */
+void Vulkan::createLightBuffers() {
+  // an empty buffer can't be bound, without lights the shaders just never read it
+  VkDeviceSize size = sizeof(Light) * std::max<size_t>(1, lights_.size());
+  createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true, light_buffer_, light_memory_);
+
+  if (!lights_.empty()) {
+    VDeleter<VkBuffer> staging_buffer{device_, vkDestroyBuffer};
+    VDeleter<VkDeviceMemory> staging_memory{device_, vkFreeMemory};
+    createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 false, staging_buffer, staging_memory);
+
+    void* data;
+    vkMapMemory(device_, staging_memory, 0, size, 0, &data);
+    memcpy(data, lights_.data(), size);
+    vkUnmapMemory(device_, staging_memory);
+
+    submitTransfer([&](VkCommandBuffer cmd) {
+      VkBufferCopy region = {};
+      region.size = size;
+      vkCmdCopyBuffer(cmd, staging_buffer, light_buffer_, 1, &region);
+    }, "light upload");
+  }
+
+  uint32_t clusters = light_tiles_x * light_tiles_y * light_slices;
+  light_params_.light_count = lights_.size();
+  light_params_.capacity = clusters * average_cluster_lights;
+
+  // written on the compute queue and read by the shading, like the draw commands
+  size_t images = swapchain_images_.size();
+  light_grid_buffers_.resize(images, VDeleter<VkBuffer>{device_, vkDestroyBuffer});
+  light_grid_memory_.resize(images, VDeleter<VkDeviceMemory>{device_, vkFreeMemory});
+  light_index_buffers_.resize(images, VDeleter<VkBuffer>{device_, vkDestroyBuffer});
+  light_index_memory_.resize(images, VDeleter<VkDeviceMemory>{device_, vkFreeMemory});
+  light_counter_buffers_.resize(images, VDeleter<VkBuffer>{device_, vkDestroyBuffer});
+  light_counter_memory_.resize(images, VDeleter<VkDeviceMemory>{device_, vkFreeMemory});
+  for (size_t i = 0; i < images; i++) {
+    createBuffer(2 * sizeof(uint32_t) * clusters, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false, light_grid_buffers_[i], light_grid_memory_[i]);
+    createBuffer(sizeof(uint32_t) * light_params_.capacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false, light_index_buffers_[i], light_index_memory_[i]);
+    createBuffer(sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false, light_counter_buffers_[i], light_counter_memory_[i]);
+  }
+
+  LOG_INFO("Created " << lights_.size() << " lights, binned into " << light_tiles_x << "x" << light_tiles_y
+           << "x" << light_slices << " clusters.");
+}
+
+/*
+ * Create the particle state, zeroed so all particles are dead, the collision depth map
+ * and the vertices and the indirect draw the simulation writes per swapchain image
+ */
+void Vulkan::createParticleBuffers() {
+  if (settings_.particle_count == 0) {
+    return;
+  }
+  particle_params_.capacity = settings_.particle_count;
+  particle_params_.time_step = particle_time_step;
+  particle_params_.lifetime = settings_.particle_lifetime;
+  // rounded down, so the emitter never catches up with particles which are still alive
+  particle_params_.emit_count = std::max(1u, uint32_t(settings_.particle_count * particle_time_step /
+                                                      settings_.particle_lifetime));
+  particle_params_.depth_width = collision_depth_size;
+  particle_params_.depth_height = collision_depth_size;
+
+  // the depth map followed by a block of zeros, which is copied as often as the state needs it
+  VkDeviceSize depth_size = sizeof(float) * collision_depth_.size();
+  VkDeviceSize zeros_size = 64 * 1024;
+  VDeleter<VkBuffer> staging_buffer{device_, vkDestroyBuffer};
+  VDeleter<VkDeviceMemory> staging_memory{device_, vkFreeMemory};
+  createBuffer(depth_size + zeros_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+               false, staging_buffer, staging_memory);
+
+  void* data;
+  vkMapMemory(device_, staging_memory, 0, depth_size + zeros_size, 0, &data);
+  memcpy(data, collision_depth_.data(), depth_size);
+  memset(static_cast<char*>(data) + depth_size, 0, zeros_size);
+  vkUnmapMemory(device_, staging_memory);
+
+  // initialized on the transfer queue and then only used by the compute passes
+  VkDeviceSize state_size = particle_size * particle_params_.capacity;
+  VkDeviceSize counter_size = 2 * sizeof(uint32_t);
+  VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+  createBuffer(state_size, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true, particle_buffer_, particle_memory_);
+  createBuffer(counter_size, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true,
+               particle_counter_buffer_, particle_counter_memory_);
+  createBuffer(depth_size, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true,
+               collision_depth_buffer_, collision_depth_memory_);
+
+  submitTransfer([&](VkCommandBuffer cmd) {
+    VkBufferCopy region = {};
+    region.size = depth_size;
+    vkCmdCopyBuffer(cmd, staging_buffer, collision_depth_buffer_, 1, &region);
+
+    std::vector<VkBufferCopy> zero_regions;
+    for (VkDeviceSize offset = 0; offset < state_size; offset += zeros_size) {
+      VkBufferCopy zeros = {};
+      zeros.srcOffset = depth_size;
+      zeros.dstOffset = offset;
+      zeros.size = std::min(zeros_size, state_size - offset);
+      zero_regions.push_back(zeros);
+    }
+    vkCmdCopyBuffer(cmd, staging_buffer, particle_buffer_, zero_regions.size(), zero_regions.data());
+
+    region.srcOffset = depth_size;
+    region.size = counter_size;
+    vkCmdCopyBuffer(cmd, staging_buffer, particle_counter_buffer_, 1, &region);
+  }, "particle upload");
+
+  particle_vertex_buffers_.resize(swapchain_images_.size(), VDeleter<VkBuffer>{device_, vkDestroyBuffer});
+  particle_vertex_memory_.resize(swapchain_images_.size(), VDeleter<VkDeviceMemory>{device_, vkFreeMemory});
+  particle_args_buffers_.resize(swapchain_images_.size(), VDeleter<VkBuffer>{device_, vkDestroyBuffer});
+  particle_args_memory_.resize(swapchain_images_.size(), VDeleter<VkDeviceMemory>{device_, vkFreeMemory});
+  for (size_t i = 0; i < swapchain_images_.size(); i++) {
+    createBuffer(particle_vertex_size * particle_params_.capacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false,
+                 particle_vertex_buffers_[i], particle_vertex_memory_[i]);
+    createBuffer(sizeof(VkDrawIndirectCommand),
+                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false,
+                 particle_args_buffers_[i], particle_args_memory_[i]);
+  }
+
+  LOG_INFO("Created " << particle_params_.capacity << " particles, " << particle_params_.emit_count
+           << " emitted per frame.");
+}
+
+/*
+ * Create the buffers of the occlusion culling: the visibility of the last frame,
+ * zeroed so the first frame has no occluders, and the draws of the occluders and
+ * the statistics per swapchain image
+ */
+void Vulkan::createOcclusionBuffers() {
+  if (!settings_.occlusion_culling) {
+    return;
+  }
+
+  // copied, vkCmdFillBuffer isn't available on transfer queues without VK_KHR_maintenance1
+  VkDeviceSize visibility_size = sizeof(uint32_t) * drawables_.size();
+  VDeleter<VkBuffer> staging_buffer{device_, vkDestroyBuffer};
+  VDeleter<VkDeviceMemory> staging_memory{device_, vkFreeMemory};
+  createBuffer(visibility_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+               false, staging_buffer, staging_memory);
+  void* data;
+  vkMapMemory(device_, staging_memory, 0, visibility_size, 0, &data);
+  memset(data, 0, visibility_size);
+  vkUnmapMemory(device_, staging_memory);
+
+  createBuffer(visibility_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true, visibility_buffer_, visibility_memory_);
+  submitTransfer([&](VkCommandBuffer cmd) {
+    VkBufferCopy region = {};
+    region.size = visibility_size;
+    vkCmdCopyBuffer(cmd, staging_buffer, visibility_buffer_, 1, &region);
+  }, "visibility upload");
+
+  size_t images = swapchain_images_.size();
+  occluder_command_buffers_.resize(images, VDeleter<VkBuffer>{device_, vkDestroyBuffer});
+  occluder_command_memory_.resize(images, VDeleter<VkDeviceMemory>{device_, vkFreeMemory});
+  occlusion_stats_buffers_.resize(images, VDeleter<VkBuffer>{device_, vkDestroyBuffer});
+  occlusion_stats_memory_.resize(images, VDeleter<VkDeviceMemory>{device_, vkFreeMemory});
+  occlusion_stats_mapped_.resize(images);
+  for (size_t i = 0; i < images; i++) {
+    createBuffer(sizeof(VkDrawIndirectCommand) * drawables_.size(),
+                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false,
+                 occluder_command_buffers_[i], occluder_command_memory_[i]);
+    createBuffer(sizeof(OcclusionStats), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, false,
+                 occlusion_stats_buffers_[i], occlusion_stats_memory_[i]);
+    vkMapMemory(device_, occlusion_stats_memory_[i], 0, sizeof(OcclusionStats), 0, &occlusion_stats_mapped_[i]);
+    memset(occlusion_stats_mapped_[i], 0, sizeof(OcclusionStats));
+  }
+}
+
+/*
+ * Create the pool of the world cells, cleared on the graphics queue which copies into it later,
+ * the upload ring the cells are decoded into and the command buffers of the copies
+ */
+void Vulkan::createWorldBuffers() {
+  if (!world_.isOpen()) {
+    return;
+  }
+
+  QueueFamilyIndices indices = findQueueFamilies(physical_device_);
+  VkDeviceSize pool_size = world_.slots() * world_.slotSize();
+  createBuffer(pool_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false, world_buffer_, world_memory_);
+  submitOnce(graphics_queue_, indices.graphics_family, [this](VkCommandBuffer cmd) {
+    vkCmdFillBuffer(cmd, world_buffer_, 0, VK_WHOLE_SIZE, 0);
+  }, "world pool clear");
+
+  // a frame never copies more than the whole pool, a ring of the budget per swapchain image
+  // lets every frame in flight use all of it
+  VkDeviceSize frame_budget = std::min(profile_.staging_budget, pool_size);
+  VkDeviceSize ring_size = frame_budget * swapchain_images_.size();
+  createBuffer(ring_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, false,
+               upload_buffer_, upload_memory_);
+  void* ring;
+  vkMapMemory(device_, upload_memory_, 0, ring_size, 0, &ring);
+  upload_ring_.init(ring, ring_size, frame_budget);
+  // a frame evicts and copies at most a cell per read
+  world_clears_.reserve(world_.reader().capacity());
+  world_uploads_.reserve(world_.reader().capacity());
+
+  VkCommandPoolCreateInfo pool_info = {};
+  pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  pool_info.queueFamilyIndex = indices.graphics_family;
+  pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  if (vkCreateCommandPool(device_, &pool_info, nullptr, upload_command_pool_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create upload command pool");
+  }
+  upload_command_buffers_.resize(swapchain_images_.size());
+  VkCommandBufferAllocateInfo alloc_info = {};
+  alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  alloc_info.commandPool = upload_command_pool_;
+  alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  alloc_info.commandBufferCount = upload_command_buffers_.size();
+  if (vkAllocateCommandBuffers(device_, &alloc_info, upload_command_buffers_.data()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to allocate upload command buffers");
+  }
+  LOG_INFO("Created world pool of " << (pool_size >> 10) << " KiB and upload ring of " << (ring_size >> 10)
+           << " KiB.");
+}
+
+/*
+ * Record commands on the transfer queue and wait for them, for the uploads at init
+ */
+void Vulkan::submitTransfer(std::function<void(VkCommandBuffer)> const& record, std::string const& what) {
+  submitOnce(transfer_queue_, findQueueFamilies(physical_device_).transfer_family, record, what);
+}
+
+void Vulkan::submitOnce(VkQueue queue, uint32_t queue_family, std::function<void(VkCommandBuffer)> const& record,
+                        std::string const& what) {
+  VDeleter<VkCommandPool> pool{device_, vkDestroyCommandPool};
+  VkCommandPoolCreateInfo pool_info = {};
+  pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  pool_info.queueFamilyIndex = queue_family;
+  pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+  if (vkCreateCommandPool(device_, &pool_info, nullptr, pool.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create command pool for " + what);
+  }
+
+  VkCommandBufferAllocateInfo alloc_info = {};
+  alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  alloc_info.commandBufferCount = 1;
+  alloc_info.commandPool = pool;
+  alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  VkCommandBuffer cmd;
+  if (vkAllocateCommandBuffers(device_, &alloc_info, &cmd) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to allocate command buffer for " + what);
+  }
+
+  VkCommandBufferBeginInfo begin_info = {};
+  begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  vkBeginCommandBuffer(cmd, &begin_info);
+  record(cmd);
+  vkEndCommandBuffer(cmd);
+
+  VkSubmitInfo submit_info = {};
+  submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit_info.commandBufferCount = 1;
+  submit_info.pCommandBuffers = &cmd;
+  if (vkQueueSubmit(queue, 1, &submit_info, VK_NULL_HANDLE) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to submit " + what);
+  }
+  vkQueueWaitIdle(queue);
+}
+
+/*
+ * The culling pass gets the scene and the draw commands of its swapchain image,
+ * the light culling and the shading the lights and the clusters of theirs,
+ * the particle passes the particles and the vertices and draw of theirs
+ */
+void Vulkan::createDescriptorSets() {
+  // drawables, draw commands and the view, see cull.comp
+  VkDescriptorSetLayoutBinding bindings[3] = {};
+  for (uint32_t i = 0; i < 3; i++) {
+    bindings[i].binding = i;
+    bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[i].descriptorCount = 1;
+    bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  }
+
+  VkDescriptorSetLayoutCreateInfo layout_info = {};
+  layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layout_info.bindingCount = 3;
+  layout_info.pBindings = bindings;
+  if (vkCreateDescriptorSetLayout(device_, &layout_info, nullptr, cull_set_layout_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create descriptor set layout");
+  }
+
+  // the view, the lights, the clusters and their light indices, for the scene pipelines, see first.frag,
+  // and the pool of the streamed world, see world.vert
+  VkDescriptorSetLayoutBinding view_bindings[5] = {};
+  for (uint32_t i = 0; i < 5; i++) {
+    view_bindings[i].binding = i;
+    view_bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    view_bindings[i].descriptorCount = 1;
+    view_bindings[i].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+  }
+  view_bindings[0].stageFlags |= VK_SHADER_STAGE_VERTEX_BIT;
+  view_bindings[4].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  layout_info.bindingCount = world_.isOpen() ? 5 : 4;
+  layout_info.pBindings = view_bindings;
+  if (vkCreateDescriptorSetLayout(device_, &layout_info, nullptr, view_set_layout_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create view descriptor set layout");
+  }
+
+  // the same and the counter of the light indices, see lights.comp
+  VkDescriptorSetLayoutBinding light_bindings[5] = {};
+  for (uint32_t i = 0; i < 5; i++) {
+    light_bindings[i].binding = i;
+    light_bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    light_bindings[i].descriptorCount = 1;
+    light_bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  }
+  layout_info.bindingCount = 5;
+  layout_info.pBindings = light_bindings;
+  if (vkCreateDescriptorSetLayout(device_, &layout_info, nullptr, light_set_layout_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create light descriptor set layout");
+  }
+
+  uint32_t set_count = swapchain_images_.size();
+  VkDescriptorPoolSize pool_size = {};
+  pool_size.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  pool_size.descriptorCount = (3 + 5 + 5 + 6) * set_count;
+
+  VkDescriptorPoolCreateInfo pool_info = {};
+  pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  pool_info.maxSets = 4 * set_count;
+  pool_info.poolSizeCount = 1;
+  pool_info.pPoolSizes = &pool_size;
+  if (vkCreateDescriptorPool(device_, &pool_info, nullptr, descriptor_pool_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create descriptor pool");
+  }
+
+  std::vector<VkDescriptorSetLayout> layouts(set_count, cull_set_layout_);
+  VkDescriptorSetAllocateInfo alloc_info = {};
+  alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  alloc_info.descriptorPool = descriptor_pool_;
+  alloc_info.descriptorSetCount = set_count;
+  alloc_info.pSetLayouts = layouts.data();
+  cull_sets_.resize(set_count);
+  if (vkAllocateDescriptorSets(device_, &alloc_info, cull_sets_.data()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to allocate descriptor sets");
+  }
+
+  layouts.assign(set_count, view_set_layout_);
+  view_sets_.resize(set_count);
+  if (vkAllocateDescriptorSets(device_, &alloc_info, view_sets_.data()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to allocate view descriptor sets");
+  }
+
+  layouts.assign(set_count, light_set_layout_);
+  light_sets_.resize(set_count);
+  if (vkAllocateDescriptorSets(device_, &alloc_info, light_sets_.data()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to allocate light descriptor sets");
+  }
+
+  struct BufferDescriptor {
+    VkDescriptorSet set;
+    uint32_t binding;
+    VkBuffer buffer;
+  };
+  for (uint32_t i = 0; i < set_count; i++) {
+    VkBuffer view = view_buffers_[i];
+    const BufferDescriptor descriptors[13] = {
+            {cull_sets_[i], 0, drawable_buffer_}, {cull_sets_[i], 1, draw_command_buffers_[i]},
+            {cull_sets_[i], 2, view},
+            {view_sets_[i], 0, view}, {view_sets_[i], 1, light_buffer_}, {view_sets_[i], 2, light_grid_buffers_[i]},
+            {view_sets_[i], 3, light_index_buffers_[i]},
+            {light_sets_[i], 0, view}, {light_sets_[i], 1, light_buffer_}, {light_sets_[i], 2, light_grid_buffers_[i]},
+            {light_sets_[i], 3, light_index_buffers_[i]}, {light_sets_[i], 4, light_counter_buffers_[i]},
+            {view_sets_[i], 4, world_buffer_},
+    };
+
+    uint32_t count = world_.isOpen() ? 13 : 12;
+    VkDescriptorBufferInfo buffer_infos[13] = {};
+    VkWriteDescriptorSet writes[13] = {};
+    for (uint32_t b = 0; b < count; b++) {
+      buffer_infos[b].buffer = descriptors[b].buffer;
+      buffer_infos[b].range = VK_WHOLE_SIZE;
+      writes[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[b].dstSet = descriptors[b].set;
+      writes[b].dstBinding = descriptors[b].binding;
+      writes[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      writes[b].descriptorCount = 1;
+      writes[b].pBufferInfo = &buffer_infos[b];
+    }
+    vkUpdateDescriptorSets(device_, count, writes, 0, nullptr);
+  }
+  LOG_INFO("Created " << 3 * set_count << " descriptor sets successfully.");
+
+  if (settings_.particle_count == 0) {
+    return;
+  }
+
+  // state, counters, collision depth, vertices and the draw, see particle_simulate.comp
+  // the vertex shader of the draw reads the vertices and the view
+  VkDescriptorSetLayoutBinding particle_bindings[6] = {};
+  for (uint32_t i = 0; i < 6; i++) {
+    particle_bindings[i].binding = i;
+    particle_bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    particle_bindings[i].descriptorCount = 1;
+    particle_bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  }
+  particle_bindings[3].stageFlags |= VK_SHADER_STAGE_VERTEX_BIT;
+  particle_bindings[5].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+  layout_info.bindingCount = 6;
+  layout_info.pBindings = particle_bindings;
+  if (vkCreateDescriptorSetLayout(device_, &layout_info, nullptr, particle_set_layout_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create particle descriptor set layout");
+  }
+
+  layouts.assign(set_count, particle_set_layout_);
+  particle_sets_.resize(set_count);
+  if (vkAllocateDescriptorSets(device_, &alloc_info, particle_sets_.data()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to allocate particle descriptor sets");
+  }
+
+  for (uint32_t i = 0; i < set_count; i++) {
+    VkBuffer buffers[6] = {particle_buffer_, particle_counter_buffer_, collision_depth_buffer_,
+                           particle_vertex_buffers_[i], particle_args_buffers_[i], view_buffers_[i]};
+    VkDescriptorBufferInfo buffer_infos[6] = {};
+    VkWriteDescriptorSet writes[6] = {};
+    for (uint32_t b = 0; b < 6; b++) {
+      buffer_infos[b].buffer = buffers[b];
+      buffer_infos[b].range = VK_WHOLE_SIZE;
+      writes[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[b].dstSet = particle_sets_[i];
+      writes[b].dstBinding = b;
+      writes[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      writes[b].descriptorCount = 1;
+      writes[b].pBufferInfo = &buffer_infos[b];
+    }
+    vkUpdateDescriptorSets(device_, 6, writes, 0, nullptr);
+  }
+
+  // created here, as the compute and the graphics pipelines using it are created in parallel
+  VkPushConstantRange push_constant_range = {};
+  push_constant_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  push_constant_range.offset = 0;
+  push_constant_range.size = sizeof(ParticleParams);
+
+  VkPipelineLayoutCreateInfo pipeline_layout_info = {};
+  pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipeline_layout_info.setLayoutCount = 1;
+  pipeline_layout_info.pSetLayouts = &particle_set_layout_;
+  pipeline_layout_info.pushConstantRangeCount = 1;
+  pipeline_layout_info.pPushConstantRanges = &push_constant_range;
+  if (vkCreatePipelineLayout(device_, &pipeline_layout_info, nullptr,
+                             particle_pipeline_layout_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create particle pipeline layout!");
+  }
+  LOG_INFO("Created " << set_count << " particle descriptor sets successfully.");
+}
+
+void Vulkan::createComputePipeline() {
+  VDeleter<VkShaderModule> cull_shader_module{device_, vkDestroyShaderModule};
+  createShaderModule(shader_code_.at("shaders/cull.comp.spv"), cull_shader_module);
+
+  // number of drawables
+  VkPushConstantRange push_constant_range = {};
+  push_constant_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  push_constant_range.offset = 0;
+  push_constant_range.size = sizeof(uint32_t);
+
+  VkPipelineLayoutCreateInfo layout_info = {};
+  layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  layout_info.setLayoutCount = 1;
+  layout_info.pSetLayouts = &cull_set_layout_;
+  layout_info.pushConstantRangeCount = 1;
+  layout_info.pPushConstantRanges = &push_constant_range;
+  if (vkCreatePipelineLayout(device_, &layout_info, nullptr, cull_pipeline_layout_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create culling pipeline layout!");
+  }
+
+  VkComputePipelineCreateInfo pipeline_info = {};
+  pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipeline_info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipeline_info.stage.module = cull_shader_module;
+  pipeline_info.stage.pName = "main";
+  // a visible drawable has an instance per view when the views are instanced
+  ShaderVariant view_variant;
+  pipeline_info.stage.pSpecializationInfo = view_variant.set(view_count_constant, view_instances_).info();
+  pipeline_info.layout = cull_pipeline_layout_;
+  pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
+  pipeline_info.basePipelineIndex = -1;
+
+  if (vkCreateComputePipelines(device_, pipeline_cache_, 1, &pipeline_info, nullptr,
+                               cull_pipeline_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create culling pipeline");
+  }
+
+  CapturePipeline& description = frame_capture_.pipelines[cull_pipeline_index];
+  description.bind_point = VK_PIPELINE_BIND_POINT_COMPUTE;
+  description.compute_shader = "shaders/cull.comp.spv";
+  description.set_bindings = 3;
+  description.push_constant_stages = push_constant_range.stageFlags;
+  description.push_constant_size = push_constant_range.size;
+
+  LOG_INFO("Created culling pipeline successfully.");
+
+  // number of lights and room for their indices
+  VDeleter<VkShaderModule> light_shader_module{device_, vkDestroyShaderModule};
+  createShaderModule(shader_code_.at("shaders/lights.comp.spv"), light_shader_module);
+  push_constant_range.size = sizeof(LightCullParams);
+  layout_info.pSetLayouts = &light_set_layout_;
+  if (vkCreatePipelineLayout(device_, &layout_info, nullptr, light_pipeline_layout_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create light culling pipeline layout!");
+  }
+
+  pipeline_info.stage.module = light_shader_module;
+  pipeline_info.stage.pSpecializationInfo = nullptr;
+  pipeline_info.layout = light_pipeline_layout_;
+  if (vkCreateComputePipelines(device_, pipeline_cache_, 1, &pipeline_info, nullptr,
+                               light_cull_pipeline_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create light culling pipeline");
+  }
+
+  CapturePipeline& light_description = frame_capture_.pipelines[light_cull_pipeline_index];
+  light_description.bind_point = VK_PIPELINE_BIND_POINT_COMPUTE;
+  light_description.compute_shader = "shaders/lights.comp.spv";
+  light_description.set_bindings = 5;
+  light_description.push_constant_stages = push_constant_range.stageFlags;
+  light_description.push_constant_size = push_constant_range.size;
+
+  LOG_INFO("Created light culling pipeline successfully.");
+
+  if (settings_.particle_count == 0) {
+    return;
+  }
+
+  // emission and simulation share the layout and the parameters
+  const char* particle_shaders[2] = {"shaders/particle_emit.comp.spv", "shaders/particle_simulate.comp.spv"};
+  VDeleter<VkPipeline>* particle_pipelines[2] = {std::addressof(particle_emit_pipeline_),
+                                                 std::addressof(particle_simulate_pipeline_)};
+  const uint32_t particle_indices[2] = {particle_emit_pipeline_index, particle_simulate_pipeline_index};
+  for (int i = 0; i < 2; i++) {
+    VDeleter<VkShaderModule> module{device_, vkDestroyShaderModule};
+    createShaderModule(shader_code_.at(particle_shaders[i]), module);
+    pipeline_info.stage.module = module;
+    // the emission writes the instances of the draw
+    pipeline_info.stage.pSpecializationInfo = view_variant.info();
+    pipeline_info.layout = particle_pipeline_layout_;
+    if (vkCreateComputePipelines(device_, pipeline_cache_, 1, &pipeline_info, nullptr,
+                                 particle_pipelines[i]->replace()) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create particle pipeline");
+    }
+
+    CapturePipeline& particle_description = frame_capture_.pipelines[particle_indices[i]];
+    particle_description.bind_point = VK_PIPELINE_BIND_POINT_COMPUTE;
+    particle_description.compute_shader = particle_shaders[i];
+    particle_description.set_bindings = 6;
+    particle_description.push_constant_stages = VK_SHADER_STAGE_COMPUTE_BIT;
+    particle_description.push_constant_size = sizeof(ParticleParams);
+  }
+  LOG_INFO("Created particle pipelines successfully.");
+}
+
+
+/*
+ * Create what the occlusion culling needs besides its buffers: the render pass and
+ * the depth-only pipeline of the occluders, the views and descriptor sets of the
+ * levels of the depth pyramid and the compute pipelines of both phases
+ */
+void Vulkan::createOcclusionCulling() {
+  if (!settings_.occlusion_culling) {
+    return;
+  }
+
+  // one depth attachment, kept for the depth pyramid
+  VkAttachmentDescription attachment = {};
+  attachment.format = occlusion_depth_format_;
+  attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+  attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+  attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  AttachmentLayouts layouts = render_graph_.attachmentLayouts(occluder_pass_, occlusion_depth_);
+  attachment.initialLayout = layouts.initial;
+  attachment.finalLayout = layouts.final;
+
+  VkAttachmentReference depth_ref = {};
+  depth_ref.attachment = 0;
+  depth_ref.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+  VkSubpassDescription subpass = {};
+  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpass.pDepthStencilAttachment = &depth_ref;
+
+  VkSubpassDependency dependency = render_graph_.externalDependency(occluder_pass_);
+
+  VkRenderPassCreateInfo renderpass_info = {};
+  renderpass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+  renderpass_info.attachmentCount = 1;
+  renderpass_info.pAttachments = &attachment;
+  renderpass_info.subpassCount = 1;
+  renderpass_info.pSubpasses = &subpass;
+  renderpass_info.dependencyCount = 1;
+  renderpass_info.pDependencies = &dependency;
+  if (vkCreateRenderPass(device_, &renderpass_info, nullptr, occluder_renderpass_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create occluder render pass");
+  }
+
+  VkImageView depth_view = render_graph_.imageView(occlusion_depth_);
+  VkFramebufferCreateInfo framebuffer_info = {};
+  framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+  framebuffer_info.renderPass = occluder_renderpass_;
+  framebuffer_info.attachmentCount = 1;
+  framebuffer_info.pAttachments = &depth_view;
+  framebuffer_info.width = swapchain_extent_.width;
+  framebuffer_info.height = swapchain_extent_.height;
+  framebuffer_info.layers = 1;
+  if (vkCreateFramebuffer(device_, &framebuffer_info, nullptr, occluder_framebuffer_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create occluder framebuffer");
+  }
+
+  // the occluders as the depth pre-pass draws them, but without multisampling
+  VDeleter<VkShaderModule> vert_shader_module{device_, vkDestroyShaderModule};
+  createShaderModule(shader_code_.at("shaders/first.vert.spv"), vert_shader_module);
+  VkPipelineShaderStageCreateInfo vert_stage_info = {};
+  vert_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  vert_stage_info.module = vert_shader_module;
+  vert_stage_info.pName = "main";
+  vert_stage_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
+
+  VkPipelineVertexInputStateCreateInfo vertex_input_info = {};
+  vertex_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+  VkPipelineInputAssemblyStateCreateInfo input_assembly = {};
+  input_assembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+  input_assembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+  VkViewport viewport = {};
+  viewport.width = float(swapchain_extent_.width);
+  viewport.height = float(swapchain_extent_.height);
+  viewport.maxDepth = 1.0f;
+  VkRect2D scissor = {};
+  scissor.extent = swapchain_extent_;
+  VkPipelineViewportStateCreateInfo viewport_state = {};
+  viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+  viewport_state.viewportCount = 1;
+  viewport_state.pViewports = &viewport;
+  viewport_state.scissorCount = 1;
+  viewport_state.pScissors = &scissor;
+
+  VkPipelineRasterizationStateCreateInfo rasterizer_info = {};
+  rasterizer_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+  rasterizer_info.polygonMode = VK_POLYGON_MODE_FILL;
+  rasterizer_info.lineWidth = 1.0f;
+  rasterizer_info.cullMode = VK_CULL_MODE_BACK_BIT;
   rasterizer_info.frontFace = VK_FRONT_FACE_CLOCKWISE;
-  rasterizer_info.depthBiasConstantFactor = 0.0f; // Optional
-  rasterizer_info.depthBiasClamp = 0.0f; // Optional
-  rasterizer_info.depthBiasSlopeFactor = 0.0f; // Optional
 
+  VkPipelineMultisampleStateCreateInfo multisampling = {};
+  multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+  multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+  VkPipelineDepthStencilStateCreateInfo depth_stencil_info = {};
+  depth_stencil_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+  depth_stencil_info.depthTestEnable = VK_TRUE;
+  depth_stencil_info.depthWriteEnable = VK_TRUE;
+  depth_stencil_info.depthCompareOp = VK_COMPARE_OP_LESS;
+
+  VkPipelineColorBlendStateCreateInfo color_blend_info = {};
+  color_blend_info.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+
+  VkGraphicsPipelineCreateInfo pipeline_info = {};
+  pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+  pipeline_info.stageCount = 1;
+  pipeline_info.pStages = &vert_stage_info;
+  pipeline_info.pVertexInputState = &vertex_input_info;
+  pipeline_info.pInputAssemblyState = &input_assembly;
+  pipeline_info.pViewportState = &viewport_state;
+  pipeline_info.pRasterizationState = &rasterizer_info;
+  pipeline_info.pMultisampleState = &multisampling;
+  pipeline_info.pDepthStencilState = &depth_stencil_info;
+  pipeline_info.pColorBlendState = &color_blend_info;
+  pipeline_info.layout = pipeline_layout_;
+  pipeline_info.renderPass = occluder_renderpass_;
+  pipeline_info.subpass = 0;
+  pipeline_info.basePipelineIndex = -1;
+  if (vkCreateGraphicsPipelines(device_, pipeline_cache_, 1, &pipeline_info, nullptr,
+                                occluder_pipeline_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create occluder pipeline");
+  }
+
+  // front to back, so the occluders reject each other's fragments
+  DrawList draw_list;
+  for (uint32_t d = 0; d < drawables_.size(); d++) {
+    draw_list.add(DrawList::key(0, 0, no_material, drawables_[d].depth), d);
+  }
+  draw_list.sort();
+  occluder_order_.clear();
+  for (auto const& draw : draw_list.draws()) {
+    occluder_order_.push_back(draw.index);
+  }
+
+  // drawables, visibility, draw commands and statistics, see occlusion.comp, the pyramid and the view
+  VkDescriptorSetLayoutBinding bindings[6] = {};
+  for (uint32_t i = 0; i < 6; i++) {
+    bindings[i].binding = i;
+    bindings[i].descriptorType = i != 4 ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bindings[i].descriptorCount = 1;
+    bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  }
+  VkDescriptorSetLayoutCreateInfo layout_info = {};
+  layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layout_info.bindingCount = 6;
+  layout_info.pBindings = bindings;
+  if (vkCreateDescriptorSetLayout(device_, &layout_info, nullptr, occlusion_set_layout_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create occlusion descriptor set layout");
+  }
+
+  // the level above (or the depth buffer) and the level, see depth_pyramid.comp
+  bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  layout_info.bindingCount = 2;
+  if (vkCreateDescriptorSetLayout(device_, &layout_info, nullptr, pyramid_set_layout_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create depth pyramid descriptor set layout");
+  }
+
+  uint32_t occlusion_set_count = 2 * swapchain_images_.size();
+  VkDescriptorPoolSize pool_sizes[3] = {};
+  pool_sizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  pool_sizes[0].descriptorCount = 5 * occlusion_set_count;
+  pool_sizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  pool_sizes[1].descriptorCount = occlusion_set_count + pyramid_levels_;
+  pool_sizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  pool_sizes[2].descriptorCount = pyramid_levels_;
+
+  VkDescriptorPoolCreateInfo pool_info = {};
+  pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  pool_info.maxSets = occlusion_set_count + pyramid_levels_;
+  pool_info.poolSizeCount = 3;
+  pool_info.pPoolSizes = pool_sizes;
+  if (vkCreateDescriptorPool(device_, &pool_info, nullptr, occlusion_descriptor_pool_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create occlusion descriptor pool");
+  }
+
+  std::vector<VkDescriptorSetLayout> set_layouts(occlusion_set_count, occlusion_set_layout_);
+  VkDescriptorSetAllocateInfo alloc_info = {};
+  alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  alloc_info.descriptorPool = occlusion_descriptor_pool_;
+  alloc_info.descriptorSetCount = occlusion_set_count;
+  alloc_info.pSetLayouts = set_layouts.data();
+  occlusion_sets_.resize(occlusion_set_count);
+  if (vkAllocateDescriptorSets(device_, &alloc_info, occlusion_sets_.data()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to allocate occlusion descriptor sets");
+  }
+
+  set_layouts.assign(pyramid_levels_, pyramid_set_layout_);
+  alloc_info.descriptorSetCount = pyramid_levels_;
+  pyramid_sets_.resize(pyramid_levels_);
+  if (vkAllocateDescriptorSets(device_, &alloc_info, pyramid_sets_.data()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to allocate depth pyramid descriptor sets");
+  }
+
+  // only read with texelFetch, the levels are chosen by the shaders
+  VkSamplerCreateInfo sampler_info = {};
+  sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  sampler_info.magFilter = VK_FILTER_NEAREST;
+  sampler_info.minFilter = VK_FILTER_NEAREST;
+  sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  sampler_info.maxLod = float(pyramid_levels_);
+  if (vkCreateSampler(device_, &sampler_info, nullptr, pyramid_sampler_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create depth pyramid sampler");
+  }
+
+  // the first phase writes the draws of the occluders, the second those of the frame
+  for (uint32_t i = 0; i < occlusion_set_count; i++) {
+    uint32_t image = i / 2;
+    VkBuffer buffers[6] = {drawable_buffer_, visibility_buffer_,
+                           i % 2 == 0 ? occluder_command_buffers_[image] : draw_command_buffers_[image],
+                           occlusion_stats_buffers_[image], VK_NULL_HANDLE, view_buffers_[image]};
+    VkDescriptorBufferInfo buffer_infos[6] = {};
+    VkWriteDescriptorSet writes[6] = {};
+    for (uint32_t b = 0; b < 6; b++) {
+      buffer_infos[b].buffer = buffers[b];
+      buffer_infos[b].range = VK_WHOLE_SIZE;
+      writes[b].pBufferInfo = b != 4 ? &buffer_infos[b] : nullptr;
+    }
+    VkDescriptorImageInfo pyramid_info = {};
+    pyramid_info.sampler = pyramid_sampler_;
+    pyramid_info.imageView = render_graph_.imageView(depth_pyramid_);
+    pyramid_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    writes[4].pImageInfo = &pyramid_info;
+    for (uint32_t b = 0; b < 6; b++) {
+      writes[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[b].dstSet = occlusion_sets_[i];
+      writes[b].dstBinding = b;
+      writes[b].descriptorType = b != 4 ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+      writes[b].descriptorCount = 1;
+    }
+    vkUpdateDescriptorSets(device_, 6, writes, 0, nullptr);
+  }
+
+  // every level reads the one above while it is written, so both stay in the general layout
+  pyramid_views_.resize(pyramid_levels_, VDeleter<VkImageView>{device_, vkDestroyImageView});
+  for (uint32_t level = 0; level < pyramid_levels_; level++) {
+    VkImageViewCreateInfo view_info = {};
+    view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    view_info.image = render_graph_.image(depth_pyramid_);
+    view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    view_info.format = VK_FORMAT_R32_SFLOAT;
+    view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    view_info.subresourceRange.baseMipLevel = level;
+    view_info.subresourceRange.levelCount = 1;
+    view_info.subresourceRange.layerCount = 1;
+    if (vkCreateImageView(device_, &view_info, nullptr, pyramid_views_[level].replace()) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create depth pyramid view");
+    }
+
+    VkDescriptorImageInfo image_infos[2] = {};
+    image_infos[0].sampler = pyramid_sampler_;
+    image_infos[0].imageView = level == 0 ? depth_view : VkImageView(pyramid_views_[level - 1]);
+    image_infos[0].imageLayout = level == 0 ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+    image_infos[1].imageView = pyramid_views_[level];
+    image_infos[1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    VkWriteDescriptorSet writes[2] = {};
+    for (uint32_t b = 0; b < 2; b++) {
+      writes[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[b].dstSet = pyramid_sets_[level];
+      writes[b].dstBinding = b;
+      writes[b].descriptorType = bindings[b].descriptorType;
+      writes[b].descriptorCount = 1;
+      writes[b].pImageInfo = &image_infos[b];
+    }
+    vkUpdateDescriptorSets(device_, 2, writes, 0, nullptr);
+  }
+
+  // number of drawables
+  VkPushConstantRange push_constant_range = {};
+  push_constant_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  push_constant_range.size = sizeof(uint32_t);
+
+  VkPipelineLayoutCreateInfo pipeline_layout_info = {};
+  pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipeline_layout_info.setLayoutCount = 1;
+  pipeline_layout_info.pSetLayouts = &occlusion_set_layout_;
+  pipeline_layout_info.pushConstantRangeCount = 1;
+  pipeline_layout_info.pPushConstantRanges = &push_constant_range;
+  if (vkCreatePipelineLayout(device_, &pipeline_layout_info, nullptr,
+                             occlusion_pipeline_layout_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create occlusion pipeline layout!");
+  }
+
+  pipeline_layout_info.pSetLayouts = &pyramid_set_layout_;
+  pipeline_layout_info.pushConstantRangeCount = 0;
+  pipeline_layout_info.pPushConstantRanges = nullptr;
+  if (vkCreatePipelineLayout(device_, &pipeline_layout_info, nullptr,
+                             pyramid_pipeline_layout_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create depth pyramid pipeline layout!");
+  }
+
+  // occlusion.comp specialized for each phase, and the pyramid
+  occlusion_pipelines_.resize(2, VDeleter<VkPipeline>{device_, vkDestroyPipeline});
+  const char* compute_shaders[3] = {"shaders/occlusion.comp.spv", "shaders/occlusion.comp.spv",
+                                    "shaders/depth_pyramid.comp.spv"};
+  VkPipelineLayout compute_layouts[3] = {occlusion_pipeline_layout_, occlusion_pipeline_layout_,
+                                         pyramid_pipeline_layout_};
+  VDeleter<VkPipeline>* compute_pipelines[3] = {std::addressof(occlusion_pipelines_[0]),
+                                                std::addressof(occlusion_pipelines_[1]),
+                                                std::addressof(pyramid_pipeline_)};
+  for (uint32_t i = 0; i < 3; i++) {
+    VDeleter<VkShaderModule> module{device_, vkDestroyShaderModule};
+    createShaderModule(shader_code_.at(compute_shaders[i]), module);
+    ShaderVariant variant;
+    if (i < 2) {
+      variant.set(occlusion_phase_constant, i).set(view_count_constant, view_instances_);
+    }
+
+    VkComputePipelineCreateInfo compute_info = {};
+    compute_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    compute_info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    compute_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    compute_info.stage.module = module;
+    compute_info.stage.pName = "main";
+    compute_info.stage.pSpecializationInfo = variant.info();
+    compute_info.layout = compute_layouts[i];
+    compute_info.basePipelineIndex = -1;
+    if (vkCreateComputePipelines(device_, pipeline_cache_, 1, &compute_info, nullptr,
+                                 compute_pipelines[i]->replace()) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create occlusion culling pipeline");
+    }
+  }
+  LOG_INFO("Created occlusion culling with a depth pyramid of " << pyramid_levels_ << " levels, "
+           << pyramid_extent_.width << "x" << pyramid_extent_.height << " at the first.");
+}
+
+void Vulkan::createGraphicsPipeline() {
+  VDeleter<VkShaderModule> vert_shader_module{device_, vkDestroyShaderModule};
+  VDeleter<VkShaderModule> frag_shader_module{device_, vkDestroyShaderModule};
+
+  createShaderModule(shader_code_.at(viewShader("shaders/first.vert.spv")), vert_shader_module);
+  // the same lighting, with the sun shadowed
+  createShaderModule(shader_code_.at(settings_.shadows ? "shaders/shadowed.frag.spv" : "shaders/first.frag.spv"),
+                     frag_shader_module);
+
+  // specify shader module in graphics pipeline
+  VkPipelineShaderStageCreateInfo vert_stage_info = {};
+  vert_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  vert_stage_info.module = vert_shader_module;
+  vert_stage_info.pName = "main";
+  vert_stage_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
+  // the instances per draw of the layered views, the world and the particles share it
+  ShaderVariant view_variant;
+  vert_stage_info.pSpecializationInfo = view_variant.set(view_count_constant, views_).info();
+
+  // specify fragment shader in graphics pipeline
+  VkPipelineShaderStageCreateInfo frag_stage_info = {};
+  frag_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  frag_stage_info.module = frag_shader_module;
+  frag_stage_info.pName = "main";
+  frag_stage_info.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+  VkPipelineShaderStageCreateInfo shader_stages[] = {vert_stage_info, frag_stage_info};
+
+
+  VkPipelineVertexInputStateCreateInfo vertex_input_info = {};
+  vertex_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+  // We don't load vertex data for now, we specify directly in the shaders
+  // We'll change this later :)
+  vertex_input_info.vertexAttributeDescriptionCount = 0;
+  vertex_input_info.pVertexAttributeDescriptions = nullptr;
+  vertex_input_info.vertexBindingDescriptionCount = 0;
+  vertex_input_info.pVertexBindingDescriptions = nullptr;
+
+  VkPipelineInputAssemblyStateCreateInfo input_assembly = {};
+  input_assembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+  input_assembly.primitiveRestartEnable = VK_FALSE; // used for element buffers
+  input_assembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST; // just triangles for now
+
+
+  VkViewport viewport = {};
+  viewport.x = 0;
+  viewport.y = 0;
+  viewport.width = float(swapchain_extent_.width);
+  viewport.height = float(swapchain_extent_.height);
+  viewport.minDepth = 0.0f;
+  viewport.maxDepth = 1.0f;
+
+  // nothing special, draw the whole fb
+  VkRect2D scissor = {};
+  scissor.offset = {0, 0};
+  scissor.extent = swapchain_extent_;
+
+  // we just use one viewport and one scissor, nothing fancy here
+  VkPipelineViewportStateCreateInfo viewport_state = {};
+  viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+  viewport_state.viewportCount = 1;
+  viewport_state.pViewports = &viewport;
+  viewport_state.scissorCount = 1;
+  viewport_state.pScissors = &scissor;
+
+
+  // perform rasterization
+  VkPipelineRasterizationStateCreateInfo rasterizer_info = {};
+  rasterizer_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+  rasterizer_info.depthClampEnable = VK_FALSE; // clamp using near & far plane
+  rasterizer_info.rasterizerDiscardEnable = VK_FALSE;
+  // determine how fragments are generated for vertices:
+  // VK_POLYGON_MODE_FILL: fill the area of the polygon with fragments
+  // VK_POLYGON_MODE_LINE: draw polygon edges as lines (requires GPU feature)
+  // VK_POLYGON_MODE_POINT: polygon vertices are drawn as points (required GPU feature)
+  rasterizer_info.polygonMode = VK_POLYGON_MODE_FILL;
+  rasterizer_info.lineWidth = 1.0f;
+  rasterizer_info.cullMode = VK_CULL_MODE_BACK_BIT; // determine face culling
+  rasterizer_info.depthBiasEnable = VK_FALSE;
+  rasterizer_info.frontFace = VK_FRONT_FACE_CLOCKWISE;
+  rasterizer_info.depthBiasConstantFactor = 0.0f; // Optional
+  rasterizer_info.depthBiasClamp = 0.0f; // Optional
+  rasterizer_info.depthBiasSlopeFactor = 0.0f; // Optional
+
+
+
+  // perform multi-sampling
+  // the sample count has to match the attachments of the render pass
+  VkPipelineMultisampleStateCreateInfo multisampling = {};
+  multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+  multisampling.sampleShadingEnable = VK_FALSE;
+  multisampling.rasterizationSamples = msaa_samples_;
+  multisampling.minSampleShading = 1.0f; // Optional
+  multisampling.pSampleMask = nullptr; /// Optional
+  multisampling.alphaToCoverageEnable = VK_FALSE; // Optional
+  multisampling.alphaToOneEnable = VK_FALSE; // Optional
+
+
+  // With the depth pre-pass the depth buffer is already final when we shade,
+  // so only the fragment that won passes the EQUAL test and we don't write again
+  VkPipelineDepthStencilStateCreateInfo depth_stencil_info = {};
+  depth_stencil_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+  depth_stencil_info.depthTestEnable = VK_TRUE;
+  depth_stencil_info.depthWriteEnable = settings_.depth_prepass ? VK_FALSE : VK_TRUE;
+  depth_stencil_info.depthCompareOp = settings_.depth_prepass ? VK_COMPARE_OP_EQUAL : VK_COMPARE_OP_LESS;
+  depth_stencil_info.depthBoundsTestEnable = VK_FALSE;
+  depth_stencil_info.stencilTestEnable = VK_FALSE;
+
+  // perform color blending
+  // this happens after the fragment shader
+  // and combines it with the color from the framebuffer
+  VkPipelineColorBlendAttachmentState color_blend_attach = {};
+  // RGBA:
+  color_blend_attach.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+  color_blend_attach.blendEnable = VK_FALSE; // disable blending for now
+  color_blend_attach.srcColorBlendFactor = VK_BLEND_FACTOR_ONE; // Optional
+  color_blend_attach.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO; // Optional
+  color_blend_attach.colorBlendOp = VK_BLEND_OP_ADD; // Optional
+  color_blend_attach.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE; // Optional
+  color_blend_attach.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO; // Optional
+  color_blend_attach.alphaBlendOp = VK_BLEND_OP_ADD; // Optional
+
+  VkPipelineColorBlendStateCreateInfo color_blend_info = {};
+  color_blend_info.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+  color_blend_info.logicOpEnable = VK_FALSE;
+  color_blend_info.logicOp = VK_LOGIC_OP_COPY; // Optional
+  color_blend_info.attachmentCount = 1;
+  color_blend_info.pAttachments = &color_blend_attach;
+  color_blend_info.blendConstants[0] = 0.0f; // Optional
+  color_blend_info.blendConstants[1] = 0.0f; // Optional
+  color_blend_info.blendConstants[2] = 0.0f; // Optional
+  color_blend_info.blendConstants[3] = 0.0f; // Optional
+
+  // with alpha-blending enabled: see VkBlendFactor and VkBlendOp
+  //color_blend_attach.blendEnable = VK_TRUE;
+  //color_blend_attach.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+  //color_blend_attach.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+  //color_blend_attach.colorBlendOp = VK_BLEND_OP_ADD;
+  //color_blend_attach.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+  //color_blend_attach.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+  //color_blend_attach.alphaBlendOp = VK_BLEND_OP_ADD;
+
+  // Set the stuff we can change without recreating the whole graphics pipeline:
+  // the dynamic resolution renders into a part of the framebuffer, see recordScenePass
+  VkDynamicState dynamic_states[] = {
+          VK_DYNAMIC_STATE_VIEWPORT,
+          VK_DYNAMIC_STATE_SCISSOR
+  };
+
+  VkPipelineDynamicStateCreateInfo dynamic_state = {};
+  dynamic_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+  dynamic_state.dynamicStateCount = 2;
+  dynamic_state.pDynamicStates = dynamic_states;
+
+  VkPipelineLayoutCreateInfo pipeline_layout_info = {};
+  pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  // the camera and the lights, and the shadow maps
+  VkDescriptorSetLayout set_layouts[] = {view_set_layout_, shadow_set_layout_};
+  pipeline_layout_info.setLayoutCount = settings_.shadows ? 2 : 1;
+  pipeline_layout_info.pSetLayouts = set_layouts;
+
+  // placement of each triangle
+  VkPushConstantRange push_constant_range = {};
+  push_constant_range.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  push_constant_range.offset = 0;
+  push_constant_range.size = sizeof(Drawable);
+  pipeline_layout_info.pushConstantRangeCount = 1;
+  pipeline_layout_info.pPushConstantRanges = &push_constant_range;
+
+  if (vkCreatePipelineLayout(device_, &pipeline_layout_info, nullptr,
+                             pipeline_layout_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create pipeline layout!");
+  }
+
+  // finally assemble the graphics pipeline
+  VkGraphicsPipelineCreateInfo pipeline_info = {};
+  pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+
+  // number of stages, we have vertex and fragment shader currently
+  pipeline_info.stageCount = 2;
+  pipeline_info.pStages = shader_stages;
+
+  pipeline_info.pVertexInputState = &vertex_input_info;
+  pipeline_info.pInputAssemblyState = &input_assembly;
+  pipeline_info.pRasterizationState = &rasterizer_info;
+  pipeline_info.pViewportState = &viewport_state;
+  pipeline_info.pMultisampleState = &multisampling;
+  pipeline_info.pColorBlendState = &color_blend_info;
+  pipeline_info.pDepthStencilState = &depth_stencil_info;
+  pipeline_info.pDynamicState = &dynamic_state;
+
+  pipeline_info.layout = pipeline_layout_;
+
+
+  // add renderpass
+  pipeline_info.renderPass = renderpass_;
+  pipeline_info.subpass = settings_.depth_prepass ? 1 : 0; // index of subpass
+
+  // we derive from no pipeline, but the shadow and the world pipelines derive from this one
+  pipeline_info.flags = settings_.shadows || world_.isOpen() ? VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT : 0;
+  pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
+  pipeline_info.basePipelineIndex = -1;
+
+  // the pipeline cache speeds up pipeline creation, if it has the pipeline from the last run
+  if (vkCreateGraphicsPipelines(device_, pipeline_cache_, 1, &pipeline_info, nullptr, graphics_pipeline_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create graphics pipeline");
+  }
+
+  // captures only have storage buffers, they are replayed without the shadows
+  CapturePipeline& description = frame_capture_.pipelines[scene_pipeline_index];
+  description = describePipeline(pipeline_info, "shaders/first.vert.spv", "shaders/first.frag.spv", 4);
+  description.push_constant_stages = push_constant_range.stageFlags;
+  description.push_constant_size = push_constant_range.size;
+
+  LOG_INFO("Created graphics pipeline successfully.");
+
+  if (settings_.shadows) {
+    createShadowPipelines(pipeline_info);
+  }
+
+  // the streamed world: only the vertex shader differs, it takes the drawables from the pool
+  VDeleter<VkShaderModule> world_shader_module{device_, vkDestroyShaderModule};
+  VkPipelineShaderStageCreateInfo world_stages[] = {vert_stage_info, frag_stage_info};
+  if (world_.isOpen()) {
+    createShaderModule(shader_code_.at(viewShader("shaders/world.vert.spv")), world_shader_module);
+    world_stages[0].module = world_shader_module;
+    VkGraphicsPipelineCreateInfo world_info = pipeline_info;
+    world_info.flags = VK_PIPELINE_CREATE_DERIVATIVE_BIT;
+    world_info.pStages = world_stages;
+    world_info.basePipelineHandle = graphics_pipeline_;
+    if (vkCreateGraphicsPipelines(device_, pipeline_cache_, 1, &world_info, nullptr,
+                                  world_pipeline_.replace()) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create world pipeline");
+    }
+    LOG_INFO("Created world pipeline successfully.");
+  }
+
+  if (settings_.particle_count > 0) {
+    // one point per particle, tested against the scene but not writing depth, and not lit
+    VDeleter<VkShaderModule> particle_shader_module{device_, vkDestroyShaderModule};
+    VDeleter<VkShaderModule> particle_frag_module{device_, vkDestroyShaderModule};
+    createShaderModule(shader_code_.at(viewShader("shaders/particle.vert.spv")), particle_shader_module);
+    createShaderModule(shader_code_.at("shaders/particle.frag.spv"), particle_frag_module);
+    VkPipelineShaderStageCreateInfo particle_stages[] = {vert_stage_info, frag_stage_info};
+    particle_stages[0].module = particle_shader_module;
+    particle_stages[1].module = particle_frag_module;
+
+    VkPipelineInputAssemblyStateCreateInfo particle_assembly = input_assembly;
+    particle_assembly.topology = VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
+    VkPipelineRasterizationStateCreateInfo particle_rasterizer = rasterizer_info;
+    particle_rasterizer.cullMode = VK_CULL_MODE_NONE;
+    VkPipelineDepthStencilStateCreateInfo particle_depth = depth_stencil_info;
+    particle_depth.depthWriteEnable = VK_FALSE;
+    particle_depth.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+
+    VkGraphicsPipelineCreateInfo particle_info = pipeline_info;
+    particle_info.pStages = particle_stages;
+    particle_info.pInputAssemblyState = &particle_assembly;
+    particle_info.pRasterizationState = &particle_rasterizer;
+    particle_info.pDepthStencilState = &particle_depth;
+    particle_info.layout = particle_pipeline_layout_;
+    if (vkCreateGraphicsPipelines(device_, pipeline_cache_, 1, &particle_info, nullptr,
+                                  particle_draw_pipeline_.replace()) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create particle pipeline");
+    }
+
+    CapturePipeline& particle_description = frame_capture_.pipelines[particle_draw_pipeline_index];
+    particle_description = describePipeline(particle_info, "shaders/particle.vert.spv", "shaders/particle.frag.spv", 6);
+    particle_description.push_constant_stages = VK_SHADER_STAGE_COMPUTE_BIT;
+    particle_description.push_constant_size = sizeof(ParticleParams);
+    LOG_INFO("Created particle draw pipeline successfully.");
+  }
+
+  if (!settings_.depth_prepass) {
+    return;
+  }
+
+  // The depth-only pipeline for the pre-pass:
+  // same vertex shader, no fragment shader and no color output
+  VkPipelineDepthStencilStateCreateInfo prepass_depth_info = depth_stencil_info;
+  prepass_depth_info.depthWriteEnable = VK_TRUE;
+  prepass_depth_info.depthCompareOp = VK_COMPARE_OP_LESS;
+
+  VkPipelineColorBlendStateCreateInfo prepass_blend_info = color_blend_info;
+  prepass_blend_info.attachmentCount = 0;
+  prepass_blend_info.pAttachments = nullptr;
+
+  pipeline_info.stageCount = 1;
+  pipeline_info.pStages = &vert_stage_info;
+  pipeline_info.pDepthStencilState = &prepass_depth_info;
+  pipeline_info.pColorBlendState = &prepass_blend_info;
+  pipeline_info.subpass = 0;
+
+  if (vkCreateGraphicsPipelines(device_, pipeline_cache_, 1, &pipeline_info, nullptr,
+                                depth_prepass_pipeline_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create depth pre-pass pipeline");
+  }
+
+  CapturePipeline& prepass_description = frame_capture_.pipelines[prepass_pipeline_index];
+  prepass_description = describePipeline(pipeline_info, "shaders/first.vert.spv", "", 4);
+  prepass_description.push_constant_stages = push_constant_range.stageFlags;
+  prepass_description.push_constant_size = push_constant_range.size;
+
+  LOG_INFO("Created depth pre-pass pipeline successfully.");
+
+  if (world_.isOpen()) {
+    pipeline_info.flags = VK_PIPELINE_CREATE_DERIVATIVE_BIT;
+    pipeline_info.pStages = &world_stages[0];
+    pipeline_info.basePipelineHandle = depth_prepass_pipeline_;
+    if (vkCreateGraphicsPipelines(device_, pipeline_cache_, 1, &pipeline_info, nullptr,
+                                  world_prepass_pipeline_.replace()) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create world pre-pass pipeline");
+    }
+  }
+}
+
+
+/*
+ * The depth-only pipelines of the shadow pass, derived from the scene pipeline: only the shaders,
+ * the depth test, the samples and the render pass differ, so the driver can start from what it
+ * compiled for that one. The clear is a variant of the static casters.
+ */
+void Vulkan::createShadowPipelines(VkGraphicsPipelineCreateInfo const& scene_info) {
+  // the cascade of the draw
+  VkPushConstantRange push_constant_range = {};
+  push_constant_range.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  push_constant_range.offset = 0;
+  push_constant_range.size = sizeof(uint32_t);
+
+  VkPipelineLayoutCreateInfo pipeline_layout_info = {};
+  pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipeline_layout_info.setLayoutCount = 1;
+  pipeline_layout_info.pSetLayouts = &shadow_set_layout_;
+  pipeline_layout_info.pushConstantRangeCount = 1;
+  pipeline_layout_info.pPushConstantRanges = &push_constant_range;
+  if (vkCreatePipelineLayout(device_, &pipeline_layout_info, nullptr,
+                             shadow_pipeline_layout_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create shadow pipeline layout!");
+  }
+
+  VDeleter<VkShaderModule> shadow_module{device_, vkDestroyShaderModule};
+  createShaderModule(shader_code_.at("shaders/shadow.vert.spv"), shadow_module);
+  VkPipelineShaderStageCreateInfo stage = scene_info.pStages[0];
+  stage.module = shadow_module;
+  stage.pSpecializationInfo = nullptr;
+
+  // the clear triangle and the casters are seen from both sides
+  VkPipelineRasterizationStateCreateInfo rasterizer = *scene_info.pRasterizationState;
+  rasterizer.cullMode = VK_CULL_MODE_NONE;
+  VkPipelineMultisampleStateCreateInfo multisampling = *scene_info.pMultisampleState;
+  multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+  VkPipelineDepthStencilStateCreateInfo depth_info = *scene_info.pDepthStencilState;
+  depth_info.depthWriteEnable = VK_TRUE;
+  depth_info.depthCompareOp = VK_COMPARE_OP_LESS;
+  VkPipelineColorBlendStateCreateInfo blend_info = *scene_info.pColorBlendState;
+  blend_info.attachmentCount = 0;
+  blend_info.pAttachments = nullptr;
+
+  VkGraphicsPipelineCreateInfo pipeline_info = scene_info;
+  pipeline_info.flags = VK_PIPELINE_CREATE_DERIVATIVE_BIT;
+  pipeline_info.stageCount = 1;
+  pipeline_info.pStages = &stage;
+  pipeline_info.pRasterizationState = &rasterizer;
+  pipeline_info.pMultisampleState = &multisampling;
+  pipeline_info.pDepthStencilState = &depth_info;
+  pipeline_info.pColorBlendState = &blend_info;
+  pipeline_info.layout = shadow_pipeline_layout_;
+  pipeline_info.renderPass = shadow_renderpass_;
+  pipeline_info.subpass = 0;
+  pipeline_info.basePipelineHandle = graphics_pipeline_;
+  pipeline_info.basePipelineIndex = -1;
+  if (vkCreateGraphicsPipelines(device_, pipeline_cache_, 1, &pipeline_info, nullptr,
+                                shadow_pipeline_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create shadow pipeline");
+  }
+
+  // the far plane over the whole layer, whatever was there before
+  ShaderVariant clear_variant;
+  stage.pSpecializationInfo = clear_variant.set(shadow_clear_constant, 1).info();
+  VkPipelineDepthStencilStateCreateInfo clear_depth_info = depth_info;
+  clear_depth_info.depthCompareOp = VK_COMPARE_OP_ALWAYS;
+  pipeline_info.pDepthStencilState = &clear_depth_info;
+  if (vkCreateGraphicsPipelines(device_, pipeline_cache_, 1, &pipeline_info, nullptr,
+                                shadow_clear_pipeline_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create shadow clear pipeline");
+  }
+
+  if (settings_.particle_count > 0) {
+    // one texel per particle, into the dynamic map of the second subpass
+    VDeleter<VkShaderModule> particle_module{device_, vkDestroyShaderModule};
+    createShaderModule(shader_code_.at("shaders/particle_shadow.vert.spv"), particle_module);
+    stage.module = particle_module;
+    stage.pSpecializationInfo = nullptr;
+    VkPipelineInputAssemblyStateCreateInfo particle_assembly = *scene_info.pInputAssemblyState;
+    particle_assembly.topology = VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
+    pipeline_info.pInputAssemblyState = &particle_assembly;
+    pipeline_info.pDepthStencilState = &depth_info;
+    pipeline_info.subpass = 1;
+    if (vkCreateGraphicsPipelines(device_, pipeline_cache_, 1, &pipeline_info, nullptr,
+                                  particle_shadow_pipeline_.replace()) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create particle shadow pipeline");
+    }
+  }
+
+  LOG_INFO("Created shadow pipelines successfully.");
+}
+
+
+void Vulkan::createRenderpass() {
+  bool msaa = msaa_samples_ != VK_SAMPLE_COUNT_1_BIT;
+
+  bool pixel_effects = !pixel_effects_.empty();
+  uint32_t shading_subpass = settings_.depth_prepass ? 1 : 0;
+
+  // the attachment for the swapchain image
+  // with MSAA it is only the resolve target and gets overwritten completely, as by the last pixel effect
+  VkAttachmentDescription attachment = {};
+  attachment.format = this->swapchain_format_;
+  attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+  attachment.loadOp = msaa || pixel_effects ? VK_ATTACHMENT_LOAD_OP_DONT_CARE : VK_ATTACHMENT_LOAD_OP_CLEAR;
+  attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE; // Rendered stuff should stay in memory
+
+  // don't care about stencil buffer
+  attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+
+  // the layouts are decided by the render graph
+  AttachmentLayouts layouts = render_graph_.attachmentLayouts(scene_pass_, scene_output_);
+  attachment.initialLayout = layouts.initial;
+  attachment.finalLayout = layouts.final;
+
+  // the depth buffer, only needed while rendering
+  VkAttachmentDescription depth_attachment = {};
+  depth_attachment.format = depth_format_;
+  depth_attachment.samples = msaa_samples_;
+  depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  depth_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  depth_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  layouts = render_graph_.attachmentLayouts(scene_pass_, depth_);
+  depth_attachment.initialLayout = layouts.initial;
+  depth_attachment.finalLayout = layouts.final;
+
+  // the multisampled color target, resolved at the end of the subpass
+  // so the samples themselves never have to be written out to memory
+  VkAttachmentDescription msaa_attachment = {};
+  msaa_attachment.format = pixel_effects ? post_format_ : swapchain_format_;
+  msaa_attachment.samples = msaa_samples_;
+  msaa_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  msaa_attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  msaa_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  msaa_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  if (msaa) {
+    layouts = render_graph_.attachmentLayouts(scene_pass_, msaa_color_);
+    msaa_attachment.initialLayout = layouts.initial;
+    msaa_attachment.finalLayout = layouts.final;
+  }
+
+  std::vector<VkAttachmentDescription> attachments = {attachment, depth_attachment};
+  if (msaa) {
+    attachments.push_back(msaa_attachment);
+  }
+
+  // the targets of the pixel effects, never stored. The shading clears the first one without MSAA
+  uint32_t post_attachment = attachments.size();
+  for (uint32_t t = 0; t < post_target_count_; t++) {
+    VkAttachmentDescription target = msaa_attachment;
+    target.format = post_format_;
+    target.samples = VK_SAMPLE_COUNT_1_BIT;
+    target.loadOp = t == 0 && !msaa ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    layouts = render_graph_.attachmentLayouts(scene_pass_, post_targets_[t]);
+    target.initialLayout = layouts.initial;
+    target.finalLayout = layouts.final;
+    attachments.push_back(target);
+  }
+  // what the shading writes: the swapchain image, or the first post target with pixel effects
+  uint32_t shading_target = pixel_effects ? post_attachment : 0;
+
+  // create the reference to the created color attachment
+  VkAttachmentReference attachment_ref = {};
+  attachment_ref.attachment = msaa ? 2 : shading_target; // index
+  attachment_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+  // with MSAA the swapchain image receives the resolved samples
+  VkAttachmentReference resolve_ref = {};
+  resolve_ref.attachment = shading_target;
+  resolve_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+  VkAttachmentReference depth_ref = {};
+  depth_ref.attachment = 1;
+  depth_ref.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+  // the shading pass only tests against the finished depth buffer of the pre-pass
+  VkAttachmentReference depth_read_ref = {};
+  depth_read_ref.attachment = 1;
+  depth_read_ref.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
+  // optional depth-only subpass which fills the depth buffer
+  VkSubpassDescription prepass = {};
+  prepass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  prepass.colorAttachmentCount = 0;
+  prepass.pDepthStencilAttachment = &depth_ref;
+
+  // create the subpass for this renderpass
+  VkSubpassDescription subpass = {};
+  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS; // graphics subpass
+  subpass.colorAttachmentCount = 1;
+  subpass.pColorAttachments = &attachment_ref;
+  subpass.pResolveAttachments = msaa ? &resolve_ref : nullptr;
+  subpass.pDepthStencilAttachment = settings_.depth_prepass ? &depth_read_ref : &depth_ref;
+
+  std::vector<VkSubpassDescription> subpasses;
+  if (settings_.depth_prepass) {
+    subpasses.push_back(prepass);
+  }
+  subpasses.push_back(subpass);
+
+  // a subpass per pixel effect, reading the post target the one before wrote and writing the other one,
+  // the last writes the swapchain image
+  std::vector<VkAttachmentReference> input_refs(pixel_effects_.size());
+  std::vector<VkAttachmentReference> output_refs(pixel_effects_.size());
+  for (uint32_t i = 0; i < pixel_effects_.size(); i++) {
+    input_refs[i].attachment = post_attachment + i % 2;
+    input_refs[i].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    output_refs[i].attachment = i + 1 < pixel_effects_.size() ? post_attachment + (i + 1) % 2 : 0;
+    output_refs[i].layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    VkSubpassDescription effect = {};
+    effect.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    effect.inputAttachmentCount = 1;
+    effect.pInputAttachments = &input_refs[i];
+    effect.colorAttachmentCount = 1;
+    effect.pColorAttachments = &output_refs[i];
+    subpasses.push_back(effect);
+  }
+
+
+  // finally create the render pass
+  VkRenderPassCreateInfo renderpass = {};
+  renderpass.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+  renderpass.attachmentCount = attachments.size();
+  renderpass.pAttachments = attachments.data();
+  renderpass.subpassCount = subpasses.size();
+  renderpass.pSubpasses = subpasses.data();
+
+  // external(implicit) subpass -> our first subpass
+  // derived by the render graph from the passes before in the frame. It doesn't see
+  // the depth test of the previous frame, which writes the same depth buffer
+  std::vector<VkSubpassDependency> dependencies;
+  VkSubpassDependency depth_dependency = render_graph_.externalDependency(scene_pass_);
+  depth_dependency.srcStageMask |= VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+  depth_dependency.srcAccessMask |= VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  depth_dependency.dstStageMask |= VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                                   VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+  depth_dependency.dstAccessMask |= VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  dependencies.push_back(depth_dependency);
+
+  // the color targets are first used by the shading, after the pre-pass. Without this the implicit
+  // dependency of that subpass would transition them at TOP_OF_PIPE, before the acquisition semaphore
+  // is waited for at COLOR_ATTACHMENT_OUTPUT; the previous frame writes the same multisampled target
+  VkSubpassDependency color_dependency = {};
+  color_dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+  color_dependency.dstSubpass = shading_subpass;
+  color_dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  color_dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  color_dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  color_dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  dependencies.push_back(color_dependency);
+
+  if (settings_.depth_prepass) {
+    // the shading pass reads the depth written by the pre-pass
+    VkSubpassDependency prepass_dependency = {};
+    prepass_dependency.srcSubpass = 0;
+    prepass_dependency.dstSubpass = 1;
+    prepass_dependency.srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    prepass_dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    prepass_dependency.dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                                      VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    prepass_dependency.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+    prepass_dependency.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+    // each view only reads its own depth
+    if (multiview_) {
+      prepass_dependency.dependencyFlags |= VK_DEPENDENCY_VIEW_LOCAL_BIT_KHR;
+    }
+    dependencies.push_back(prepass_dependency);
+  }
+
+  // each pixel effect reads what the subpass before wrote at the same pixel, which a tiled GPU does on chip
+  // with a dependency by region, and overwrites the target the one before read
+  for (uint32_t i = 0; i < pixel_effects_.size(); i++) {
+    VkSubpassDependency effect_dependency = {};
+    effect_dependency.srcSubpass = shading_subpass + i;
+    effect_dependency.dstSubpass = shading_subpass + i + 1;
+    effect_dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                                     VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    effect_dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    effect_dependency.dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+                                     VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    effect_dependency.dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    effect_dependency.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+    if (multiview_) {
+      effect_dependency.dependencyFlags |= VK_DEPENDENCY_VIEW_LOCAL_BIT_KHR;
+    }
+    dependencies.push_back(effect_dependency);
+  }
+  // the last frame used the targets of the effects too, the chain from the first subpass
+  // doesn't reach them through the depth stages of the pre-pass
+  if (pixel_effects) {
+    VkSubpassDependency external_dependency = render_graph_.externalDependency(scene_pass_);
+    external_dependency.dstSubpass = shading_subpass + 1;
+    dependencies.push_back(external_dependency);
+  }
+  // the last effect is the first to use the swapchain image, its transition has to wait for the acquisition
+  // like the one of the shading without effects
+  uint32_t last_effect = shading_subpass + pixel_effects_.size();
+  if (pixel_effects && last_effect != shading_subpass + 1) {
+    VkSubpassDependency output_dependency = color_dependency;
+    output_dependency.dstSubpass = last_effect;
+    dependencies.push_back(output_dependency);
+  }
+
+  renderpass.dependencyCount = dependencies.size();
+  renderpass.pDependencies = dependencies.data();
+
+  // every subpass draws all views, each into its layer. They see almost the same, which
+  // the correlation mask tells the implementation
+  std::vector<uint32_t> view_masks(subpasses.size(), (1u << views_) - 1);
+  uint32_t correlation_mask = view_masks[0];
+  VkRenderPassMultiviewCreateInfoKHR multiview = {};
+  multiview.sType = VK_STRUCTURE_TYPE_RENDER_PASS_MULTIVIEW_CREATE_INFO_KHR;
+  multiview.subpassCount = subpasses.size();
+  multiview.pViewMasks = view_masks.data();
+  multiview.correlationMaskCount = 1;
+  multiview.pCorrelationMasks = &correlation_mask;
+  if (multiview_) {
+    renderpass.pNext = &multiview;
+  }
+
+
+  if (vkCreateRenderPass(device_, &renderpass, nullptr, renderpass_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create render pass");
+  }
+
+  // same clear values as recordScenePass
+  frame_capture_.renderpass = describeRenderPass(renderpass);
+  frame_capture_.renderpass.clear_values.resize(renderpass.attachmentCount);
+  for (uint32_t i = 0; i < renderpass.attachmentCount; i++) {
+    VkClearValue& clear = frame_capture_.renderpass.clear_values[i];
+    if (i == 1) {
+      clear.depthStencil = {1.0f, 0};
+    } else {
+      clear.color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+    }
+  }
+  LOG_INFO("Created render pass successfully.");
+
+  // the filters draw over all of their target, in the views of the scene
+  filter_renderpasses_.clear();
+  filter_renderpasses_.resize(filter_effects_.size(), VDeleter<VkRenderPass>{device_, vkDestroyRenderPass});
+  for (uint32_t f = 0; f < filter_effects_.size(); f++) {
+    VkAttachmentDescription filter_attachment = attachment;
+    filter_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    layouts = render_graph_.attachmentLayouts(filter_passes_[f], filterOutput(f));
+    filter_attachment.initialLayout = layouts.initial;
+    filter_attachment.finalLayout = layouts.final;
+
+    VkAttachmentReference filter_ref = {};
+    filter_ref.attachment = 0;
+    filter_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    VkSubpassDescription filter_subpass = {};
+    filter_subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    filter_subpass.colorAttachmentCount = 1;
+    filter_subpass.pColorAttachments = &filter_ref;
+    VkSubpassDependency filter_dependency = render_graph_.externalDependency(filter_passes_[f]);
+
+    VkRenderPassCreateInfo filter_info = {};
+    filter_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    filter_info.attachmentCount = 1;
+    filter_info.pAttachments = &filter_attachment;
+    filter_info.subpassCount = 1;
+    filter_info.pSubpasses = &filter_subpass;
+    filter_info.dependencyCount = 1;
+    filter_info.pDependencies = &filter_dependency;
+    VkRenderPassMultiviewCreateInfoKHR filter_multiview = multiview;
+    filter_multiview.subpassCount = 1;
+    if (multiview_) {
+      filter_info.pNext = &filter_multiview;
+    }
+    if (vkCreateRenderPass(device_, &filter_info, nullptr, filter_renderpasses_[f].replace()) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create filter render pass");
+    }
+  }
+
+  if (!blit_scene_ || !settings_.overlay) {
+    return;
+  }
+
+  // the overlay on top of the upscaled scene
+  VkAttachmentDescription overlay_attachment = attachment;
+  overlay_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+  layouts = render_graph_.attachmentLayouts(overlay_pass_, backbuffer_);
+  overlay_attachment.initialLayout = layouts.initial;
+  overlay_attachment.finalLayout = layouts.final;
+
+  VkAttachmentReference overlay_ref = {};
+  overlay_ref.attachment = 0;
+  overlay_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+  VkSubpassDescription overlay_subpass = {};
+  overlay_subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  overlay_subpass.colorAttachmentCount = 1;
+  overlay_subpass.pColorAttachments = &overlay_ref;
+  VkSubpassDependency overlay_dependency = render_graph_.externalDependency(overlay_pass_);
+
+  VkRenderPassCreateInfo overlay_info = {};
+  overlay_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+  overlay_info.attachmentCount = 1;
+  overlay_info.pAttachments = &overlay_attachment;
+  overlay_info.subpassCount = 1;
+  overlay_info.pSubpasses = &overlay_subpass;
+  overlay_info.dependencyCount = 1;
+  overlay_info.pDependencies = &overlay_dependency;
+  if (vkCreateRenderPass(device_, &overlay_info, nullptr, overlay_renderpass_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create overlay render pass");
+  }
+}
+
+void Vulkan::createFramebuffers() {
+  // match number of image views
+  sc_framebuffers_.resize(sc_image_views_.size(), VDeleter<VkFramebuffer> {device_, vkDestroyFramebuffer});
+
+  // does this work with auto const&
+  for(size_t i = 0; i < sc_image_views_.size(); i++) {
+    // same order as the attachments of the render pass
+    VkImageView attachments[5] = {
+            scene_output_ == backbuffer_ ? VkImageView(sc_image_views_[i]) : render_graph_.imageView(scene_output_),
+            render_graph_.imageView(depth_)
+    };
+    uint32_t count = 2;
+    if (msaa_samples_ != VK_SAMPLE_COUNT_1_BIT) {
+      attachments[count++] = render_graph_.imageView(msaa_color_);
+    }
+    for (uint32_t t = 0; t < post_target_count_; t++) {
+      attachments[count++] = render_graph_.imageView(post_targets_[t]);
+    }
+
+    VkFramebufferCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    info.renderPass = renderpass_;
+    info.attachmentCount = count;
+    info.pAttachments = attachments;
+    info.width = viewExtent().width;
+    info.height = viewExtent().height;
+    // the instanced views write gl_Layer, a multiview render pass has the views in the layers itself
+    info.layers = multiview_ ? 1 : views_;
+
+    if (vkCreateFramebuffer(device_, &info, nullptr, sc_framebuffers_[i].replace()) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create framebuffer for image view");
+    }
+  }
+
+  LOG_INFO("Number of created framebuffers: " << sc_framebuffers_.size());
+
+  // the last filter writes the swapchain image if the scene isn't blitted into it
+  size_t images = sc_image_views_.size();
+  filter_framebuffers_.clear();
+  filter_framebuffers_.resize(filter_effects_.size() * images, VDeleter<VkFramebuffer>{device_, vkDestroyFramebuffer});
+  for (uint32_t f = 0; f < filter_effects_.size(); f++) {
+    RenderGraph::Resource output = filterOutput(f);
+    for (size_t i = 0; i < images; i++) {
+      VkImageView attachment = output == backbuffer_ ? VkImageView(sc_image_views_[i]) :
+                               render_graph_.imageView(output);
+      VkFramebufferCreateInfo info = {};
+      info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+      info.renderPass = filter_renderpasses_[f];
+      info.attachmentCount = 1;
+      info.pAttachments = &attachment;
+      info.width = viewExtent().width;
+      info.height = viewExtent().height;
+      info.layers = multiview_ ? 1 : views_;
+      if (vkCreateFramebuffer(device_, &info, nullptr, filter_framebuffers_[f * images + i].replace()) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create filter framebuffer");
+      }
+    }
+  }
+
+  if (!blit_scene_ || !settings_.overlay) {
+    return;
+  }
+  overlay_framebuffers_.resize(sc_image_views_.size(), VDeleter<VkFramebuffer>{device_, vkDestroyFramebuffer});
+  for (size_t i = 0; i < sc_image_views_.size(); i++) {
+    VkImageView attachment = sc_image_views_[i];
+    VkFramebufferCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    info.renderPass = overlay_renderpass_;
+    info.attachmentCount = 1;
+    info.pAttachments = &attachment;
+    info.width = swapchain_extent_.width;
+    info.height = swapchain_extent_.height;
+    info.layers = 1;
+    if (vkCreateFramebuffer(device_, &info, nullptr, overlay_framebuffers_[i].replace()) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create overlay framebuffer");
+    }
+  }
+}
+
+/*
+ * Create the cache of the static shadow casters, which lives outside of the render graph,
+ * the buffers the cascades are written to per swapchain image and the descriptor sets
+ * of the shadow pass and the shading, without the maps themselves yet
+ */
+void Vulkan::createShadowMaps() {
+  if (!settings_.shadows) {
+    return;
+  }
+
+  shadow_format_ = findSupportedFormat(
+          {VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32, VK_FORMAT_D16_UNORM}, VK_IMAGE_TILING_OPTIMAL,
+          VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT);
+  createImage(settings_.shadow_map_size, settings_.shadow_map_size, shadow_format_, VK_SAMPLE_COUNT_1_BIT,
+              VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, shadow_cache_image_, shadow_cache_memory_, shadow_cascade_count);
+
+  // the graph expects it in the layout of the shading, the contents don't matter: the first frame draws all cascades
+  submitOnce(graphics_queue_, findQueueFamilies(physical_device_).graphics_family, [this](VkCommandBuffer cmd) {
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = shadow_cache_image_;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+                         0, nullptr, 0, nullptr, 1, &barrier);
+  }, "shadow cache transition");
+  shadow_origins_.assign(2 * shadow_cascade_count, 0.0f);
+  shadow_cache_stale_ = true;
+
+  size_t images = swapchain_images_.size();
+  VkDeviceSize draws_size = 2 * shadow_cascade_count * sizeof(VkDrawIndirectCommand);
+  shadow_frame_buffers_.resize(images, VDeleter<VkBuffer>{device_, vkDestroyBuffer});
+  shadow_frame_memory_.resize(images, VDeleter<VkDeviceMemory>{device_, vkFreeMemory});
+  shadow_frame_mapped_.resize(images);
+  shadow_draw_buffers_.resize(images, VDeleter<VkBuffer>{device_, vkDestroyBuffer});
+  shadow_draw_memory_.resize(images, VDeleter<VkDeviceMemory>{device_, vkFreeMemory});
+  shadow_draw_mapped_.resize(images);
+  for (size_t i = 0; i < images; i++) {
+    createBuffer(sizeof(ShadowFrame), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, false,
+                 shadow_frame_buffers_[i], shadow_frame_memory_[i]);
+    vkMapMemory(device_, shadow_frame_memory_[i], 0, sizeof(ShadowFrame), 0, &shadow_frame_mapped_[i]);
+    memset(shadow_frame_mapped_[i], 0, sizeof(ShadowFrame));
+    createBuffer(draws_size, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, false,
+                 shadow_draw_buffers_[i], shadow_draw_memory_[i]);
+    vkMapMemory(device_, shadow_draw_memory_[i], 0, draws_size, 0, &shadow_draw_mapped_[i]);
+    memset(shadow_draw_mapped_[i], 0, draws_size);
+  }
+
+  // the cascades, the cached and the dynamic map, the drawables and the particle vertices,
+  // see shadow.vert, particle_shadow.vert and shadowed.frag
+  bool particles = settings_.particle_count > 0;
+  uint32_t binding_count = particles ? 5 : 4;
+  VkDescriptorSetLayoutBinding bindings[5] = {};
+  for (uint32_t i = 0; i < 5; i++) {
+    bindings[i].binding = i;
+    bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[i].descriptorCount = 1;
+    bindings[i].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  }
+  bindings[0].stageFlags |= VK_SHADER_STAGE_FRAGMENT_BIT;
+  for (uint32_t i = 1; i < 3; i++) {
+    bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bindings[i].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+  }
+
+  VkDescriptorSetLayoutCreateInfo layout_info = {};
+  layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layout_info.bindingCount = binding_count;
+  layout_info.pBindings = bindings;
+  if (vkCreateDescriptorSetLayout(device_, &layout_info, nullptr, shadow_set_layout_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create shadow descriptor set layout");
+  }
+
+  VkDescriptorPoolSize pool_sizes[2] = {};
+  pool_sizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  pool_sizes[0].descriptorCount = (binding_count - 2) * images;
+  pool_sizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  pool_sizes[1].descriptorCount = 2 * images;
+
+  VkDescriptorPoolCreateInfo pool_info = {};
+  pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  pool_info.maxSets = images;
+  pool_info.poolSizeCount = 2;
+  pool_info.pPoolSizes = pool_sizes;
+  if (vkCreateDescriptorPool(device_, &pool_info, nullptr, shadow_descriptor_pool_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create shadow descriptor pool");
+  }
+
+  std::vector<VkDescriptorSetLayout> layouts(images, shadow_set_layout_);
+  VkDescriptorSetAllocateInfo alloc_info = {};
+  alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  alloc_info.descriptorPool = shadow_descriptor_pool_;
+  alloc_info.descriptorSetCount = images;
+  alloc_info.pSetLayouts = layouts.data();
+  shadow_sets_.resize(images);
+  if (vkAllocateDescriptorSets(device_, &alloc_info, shadow_sets_.data()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to allocate shadow descriptor sets");
+  }
+
+  // the maps follow in createShadowFramebuffers, once the graph created the dynamic one
+  for (size_t i = 0; i < images; i++) {
+    VkBuffer buffers[3] = {shadow_frame_buffers_[i], drawable_buffer_,
+                           particles ? VkBuffer(particle_vertex_buffers_[i]) : VK_NULL_HANDLE};
+    uint32_t buffer_bindings[3] = {0, 3, 4};
+    VkDescriptorBufferInfo buffer_infos[3] = {};
+    VkWriteDescriptorSet writes[3] = {};
+    for (uint32_t b = 0; b < 3; b++) {
+      buffer_infos[b].buffer = buffers[b];
+      buffer_infos[b].range = VK_WHOLE_SIZE;
+      writes[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[b].dstSet = shadow_sets_[i];
+      writes[b].dstBinding = buffer_bindings[b];
+      writes[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      writes[b].descriptorCount = 1;
+      writes[b].pBufferInfo = &buffer_infos[b];
+    }
+    vkUpdateDescriptorSets(device_, binding_count - 2, writes, 0, nullptr);
+  }
+
+  LOG_INFO("Created " << shadow_cascade_count << " shadow cascades of " << settings_.shadow_map_size << "x"
+           << settings_.shadow_map_size << " texels.");
+}
+
+/*
+ * One render pass per cascade over its layer of both maps: the static casters are drawn
+ * into the cache in the first subpass, the particles into the dynamic map in the second
+ */
+void Vulkan::createShadowRenderpass() {
+  if (!settings_.shadows) {
+    return;
+  }
+
+  VkAttachmentDescription attachments[2] = {};
+  for (uint32_t i = 0; i < 2; i++) {
+    attachments[i].format = shadow_format_;
+    attachments[i].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachments[i].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attachments[i].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[i].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  }
+  // the cascades which didn't move keep what was drawn before
+  attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+  attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  AttachmentLayouts layouts = render_graph_.attachmentLayouts(shadow_pass_, shadow_cache_);
+  attachments[0].initialLayout = layouts.initial;
+  attachments[0].finalLayout = layouts.final;
+  layouts = render_graph_.attachmentLayouts(shadow_pass_, dynamic_shadows_);
+  attachments[1].initialLayout = layouts.initial;
+  attachments[1].finalLayout = layouts.final;
+
+  VkAttachmentReference depth_refs[2] = {};
+  VkSubpassDescription subpasses[2] = {};
+  for (uint32_t i = 0; i < 2; i++) {
+    depth_refs[i].attachment = i;
+    depth_refs[i].layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    subpasses[i].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpasses[i].pDepthStencilAttachment = &depth_refs[i];
+  }
+
+  // the subpasses touch different attachments, each only has to wait for the last frame
+  VkSubpassDependency dependencies[2] = {render_graph_.externalDependency(shadow_pass_),
+                                         render_graph_.externalDependency(shadow_pass_)};
+  dependencies[1].dstSubpass = 1;
+
+  VkRenderPassCreateInfo renderpass_info = {};
+  renderpass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+  renderpass_info.attachmentCount = 2;
+  renderpass_info.pAttachments = attachments;
+  renderpass_info.subpassCount = 2;
+  renderpass_info.pSubpasses = subpasses;
+  renderpass_info.dependencyCount = 2;
+  renderpass_info.pDependencies = dependencies;
+  if (vkCreateRenderPass(device_, &renderpass_info, nullptr, shadow_renderpass_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create shadow render pass");
+  }
+}
+
+/*
+ * Views on the layers of both maps and the framebuffers of the cascades,
+ * and the maps as arrays for the descriptor sets of the shading
+ */
+void Vulkan::createShadowFramebuffers() {
+  if (!settings_.shadows) {
+    return;
+  }
+
+  auto createView = [this](VkImage image, VkImageViewType type, uint32_t first_layer, uint32_t layers,
+                           VDeleter<VkImageView>& view) {
+    VkImageViewCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    info.image = image;
+    info.viewType = type;
+    info.format = shadow_format_;
+    info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    info.subresourceRange.levelCount = 1;
+    info.subresourceRange.baseArrayLayer = first_layer;
+    info.subresourceRange.layerCount = layers;
+    if (vkCreateImageView(device_, &info, nullptr, view.replace()) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create shadow map view");
+    }
+  };
+
+  VkImage maps[2] = {shadow_cache_image_, render_graph_.image(dynamic_shadows_)};
+  shadow_layer_views_.resize(2 * shadow_cascade_count, VDeleter<VkImageView>{device_, vkDestroyImageView});
+  shadow_framebuffers_.resize(shadow_cascade_count, VDeleter<VkFramebuffer>{device_, vkDestroyFramebuffer});
+  for (uint32_t c = 0; c < shadow_cascade_count; c++) {
+    for (uint32_t m = 0; m < 2; m++) {
+      createView(maps[m], VK_IMAGE_VIEW_TYPE_2D, c, 1, shadow_layer_views_[m * shadow_cascade_count + c]);
+    }
+    VkImageView attachments[2] = {shadow_layer_views_[c], shadow_layer_views_[shadow_cascade_count + c]};
+
+    VkFramebufferCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    info.renderPass = shadow_renderpass_;
+    info.attachmentCount = 2;
+    info.pAttachments = attachments;
+    info.width = settings_.shadow_map_size;
+    info.height = settings_.shadow_map_size;
+    info.layers = 1;
+    if (vkCreateFramebuffer(device_, &info, nullptr, shadow_framebuffers_[c].replace()) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create shadow framebuffer");
+    }
+  }
+  // the graph has one of the dynamic map already
+  createView(shadow_cache_image_, VK_IMAGE_VIEW_TYPE_2D_ARRAY, 0, shadow_cascade_count, shadow_cache_view_);
+
+  // texels are compared as they are, the cascades don't reach beyond their edges
+  VkSamplerCreateInfo sampler_info = {};
+  sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  sampler_info.magFilter = VK_FILTER_NEAREST;
+  sampler_info.minFilter = VK_FILTER_NEAREST;
+  sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  sampler_info.maxLod = 0.0f;
+  if (vkCreateSampler(device_, &sampler_info, nullptr, shadow_sampler_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create shadow sampler");
+  }
+
+  for (VkDescriptorSet set : shadow_sets_) {
+    VkDescriptorImageInfo image_infos[2] = {};
+    VkWriteDescriptorSet writes[2] = {};
+    VkImageView views[2] = {shadow_cache_view_, render_graph_.imageView(dynamic_shadows_)};
+    for (uint32_t m = 0; m < 2; m++) {
+      image_infos[m].sampler = shadow_sampler_;
+      image_infos[m].imageView = views[m];
+      image_infos[m].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+      writes[m].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[m].dstSet = set;
+      writes[m].dstBinding = 1 + m;
+      writes[m].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+      writes[m].descriptorCount = 1;
+      writes[m].pImageInfo = &image_infos[m];
+    }
+    vkUpdateDescriptorSets(device_, 2, writes, 0, nullptr);
+  }
+}
+
+void Vulkan::createCommandPool() {
+  QueueFamilyIndices queue_indices = findQueueFamilies(physical_device_);
+
+  VkCommandPoolCreateInfo info = {};
+  info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  info.queueFamilyIndex = queue_indices.graphics_family;
+  // possible flags:
+  // VK_COMMAND_POOL_CREATE_TRANSIENT_BIT:
+  //    indicate that we rerecord the command buffers often
+  // the buckets of the scene and the command buffers executing them are recorded again when they change
+  info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+  if (vkCreateCommandPool(device_, &info, nullptr, command_pool_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create command pool");
+  }
+
+  if (render_graph_.usesAsyncCompute()) {
+    info.queueFamilyIndex = queue_indices.compute_family;
+    if (vkCreateCommandPool(device_, &info, nullptr, compute_command_pool_.replace()) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create compute command pool");
+    }
+  }
+  LOG_INFO("Created command pool successfully.");
+}
+
+void Vulkan::createCommandBuffers() {
+  // one set per resolution, switching between them costs nothing
+  uint32_t images = sc_framebuffers_.size();
+  uint32_t levels = dynamic_resolution_ ? ResolutionController::levels : 1;
+  command_buffers_.resize(levels * images);
+  overlay_recorded_.assign(command_buffers_.size(), false);
+  image_levels_.assign(images, 0);
+  frame_arenas_.clear();
+  for (uint32_t i = 0; i < images; i++) {
+    frame_arenas_.push_back(LinearArena(frame_arena_size));
+  }
+
+  VkCommandBufferAllocateInfo alloc_info = {};
+  alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  alloc_info.commandBufferCount = command_buffers_.size();
+  alloc_info.commandPool = command_pool_;
+
+  // VK_COMMAND_BUFFER_LEVEL_PRIMARY: Can be submitted to a queue for execution, but cannot be called from other command buffers.
+  // VK_COMMAND_BUFFER_LEVEL_SECONDARY: Cannot be submitted directly, but can be called from primary command buffers.
+  alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+
+  if (vkAllocateCommandBuffers(device_, &alloc_info, command_buffers_.data()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to allocate command bufffers");
+  }
+
+  frame_stats_.draw_calls = prepass_commands_.workCount() + scene_commands_.workCount() +
+                            particle_draw_commands_.workCount();
+  for (CommandStream const* stream : {&cull_commands_, &light_cull_commands_, &particle_emit_commands_,
+                                      &particle_simulate_commands_, &particle_draw_commands_}) {
+    if (stream == &cull_commands_ && settings_.occlusion_culling) {
+      continue;
+    }
+    frame_stats_.binds += stream->bindCount();
+    frame_stats_.skipped_binds += stream->skippedBinds();
+  }
+  // the draws are recorded in buckets, each binding its state again
+  for (auto const* buckets : {&prepass_bucket_commands_, &scene_bucket_commands_}) {
+    for (CommandStream const& stream : *buckets) {
+      frame_stats_.binds += stream.bindCount();
+      frame_stats_.skipped_binds += stream.skippedBinds();
+    }
+  }
+  if (settings_.occlusion_culling) {
+    // one draw per drawable for the occluders, most of them without an instance
+    frame_stats_.draw_calls += drawables_.size();
+  }
+  if (overlay_enabled_) {
+    frame_stats_.draw_calls += overlay_.drawCount();
+  }
+  // a triangle per post effect
+  frame_stats_.draw_calls += settings_.post_effects.size();
+
+  std::vector<VkFramebuffer> framebuffers;
+  for (auto const& framebuffer : sc_framebuffers_) {
+    framebuffers.push_back(framebuffer);
+  }
+  command_cache_.init(device_, command_pool_, renderpass_, framebuffers, levels, pipeline_statistics_supported_ ?
+                      VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT : 0);
+  for (size_t c = 0; c < command_buffers_.size(); c++) {
+    uint32_t i = c % images;
+    uint32_t level = c / images;
+    command_cache_.update(i, level);
+    recordCommandBuffer(i, level);
+  }
+  LOG_INFO("Recorded " << command_buffers_.size() << " command buffers with " << command_cache_.bucketCount()
+           << " buckets of the scene each.");
+
+  if (!render_graph_.usesAsyncCompute()) {
+    return;
+  }
+
+  // the passes on the async compute queue, submitted before the graphics work
+  compute_command_buffers_.resize(images);
+  alloc_info.commandPool = compute_command_pool_;
+  alloc_info.commandBufferCount = images;
+  if (vkAllocateCommandBuffers(device_, &alloc_info, compute_command_buffers_.data()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to allocate compute command bufffers");
+  }
+
+  for (size_t i = 0; i < compute_command_buffers_.size(); i++) {
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+
+    if (vkBeginCommandBuffer(compute_command_buffers_[i], &begin_info) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to start recording compute command buffer");
+    }
+
+    if (timestamps_supported_) {
+      vkCmdResetQueryPool(compute_command_buffers_[i], timestamp_query_pool_, timestamps_per_image * i, 2);
+      vkCmdWriteTimestamp(compute_command_buffers_[i], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestamp_query_pool_,
+                          timestamps_per_image * i);
+    }
+
+    render_graph_.execute(compute_command_buffers_[i], i, QueueType::AsyncCompute);
+
+    if (timestamps_supported_) {
+      vkCmdWriteTimestamp(compute_command_buffers_[i], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestamp_query_pool_,
+                          timestamps_per_image * i + 1);
+    }
+
+    if (vkEndCommandBuffer(compute_command_buffers_[i]) != VK_SUCCESS) {
+      throw std::runtime_error("failed to record compute command buffer");
+    }
+  }
+  LOG_INFO("Recorded " << compute_command_buffers_.size() << " compute command buffers.");
+}
+
+/*
+ * Record the primary command buffer of the image at the resolution level: the whole render graph,
+ * the scene render pass executing the buckets as the command cache has them. Once when the command
+ * buffers are created, and again by the frames whose buckets changed, once the last frame of the image is done
+ */
+void Vulkan::recordCommandBuffer(uint32_t image_index, uint32_t level) {
+  VkCommandBuffer cmd = command_buffers_[level * swapchain_images_.size() + image_index];
+  overlay_recorded_[level * swapchain_images_.size() + image_index] = overlay_enabled_;
+  recording_level_ = level;
+  VkCommandBufferBeginInfo begin_info = {};
+  begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  // we can specify the command buffer usage:
+  // simultaneous: we can resubmit instantly, if we want
+  // one_time: will be rerecorded after submitting
+  // render_pass: used for renderpass (duh!)
+  begin_info.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+  begin_info.pInheritanceInfo = nullptr; // we don't inherit
+
+  // resets it, the pool allows that
+  if (vkBeginCommandBuffer(cmd, &begin_info) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to start recording command buffer");
+  }
+
+  if (timestamps_supported_) {
+    vkCmdResetQueryPool(cmd, timestamp_query_pool_, timestamps_per_image * image_index + 2, 2);
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestamp_query_pool_,
+                        timestamps_per_image * image_index + 2);
+  }
+
+  // barriers, the scene render pass and the final transitions
+  render_graph_.execute(cmd, image_index);
+
+  if (timestamps_supported_) {
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestamp_query_pool_,
+                        timestamps_per_image * image_index + 3);
+  }
+
+  if (vkEndCommandBuffer(cmd) != VK_SUCCESS) {
+    throw std::runtime_error("failed to record command buffer");
+  }
+}
+
+/*
+ * Build the draws and dispatches of the passes
+ *
+ * They don't depend on the swapchain image, only the objects they use do,
+ * so they are built once and recorded with the bindings of each image.
+ */
+void Vulkan::createCommandStreams() {
+  uint32_t count = drawables_.size();
+  cull_commands_.bindPipeline(cull_pipeline_index);
+  cull_commands_.bindDescriptorSet(cull_pipeline_index, 0, cull_set_index);
+  cull_commands_.pushConstants(cull_pipeline_index, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(count), &count);
+  cull_commands_.dispatch((count + 63) / 64, 1, 1);
+
+  // a workgroup per cluster, the counter is cleared in a pass of its own so the graph orders it
+  light_reset_commands_.fillBuffer(light_counter_buffer_index, 0, VK_WHOLE_SIZE, 0);
+  light_cull_commands_.bindPipeline(light_cull_pipeline_index);
+  light_cull_commands_.bindDescriptorSet(light_cull_pipeline_index, 0, light_set_index);
+  light_cull_commands_.pushConstants(light_cull_pipeline_index, VK_SHADER_STAGE_COMPUTE_BIT,
+                                     0, sizeof(LightCullParams), &light_params_);
+  light_cull_commands_.dispatch(light_tiles_x, light_tiles_y, light_slices);
+
+  // opaque geometry is drawn front to back, so the depth test rejects as many
+  // hidden fragments as possible before they are shaded
+  DrawList draw_list;
+  for (uint32_t d = 0; d < drawables_.size(); d++) {
+    if (settings_.depth_prepass) {
+      draw_list.add(DrawList::key(prepass_draw_pass, prepass_pipeline_index, no_material, drawables_[d].depth), d);
+    }
+    draw_list.add(DrawList::key(scene_draw_pass, scene_pipeline_index, no_material, drawables_[d].depth), d);
+  }
+  draw_list.sort();
+
+  // the draws of each pass also go into buckets of consecutive draws, recorded on their own
+  uint32_t pass_draws[2] = {0, 0};
+  for (auto const& draw : draw_list.draws()) {
+    pass_draws[DrawList::pass(draw.key)]++;
+  }
+  prepass_bucket_commands_.assign(settings_.depth_prepass ? scene_buckets : 0, CommandStream());
+  scene_bucket_commands_.assign(scene_buckets, CommandStream());
+  uint32_t pass_index[2] = {0, 0};
+
+  // every draw asks for its state, the streams leave out what is bound already
+  for (auto const& draw : draw_list.draws()) {
+    uint32_t pass = DrawList::pass(draw.key);
+    CommandStream& stream = pass == prepass_draw_pass ? prepass_commands_ : scene_commands_;
+    std::vector<CommandStream>& buckets = pass == prepass_draw_pass ? prepass_bucket_commands_
+                                                                     : scene_bucket_commands_;
+    CommandStream& bucket = buckets[uint64_t(pass_index[pass]++) * scene_buckets / pass_draws[pass]];
+    uint32_t pipeline = DrawList::pipeline(draw.key);
+    for (CommandStream* commands : {&stream, &bucket}) {
+      commands->bindPipeline(pipeline);
+      commands->bindDescriptorSet(pipeline, 0, view_set_index);
+      if (DrawList::material(draw.key) != no_material) {
+        commands->bindDescriptorSet(pipeline, 1, DrawList::material(draw.key) - 1);
+      }
+      commands->pushConstants(pipeline, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(Drawable), &drawables_[draw.index]);
+      // written by the culling pass: 3 vertices, 1 instance if visible, 0 otherwise
+      commands->drawIndirect(draw_command_buffer_index, draw.index * sizeof(VkDrawIndirectCommand),
+                             1, sizeof(VkDrawIndirectCommand));
+    }
+  }
+
+  bool particles = settings_.particle_count > 0;
+  if (particles) {
+    particle_emit_commands_.bindPipeline(particle_emit_pipeline_index);
+    particle_emit_commands_.bindDescriptorSet(particle_emit_pipeline_index, 0, particle_set_index);
+    particle_emit_commands_.pushConstants(particle_emit_pipeline_index, VK_SHADER_STAGE_COMPUTE_BIT,
+                                          0, sizeof(ParticleParams), &particle_params_);
+    particle_emit_commands_.dispatch((particle_params_.emit_count + 63) / 64, 1, 1);
+
+    particle_simulate_commands_.bindPipeline(particle_simulate_pipeline_index);
+    particle_simulate_commands_.bindDescriptorSet(particle_simulate_pipeline_index, 0, particle_set_index);
+    particle_simulate_commands_.pushConstants(particle_simulate_pipeline_index, VK_SHADER_STAGE_COMPUTE_BIT,
+                                              0, sizeof(ParticleParams), &particle_params_);
+    particle_simulate_commands_.dispatch((particle_params_.capacity + 255) / 256, 1, 1);
+
+    // as many points as the simulation kept, nothing is read back
+    particle_draw_commands_.bindPipeline(particle_draw_pipeline_index);
+    particle_draw_commands_.bindDescriptorSet(particle_draw_pipeline_index, 0, particle_set_index);
+    particle_draw_commands_.drawIndirect(particle_args_buffer_index, 0, 1, sizeof(VkDrawIndirectCommand));
+  }
+
+  // same order as the indices at the top
+  command_bindings_.resize(swapchain_images_.size());
+  for (size_t i = 0; i < command_bindings_.size(); i++) {
+    CommandBindings& bindings = command_bindings_[i];
+    bindings.pipelines = {cull_pipeline_, depth_prepass_pipeline_, graphics_pipeline_,
+                          particle_emit_pipeline_, particle_simulate_pipeline_, particle_draw_pipeline_,
+                          light_cull_pipeline_};
+    bindings.layouts = {cull_pipeline_layout_, pipeline_layout_, pipeline_layout_,
+                        particle_pipeline_layout_, particle_pipeline_layout_, particle_pipeline_layout_,
+                        light_pipeline_layout_};
+    bindings.bind_points = {VK_PIPELINE_BIND_POINT_COMPUTE, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            VK_PIPELINE_BIND_POINT_GRAPHICS, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            VK_PIPELINE_BIND_POINT_COMPUTE, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            VK_PIPELINE_BIND_POINT_COMPUTE};
+    bindings.descriptor_sets = {cull_sets_[i], view_sets_[i], light_sets_[i]};
+    bindings.buffers = {drawable_buffer_, draw_command_buffers_[i], view_buffers_[i], light_buffer_,
+                        light_grid_buffers_[i], light_index_buffers_[i], light_counter_buffers_[i]};
+    if (particles) {
+      bindings.descriptor_sets.push_back(particle_sets_[i]);
+      bindings.buffers.insert(bindings.buffers.end(), {particle_buffer_, particle_counter_buffer_,
+                                                       collision_depth_buffer_, particle_vertex_buffers_[i],
+                                                       particle_args_buffers_[i]});
+    }
+  }
+
+  // what the buckets record depends on, see createCommandBuckets
+  bucket_stream_hashes_.clear();
+  for (auto const* buckets : {&prepass_bucket_commands_, &scene_bucket_commands_}) {
+    for (CommandStream const& stream : *buckets) {
+      bucket_stream_hashes_.push_back(CommandCache::hash(stream.data().data(), stream.data().size()));
+    }
+  }
+  binding_hashes_.resize(command_bindings_.size());
+  for (size_t i = 0; i < command_bindings_.size(); i++) {
+    binding_hashes_[i] = hashBindings(command_bindings_[i]);
+    if (settings_.shadows) {
+      binding_hashes_[i] = CommandCache::combine(binding_hashes_[i], shadow_sets_[i]);
+    }
+  }
+
+  // the rest of the capture, the pipelines and the render pass described themselves
+  frame_capture_.extent = swapchain_extent_;
+  for (auto const& shader : shader_code_) {
+    frame_capture_.shaders.push_back(shader);
+  }
+
+  CaptureBuffer drawable_buffer;
+  drawable_buffer.size = sizeof(Drawable) * drawables_.size();
+  drawable_buffer.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+  const char* drawable_data = reinterpret_cast<const char*>(drawables_.data());
+  drawable_buffer.data.assign(drawable_data, drawable_data + drawable_buffer.size);
+  CaptureBuffer draw_command_buffer;
+  draw_command_buffer.size = sizeof(VkDrawIndirectCommand) * drawables_.size();
+  draw_command_buffer.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+  // the camera at the start, writeCapture puts in the one of the captured frame
+  CaptureBuffer view_buffer;
+  view_buffer.size = sizeof(View);
+  view_buffer.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+  const char* view_data = reinterpret_cast<const char*>(&identity_view);
+  view_buffer.data.assign(view_data, view_data + view_buffer.size);
+  CaptureBuffer light_buffer;
+  light_buffer.size = sizeof(Light) * std::max<size_t>(1, lights_.size());
+  light_buffer.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+  const char* light_data = reinterpret_cast<const char*>(lights_.data());
+  light_buffer.data.assign(light_data, light_data + sizeof(Light) * lights_.size());
+  CaptureBuffer light_grid_buffer;
+  light_grid_buffer.size = 2 * sizeof(uint32_t) * light_tiles_x * light_tiles_y * light_slices;
+  light_grid_buffer.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+  CaptureBuffer light_index_buffer;
+  light_index_buffer.size = sizeof(uint32_t) * light_params_.capacity;
+  light_index_buffer.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+  CaptureBuffer light_counter_buffer;
+  light_counter_buffer.size = sizeof(uint32_t);
+  light_counter_buffer.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+  frame_capture_.buffers = {drawable_buffer, draw_command_buffer, view_buffer,
+                            light_buffer, light_grid_buffer, light_index_buffer, light_counter_buffer};
+
+  CaptureDescriptorSet cull_set;
+  cull_set.buffers = {drawable_buffer_index, draw_command_buffer_index, view_buffer_index};
+  CaptureDescriptorSet view_set;
+  view_set.buffers = {view_buffer_index, light_buffer_index, light_grid_buffer_index, light_index_buffer_index};
+  CaptureDescriptorSet light_set;
+  light_set.buffers = {view_buffer_index, light_buffer_index, light_grid_buffer_index, light_index_buffer_index,
+                       light_counter_buffer_index};
+  frame_capture_.descriptor_sets = {cull_set, view_set, light_set};
+
+  CapturePass cull_pass;
+  cull_pass.name = "cull";
+  cull_pass.streams.push_back(cull_commands_);
+  CapturePass light_reset_pass;
+  light_reset_pass.name = "light reset";
+  light_reset_pass.streams.push_back(light_reset_commands_);
+  CapturePass light_cull_pass;
+  light_cull_pass.name = "light cull";
+  light_cull_pass.streams.push_back(light_cull_commands_);
+  CapturePass scene_pass;
+  scene_pass.name = "scene";
+  scene_pass.renderpass = true;
+  if (settings_.depth_prepass) {
+    scene_pass.streams.push_back(prepass_commands_);
+  }
+  // the shading subpass draws the particles after the scene
+  CommandStream shading_commands = scene_commands_;
+  if (particles) {
+    shading_commands.bindPipeline(particle_draw_pipeline_index);
+    shading_commands.bindDescriptorSet(particle_draw_pipeline_index, 0, particle_set_index);
+    shading_commands.drawIndirect(particle_args_buffer_index, 0, 1, sizeof(VkDrawIndirectCommand));
+  }
+  scene_pass.streams.push_back(shading_commands);
+  frame_capture_.passes = {cull_pass, light_reset_pass, light_cull_pass, scene_pass};
 
+  if (!particles) {
+    return;
+  }
 
-  // perform multi-sampling
-  // We don't use it for now, but we'll change this later (TODO)
-  VkPipelineMultisampleStateCreateInfo multisampling = {};
-  multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-  multisampling.sampleShadingEnable = VK_FALSE;
-  multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-  multisampling.minSampleShading = 1.0f; // Optional
-  multisampling.pSampleMask = nullptr; /// Optional
-  multisampling.alphaToCoverageEnable = VK_FALSE; // Optional
-  multisampling.alphaToOneEnable = VK_FALSE; // Optional
+  // the state starts out dead, as in the engine: the capture replays the first frame of the particles
+  CaptureBuffer particle_buffer;
+  particle_buffer.size = particle_size * particle_params_.capacity;
+  particle_buffer.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+  CaptureBuffer counter_buffer;
+  counter_buffer.size = 2 * sizeof(uint32_t);
+  counter_buffer.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+  CaptureBuffer depth_buffer;
+  depth_buffer.size = sizeof(float) * collision_depth_.size();
+  depth_buffer.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+  const char* depth_data = reinterpret_cast<const char*>(collision_depth_.data());
+  depth_buffer.data.assign(depth_data, depth_data + depth_buffer.size);
+  CaptureBuffer vertex_buffer;
+  vertex_buffer.size = particle_vertex_size * particle_params_.capacity;
+  vertex_buffer.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+  CaptureBuffer args_buffer;
+  args_buffer.size = sizeof(VkDrawIndirectCommand);
+  args_buffer.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+  frame_capture_.buffers.insert(frame_capture_.buffers.end(),
+                                {particle_buffer, counter_buffer, depth_buffer, vertex_buffer, args_buffer});
+
+  CaptureDescriptorSet particle_set;
+  particle_set.buffers = {particle_buffer_index, particle_counter_buffer_index, collision_depth_buffer_index,
+                          particle_vertex_buffer_index, particle_args_buffer_index, view_buffer_index};
+  frame_capture_.descriptor_sets.push_back(particle_set);
+
+  CapturePass emit_pass;
+  emit_pass.name = "particle emit";
+  emit_pass.streams.push_back(particle_emit_commands_);
+  CapturePass simulate_pass;
+  simulate_pass.name = "particle simulate";
+  simulate_pass.streams.push_back(particle_simulate_commands_);
+  frame_capture_.passes.insert(frame_capture_.passes.begin(), {emit_pass, simulate_pass});
+}
 
+/*
+ * Split the scene render pass into the buckets of the command cache, in the order of the subpasses:
+ * the ranges of the sorted draws, then the world, then the particles and the overlay. Each hashes
+ * what it records, so the frames record again only the buckets whose draws, pipelines or bindings
+ * changed, e.g. the world when cells stream in or out.
+ */
+void Vulkan::createCommandBuckets() {
+  command_cache_.clear();
+  uint32_t shading_subpass = settings_.depth_prepass ? 1 : 0;
+  uint32_t prepass_buckets = prepass_bucket_commands_.size();
+  for (uint32_t b = 0; b < prepass_bucket_commands_.size(); b++) {
+    command_cache_.addBucket(0, [this, b](VkCommandBuffer cmd, uint32_t image, uint32_t level) {
+      beginSceneBucket(cmd, image, level);
+      prepass_bucket_commands_[b].record(cmd, command_bindings_[image]);
+    }, [this, b](uint32_t image) {
+      return CommandCache::combine(bucket_stream_hashes_[b], binding_hashes_[image]);
+    });
+  }
+  if (settings_.depth_prepass && world_.isOpen()) {
+    command_cache_.addBucket(0, [this](VkCommandBuffer cmd, uint32_t image, uint32_t level) {
+      beginSceneBucket(cmd, image, level);
+      recordWorldDraw(cmd, image, world_prepass_pipeline_);
+    }, [this](uint32_t image) {
+      return CommandCache::combine(CommandCache::combine(worldDrawHash(), binding_hashes_[image]),
+                                   VkPipeline(world_prepass_pipeline_));
+    });
+  }
 
-  // We don't use depth and stencil buffer r/n
-  //VkPipelineDepthStencilStateCreateInfo depth_stencil_info = {};
+  for (uint32_t b = 0; b < scene_bucket_commands_.size(); b++) {
+    command_cache_.addBucket(shading_subpass, [this, b](VkCommandBuffer cmd, uint32_t image, uint32_t level) {
+      beginSceneBucket(cmd, image, level);
+      scene_bucket_commands_[b].record(cmd, command_bindings_[image]);
+    }, [this, b, prepass_buckets](uint32_t image) {
+      return CommandCache::combine(bucket_stream_hashes_[prepass_buckets + b], binding_hashes_[image]);
+    });
+  }
+  if (world_.isOpen()) {
+    command_cache_.addBucket(shading_subpass, [this](VkCommandBuffer cmd, uint32_t image, uint32_t level) {
+      beginSceneBucket(cmd, image, level);
+      recordWorldDraw(cmd, image, world_pipeline_);
+    }, [this](uint32_t image) {
+      return CommandCache::combine(CommandCache::combine(worldDrawHash(), binding_hashes_[image]),
+                                   VkPipeline(world_pipeline_));
+    });
+  }
 
-  // perform color blending
-  // this happens after the fragment shader
-  // and combines it with the color from the framebuffer
-  VkPipelineColorBlendAttachmentState color_blend_attach = {};
-  // RGBA:
-  color_blend_attach.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-  color_blend_attach.blendEnable = VK_FALSE; // disable blending for now
-  color_blend_attach.srcColorBlendFactor = VK_BLEND_FACTOR_ONE; // Optional
-  color_blend_attach.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO; // Optional
-  color_blend_attach.colorBlendOp = VK_BLEND_OP_ADD; // Optional
-  color_blend_attach.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE; // Optional
-  color_blend_attach.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO; // Optional
-  color_blend_attach.alphaBlendOp = VK_BLEND_OP_ADD; // Optional
+  // recorded directly, they are no part of the captured frame
+  command_cache_.addBucket(shading_subpass, [this](VkCommandBuffer cmd, uint32_t image, uint32_t level) {
+    beginSceneBucket(cmd, image, level);
+    particle_draw_commands_.record(cmd, command_bindings_[image]);
+    if (overlay_enabled_ && !blit_scene_ && settings_.post_effects.empty()) {
+      overlay_.record(cmd, image);
+    }
+  }, [this](uint32_t image) {
+    uint64_t hash = CommandCache::combine(CommandCache::hash(particle_draw_commands_.data().data(),
+                                                             particle_draw_commands_.data().size()),
+                                          binding_hashes_[image]);
+    return CommandCache::combine(hash, overlay_enabled_);
+  });
+
+  // a subpass per pixel effect, the overlay goes on top of the last one unless a filter follows
+  for (uint32_t e = 0; e < pixel_effects_.size(); e++) {
+    bool overlay = !blit_scene_ && filter_effects_.empty() && e + 1 == pixel_effects_.size();
+    command_cache_.addBucket(shading_subpass + 1 + e, [this, e, overlay](VkCommandBuffer cmd, uint32_t image,
+                                                                         uint32_t level) {
+      recordPostDraw(cmd, level, e);
+      if (overlay && overlay_enabled_) {
+        overlay_.record(cmd, image);
+      }
+    }, [this, e](uint32_t) {
+      uint64_t hash = CommandCache::combine(CommandCache::combine(uint64_t(e), VkPipeline(post_pipelines_[e])),
+                                            post_sets_[e % 2]);
+      return CommandCache::combine(hash, overlay_enabled_);
+    });
+  }
+}
 
-  VkPipelineColorBlendStateCreateInfo color_blend_info = {};
-  color_blend_info.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-  color_blend_info.logicOpEnable = VK_FALSE;
-  color_blend_info.logicOp = VK_LOGIC_OP_COPY; // Optional
-  color_blend_info.attachmentCount = 1;
-  color_blend_info.pAttachments = &color_blend_attach;
-  color_blend_info.blendConstants[0] = 0.0f; // Optional
-  color_blend_info.blendConstants[1] = 0.0f; // Optional
-  color_blend_info.blendConstants[2] = 0.0f; // Optional
-  color_blend_info.blendConstants[3] = 0.0f; // Optional
+/*
+ * Record the particle emission of the render graph, which starts the particle timing
+ */
+void Vulkan::recordParticleEmitPass(VkCommandBuffer cmd, uint32_t image_index) {
+  if (timestamps_supported_) {
+    vkCmdResetQueryPool(cmd, timestamp_query_pool_, timestamps_per_image * image_index + 4, 2);
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestamp_query_pool_,
+                        timestamps_per_image * image_index + 4);
+  }
+  particle_emit_commands_.record(cmd, command_bindings_[image_index]);
+}
 
-  // with alpha-blending enabled: see VkBlendFactor and VkBlendOp
-  //color_blend_attach.blendEnable = VK_TRUE;
-  //color_blend_attach.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
-  //color_blend_attach.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
-  //color_blend_attach.colorBlendOp = VK_BLEND_OP_ADD;
-  //color_blend_attach.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-  //color_blend_attach.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-  //color_blend_attach.alphaBlendOp = VK_BLEND_OP_ADD;
+/*
+ * Record the particle simulation of the render graph: integration, collision and compaction
+ */
+void Vulkan::recordParticleSimulatePass(VkCommandBuffer cmd, uint32_t image_index) {
+  particle_simulate_commands_.record(cmd, command_bindings_[image_index]);
+  if (timestamps_supported_) {
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestamp_query_pool_,
+                        timestamps_per_image * image_index + 5);
+  }
+}
 
-  // Set the stuff we can change without recreating the whole graphics pipeline
-  // We *don't* use this currently
-  VkDynamicState dynamic_states[] = {
-          VK_DYNAMIC_STATE_VIEWPORT,
-          VK_DYNAMIC_STATE_LINE_WIDTH
-  };
+/*
+ * Record the culling pass of the render graph: one draw command per drawable
+ */
+void Vulkan::recordCullPass(VkCommandBuffer cmd, uint32_t image_index) {
+  cull_commands_.record(cmd, command_bindings_[image_index]);
+}
 
-  VkPipelineDynamicStateCreateInfo dynamic_state = {};
-  dynamic_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-  dynamic_state.dynamicStateCount = 2;
-  dynamic_state.pDynamicStates = dynamic_states;
+/*
+ * Record the clearing of the light index counter, which starts the light timing
+ */
+void Vulkan::recordLightResetPass(VkCommandBuffer cmd, uint32_t image_index) {
+  if (timestamps_supported_) {
+    vkCmdResetQueryPool(cmd, timestamp_query_pool_, timestamps_per_image * image_index + 6, 2);
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestamp_query_pool_,
+                        timestamps_per_image * image_index + 6);
+  }
+  light_reset_commands_.record(cmd, command_bindings_[image_index]);
+}
 
-  VkPipelineLayoutCreateInfo pipeline_layout_info = {};
-  pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-  pipeline_layout_info.setLayoutCount = 0; // Optional
-  pipeline_layout_info.pSetLayouts = nullptr; // Optional
-  pipeline_layout_info.pushConstantRangeCount = 0; // Optional
-  pipeline_layout_info.pPushConstantRanges = 0; // Optional
+/*
+ * Record the light culling of the render graph: the lights of every cluster of the view
+ */
+void Vulkan::recordLightCullPass(VkCommandBuffer cmd, uint32_t image_index) {
+  light_cull_commands_.record(cmd, command_bindings_[image_index]);
+  if (timestamps_supported_) {
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestamp_query_pool_,
+                        timestamps_per_image * image_index + 7);
+  }
+}
 
-  if (vkCreatePipelineLayout(device_, &pipeline_layout_info, nullptr,
-                             pipeline_layout_.replace()) != VK_SUCCESS) {
-    throw std::runtime_error("failed to create pipeline layout!");
+/*
+ * Record a phase of the occlusion culling: 0 writes the draws of the occluders,
+ * 1 tests the drawables against the depth pyramid and writes the draws of the frame
+ */
+void Vulkan::recordOcclusionPass(VkCommandBuffer cmd, uint32_t image_index, uint32_t phase) {
+  uint32_t count = drawables_.size();
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, occlusion_pipelines_[phase]);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, occlusion_pipeline_layout_, 0, 1,
+                          &occlusion_sets_[2 * image_index + phase], 0, nullptr);
+  vkCmdPushConstants(cmd, occlusion_pipeline_layout_, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(count), &count);
+  vkCmdDispatch(cmd, (count + 63) / 64, 1, 1);
+
+  if (phase == 0) {
+    return;
   }
 
-  // finally assemble the graphics pipeline
-  VkGraphicsPipelineCreateInfo pipeline_info = {};
-  pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+  // the statistics are read on the host once the last frame of the image is done
+  VkBufferMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.buffer = occlusion_stats_buffers_[image_index];
+  barrier.size = VK_WHOLE_SIZE;
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+                       0, nullptr, 1, &barrier, 0, nullptr);
+}
 
-  // number of stages, we have vertex and fragment shader currently
-  pipeline_info.stageCount = 2;
-  pipeline_info.pStages = shader_stages;
+/*
+ * Record the occluders of the render graph: the drawables visible in the last frame,
+ * depth only and front to back
+ */
+void Vulkan::recordOccluderPass(VkCommandBuffer cmd, uint32_t image_index) {
+  VkClearValue clear_value = {};
+  clear_value.depthStencil = {1.0f, 0};
+
+  VkRenderPassBeginInfo render_info = {};
+  render_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+  render_info.renderPass = occluder_renderpass_;
+  render_info.framebuffer = occluder_framebuffer_;
+  render_info.renderArea.extent = swapchain_extent_;
+  render_info.clearValueCount = 1;
+  render_info.pClearValues = &clear_value;
+  vkCmdBeginRenderPass(cmd, &render_info, VK_SUBPASS_CONTENTS_INLINE);
+
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, occluder_pipeline_);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout_, 0, 1,
+                          &view_sets_[image_index], 0, nullptr);
+  for (uint32_t d : occluder_order_) {
+    vkCmdPushConstants(cmd, pipeline_layout_, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(Drawable), &drawables_[d]);
+    // no instance for the drawables which aren't occluders
+    vkCmdDrawIndirect(cmd, occluder_command_buffers_[image_index], d * sizeof(VkDrawIndirectCommand),
+                      1, sizeof(VkDrawIndirectCommand));
+  }
 
-  pipeline_info.pVertexInputState = &vertex_input_info;
-  pipeline_info.pInputAssemblyState = &input_assembly;
-  pipeline_info.pRasterizationState = &rasterizer_info;
-  pipeline_info.pViewportState = &viewport_state;
-  pipeline_info.pMultisampleState = &multisampling;
-  pipeline_info.pColorBlendState = &color_blend_info;
-  pipeline_info.pDepthStencilState = nullptr;
-  pipeline_info.pDynamicState = nullptr;
+  vkCmdEndRenderPass(cmd);
+}
 
-  pipeline_info.layout = pipeline_layout_;
+/*
+ * Record the depth pyramid of the render graph: one dispatch per level,
+ * each waiting for the one before
+ */
+void Vulkan::recordDepthPyramidPass(VkCommandBuffer cmd) {
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pyramid_pipeline_);
+
+  VkImageMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+  barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = render_graph_.image(depth_pyramid_);
+  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  barrier.subresourceRange.levelCount = 1;
+  barrier.subresourceRange.layerCount = 1;
+
+  uint32_t width = pyramid_extent_.width;
+  uint32_t height = pyramid_extent_.height;
+  for (uint32_t level = 0; level < pyramid_levels_; level++) {
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pyramid_pipeline_layout_, 0, 1,
+                            &pyramid_sets_[level], 0, nullptr);
+    vkCmdDispatch(cmd, (width + 7) / 8, (height + 7) / 8, 1);
+
+    // the render graph takes care of the last one
+    if (level + 1 < pyramid_levels_) {
+      barrier.subresourceRange.baseMipLevel = level;
+      vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                           0, nullptr, 0, nullptr, 1, &barrier);
+    }
+    width = std::max(1u, width / 2);
+    height = std::max(1u, height / 2);
+  }
+}
 
+/*
+ * Record the shadow pass of the render graph: per cascade a render pass over its layers,
+ * the clear and the static casters of the cache, then the particles. Whether the cache is
+ * drawn again is decided per frame by updateShadowCascades, through the indirect draws.
+ */
+void Vulkan::recordShadowPass(VkCommandBuffer cmd, uint32_t image_index) {
+  // indexed like the attachments, the cache is loaded
+  VkClearValue clear_values[2] = {};
+  clear_values[1].depthStencil = {1.0f, 0};
+
+  VkRenderPassBeginInfo render_info = {};
+  render_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+  render_info.renderPass = shadow_renderpass_;
+  render_info.renderArea.extent = {settings_.shadow_map_size, settings_.shadow_map_size};
+  render_info.clearValueCount = 2;
+  render_info.pClearValues = clear_values;
 
-  // add renderpass
-  pipeline_info.renderPass = renderpass_;
-  pipeline_info.subpass = 0; // index of subpass
+  VkViewport viewport = {};
+  viewport.width = float(settings_.shadow_map_size);
+  viewport.height = float(settings_.shadow_map_size);
+  viewport.maxDepth = 1.0f;
+  vkCmdSetViewport(cmd, 0, 1, &viewport);
+  vkCmdSetScissor(cmd, 0, 1, &render_info.renderArea);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, shadow_pipeline_layout_, 0, 1,
+                          &shadow_sets_[image_index], 0, nullptr);
+
+  VkBuffer draws = shadow_draw_buffers_[image_index];
+  for (uint32_t c = 0; c < shadow_cascade_count; c++) {
+    render_info.framebuffer = shadow_framebuffers_[c];
+    vkCmdBeginRenderPass(cmd, &render_info, VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdPushConstants(cmd, shadow_pipeline_layout_, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(uint32_t), &c);
+
+    // no instances if the cascade is cached
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, shadow_clear_pipeline_);
+    vkCmdDrawIndirect(cmd, draws, 2 * c * sizeof(VkDrawIndirectCommand), 1, sizeof(VkDrawIndirectCommand));
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, shadow_pipeline_);
+    vkCmdDrawIndirect(cmd, draws, (2 * c + 1) * sizeof(VkDrawIndirectCommand), 1, sizeof(VkDrawIndirectCommand));
+
+    vkCmdNextSubpass(cmd, VK_SUBPASS_CONTENTS_INLINE);
+    if (settings_.particle_count > 0) {
+      vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, particle_shadow_pipeline_);
+      vkCmdDrawIndirect(cmd, particle_args_buffers_[image_index], 0, 1, sizeof(VkDrawIndirectCommand));
+    }
+    vkCmdEndRenderPass(cmd);
+  }
+}
 
-  // we derive from no pipeline
-  pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
-  pipeline_info.basePipelineIndex = -1;
+/*
+ * Record the scene pass of the render graph: depth pre-pass and shading, the buckets of the command cache
+ */
+void Vulkan::recordScenePass(VkCommandBuffer cmd, uint32_t image_index) {
+  // queries have to be reset outside of a render pass before every use
+  if (pipeline_statistics_supported_) {
+    vkCmdResetQueryPool(cmd, stats_query_pool_, image_index, 1);
+    // count the fragment shader invocations of the render pass, the buckets inherit the query
+    vkCmdBeginQuery(cmd, stats_query_pool_, image_index, 0);
+  }
 
-  // VK_NULL_HANDLE is VkPipelineCache used to speed up pipeline creation
-  if (vkCreateGraphicsPipelines(device_, VK_NULL_HANDLE, 1, &pipeline_info, nullptr, graphics_pipeline_.replace()) != VK_SUCCESS) {
-    throw std::runtime_error("Failed to create graphics pipeline");
+  // now lets add the renderpass to the command buffer
+  VkRenderPassBeginInfo render_info = {};
+  render_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+  render_info.renderPass = renderpass_;
+  render_info.framebuffer = sc_framebuffers_[image_index];
+  render_info.renderArea.offset = {0, 0};
+  render_info.renderArea.extent = renderExtent(recording_level_);
+
+  //VkClearValue clear_color = {0.2, 0.3, 0.3, 1.0};
+  // indexed like the attachments, the multisampled target or the first post target is cleared
+  // instead of the swapchain image
+  VkClearValue clear_values[5] = {};
+  for (VkClearValue& value : clear_values) {
+    value.color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+  }
+  clear_values[1].depthStencil = {1.0f, 0}; // far plane
+
+  render_info.clearValueCount = (msaa_samples_ != VK_SAMPLE_COUNT_1_BIT ? 3 : 2) + post_target_count_;
+  render_info.pClearValues = clear_values;
+
+  // everything in the subpasses is in the secondary command buffers of the buckets:
+  // the depth pre-pass, the shading and the pixel effects
+  vkCmdBeginRenderPass(cmd, &render_info, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+  uint32_t subpasses = (settings_.depth_prepass ? 2 : 1) + pixel_effects_.size();
+  for (uint32_t subpass = 0; subpass < subpasses; subpass++) {
+    if (subpass > 0) {
+      vkCmdNextSubpass(cmd, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+    }
+    command_cache_.execute(cmd, image_index, recording_level_, subpass);
   }
+  vkCmdEndRenderPass(cmd);
 
-  std::cout << "Created graphics pipeline successfully.\n";
+  if (pipeline_statistics_supported_) {
+    vkCmdEndQuery(cmd, stats_query_pool_, image_index);
+  }
 }
 
+/*
+ * Set the dynamic state of the scene pipelines for the resolution level and bind the shadow maps
+ * at set 1, the streams only bind the first set and the maps stay bound through them
+ */
+void Vulkan::beginSceneBucket(VkCommandBuffer cmd, uint32_t image_index, uint32_t level) {
+  setRenderArea(cmd, level);
 
-void Vulkan::createRenderpass() {
-  // just the attachment for the swapchain image
-  VkAttachmentDescription attachment = {};
-  attachment.format = this->swapchain_format_;
-  attachment.samples = VK_SAMPLE_COUNT_1_BIT;
-  attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR; // clear framebuffer
-  attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE; // Rendered stuff should stay in memory
+  if (settings_.shadows) {
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout_, 1, 1,
+                            &shadow_sets_[image_index], 0, nullptr);
+  }
+}
 
-  // don't care about stencil buffer
-  attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-  attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+void Vulkan::setRenderArea(VkCommandBuffer cmd, uint32_t level) {
+  VkRect2D area = {{0, 0}, renderExtent(level)};
+  VkViewport viewport = {};
+  viewport.width = float(area.extent.width);
+  viewport.height = float(area.extent.height);
+  viewport.maxDepth = 1.0f;
+  vkCmdSetViewport(cmd, 0, 1, &viewport);
+  vkCmdSetScissor(cmd, 0, 1, &area);
+}
 
-  attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; // we would like to have the images in the swap chain
+/*
+ * Record the triangle of a post effect over the rendered part of each view. A pixel effect reads
+ * the post target of the subpass before, a filter samples its input
+ */
+void Vulkan::recordPostDraw(VkCommandBuffer cmd, uint32_t level, uint32_t effect) {
+  bool filter = effect >= pixel_effects_.size();
+  VkPipelineLayout layout = filter ? filter_pipeline_layout_ : post_pipeline_layout_;
+  VkDescriptorSet set = filter ? post_sets_[post_target_count_ + effect - pixel_effects_.size()] :
+                        post_sets_[effect % 2];
+  setRenderArea(cmd, level);
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, post_pipelines_[effect]);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0, 1, &set, 0, nullptr);
+
+  VkExtent2D extent = renderExtent(level);
+  PostParams params = {{float(extent.width), float(extent.height)}};
+  vkCmdPushConstants(cmd, layout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PostParams), &params);
+  // the instanced views get a triangle each, see post.vert
+  vkCmdDraw(cmd, 3, view_instances_, 0, 0);
+}
 
-  // create the reference to the created color attachment
-  VkAttachmentReference attachment_ref = {};
-  attachment_ref.attachment = 0; // index
-  attachment_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+/*
+ * Record the draw of the world pool: a draw per run of slots with a cell in them, the others
+ * aren't drawn. Its bucket is recorded again whenever that changes, see worldDrawHash.
+ * The copies into the pool are submitted before the frame, outside of the render graph.
+ */
+void Vulkan::recordWorldDraw(VkCommandBuffer cmd, uint32_t image_index, VkPipeline pipeline) {
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+  // the shadow maps at set 1 stay
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout_, 0, 1, &view_sets_[image_index],
+                          0, nullptr);
+  uint32_t drawables = world_.slotDrawables();
+  uint32_t slot = 0;
+  while (slot < world_.slots()) {
+    if (!world_.slotResident(slot)) {
+      slot++;
+      continue;
+    }
+    uint32_t first = slot;
+    while (slot < world_.slots() && world_.slotResident(slot)) {
+      slot++;
+    }
+    // the instanced views take the drawable from every view_instances_-th instance, see views.glsl
+    vkCmdDraw(cmd, 3, (slot - first) * drawables * view_instances_, 0, first * drawables * view_instances_);
+  }
+}
 
-  // create the subpass for this renderpass
-  // can be used for post-processing stuff
-  VkSubpassDescription subpass = {};
-  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS; // graphics subpass
-  subpass.colorAttachmentCount = 1;
-  subpass.pColorAttachments = &attachment_ref;
+uint64_t Vulkan::worldDrawHash() const {
+  uint64_t hash = CommandCache::hash(nullptr, 0);
+  // a bit per slot, 64 at a time
+  uint64_t bits = 0;
+  for (uint32_t slot = 0; slot < world_.slots(); slot++) {
+    bits |= uint64_t(world_.slotResident(slot) ? 1 : 0) << (slot % 64);
+    if (slot % 64 == 63 || slot + 1 == world_.slots()) {
+      hash = CommandCache::combine(hash, bits);
+      bits = 0;
+    }
+  }
+  return hash;
+}
 
+/*
+ * Record the upscale of the render graph: the rendered part of each layer of the scene target
+ * stretched over the part of the swapchain image of its view, side by side from the left
+ */
+void Vulkan::recordUpscalePass(VkCommandBuffer cmd, uint32_t image_index) {
+  VkExtent2D extent = renderExtent(recording_level_);
+  VkImageBlit regions[32] = {};
+  for (uint32_t v = 0; v < views_; v++) {
+    VkImageBlit& region = regions[v];
+    region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.srcSubresource.baseArrayLayer = v;
+    region.srcSubresource.layerCount = 1;
+    region.srcOffsets[1] = {int32_t(extent.width), int32_t(extent.height), 1};
+    region.dstSubresource = region.srcSubresource;
+    region.dstSubresource.baseArrayLayer = 0;
+    // the last one takes what is left of the width
+    region.dstOffsets[0] = {int32_t(v * viewExtent().width), 0, 0};
+    region.dstOffsets[1] = {int32_t(v + 1 < views_ ? (v + 1) * viewExtent().width : swapchain_extent_.width),
+                            int32_t(swapchain_extent_.height), 1};
+  }
+  vkCmdBlitImage(cmd, render_graph_.image(scene_color_), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                 render_graph_.image(backbuffer_, image_index), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                 views_, regions, upscale_filter_);
+}
 
-  // finally create the render pass
-  VkRenderPassCreateInfo renderpass = {};
-  renderpass.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-  renderpass.attachmentCount = 1;
-  renderpass.pAttachments = &attachment;
-  renderpass.subpassCount = 1;
-  renderpass.pSubpasses = &subpass;
+/*
+ * Record a filter of the render graph, sampling the result of the scene render pass or of the filter
+ * before. The last one also draws the overlay if it writes the swapchain image
+ */
+void Vulkan::recordFilterPass(VkCommandBuffer cmd, uint32_t image_index, uint32_t filter) {
+  VkRenderPassBeginInfo render_info = {};
+  render_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+  render_info.renderPass = filter_renderpasses_[filter];
+  render_info.framebuffer = filter_framebuffers_[filter * sc_framebuffers_.size() + image_index];
+  render_info.renderArea.extent = renderExtent(recording_level_);
+  vkCmdBeginRenderPass(cmd, &render_info, VK_SUBPASS_CONTENTS_INLINE);
+  recordPostDraw(cmd, recording_level_, pixel_effects_.size() + filter);
+  if (overlay_enabled_ && !blit_scene_ && filter + 1 == filter_effects_.size()) {
+    overlay_.record(cmd, image_index);
+  }
+  vkCmdEndRenderPass(cmd);
+}
 
-  // TODO: understand subpass dependencies better
+/*
+ * Record the overlay of the render graph, over the blitted scene at the full resolution
+ */
+void Vulkan::recordOverlayPass(VkCommandBuffer cmd, uint32_t image_index) {
+  VkRenderPassBeginInfo render_info = {};
+  render_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+  render_info.renderPass = overlay_renderpass_;
+  render_info.framebuffer = overlay_framebuffers_[image_index];
+  render_info.renderArea.extent = swapchain_extent_;
+  vkCmdBeginRenderPass(cmd, &render_info, VK_SUBPASS_CONTENTS_INLINE);
+  if (overlay_enabled_) {
+    overlay_.record(cmd, image_index);
+  }
+  vkCmdEndRenderPass(cmd);
+}
 
-  VkSubpassDependency dependency = {};
-  // external(implicit) subpass -> our subpass
-  dependency.srcSubpass = VK_SUBPASS_EXTERNAL; // external: implicit subpass before
-  dependency.dstSubpass = 0; // our created subpass
+VkExtent2D Vulkan::renderExtent(uint32_t level) const {
+  VkExtent2D extent = viewExtent();
+  if (!dynamic_resolution_) {
+    return extent;
+  }
+  float scale = resolution_.scale(level);
+  return {std::max(1u, uint32_t(extent.width * scale + 0.5f)),
+          std::max(1u, uint32_t(extent.height * scale + 0.5f))};
+}
 
-  // we need to wait on the swap chain to read the image
-  dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  dependency.srcAccessMask = 0;
+VkExtent2D Vulkan::viewExtent() const {
+  return {swapchain_extent_.width / views_, swapchain_extent_.height};
+}
 
-  dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+std::string Vulkan::viewShader(std::string const& name) const {
+  if (views_ == 1) {
+    return name;
+  }
+  // shaders/first.vert.spv -> shaders/first.vert.multiview.spv
+  return name.substr(0, name.size() - 4) + (multiview_ ? ".multiview.spv" : ".layered.spv");
+}
 
-  renderpass.dependencyCount = 1;
-  renderpass.pDependencies = &dependency;
+Camera Vulkan::coveringCamera(Camera const& camera) const {
+  // the outer views are half the separation of all of them off to the sides, the zoom shows that much more
+  float spread = 0.5f * settings_.view_separation * float(views_ - 1);
+  Camera covering = camera;
+  covering.zoom = 1.0f / (1.0f / std::max(camera.zoom, 1e-3f) + spread);
+  return covering;
+}
 
+/*
+ * Write the cameras of the frame into the view buffer of the image: the one covering all views
+ * for the culling and the light clusters, then the views from left to right, view_separation apart.
+ * The last frame of the image has to be done reading it, drawFrame waits for its fence first
+ */
+void Vulkan::writeViews(uint32_t image_index, Camera const& camera) {
+  View* views = static_cast<View*>(view_mapped_[image_index]);
+  views[0] = toView(coveringCamera(camera));
+  for (uint32_t v = 0; v < views_; v++) {
+    Camera eye = camera;
+    eye.position[0] += (float(v) - 0.5f * float(views_ - 1)) * settings_.view_separation;
+    views[1 + v] = toView(eye);
+  }
+}
 
-  if (vkCreateRenderPass(device_, &renderpass, nullptr, renderpass_.replace()) != VK_SUCCESS) {
-    throw std::runtime_error("Failed to create render pass");
+void Vulkan::createSemaphores() {
+  VkSemaphoreCreateInfo info = {};
+  info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+  // one more acquisition semaphore than images can be acquired at once,
+  // so we never signal one which the previous frame with it still waits for
+  size_t image_count = swapchain_images_.size();
+  image_available_.resize(image_count + 1, VDeleter<VkSemaphore>{device_, vkDestroySemaphore});
+  render_finished_.resize(image_count, VDeleter<VkSemaphore>{device_, vkDestroySemaphore});
+  compute_finished_.resize(image_count, VDeleter<VkSemaphore>{device_, vkDestroySemaphore});
+  readback_finished_.resize(image_count, VDeleter<VkSemaphore>{device_, vkDestroySemaphore});
+  frame_fences_.resize(image_available_.size(), VDeleter<VkFence>{device_, vkDestroyFence});
+  image_fences_.assign(image_count, VK_NULL_HANDLE);
+
+  // signaled, as if a frame before the first one was done with them
+  VkFenceCreateInfo fence_info = {};
+  fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+  fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+  for (size_t i = 0; i < image_available_.size(); i++) {
+    if (vkCreateSemaphore(device_, &info, nullptr, image_available_[i].replace()) != VK_SUCCESS ||
+        vkCreateFence(device_, &fence_info, nullptr, frame_fences_[i].replace()) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create semaphores");
+    }
   }
-  std::cout << "Created render pass successfully.\n";
+  for (size_t i = 0; i < image_count; i++) {
+    if (vkCreateSemaphore(device_, &info, nullptr, render_finished_[i].replace()) != VK_SUCCESS ||
+        vkCreateSemaphore(device_, &info, nullptr, compute_finished_[i].replace()) != VK_SUCCESS ||
+        vkCreateSemaphore(device_, &info, nullptr, readback_finished_[i].replace()) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create semaphores");
+    }
+  }
+
+  LOG_INFO("Successfully created semaphores.");
 }
 
-void Vulkan::createFramebuffers() {
-  // match number of image views
-  sc_framebuffers_.resize(sc_image_views_.size(), VDeleter<VkFramebuffer> {device_, vkDestroyFramebuffer});
+/*
+ * Buffers for the frames in flight plus one being encoded per worker,
+ * the workers are the ones the device profile has for background work
+ */
+void Vulkan::createReadback() {
+  if (settings_.readback_interval == 0) {
+    return;
+  }
+  if (!(swapchain_usage_ & VK_IMAGE_USAGE_TRANSFER_SRC_BIT)) {
+    LOG_WARNING("The swapchain images can't be copied, the readback is disabled.");
+    return;
+  }
 
-  // does this work with auto const&
-  for(size_t i = 0; i < sc_image_views_.size(); i++) {
-    VkImageView attachments[] = {
-            sc_image_views_[i]
-    };
+  QueueFamilyIndices indices = findQueueFamilies(physical_device_);
+  uint32_t workers = std::max(1u, profile_.worker_threads);
+  try {
+    readback_.init(physical_device_, indices.graphics_family, swapchain_extent_, swapchain_format_,
+                   swapchain_images_.size() + workers, settings_.readback_format, settings_.readback_prefix,
+                   workers);
+  } catch (std::exception const& e) {
+    // e.g. an unusual swapchain format, not worth failing the start for
+    LOG_WARNING(e.what() << ", the readback is disabled.");
+  }
+}
 
-    VkFramebufferCreateInfo info = {};
-    info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-    info.renderPass = renderpass_;
-    info.attachmentCount = 1;
-    info.pAttachments = attachments;
-    info.width = swapchain_extent_.width;
-    info.height = swapchain_extent_.height;
-    info.layers = 1;
+/*
+ * Drawn last in the shading subpass, uploading its font on the graphics queue
+ */
+void Vulkan::createOverlay(VkQueue queue) {
+  if (!settings_.overlay) {
+    return;
+  }
 
-    if (vkCreateFramebuffer(device_, &info, nullptr, sc_framebuffers_[i].replace()) != VK_SUCCESS) {
-      throw std::runtime_error("Failed to create framebuffer for image view");
+  QueueFamilyIndices indices = findQueueFamilies(physical_device_);
+  try {
+    // with dynamic resolution or the views in a render pass of its own, after the blit,
+    // else by what writes the swapchain image last: the last filter, the last pixel effect or the shading
+    VkRenderPass renderpass = renderpass_;
+    uint32_t subpass = (settings_.depth_prepass ? 1 : 0) + pixel_effects_.size();
+    VkSampleCountFlagBits samples = pixel_effects_.empty() ? msaa_samples_ : VK_SAMPLE_COUNT_1_BIT;
+    if (blit_scene_ || !filter_effects_.empty()) {
+      renderpass = blit_scene_ ? VkRenderPass(overlay_renderpass_) : VkRenderPass(filter_renderpasses_.back());
+      subpass = 0;
+      samples = VK_SAMPLE_COUNT_1_BIT;
     }
+    overlay_.init(physical_device_, queue, indices.graphics_family, renderpass, subpass, samples,
+                  swapchain_extent_, swapchain_images_.size(), shader_code_.at("shaders/overlay.vert.spv"),
+                  shader_code_.at("shaders/overlay.frag.spv"), pipeline_cache_, overlay_max_vertices);
+  } catch (std::exception const& e) {
+    LOG_WARNING(e.what() << ", the overlay is disabled.");
   }
+}
 
-  std::cout << "Number of created framebuffers: " << sc_framebuffers_.size() << "\n";
+RenderGraph::Resource Vulkan::filterOutput(uint32_t filter) const {
+  if (filter + 1 < filter_inputs_.size()) {
+    return filter_inputs_[filter + 1];
+  }
+  return blit_scene_ ? scene_color_ : backbuffer_;
 }
 
-void Vulkan::createCommandPool() {
-  QueueFamilyIndices queue_indices = findQueueFamilies(physical_device_);
+/*
+ * The pixel effects read the post target the subpass before wrote as input attachment,
+ * the filters sample their input. A set per post target and per filter, pipelines per effect
+ */
+void Vulkan::createPostProcessing() {
+  if (settings_.post_effects.empty()) {
+    return;
+  }
+  uint32_t filters = filter_effects_.size();
+
+  VkDescriptorSetLayoutBinding binding = {};
+  binding.binding = 0;
+  binding.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+  binding.descriptorCount = 1;
+  binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+  VkDescriptorSetLayoutCreateInfo layout_info = {};
+  layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layout_info.bindingCount = 1;
+  layout_info.pBindings = &binding;
+  if (vkCreateDescriptorSetLayout(device_, &layout_info, nullptr, post_set_layout_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create post-processing descriptor set layout");
+  }
+  binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  if (vkCreateDescriptorSetLayout(device_, &layout_info, nullptr, filter_set_layout_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create filter descriptor set layout");
+  }
 
-  VkCommandPoolCreateInfo info = {};
-  info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-  info.queueFamilyIndex = queue_indices.graphics_family;
-  // possible flags:
-  // VK_COMMAND_POOL_CREATE_TRANSIENT_BIT:
-  //    indicate that we rerecord the command buffers often
-  info.flags = 0;
+  // a pool may not have sizes of 0 descriptors
+  VkDescriptorPoolSize pool_sizes[2] = {};
+  uint32_t size_count = 0;
+  if (post_target_count_ > 0) {
+    pool_sizes[size_count].type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+    pool_sizes[size_count++].descriptorCount = post_target_count_;
+  }
+  if (filters > 0) {
+    pool_sizes[size_count].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    pool_sizes[size_count++].descriptorCount = filters;
+  }
+  VkDescriptorPoolCreateInfo pool_info = {};
+  pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  pool_info.maxSets = post_target_count_ + filters;
+  pool_info.poolSizeCount = size_count;
+  pool_info.pPoolSizes = pool_sizes;
+  if (vkCreateDescriptorPool(device_, &pool_info, nullptr, post_descriptor_pool_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create post-processing descriptor pool");
+  }
+
+  std::vector<VkDescriptorSetLayout> layouts(post_target_count_, post_set_layout_);
+  layouts.resize(post_target_count_ + filters, filter_set_layout_);
+  VkDescriptorSetAllocateInfo alloc_info = {};
+  alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  alloc_info.descriptorPool = post_descriptor_pool_;
+  alloc_info.descriptorSetCount = layouts.size();
+  alloc_info.pSetLayouts = layouts.data();
+  post_sets_.resize(layouts.size());
+  if (vkAllocateDescriptorSets(device_, &alloc_info, post_sets_.data()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to allocate post-processing descriptor sets");
+  }
+
+  if (filters > 0) {
+    // the edges are blended along, the samples next to the border repeat it
+    VkSamplerCreateInfo sampler_info = {};
+    sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    sampler_info.magFilter = VK_FILTER_LINEAR;
+    sampler_info.minFilter = VK_FILTER_LINEAR;
+    sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.maxLod = 0.0f;
+    if (vkCreateSampler(device_, &sampler_info, nullptr, filter_sampler_.replace()) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create filter sampler");
+    }
+  }
+
+  filter_views_.clear();
+  filter_views_.resize(filters, VDeleter<VkImageView>{device_, vkDestroyImageView});
+  for (uint32_t f = 0; f < filters; f++) {
+    VkImageViewCreateInfo view_info = {};
+    view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    view_info.image = render_graph_.image(filter_inputs_[f]);
+    view_info.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+    view_info.format = swapchain_format_;
+    view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    view_info.subresourceRange.levelCount = 1;
+    view_info.subresourceRange.layerCount = views_;
+    if (vkCreateImageView(device_, &view_info, nullptr, filter_views_[f].replace()) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create filter input view");
+    }
+  }
+
+  for (uint32_t s = 0; s < post_sets_.size(); s++) {
+    bool filter = s >= post_target_count_;
+    VkDescriptorImageInfo image_info = {};
+    image_info.sampler = filter ? VkSampler(filter_sampler_) : VK_NULL_HANDLE;
+    image_info.imageView = filter ? VkImageView(filter_views_[s - post_target_count_]) :
+                           render_graph_.imageView(post_targets_[s]);
+    image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    VkWriteDescriptorSet write = {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = post_sets_[s];
+    write.dstBinding = 0;
+    write.descriptorType = filter ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+    write.descriptorCount = 1;
+    write.pImageInfo = &image_info;
+    vkUpdateDescriptorSets(device_, 1, &write, 0, nullptr);
+  }
+
+  // the rendered part of the views
+  VkPushConstantRange push_constant_range = {};
+  push_constant_range.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+  push_constant_range.offset = 0;
+  push_constant_range.size = sizeof(PostParams);
+  VkPipelineLayoutCreateInfo pipeline_layout_info = {};
+  pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipeline_layout_info.setLayoutCount = 1;
+  pipeline_layout_info.pSetLayouts = &post_set_layout_;
+  pipeline_layout_info.pushConstantRangeCount = 1;
+  pipeline_layout_info.pPushConstantRanges = &push_constant_range;
+  if (vkCreatePipelineLayout(device_, &pipeline_layout_info, nullptr,
+                             post_pipeline_layout_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create post-processing pipeline layout");
+  }
+  pipeline_layout_info.pSetLayouts = &filter_set_layout_;
+  if (vkCreatePipelineLayout(device_, &pipeline_layout_info, nullptr,
+                             filter_pipeline_layout_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create filter pipeline layout");
+  }
 
-  if (vkCreateCommandPool(device_, &info, nullptr, command_pool_.replace()) != VK_SUCCESS) {
-    throw std::runtime_error("Failed to create command pool");
+  VDeleter<VkShaderModule> vert_shader_module{device_, vkDestroyShaderModule};
+  VDeleter<VkShaderModule> post_shader_module{device_, vkDestroyShaderModule};
+  VDeleter<VkShaderModule> filter_shader_module{device_, vkDestroyShaderModule};
+  createShaderModule(shader_code_.at(viewShader("shaders/post.vert.spv")), vert_shader_module);
+  if (!pixel_effects_.empty()) {
+    createShaderModule(shader_code_.at("shaders/post.frag.spv"), post_shader_module);
+  }
+  if (filters > 0) {
+    createShaderModule(shader_code_.at("shaders/post_filter.frag.spv"), filter_shader_module);
   }
-  std::cout << "Created command pool successfully.\n";
-}
 
-void Vulkan::createCommandBuffers() {
-  command_buffers_.resize(sc_framebuffers_.size());
+  VkPipelineShaderStageCreateInfo stages[2] = {};
+  stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+  stages[0].module = vert_shader_module;
+  stages[0].pName = "main";
+  ShaderVariant view_variant;
+  stages[0].pSpecializationInfo = view_variant.set(view_count_constant, views_).info();
+  stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+  stages[1].pName = "main";
+
+  // a triangle over the whole view, made up by the vertex shader
+  VkPipelineVertexInputStateCreateInfo vertex_input_info = {};
+  vertex_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+  VkPipelineInputAssemblyStateCreateInfo input_assembly = {};
+  input_assembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+  input_assembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
 
-  VkCommandBufferAllocateInfo alloc_info = {};
-  alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-  alloc_info.commandBufferCount = command_buffers_.size();
-  alloc_info.commandPool = command_pool_;
+  // the viewport and the scissor are set like for the scene, see setRenderArea
+  VkPipelineViewportStateCreateInfo viewport_state = {};
+  viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+  viewport_state.viewportCount = 1;
+  viewport_state.scissorCount = 1;
+  VkDynamicState dynamic_states[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+  VkPipelineDynamicStateCreateInfo dynamic_state = {};
+  dynamic_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+  dynamic_state.dynamicStateCount = 2;
+  dynamic_state.pDynamicStates = dynamic_states;
 
-  // VK_COMMAND_BUFFER_LEVEL_PRIMARY: Can be submitted to a queue for execution, but cannot be called from other command buffers.
-  // VK_COMMAND_BUFFER_LEVEL_SECONDARY: Cannot be submitted directly, but can be called from primary command buffers.
-  alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  VkPipelineRasterizationStateCreateInfo rasterizer_info = {};
+  rasterizer_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+  rasterizer_info.polygonMode = VK_POLYGON_MODE_FILL;
+  rasterizer_info.lineWidth = 1.0f;
+  rasterizer_info.cullMode = VK_CULL_MODE_NONE;
+  rasterizer_info.frontFace = VK_FRONT_FACE_CLOCKWISE;
 
-  if (vkAllocateCommandBuffers(device_, &alloc_info, command_buffers_.data()) != VK_SUCCESS) {
-    throw std::runtime_error("Failed to allocate command bufffers");
-  }
+  // the multisampled shading is resolved before the first effect
+  VkPipelineMultisampleStateCreateInfo multisampling = {};
+  multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+  multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+  multisampling.minSampleShading = 1.0f;
 
-  // Begin command buffer recording
-  for (size_t i=0; i < command_buffers_.size(); i++) {
-    VkCommandBufferBeginInfo begin_info = {};
-    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    // we can specify the command buffer usage:
-    // simultaneous: we can resubmit instantly, if we want
-    // one_time: will be rerecorded after submitting
-    // render_pass: used for renderpass (duh!)
-    begin_info.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-    begin_info.pInheritanceInfo = nullptr; // we don't inherit
+  VkPipelineDepthStencilStateCreateInfo depth_stencil_info = {};
+  depth_stencil_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
 
-    if (vkBeginCommandBuffer(command_buffers_[i], &begin_info) != VK_SUCCESS) {
-      throw std::runtime_error("Failed to start recording command buffer");
-    }
+  // every pixel is written, nothing is blended
+  VkPipelineColorBlendAttachmentState color_blend_attach = {};
+  color_blend_attach.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                                      VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+  VkPipelineColorBlendStateCreateInfo color_blend_info = {};
+  color_blend_info.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+  color_blend_info.attachmentCount = 1;
+  color_blend_info.pAttachments = &color_blend_attach;
 
-    // now lets add the renderpass to the command buffer
-    VkRenderPassBeginInfo render_info = {};
-    render_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    render_info.renderPass = renderpass_;
-    render_info.framebuffer = sc_framebuffers_[i];
-    render_info.renderArea.offset = {0, 0};
-    render_info.renderArea.extent = swapchain_extent_;
+  VkGraphicsPipelineCreateInfo pipeline_info = {};
+  pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+  pipeline_info.stageCount = 2;
+  pipeline_info.pStages = stages;
+  pipeline_info.pVertexInputState = &vertex_input_info;
+  pipeline_info.pInputAssemblyState = &input_assembly;
+  pipeline_info.pRasterizationState = &rasterizer_info;
+  pipeline_info.pViewportState = &viewport_state;
+  pipeline_info.pMultisampleState = &multisampling;
+  pipeline_info.pColorBlendState = &color_blend_info;
+  pipeline_info.pDepthStencilState = &depth_stencil_info;
+  pipeline_info.pDynamicState = &dynamic_state;
+  pipeline_info.basePipelineIndex = -1;
 
-    //VkClearValue clear_color = {0.2, 0.3, 0.3, 1.0};
-    VkClearValue clear_color = {0.0f, 0.0f, 0.0f, 1.0f};
+  uint32_t shading_subpass = settings_.depth_prepass ? 1 : 0;
+  post_pipelines_.clear();
+  post_pipelines_.resize(settings_.post_effects.size(), VDeleter<VkPipeline>{device_, vkDestroyPipeline});
+  for (uint32_t e = 0; e < post_pipelines_.size(); e++) {
+    bool filter = e >= pixel_effects_.size();
+    // which effect post.frag applies
+    ShaderVariant effect_variant;
+    if (filter) {
+      stages[1].module = filter_shader_module;
+      stages[1].pSpecializationInfo = nullptr;
+      pipeline_info.layout = filter_pipeline_layout_;
+      pipeline_info.renderPass = filter_renderpasses_[e - pixel_effects_.size()];
+      pipeline_info.subpass = 0;
+    } else {
+      stages[1].module = post_shader_module;
+      stages[1].pSpecializationInfo = effect_variant.set(post_effect_constant, uint32_t(pixel_effects_[e])).info();
+      pipeline_info.layout = post_pipeline_layout_;
+      pipeline_info.renderPass = renderpass_;
+      pipeline_info.subpass = shading_subpass + 1 + e;
+    }
+    if (vkCreateGraphicsPipelines(device_, pipeline_cache_, 1, &pipeline_info, nullptr,
+                                  post_pipelines_[e].replace()) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create post-processing pipeline");
+    }
+  }
+  LOG_INFO("Created " << pixel_effects_.size() << " post-processing subpasses and " << filters
+           << " filter passes.");
+}
 
-    render_info.clearValueCount = 1;
-    render_info.pClearValues = &clear_color;
+/*
+ * Create the pipeline statistics queries used to measure overdraw
+ * and the timestamp queries used to measure the GPU time of the queues
+ * and of the particles (per command buffer, as they are recorded only once)
+ */
+void Vulkan::createQueryPool() {
+  queries_used_.assign(sc_framebuffers_.size(), false);
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physical_device_, &properties);
+  timestamps_supported_ = properties.limits.timestampComputeAndGraphics == VK_TRUE;
+  timestamp_period_ = properties.limits.timestampPeriod;
+
+  if (timestamps_supported_) {
+    VkQueryPoolCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    info.queryCount = timestamps_per_image * sc_framebuffers_.size();
+
+    if (vkCreateQueryPool(device_, &info, nullptr, timestamp_query_pool_.replace()) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create timestamp query pool");
+    }
+  } else {
+    LOG_INFO("Timestamps not supported on all queues, no GPU timings.");
+  }
 
-    // we dont use a secondary command buffer (with subpass) -> inline
-    vkCmdBeginRenderPass(command_buffers_[i], &render_info, VK_SUBPASS_CONTENTS_INLINE);
+  if (!pipeline_statistics_supported_) {
+    LOG_INFO("Pipeline statistics queries not supported, no overdraw statistics.");
+    return;
+  }
 
-    vkCmdBindPipeline(command_buffers_[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphics_pipeline_);
+  VkQueryPoolCreateInfo info = {};
+  info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  info.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+  info.queryCount = sc_framebuffers_.size();
+  info.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
 
-    // vertex count, instance count, first vertex, first instance
-    vkCmdDraw(command_buffers_[i], 3, 1, 0, 0);
+  if (vkCreateQueryPool(device_, &info, nullptr, stats_query_pool_.replace()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create query pool");
+  }
+  LOG_INFO("Created query pool successfully.");
+}
 
-    vkCmdEndRenderPass(command_buffers_[i]);
+/*
+ * Generate the test scene: a bunch of overlapping triangles at random depths
+ * Always uses the same seed, so the numbers are comparable between runs
+ */
+void Vulkan::createScene() {
+  std::mt19937 rng(42);
+  // some of the triangles end up off screen and are culled
+  std::uniform_real_distribution<float> position(-1.25f, 1.25f);
+  std::uniform_real_distribution<float> scale(0.5f, 1.5f);
+  std::uniform_real_distribution<float> depth(0.05f, 0.95f);
+
+  drawables_.resize(settings_.scene_triangles);
+  for (auto& drawable : drawables_) {
+    drawable.offset[0] = position(rng);
+    drawable.offset[1] = position(rng);
+    drawable.scale = scale(rng);
+    drawable.depth = depth(rng);
+  }
+  if (settings_.particle_count > 0) {
+    createCollisionDepth();
+  }
+  createLights();
+  LOG_INFO("Created scene with " << drawables_.size() << " triangles.");
+}
 
-    if (vkEndCommandBuffer(command_buffers_[i]) != VK_SUCCESS) {
-      throw std::runtime_error("failed to record command buffer");
+/*
+ * Scatter the lights over the scene, with a seed of their own
+ * so the triangles stay the same whatever the number of lights
+ */
+void Vulkan::createLights() {
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<float> position(-1.25f, 1.25f);
+  std::uniform_real_distribution<float> depth(0.0f, 1.0f);
+  std::uniform_real_distribution<float> radius(0.1f, 0.4f);
+  std::uniform_real_distribution<float> color(0.2f, 1.0f);
+  std::uniform_real_distribution<float> intensity(0.5f, 1.0f);
+
+  lights_.resize(settings_.light_count);
+  for (auto& light : lights_) {
+    light.position[0] = position(rng);
+    light.position[1] = position(rng);
+    light.depth = depth(rng);
+    light.radius = radius(rng);
+    for (float& channel : light.color) {
+      channel = color(rng);
     }
-    std::cout << "Successfully recorded command buffer i=" << i << "\n";
+    light.intensity = intensity(rng);
   }
 }
 
-void Vulkan::createSemaphores() {
-  VkSemaphoreCreateInfo info = {};
-  info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-
-  if (vkCreateSemaphore(device_, &info, nullptr, image_available_.replace()) != VK_SUCCESS ||
-      vkCreateSemaphore(device_, &info, nullptr, render_finished_.replace()) != VK_SUCCESS    ) {
-    throw std::runtime_error("Failed to create semaphores");
+/*
+ * Rasterize the scene into the depth map the particles collide with, at the center of each cell
+ *
+ * The depth buffer of the frame only lives inside the render pass on the graphics queue,
+ * the scene doesn't move, so the particles get their own once.
+ */
+void Vulkan::createCollisionDepth() {
+  // the triangle of first.vert
+  const float corners[3][2] = {{0.0f, -0.5f}, {0.5f, 0.5f}, {-0.5f, 0.5f}};
+  const float cell = 2.0f / collision_depth_size;
+
+  collision_depth_.assign(collision_depth_size * collision_depth_size, 1.0f);
+  for (auto const& drawable : drawables_) {
+    float x[3], y[3];
+    for (int v = 0; v < 3; v++) {
+      x[v] = corners[v][0] * drawable.scale + drawable.offset[0];
+      y[v] = corners[v][1] * drawable.scale + drawable.offset[1];
+    }
+    // the cells whose centers the bounding box covers
+    auto first = [cell](float lo) { return std::max(0, int(std::ceil((lo + 1.0f) / cell - 0.5f))); };
+    auto last = [cell](float hi) {
+      return std::min(int(collision_depth_size) - 1, int(std::floor((hi + 1.0f) / cell - 0.5f)));
+    };
+    int x0 = first(std::min({x[0], x[1], x[2]}));
+    int x1 = last(std::max({x[0], x[1], x[2]}));
+    int y0 = first(std::min({y[0], y[1], y[2]}));
+    int y1 = last(std::max({y[0], y[1], y[2]}));
+
+    for (int cy = y0; cy <= y1; cy++) {
+      for (int cx = x0; cx <= x1; cx++) {
+        float px = (cx + 0.5f) * cell - 1.0f;
+        float py = (cy + 0.5f) * cell - 1.0f;
+        // inside if on the same side of all three edges
+        bool negative = false, positive = false;
+        for (int v = 0; v < 3; v++) {
+          int w = (v + 1) % 3;
+          float edge = (x[w] - x[v]) * (py - y[v]) - (y[w] - y[v]) * (px - x[v]);
+          negative = negative || edge < 0.0f;
+          positive = positive || edge > 0.0f;
+        }
+        float& depth = collision_depth_[cy * collision_depth_size + cx];
+        if (!(negative && positive)) {
+          depth = std::min(depth, drawable.depth);
+        }
+      }
+    }
   }
+}
 
-  std::cout << "Successfully created semaphores.\n";
+/*
+ * Open the streamed world, generating it first if there is none yet
+ * Only its index is read here, the cells are read around the camera while rendering
+ */
+void Vulkan::createWorld() {
+  if (settings_.world_path.empty()) {
+    return;
+  }
+  if (!std::ifstream(settings_.world_path).good()) {
+    if (!WorldStreamer::generate(settings_.world_path, world_cells, world_cells, world_cell_size,
+                                 world_cell_drawables)) {
+      throw std::runtime_error("Failed to write world " + settings_.world_path);
+    }
+    LOG_INFO("Generated world " << settings_.world_path << ".");
+  }
+  world_.open(settings_.world_path, settings_.world_memory, world_queue_depth, profile_.worker_threads,
+              settings_.world_threads);
 }
+
 /*
  * create a new SPIR-V shadermodule from bytecode
  */
@@ -692,7 +5060,7 @@ void Vulkan::createShaderModule(const std::vector<char>& code, VDeleter<VkShader
   if (vkCreateShaderModule(device_, &info, nullptr, module.replace()) != VK_SUCCESS) {
     throw std::runtime_error("failed to create shader module!");
   }
-  std::cout << "Created shader module successfully.\n";
+  LOG_DEBUG("Created shader module successfully.");
 }
 
 
@@ -700,27 +5068,42 @@ QueueFamilyIndices Vulkan::findQueueFamilies(VkPhysicalDevice device) {
   QueueFamilyIndices indices;
   uint32_t family_count = 0;
   vkGetPhysicalDeviceQueueFamilyProperties(device, &family_count, nullptr);
-  std::vector<VkQueueFamilyProperties> queue_families(family_count);
+  ScratchScope scratch;
+  ArenaVector<VkQueueFamilyProperties> queue_families(family_count, VkQueueFamilyProperties(), scratch.arena());
   vkGetPhysicalDeviceQueueFamilyProperties(device, &family_count, queue_families.data());
 
   uint32_t i = 0;
   for (auto const& family : queue_families) {
-      if (family.queueCount > 0 && family.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+      if (indices.graphics_family < 0 && family.queueCount > 0 && family.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
         indices.graphics_family = i;
       }
 
       VkBool32 presentSupport = false;
       vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface_, &presentSupport);
 
-      if (family.queueCount > 0 && presentSupport) {
+      if (indices.presentation_family < 0 && family.queueCount > 0 && presentSupport) {
         indices.presentation_family = i;
       }
 
-      if (indices.isComplete()) {
-        break;
+      // families without graphics are the ones which really run next to it
+      if (indices.compute_family < 0 && family.queueCount > 0 && (family.queueFlags & VK_QUEUE_COMPUTE_BIT) &&
+          !(family.queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+        indices.compute_family = i;
+      }
+      if (indices.transfer_family < 0 && family.queueCount > 0 && (family.queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+          !(family.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+        indices.transfer_family = i;
       }
     i++;
   }
+
+  // graphics queues can do everything
+  if (indices.compute_family < 0) {
+    indices.compute_family = indices.graphics_family;
+  }
+  if (indices.transfer_family < 0) {
+    indices.transfer_family = indices.graphics_family;
+  }
   return indices;
 
 }
@@ -735,7 +5118,7 @@ SwapChainSupportDetails Vulkan::querySwapChainSupport(VkPhysicalDevice const& de
   // Query available formats for surface
   uint32_t format_count = 0;
   vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface_, &format_count, nullptr);
-  std::cout << "Number of surface formats found: " << format_count << "\n";
+  LOG_DEBUG("Number of surface formats found: " << format_count);
 
   if (format_count != 0) {
     details.formats.resize(format_count);
@@ -745,7 +5128,7 @@ SwapChainSupportDetails Vulkan::querySwapChainSupport(VkPhysicalDevice const& de
   // Query presentation modes for surface
   uint32_t modes_count = 0;
   vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface_, &modes_count, nullptr);
-  std::cout << "Number of presentation modes found: " << modes_count << "\n";
+  LOG_DEBUG("Number of presentation modes found: " << modes_count);
   if (modes_count) {
     details.present_modes.resize(modes_count);
     vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface_, &modes_count, details.present_modes.data());
@@ -758,7 +5141,7 @@ VkSurfaceFormatKHR Vulkan::chooseSwapSurfaceFormat(std::vector<VkSurfaceFormatKH
   // best case:
   // surface has no preferred format, we can choose freely :)
   if (formats.size() == 1 && formats[0].format == VK_FORMAT_UNDEFINED) {
-    std::cout << "best case for surface\n";
+    LOG_DEBUG("best case for surface");
     return {VK_FORMAT_B8G8R8A8_UNORM, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR};
   }
 
@@ -773,8 +5156,11 @@ VkSurfaceFormatKHR Vulkan::chooseSwapSurfaceFormat(std::vector<VkSurfaceFormatKH
 }
 
 // choose the presentation mode for the surface
-// just use FIFO for now (basically vsync)
+// the one of the device profile if available, FIFO (basically vsync) is always there
 VkPresentModeKHR Vulkan::chooseSwapPresentMode(const std::vector<VkPresentModeKHR> present_modes) {
+  if (std::find(present_modes.begin(), present_modes.end(), profile_.present_mode) != present_modes.end()) {
+    return profile_.present_mode;
+  }
   return VK_PRESENT_MODE_FIFO_KHR;
 }
 
@@ -796,10 +5182,9 @@ VkExtent2D Vulkan::chooseSwapExtent(VkSurfaceCapabilitiesKHR const& capabilities
 }
 
 /*
- * Initialize GLFW window and setup input
+ * Create the GLFW window and setup input, after glfwInit()
  */
 void Vulkan::initWindow() {
-  glfwInit();
   // Don't create OpenGL context
   glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
   glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
@@ -819,56 +5204,661 @@ void Vulkan::initWindow() {
  * Exit through the keyboard/mouse callback
  */
 void Vulkan::mainLoop() {
+  double last_report = glfwGetTime();
+  double last_memory_sample = last_report;
+  uint64_t last_frames = frame_stats_.frames;
+
+  if (settings_.submit_thread) {
+    std::vector<VkSemaphore> semaphores;
+    std::vector<VkFence> fences;
+    for (size_t i = 0; i < image_available_.size(); i++) {
+      semaphores.push_back(image_available_[i]);
+      fences.push_back(frame_fences_[i]);
+    }
+    submit_thread_.start(device_, swapchain_, presentation_queue_, semaphores, fences, max_acquired_images_);
+    LOG_INFO("Started submit thread, acquiring up to " << max_acquired_images_ << " images ahead.");
+  }
+  simulation_.start(settings_.simulation_rate);
+  LOG_INFO("Started simulation thread at " << settings_.simulation_rate << " ticks per second.");
+  if (settings_.strict_allocations && !ENGINE_ALLOCATION_CHECK) {
+    LOG_WARNING("Heap allocations aren't counted in this build, build with -DENGINE_ALLOCATION_CHECK=1 to check them.");
+  }
+
   while (!glfwWindowShouldClose(window_)) {
     glfwPollEvents();
-    drawFrame();
+    if (capture_requested_) {
+      writeCapture();
+      capture_requested_ = false;
+    }
+    if (background_init_.joinable() && background_done_.load(std::memory_order_acquire)) {
+      collectBackgroundInit();
+    }
+    if (!drawFrame()) {
+      // the submit thread stopped, no images come anymore
+      break;
+    }
+
+    double now = glfwGetTime();
+    if (now - last_memory_sample >= memory_sample_interval) {
+      std::lock_guard<std::mutex> lock(residency_mutex_);
+      residency_.update(frame_stats_.frames, swapchain_images_.size());
+      last_memory_sample = now;
+    }
+    if (settings_.stats_interval > 0.0 && now - last_report >= settings_.stats_interval) {
+      reportStats(now - last_report, frame_stats_.frames - last_frames);
+      last_report = now;
+      last_frames = frame_stats_.frames;
+    }
+  }
+  submit_thread_.stop();
+  simulation_.stop();
+  if (background_init_.joinable()) {
+    background_init_.join();
   }
   vkDeviceWaitIdle(device_);
+  savePipelineCache();
+
+  if (readback_.initialized()) {
+    readback_.finish();
+    LOG_INFO("Readback wrote " << readback_.written() << " frames, skipped " << readback_.skipped() << ".");
+  }
+
+  if (calibration_pending_) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physical_device_, &properties);
+    std::string path = deviceProfilePath(properties);
+    calibrateDevice(profile_, true);
+    if (writeDeviceProfile(path, profile_)) {
+      LOG_INFO("Saved device profile " << path << " for the next launch.");
+    }
+  }
 
   glfwTerminate();
 }
 
-void Vulkan::drawFrame() {
+/*
+ * Hand the next frame over to the GPU
+ * Returns false if there was no image to render into, the submit thread stopped
+ */
+bool Vulkan::drawFrame() {
+  uint64_t heap_allocations = threadHeapAllocations();
   uint32_t image_index;
+  VkSemaphore image_available;
+  VkFence frame_fence;
 
-  // acquire next image, without timeout
-  VkResult result = vkAcquireNextImageKHR(device_, swapchain_, std::numeric_limits<uint64_t>::max(),
-  image_available_, VK_NULL_HANDLE, &image_index);
+  if (submit_thread_.running()) {
+    FrameResult result;
+    while (submit_thread_.result(result)) {
+      processFrameResult(result);
+    }
 
-  VkSubmitInfo submit_info = {};
-  submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-  submit_info.commandBufferCount = 1;
-  submit_info.pCommandBuffers = &command_buffers_[image_index];
+    AcquiredImage image;
+    if (!submit_thread_.acquired(image)) {
+      return false;
+    }
+    // the window can't be resized, so the swapchain is never recreated to resume the thread with
+    if (image.result != VK_SUCCESS && image.result != VK_SUBOPTIMAL_KHR) {
+      throw std::runtime_error("Failed to acquire swap chain image");
+    }
+    image_index = image.image_index;
+    image_available = image.semaphore;
+    frame_fence = image.fence;
+  } else {
+    // acquire next image, without timeout
+    size_t slot = next_image_available_++ % image_available_.size();
+    image_available = image_available_[slot];
+    frame_fence = frame_fences_[slot];
+    // the semaphore may only be signaled again once the frame which waited for it is done
+    if (vkWaitForFences(device_, 1, &frame_fence, VK_TRUE, std::numeric_limits<uint64_t>::max()) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to wait for the last frame of the semaphore");
+    }
+    VkResult result = vkAcquireNextImageKHR(device_, swapchain_, std::numeric_limits<uint64_t>::max(),
+                                            image_available, VK_NULL_HANDLE, &image_index);
+    if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+      throw std::runtime_error("Failed to acquire swap chain image");
+    }
+  }
 
-  VkSemaphore wait_semaphores[] = {image_available_};
-  VkPipelineStageFlags wait_stages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-  submit_info.waitSemaphoreCount = 1;
-  submit_info.pWaitSemaphores = wait_semaphores;
-  submit_info.pWaitDstStageMask = wait_stages;
+  // an acquired image may still be rendered into by its last frame: its command buffers, buffers and
+  // staging memory are only ours once that is done. The fence of this frame was waited for before the
+  // acquisition with its semaphore, it is handed to the submit of this one
+  VkFence& image_fence = image_fences_[image_index];
+  if (image_fence != VK_NULL_HANDLE &&
+      vkWaitForFences(device_, 1, &image_fence, VK_TRUE, std::numeric_limits<uint64_t>::max()) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to wait for the last frame of the image");
+  }
+  vkResetFences(device_, 1, &frame_fence);
+  image_fence = frame_fence;
+
+  frame_arenas_[image_index].reset();
+  collectFrameStats(image_index);
+  image_levels_[image_index] = resolution_.level();
+  // the last frame of the image no longer draws the overlay vertices
+  if (overlay_enabled_) {
+    overlay_.update(image_index);
+  }
+  if (readback_enabled_) {
+    readback_.poll();
+  }
+  // the camera for the time the frame is submitted, as late as the recorded command buffers allow
+  Camera camera = simulation_.camera();
+  writeViews(image_index, camera);
+  if (settings_.shadows) {
+    updateShadowCascades(image_index, camera);
+  }
+  VkCommandBuffer upload = streamWorld(image_index, coveringCamera(camera));
+  // the buckets whose draws changed, e.g. as cells streamed in, and the command buffer executing them
+  uint32_t level = image_levels_[image_index];
+  uint32_t records = command_cache_.update(image_index, level);
+  // or the overlay came up since, its render passes are recorded into it
+  bool overlay_changed = overlay_recorded_[level * swapchain_images_.size() + image_index] != overlay_enabled_;
+  if (records > 0 || overlay_changed) {
+    recordCommandBuffer(image_index, level);
+    frame_stats_.bucket_records += records;
+  }
 
+  FrameSubmission frame = frameSubmission(image_index, image_available, upload, frame_fence);
+  if (submit_thread_.running()) {
+    submit_thread_.submit(frame);
+  } else {
+    FrameResult result;
+    SubmitThread::submitFrames(presentation_queue_, swapchain_, &frame, 1, &result);
+    processFrameResult(result);
+  }
 
-  VkSemaphore signal_semaphores[] = {render_finished_};
-  submit_info.signalSemaphoreCount = 1;
-  submit_info.pSignalSemaphores = signal_semaphores;
+  queries_used_[image_index] = true;
+  checkFrameAllocations(threadHeapAllocations() - heap_allocations);
+  frame_stats_.frames++;
+  return true;
+}
 
-  if (vkQueueSubmit(graphics_queue_, 1, &submit_info, VK_NULL_HANDLE) != VK_SUCCESS) {
+/*
+ * Stream the world for the camera of the frame and record the copies of the cells which
+ * finished loading. The command buffer runs on the graphics queue right before the frame,
+ * so the barriers in it order the copies after the draws of the earlier frames and before
+ * the draws of this one.
+ */
+VkCommandBuffer Vulkan::streamWorld(uint32_t image_index, Camera const& camera) {
+  if (!world_.isOpen()) {
+    return VK_NULL_HANDLE;
+  }
+  // drawFrame waited for the last frame of the image, its part of the ring and its command buffer are free
+  upload_ring_.begin(image_index);
+  world_clears_.clear();
+  world_uploads_.clear();
+  world_.update(camera, glfwGetTime(), upload_ring_, world_clears_, world_uploads_);
+  upload_ring_.end(image_index);
+  if (world_clears_.empty() && world_uploads_.empty()) {
+    return VK_NULL_HANDLE;
+  }
+
+  VkCommandBuffer cmd = upload_command_buffers_[image_index];
+  vkResetCommandBuffer(cmd, 0);
+  VkCommandBufferBeginInfo begin_info = {};
+  begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  if (vkBeginCommandBuffer(cmd, &begin_info) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to start recording world uploads");
+  }
+
+  // the pool is shared by the frames: the slots are overwritten once the frames of the other images
+  // in flight are done drawing them. The host writes into the ring are made visible by the submit itself
+  VkMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = 0;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                       1, &barrier, 0, nullptr, 0, nullptr);
+
+  VkDeviceSize slot_size = world_.slotSize();
+  if (!world_uploads_.empty()) {
+    ArenaVector<VkBufferCopy> regions(world_uploads_.size(), VkBufferCopy(), frame_arenas_[image_index]);
+    for (size_t i = 0; i < world_uploads_.size(); i++) {
+      regions[i].srcOffset = world_uploads_[i].ring_offset;
+      regions[i].dstOffset = world_uploads_[i].slot * slot_size;
+      regions[i].size = slot_size;
+    }
+    vkCmdCopyBuffer(cmd, upload_buffer_, world_buffer_, regions.size(), regions.data());
+  }
+  // evicted after the copies were decided, a slot may have been copied into just before
+  if (!world_clears_.empty()) {
+    if (!world_uploads_.empty()) {
+      barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                           1, &barrier, 0, nullptr, 0, nullptr);
+    }
+    for (uint32_t slot : world_clears_) {
+      vkCmdFillBuffer(cmd, world_buffer_, slot * slot_size, slot_size, 0);
+    }
+  }
+
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0,
+                       1, &barrier, 0, nullptr, 0, nullptr);
+
+  if (vkEndCommandBuffer(cmd) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to record world uploads");
+  }
+  return cmd;
+}
+
+/*
+ * The submits of the frame rendering into the image
+ * The compute work waits for the image and the graphics work for the compute work, the world uploads
+ * go first on the graphics queue. The graphics submit signals the fence, everything before it is done then
+ */
+FrameSubmission Vulkan::frameSubmission(uint32_t image_index, VkSemaphore image_available, VkCommandBuffer upload,
+                                        VkFence fence) {
+  FrameSubmission frame = {};
+  frame.frame = frame_stats_.frames;
+  frame.image_index = image_index;
+
+  QueueSubmit graphics = {};
+  graphics.queue = graphics_queue_;
+  graphics.command_buffer = command_buffers_[image_levels_[image_index] * swapchain_images_.size() + image_index];
+  graphics.wait_semaphore = image_available;
+  graphics.wait_stage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  graphics.signal_semaphore = render_finished_[image_index];
+  // after the compute work and the uploads, the readback has fences of its own
+  graphics.fence = fence;
+
+  if (render_graph_.usesAsyncCompute()) {
+    QueueSubmit compute = {};
+    compute.queue = compute_queue_;
+    compute.command_buffer = compute_command_buffers_[image_index];
+    compute.wait_semaphore = image_available;
+    compute.wait_stage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    compute.signal_semaphore = compute_finished_[image_index];
+    frame.submits[frame.submit_count++] = compute;
+
+    graphics.wait_semaphore = compute_finished_[image_index];
+    graphics.wait_stage |= render_graph_.computeWaitStages();
+  }
+  // waits for nothing, the copies only touch the world pool
+  if (upload != VK_NULL_HANDLE) {
+    QueueSubmit copies = {};
+    copies.queue = graphics_queue_;
+    copies.command_buffer = upload;
+    frame.submits[frame.submit_count++] = copies;
+  }
+  // the frames drawing the overlay all come after this one on the queue
+  if (overlay_upload_ != VK_NULL_HANDLE) {
+    QueueSubmit atlases = {};
+    atlases.queue = graphics_queue_;
+    atlases.command_buffer = overlay_upload_;
+    frame.submits[frame.submit_count++] = atlases;
+    overlay_upload_ = VK_NULL_HANDLE;
+  }
+  frame.submits[frame.submit_count++] = graphics;
+  frame.present_wait_semaphore = render_finished_[image_index];
+
+  // copy the image out between rendering and presentation, skipped if the readback is busy
+  if (readback_enabled_ && frame.frame % settings_.readback_interval == 0) {
+    QueueSubmit readback = {};
+    readback.command_buffer = readback_.request(swapchain_images_[image_index], VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                                                frame.frame, readback.fence);
+    if (readback.command_buffer != VK_NULL_HANDLE) {
+      readback.queue = graphics_queue_;
+      readback.wait_semaphore = render_finished_[image_index];
+      readback.wait_stage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+      readback.signal_semaphore = readback_finished_[image_index];
+      frame.submits[frame.submit_count++] = readback;
+      frame.present_wait_semaphore = readback_finished_[image_index];
+    }
+  }
+  return frame;
+}
+
+void Vulkan::processFrameResult(FrameResult const& result) {
+  if (result.submit_result != VK_SUCCESS) {
     throw std::runtime_error("Failed to submit command buffer");
   }
+  // presentation errors (e.g. out of date) are ignored, the window can't be resized
+  frame_stats_.queue_submits += result.queue_submits;
+
+  if (result.frame == 0) {
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - init_start_;
+    LOG_INFO("Time to first frame: " << elapsed.count() << " ms");
+  }
+}
+
+/*
+ * Heap allocations of the thread in one frame, after the warm-up there should be none: the frames
+ * get by with their arenas and containers which kept their capacity. With Settings::strict_allocations
+ * they are an error, else they are counted for the report and the first frame making some is logged,
+ * the driver, GLFW, the world streaming and the validation layers may allocate behind our calls too
+ */
+void Vulkan::checkFrameAllocations(uint64_t allocations) {
+  if (allocations == 0 || frame_stats_.frames < allocation_warmup_frames) {
+    return;
+  }
+  if (settings_.strict_allocations) {
+    throw std::runtime_error("Frame " + std::to_string(frame_stats_.frames) + " made " +
+                             std::to_string(allocations) + " heap allocations in steady state");
+  }
+  if (frame_stats_.heap_allocations == 0 && !validation_enabled_) {
+    LOG_WARNING("Frame " << frame_stats_.frames << " made " << allocations << " heap allocations in steady state.");
+  }
+  frame_stats_.heap_allocations += allocations;
+}
+
+/*
+ * Fetch the statistics of the last frame which used this image
+ * Never waits, if the results are not there yet we just keep the old ones
+ */
+void Vulkan::collectFrameStats(uint32_t image_index) {
+  if (!queries_used_[image_index]) {
+    return;
+  }
+
+  uint64_t invocations = 0;
+  if (pipeline_statistics_supported_ &&
+      vkGetQueryPoolResults(device_, stats_query_pool_, image_index, 1,
+                            sizeof(invocations), &invocations, sizeof(invocations),
+                            VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+    frame_stats_.fragment_invocations = invocations;
+    VkExtent2D extent = renderExtent(image_levels_[image_index]);
+    frame_stats_.overdraw = double(invocations) / (double(extent.width) * extent.height);
+  }
+
+  if (settings_.occlusion_culling) {
+    OcclusionStats const& occlusion = *static_cast<OcclusionStats const*>(occlusion_stats_mapped_[image_index]);
+    frame_stats_.frustum_culled = occlusion.frustum_culled;
+    frame_stats_.occlusion_culled = occlusion.occlusion_culled;
+    frame_stats_.culled_triangles = occlusion.culled_triangles;
+  }
+
+  if (!timestamps_supported_) {
+    return;
+  }
+
+  // compute begin/end, graphics begin/end
+  uint64_t timestamps[4] = {};
+  uint32_t first = render_graph_.usesAsyncCompute() ? 0 : 2;
+  uint32_t base = timestamps_per_image * image_index;
+  if (vkGetQueryPoolResults(device_, timestamp_query_pool_, base + first, 4 - first,
+                            sizeof(uint64_t) * (4 - first), &timestamps[first], sizeof(uint64_t),
+                            VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+    return;
+  }
+
+  double ms_per_tick = timestamp_period_ / 1e6;
+  uint64_t particle_timestamps[2] = {};
+  if (settings_.particle_count > 0 &&
+      vkGetQueryPoolResults(device_, timestamp_query_pool_, base + 4, 2, sizeof(particle_timestamps),
+                            particle_timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+    frame_stats_.particle_ms = (particle_timestamps[1] - particle_timestamps[0]) * ms_per_tick;
+  }
+  uint64_t light_timestamps[2] = {};
+  if (vkGetQueryPoolResults(device_, timestamp_query_pool_, base + 6, 2, sizeof(light_timestamps),
+                            light_timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+    frame_stats_.light_ms = (light_timestamps[1] - light_timestamps[0]) * ms_per_tick;
+  }
+  frame_stats_.graphics_ms = (timestamps[3] - timestamps[2]) * ms_per_tick;
+  if (dynamic_resolution_ && resolution_.update(frame_stats_.graphics_ms, image_levels_[image_index])) {
+    frame_stats_.resolution_scale = resolution_.scale();
+    LOG_DEBUG("Rendering the scene at " << frame_stats_.resolution_scale * 100.0f << "% of the resolution.");
+  }
+  if (first == 0) {
+    // the graphics work of this frame waits for the compute work,
+    // only the previous frame can run at the same time
+    uint64_t begin = std::max(timestamps[0], last_graphics_timestamps_[0]);
+    uint64_t end = std::min(timestamps[1], last_graphics_timestamps_[1]);
+    frame_stats_.compute_ms = (timestamps[1] - timestamps[0]) * ms_per_tick;
+    frame_stats_.overlap_ms = end > begin ? (end - begin) * ms_per_tick : 0.0;
+  }
+  last_graphics_timestamps_[0] = timestamps[2];
+  last_graphics_timestamps_[1] = timestamps[3];
+}
+
+/*
+ * Fit the shadow cascades around the camera for the frame of the image,
+ * and decide which of them draw their static casters into the cache again
+ *
+ * The cascades have a fixed size in the scene, each twice the one before, and their
+ * origins snap to whole texels: as long as a cascade stays, the casters land on the
+ * same texels and its layer of the cache stays valid, when it moves they land on the
+ * same texel grid and the edges don't shimmer. A cascade is moved when the camera got
+ * further from its center than shadow_move_threshold of its half extent.
+ * Writes the buffers of the image, drawFrame waits for the fence of its last frame first.
+ */
+void Vulkan::updateShadowCascades(uint32_t image_index, Camera const& camera) {
+  ShadowFrame frame = {};
+  frame.light_shift[0] = -sun_direction[0] / sun_direction[2];
+  frame.light_shift[1] = -sun_direction[1] / sun_direction[2];
+  // the middle of the depth range, in shadow space
+  float center[2] = {camera.position[0] + 0.5f * frame.light_shift[0],
+                     camera.position[1] + 0.5f * frame.light_shift[1]};
+
+  VkDrawIndirectCommand* draws = static_cast<VkDrawIndirectCommand*>(shadow_draw_mapped_[image_index]);
+  for (uint32_t c = 0; c < shadow_cascade_count; c++) {
+    float half_extent = shadow_base_extent * float(1u << c);
+    float texel = 2.0f * half_extent / settings_.shadow_map_size;
+    float* origin = &shadow_origins_[2 * c];
+    float distance = std::max(std::abs(center[0] - origin[0]), std::abs(center[1] - origin[1]));
+    bool redraw = shadow_cache_stale_ || distance > shadow_move_threshold * half_extent;
+    if (redraw) {
+      origin[0] = std::round(center[0] / texel) * texel;
+      origin[1] = std::round(center[1] / texel) * texel;
+      frame_stats_.shadow_redraws++;
+    } else {
+      frame_stats_.shadow_cached++;
+      frame_stats_.shadow_casters_skipped += drawables_.size();
+    }
+    frame.cascades[c][0] = origin[0];
+    frame.cascades[c][1] = origin[1];
+    frame.cascades[c][2] = half_extent;
+
+    // the clear and the static casters, the previous frames are done with the cache when this one runs
+    VkDrawIndirectCommand clear = {3, redraw ? 1u : 0u, 0, 0};
+    VkDrawIndirectCommand casters = {3, redraw ? uint32_t(drawables_.size()) : 0u, 0, 0};
+    draws[2 * c] = clear;
+    draws[2 * c + 1] = casters;
+  }
+  shadow_cache_stale_ = false;
+  memcpy(shadow_frame_mapped_[image_index], &frame, sizeof(ShadowFrame));
+}
+
+void Vulkan::reportStats(double elapsed, uint64_t frames) {
+  // one line each on the overlay
+  std::vector<std::string> parts;
+  std::ostringstream part;
+  auto next = [&parts, &part] {
+    parts.push_back(part.str());
+    part.str("");
+  };
+
+  part << "frames: " << frames << " (" << frames / elapsed << " fps)";
+  next();
+  part << "draw calls: " << frame_stats_.draw_calls;
+  next();
+  part << "binds/frame: " << frame_stats_.binds << " (skipped " << frame_stats_.skipped_binds << ")";
+  next();
+  if (settings_.occlusion_culling) {
+    part << "culled: " << frame_stats_.frustum_culled + frame_stats_.occlusion_culled << " objects ("
+         << frame_stats_.frustum_culled << " by frustum, " << frame_stats_.occlusion_culled << " occluded), "
+         << frame_stats_.culled_triangles << " triangles";
+    next();
+  }
+  if (dynamic_resolution_) {
+    VkExtent2D extent = renderExtent(resolution_.level());
+    part << "resolution: " << int(frame_stats_.resolution_scale * 100.0f + 0.5f) << "% (" << extent.width << "x"
+         << extent.height << ", " << resolution_.changes() << " changes)";
+    next();
+  }
+  if (views_ > 1) {
+    part << "views: " << views_ << " (" << (multiview_ ? "multiview" : "instanced layers") << ", "
+         << viewExtent().width << "x" << viewExtent().height << " each)";
+    next();
+  }
+  if (simulation_.running()) {
+    part << "simulation: " << simulation_.ticks() << " ticks (dropped " << simulation_.droppedTicks() << ")";
+    next();
+  }
+  if (frame_stats_.frames > 0) {
+    part << "queue submits/frame: " << double(frame_stats_.queue_submits) / frame_stats_.frames;
+    next();
+    part << "command buckets: " << command_cache_.bucketCount() << ", re-recorded "
+         << double(frame_stats_.bucket_records) / frame_stats_.frames << "/frame";
+    next();
+  }
+  if (pipeline_statistics_supported_) {
+    part << "shaded fragments: " << frame_stats_.fragment_invocations
+         << ", overdraw: " << frame_stats_.overdraw << "x";
+    next();
+  }
+  if (timestamps_supported_) {
+    part << "gpu graphics: " << frame_stats_.graphics_ms << " ms";
+    next();
+  }
+  if (timestamps_supported_ && render_graph_.usesAsyncCompute()) {
+    part << "gpu compute: " << frame_stats_.compute_ms << " ms"
+         << ", overlapping: " << frame_stats_.overlap_ms << " ms";
+    next();
+  }
+  if (timestamps_supported_ && settings_.particle_count > 0 && frame_stats_.particle_ms > 0.0) {
+    // every slot is simulated, alive or not, so this is the throughput of the whole pool
+    part << "particles: " << particle_params_.capacity << " in " << frame_stats_.particle_ms << " ms ("
+         << particle_params_.capacity / frame_stats_.particle_ms << " per ms)";
+    next();
+  }
+  if (settings_.shadows && frame_stats_.frames > 0) {
+    uint64_t cascades = frame_stats_.shadow_redraws + frame_stats_.shadow_cached;
+    part << "shadows: " << frame_stats_.shadow_cached * 100 / std::max<uint64_t>(1, cascades)
+         << "% of cascades cached (" << frame_stats_.shadow_redraws << " redraws), "
+         << frame_stats_.shadow_casters_skipped / frame_stats_.frames << " static caster draws skipped/frame";
+    next();
+  }
+  if (world_.isOpen()) {
+    part << "world: " << world_.residentCells() << "/" << world_.slots() << " cells resident, "
+         << world_.loadingCells() << " loading, " << world_.loads() << " loaded (" << (world_.bytesRead() >> 10)
+         << " KiB in " << world_.reader().reads() << " reads, " << world_.reader().submits()
+         << (world_.reader().usesIoUring() ? " io_uring submits" : " thread wakeups") << "), "
+         << world_.evictions() << " evicted";
+    if (upload_ring_.exhausted() > 0) {
+      part << ", staging full in " << upload_ring_.exhausted() << " frames";
+    }
+    next();
+  }
+  // the binning grows with the lights, the shading with the lights per cluster
+  part << "lights: " << light_params_.light_count;
+  if (timestamps_supported_) {
+    part << " binned in " << frame_stats_.light_ms << " ms";
+  }
+  next();
+  for (uint32_t h = 0; h < memory_budget_.heaps().size(); h++) {
+    HeapBudget const& heap = memory_budget_.heaps()[h];
+    if (heap.device_local) {
+      part << "heap " << h << ": " << heap.usage / (1024 * 1024) << " of " << heap.budget / (1024 * 1024) << " MB";
+      next();
+    }
+  }
+  if (residency_.evictions() > 0 || residency_.refusals() > 0) {
+    part << "evictions: " << residency_.evictions() << ", refused loads: " << residency_.refusals();
+    next();
+  }
+  if (readback_enabled_) {
+    part << "frames read back: " << readback_.written() << " (skipped " << readback_.skipped() << ")";
+    next();
+  }
+  if (validation_filter_.suppressed() > 0) {
+    part << "validation messages suppressed: " << validation_filter_.suppressed();
+    next();
+  }
+  if (frame_stats_.heap_allocations > 0) {
+    // with the validation layers, which allocate too
+    part << "heap allocations in steady state: " << frame_stats_.heap_allocations;
+    next();
+  }
+
+  std::ostringstream report;
+  for (size_t i = 0; i < parts.size(); i++) {
+    report << (i > 0 ? ", " : "") << parts[i];
+  }
+  LOG_INFO(report.str());
 
+  fps_history_.push_back(frames / elapsed);
+  if (fps_history_.size() > overlay_history) {
+    fps_history_.pop_front();
+  }
+  updateOverlay(parts);
+}
 
-  VkPresentInfoKHR present_info = {};
-  present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-  present_info.waitSemaphoreCount = 1;
-  present_info.pWaitSemaphores = signal_semaphores;
+/*
+ * The report in the top left corner, above a graph of the frame rates of
+ * the last reports, scaled to the highest one. Only copied to the GPU in the
+ * frames after this, the command buffers stay as they are.
+ */
+void Vulkan::updateOverlay(std::vector<std::string> const& lines) {
+  if (!overlay_enabled_) {
+    return;
+  }
 
-  VkSwapchainKHR swap_chains[] = {swapchain_};
-  present_info.swapchainCount = 1;
-  present_info.pSwapchains = swap_chains;
-  present_info.pImageIndices = &image_index;
+  // whole multiples of the font size keep it sharp
+  float scale = float(std::max(1u, swapchain_extent_.width / 640));
+  float line_height = (Overlay::glyph_height + 2) * scale;
+  float margin = 4.0f * scale;
+  size_t longest = 0;
+  for (auto const& line : lines) {
+    longest = std::max(longest, line.size());
+  }
+  float width = longest * Overlay::glyph_width * scale + 2 * margin;
+  float graph_height = 40.0f * scale;
+  float height = lines.size() * line_height + graph_height + 3 * margin;
+
+  overlay_.clear();
+  overlay_.rect(0.0f, 0.0f, width, height, Overlay::rgba(0, 0, 0, 160));
+  float y = margin;
+  for (auto const& line : lines) {
+    overlay_.text(margin, y, line, Overlay::rgba(255, 255, 255), scale);
+    y += line_height;
+  }
 
-  present_info.pResults = nullptr;
+  y += margin;
+  float bottom = y + graph_height;
+  overlay_.line(margin, bottom, width - margin, bottom, scale, Overlay::rgba(128, 128, 128));
+  double highest = *std::max_element(fps_history_.begin(), fps_history_.end());
+  if (fps_history_.size() < 2 || highest <= 0.0) {
+    return;
+  }
+  float step = (width - 2 * margin) / (overlay_history - 1);
+  for (size_t i = 1; i < fps_history_.size(); i++) {
+    float x0 = margin + (i - 1) * step;
+    float y0 = bottom - float(fps_history_[i - 1] / highest) * graph_height;
+    float y1 = bottom - float(fps_history_[i] / highest) * graph_height;
+    overlay_.line(x0, y0, x0 + step, y1, scale, Overlay::rgba(80, 220, 80));
+  }
+}
 
-  result = vkQueuePresentKHR(presentation_queue_, &present_info);
+/*
+ * Write the frame to a capture file, which tools/replay.cpp executes again
+ *
+ * The command buffers are recorded once, so every frame is the same:
+ * the capture holds the scene as uploaded and the streams of the passes.
+ */
+void Vulkan::writeCapture() {
+  // the replay has one view, and the pipelines of the views need their render pass
+  if (views_ > 1) {
+    LOG_WARNING("Frame captures are of a single view, nothing captured.");
+    return;
+  }
+  // the replay renders into a single subpass, the shading pipelines are made for the one before the effects
+  if (!settings_.post_effects.empty()) {
+    LOG_WARNING("Frame captures have no post-processing, nothing captured.");
+    return;
+  }
+  std::string path = "capture-" + std::to_string(frame_stats_.frames) + ".vkcap";
+  View view = toView(simulation_.camera());
+  const char* view_data = reinterpret_cast<const char*>(&view);
+  frame_capture_.buffers[view_buffer_index].data.assign(view_data, view_data + sizeof(View));
+  try {
+    writeFrameCapture(path, frame_capture_);
+    LOG_INFO("Wrote frame capture " << path << ".");
+  } catch (std::exception const& e) {
+    // not worth stopping the engine for
+    LOG_ERROR(e.what());
+  }
 }
 
 void Vulkan::cbKeyboardDispatcher(
@@ -890,6 +5880,30 @@ void Vulkan::cbKeyboard(
   if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS) {
     glfwSetWindowShouldClose(window, GLFW_TRUE);
   }
+  // written before the next frame, see writeCapture
+  if (key == GLFW_KEY_F12 && action == GLFW_PRESS) {
+    capture_requested_ = true;
+  }
+  // as if the static scene changed, see updateShadowCascades
+  if (key == GLFW_KEY_F5 && action == GLFW_PRESS) {
+    shadow_cache_stale_ = true;
+  }
+
+  // the camera, applied at the next tick of the simulation
+  Control control;
+  switch (key) {
+    case GLFW_KEY_LEFT: case GLFW_KEY_A: control = Control::PanLeft; break;
+    case GLFW_KEY_RIGHT: case GLFW_KEY_D: control = Control::PanRight; break;
+    case GLFW_KEY_UP: case GLFW_KEY_W: control = Control::PanUp; break;
+    case GLFW_KEY_DOWN: case GLFW_KEY_S: control = Control::PanDown; break;
+    case GLFW_KEY_E: control = Control::ZoomIn; break;
+    case GLFW_KEY_Q: control = Control::ZoomOut; break;
+    case GLFW_KEY_R: control = Control::Reset; break;
+    default: return;
+  }
+  if (action != GLFW_REPEAT && !simulation_.input(InputEvent{control, action == GLFW_PRESS})) {
+    LOG_WARNING("Dropped input, the simulation doesn't keep up.");
+  }
 }
 
 bool Vulkan::checkValidationLayers() {
@@ -900,7 +5914,7 @@ bool Vulkan::checkValidationLayers() {
   vkEnumerateInstanceLayerProperties(&layer_count, available_layers.data());
 
   for(auto const& l : available_layers) {
-    std::cout << "Found layer: " << l.layerName << "\n\t" << l.description << std::endl;
+    LOG_DEBUG("Found layer: " << l.layerName << " - " << l.description);
   }
 
   for(auto const& requested_layer : requested_validation_layers_) {
@@ -931,15 +5945,34 @@ std::vector<const char*> Vulkan::getRequiredExtensions() {
     extensions.push_back(glfw_extensions[i]);
   }
 
-  std::cout << "We've got " << count << " Vulkan extensions by GLFW:\n";
+  LOG_DEBUG("We've got " << count << " Vulkan extensions by GLFW:");
   for(auto const& ext : extensions) {
-    std::cout << "\t" << ext << "\n";
+    LOG_DEBUG("    " << ext);
   }
 
   if (enable_validation_) {
     extensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
   }
 
+  // optional, needed to query the memory budget and the device UUIDs
+  uint32_t available_count = 0;
+  vkEnumerateInstanceExtensionProperties(nullptr, &available_count, nullptr);
+  std::vector<VkExtensionProperties> available(available_count);
+  vkEnumerateInstanceExtensionProperties(nullptr, &available_count, available.data());
+  bool external_memory = false;
+  for (auto const& extension : available) {
+    if (strcmp(extension.extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0) {
+      extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+      properties2_supported_ = true;
+    }
+    external_memory |= strcmp(extension.extensionName, VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME) == 0;
+  }
+  // it brings VkPhysicalDeviceIDPropertiesKHR, which is queried through properties2
+  if (properties2_supported_ && external_memory) {
+    extensions.push_back(VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME);
+    device_id_supported_ = true;
+  }
+
   return extensions;
 }
 
@@ -948,17 +5981,16 @@ void Vulkan::setupDebugCallback() {
 
   VkDebugReportCallbackCreateInfoEXT createInfo = {};
   createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_REPORT_CALLBACK_CREATE_INFO_EXT;
+  // repeated messages are filtered in debugCallback, so the performance warnings don't flood the log
   createInfo.flags = VK_DEBUG_REPORT_ERROR_BIT_EXT |
-                     VK_DEBUG_REPORT_WARNING_BIT_EXT/* |
-                     /*VK_DEBUG_REPORT_INFORMATION_BIT_EXT |
-                     VK_DEBUG_REPORT_DEBUG_BIT_EXT/* |
-                     VK_DEBUG_REPORT_PERFORMANCE_WARNING_BIT_EXT*/;
+                     VK_DEBUG_REPORT_WARNING_BIT_EXT |
+                     VK_DEBUG_REPORT_PERFORMANCE_WARNING_BIT_EXT;
   createInfo.pUserData = this;
   createInfo.pfnCallback = Vulkan::debugCallback;
   if (CreateDebugReportCallbackEXT(instance_, &createInfo, nullptr, debug_cb_.replace()) != VK_SUCCESS) {
     throw std::runtime_error("failed to set up debug callback!");
   } else {
-    std::cout << "Setup debug callback successfully.\n";
+    LOG_INFO("Setup debug callback successfully.");
   }
 
 }
@@ -974,7 +6006,19 @@ VKAPI_ATTR VkBool32 VKAPI_CALL Vulkan::debugCallback(
         void* userData) {
   Vulkan* vulkan = (Vulkan *) userData;
 
-  std::cerr << "[!!] Validation layer: " << prefix << ": " << msg << std::endl;
+  // the same problem is reported from the same place in the layer, whatever the objects
+  uint64_t key = std::hash<std::string>()(prefix) ^ (uint64_t(uint32_t(code)) << 32) ^ location;
+  uint64_t count;
+  if (!vulkan->validation_filter_.pass(key, count)) {
+    return VK_FALSE;
+  }
+
+  std::string repeats = count > 1 ? " (seen " + std::to_string(count) + " times)" : "";
+  if (flags & VK_DEBUG_REPORT_ERROR_BIT_EXT) {
+    LOG_ERROR("Validation layer: " << prefix << ": " << msg << repeats);
+  } else {
+    LOG_WARNING("Validation layer: " << prefix << ": " << msg << repeats);
+  }
 
   return VK_FALSE;
 }
@@ -10,20 +10,48 @@
 #define ENGINE_VERSION_PATCH 0
 
 #include "VDeleter.h"
+#include "Settings.h"
+#include "DeviceProfile.h"
+#include "RenderGraph.h"
+#include "SubmitThread.h"
+#include "CommandStream.h"
+#include "CommandCache.h"
+#include "DrawList.h"
+#include "Capture.h"
+#include "Readback.h"
+#include "Overlay.h"
+#include "MemoryBudget.h"
+#include "Simulation.h"
+#include "DynamicResolution.h"
+#include "FrameArena.h"
+#include "UploadRing.h"
+#include "WorldStreamer.h"
+#include "../Log.h"
 
 #include <vulkan/vulkan.h>
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
 #include <vector>
+#include <map>
+#include <chrono>
 #include <iostream>
 #include <cstring>
+#include <functional>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <exception>
+#include <thread>
 
 namespace engine {
 
 struct QueueFamilyIndices {
   int graphics_family = -1;
   int presentation_family = -1;
+  // dedicated families if the GPU has them, the graphics family otherwise
+  int compute_family = -1;
+  int transfer_family = -1;
 
   bool isComplete() {
       return graphics_family >= 0 && presentation_family >= 0;
@@ -37,10 +65,137 @@ struct SwapChainSupportDetails {
   std::vector<VkPresentModeKHR> present_modes;
 };
 
+// Placement of one triangle of the test scene
+// Pushed as push constant block to first.vert, keep the layouts in sync
+struct Drawable {
+  float offset[2];
+  float scale;
+  float depth; // [0, 1], smaller is closer
+};
+
+// The camera of the simulation, written per swapchain image just before it is submitted
+// Read by views.glsl, lighting.glsl, cull.comp, occlusion.comp and lights.comp, keep the layouts in sync.
+// The view buffer starts with the one covering all views, then has one per view
+struct View {
+  float offset[2];
+  float zoom;
+  float padding;
+};
+
+// A point light of the test scene, static in the scene but binned into the clusters of every frame
+// Read by lights.comp and first.frag, keep the layouts in sync
+struct Light {
+  float position[2];
+  float depth;
+  // reaches as far in depth as in the plane
+  float radius;
+  float color[3];
+  float intensity;
+};
+
+// Push constants of lights.comp, keep the layouts in sync
+struct LightCullParams {
+  uint32_t light_count;
+  // light indices the clusters share per swapchain image
+  uint32_t capacity;
+};
+
+// layers of the shadow maps, see shadow.vert, particle_shadow.vert and shadowed.frag
+const uint32_t shadow_cascade_count = 4;
+
+// Where the shadow cascades are, written per swapchain image just before it is submitted
+// Read by shadow.vert, particle_shadow.vert and shadowed.frag, keep the layouts in sync
+struct ShadowFrame {
+  // moves a point of the scene along the sun to depth 0 (shadow space), per unit of depth
+  float light_shift[2];
+  float padding[2];
+  // per cascade: the origin in shadow space, the half extent and padding
+  float cascades[shadow_cascade_count][4];
+};
+
+// Push constants of the particle compute shaders, keep the layouts in sync
+struct ParticleParams {
+  uint32_t capacity;
+  // particles emitted per frame, as many as die per frame on average
+  uint32_t emit_count;
+  // seconds simulated per frame, the command buffers are recorded once
+  float time_step;
+  float lifetime;
+  // cells of the collision depth map
+  uint32_t depth_width;
+  uint32_t depth_height;
+};
+
+// Push constants of post.frag and post_filter.frag, keep the layouts in sync
+struct PostParams {
+  // the pixels of a view rendered at the current resolution
+  float extent[2];
+};
+
+// Counted by occlusion.comp per swapchain image, keep the layouts in sync
+struct OcclusionStats {
+  uint32_t drawn;
+  uint32_t frustum_culled;
+  uint32_t occlusion_culled;
+  // of the culled drawables
+  uint32_t culled_triangles;
+};
+
+// Statistics gathered while rendering, reported periodically by mainLoop
+struct FrameStats {
+  uint64_t frames = 0;
+  uint32_t draw_calls = 0;
+  // pipeline and descriptor set binds, and the redundant ones the command streams left out
+  uint32_t binds = 0;
+  uint32_t skipped_binds = 0;
+
+  // drawables the occlusion culling left out in the last finished frame, and their triangles
+  uint32_t frustum_culled = 0;
+  uint32_t occlusion_culled = 0;
+  uint32_t culled_triangles = 0;
+
+  // of the scene in both directions, below 1 with dynamic resolution under load
+  float resolution_scale = 1.0f;
+
+  // vkQueueSubmit calls, less than the frames if the submit thread batched them
+  uint64_t queue_submits = 0;
+
+  // fragment shader invocations of the scene render pass in the last finished frame, the particles
+  // and the overlay in it included
+  uint64_t fragment_invocations = 0;
+
+  // shaded fragments per pixel, 1.0 means no overdraw at all
+  double overdraw = 0.0;
+
+  // GPU time of the command buffers, from timestamps
+  double graphics_ms = 0.0;
+  double compute_ms = 0.0;
+  // how long the compute work ran concurrently to the graphics work of the previous frame
+  double overlap_ms = 0.0;
+  // emission and simulation of the particles
+  double particle_ms = 0.0;
+  // binning the lights into the clusters
+  double light_ms = 0.0;
+
+  // shadow cascades whose static casters were drawn again or kept from the cache,
+  // and the caster draws the cache saved, since the start
+  uint64_t shadow_redraws = 0;
+  uint64_t shadow_cached = 0;
+  uint64_t shadow_casters_skipped = 0;
+
+  // buckets of the scene render pass recorded again by the frames, because their draws changed
+  uint64_t bucket_records = 0;
+
+  // heap allocations of the frames once warmed up, counted with ENGINE_ALLOCATION_CHECK
+  uint64_t heap_allocations = 0;
+};
+
 
 class Vulkan {
   public:
-    Vulkan();
+    explicit Vulkan(Settings const& settings = Settings());
+
+    ~Vulkan();
 
     void init();
 
@@ -55,19 +210,365 @@ class Vulkan {
     std::vector<VDeleter<VkImageView>> sc_image_views_;
     std::vector<VDeleter<VkFramebuffer>> sc_framebuffers_;
     VDeleter<VkCommandPool> command_pool_{device_, vkDestroyCommandPool};
+    // per resolution level and swapchain image: level * images + image
     std::vector<VkCommandBuffer> command_buffers_;
     VkFormat swapchain_format_;
     VkExtent2D swapchain_extent_;
     VkPhysicalDevice physical_device_ = VK_NULL_HANDLE;
     VkQueue graphics_queue_;
     VkQueue presentation_queue_;
-    VDeleter<VkSemaphore> image_available_{device_, vkDestroySemaphore};
-    VDeleter<VkSemaphore> render_finished_{device_, vkDestroySemaphore};
+    VkQueue compute_queue_;
+    VkQueue transfer_queue_;
+    bool async_compute_ = false;
+    // used round-robin for the acquisitions, the others are per swapchain image
+    std::vector<VDeleter<VkSemaphore>> image_available_;
+    uint64_t next_image_available_ = 0;
+    // per acquisition semaphore, signaled by the last submit of the frame which waited for it
+    std::vector<VDeleter<VkFence>> frame_fences_;
+    // per swapchain image, the fence of the last frame rendering into it, VK_NULL_HANDLE before the first
+    std::vector<VkFence> image_fences_;
+    std::vector<VDeleter<VkSemaphore>> render_finished_;
+    std::vector<VDeleter<VkSemaphore>> compute_finished_;
+    // signaled by the readback copy, presentation waits for it instead of render_finished_ then
+    std::vector<VDeleter<VkSemaphore>> readback_finished_;
+    Readback readback_{device_};
+    // the statistics over the frame, rebuilt with every report
+    Overlay overlay_{device_};
+    // what the frames use of the two, only changed on the main thread, see collectBackgroundInit
+    bool readback_enabled_ = false;
+    bool overlay_enabled_ = false;
+    // the atlas upload of an overlay created in the background, submitted with the next frame
+    VkCommandBuffer overlay_upload_ = VK_NULL_HANDLE;
+    // per command buffer, if its render passes draw the overlay
+    std::vector<bool> overlay_recorded_;
+    std::deque<double> fps_history_;
+    VDeleter<VkCommandPool> compute_command_pool_{device_, vkDestroyCommandPool};
+    std::vector<VkCommandBuffer> compute_command_buffers_;
     VDeleter<VkPipelineLayout> pipeline_layout_{device_, vkDestroyPipelineLayout};
     VDeleter<VkRenderPass> renderpass_{device_, vkDestroyRenderPass};
     VDeleter<VkPipeline> graphics_pipeline_{device_, vkDestroyPipeline};
+    VDeleter<VkPipeline> depth_prepass_pipeline_{device_, vkDestroyPipeline};
+    // persisted next to the device profile, so later launches skip most of the shader compilation
+    VDeleter<VkPipelineCache> pipeline_cache_{device_, vkDestroyPipelineCache};
+    // SPIR-V by the name of its file in the build, embedded into the engine
+    std::map<std::string, std::vector<char>> shader_code_;
     VDeleter<VkSwapchainKHR> swapchain_{device_, vkDestroySwapchainKHR};
-
+    VkImageUsageFlags swapchain_usage_ = 0;
+    VkFormat depth_format_;
+    VkSampleCountFlagBits msaa_samples_ = VK_SAMPLE_COUNT_1_BIT;
+
+    // the frame: owns the depth buffer and the multisampled color target
+    // (resolved into the swapchain image at the end of the subpass)
+    RenderGraph render_graph_{device_};
+    RenderGraph::Resource backbuffer_ = 0;
+    RenderGraph::Resource depth_ = 0;
+    RenderGraph::Resource msaa_color_ = 0;
+    // with dynamic resolution the scene renders into a corner of this, which is upscaled to the backbuffer,
+    // with several views it has a layer per view, which are blitted side by side
+    RenderGraph::Resource scene_color_ = 0;
+    RenderGraph::Resource drawable_data_ = 0;
+    RenderGraph::Resource draw_commands_ = 0;
+    RenderGraph::Resource particle_state_ = 0;
+    RenderGraph::Resource particle_counters_ = 0;
+    RenderGraph::Resource collision_depth_data_ = 0;
+    RenderGraph::Resource particle_vertices_ = 0;
+    RenderGraph::Resource particle_args_ = 0;
+    RenderGraph::Resource visibility_ = 0;
+    RenderGraph::Resource occluder_commands_ = 0;
+    RenderGraph::Resource occlusion_stats_ = 0;
+    RenderGraph::Resource occlusion_depth_ = 0;
+    RenderGraph::Resource depth_pyramid_ = 0;
+    RenderGraph::Resource light_data_ = 0;
+    RenderGraph::Resource light_grid_ = 0;
+    RenderGraph::Resource light_indices_ = 0;
+    RenderGraph::Resource light_counters_ = 0;
+    RenderGraph::Resource shadow_cache_ = 0;
+    RenderGraph::Resource dynamic_shadows_ = 0;
+    RenderGraph::Pass particle_emit_pass_ = 0;
+    RenderGraph::Pass particle_simulate_pass_ = 0;
+    RenderGraph::Pass cull_pass_ = 0;
+    RenderGraph::Pass occluder_pass_ = 0;
+    RenderGraph::Pass shadow_pass_ = 0;
+    RenderGraph::Pass scene_pass_ = 0;
+    RenderGraph::Pass overlay_pass_ = 0;
+
+    // the scene at a resolution chosen by the GPU time, the overlay at the full size on top of it
+    bool dynamic_resolution_ = false;
+    // the scene renders into scene_color_ instead of the swapchain images, for the dynamic
+    // resolution or the views, and the overlay has a render pass of its own
+    bool blit_scene_ = false;
+    ResolutionController resolution_;
+    VkFilter upscale_filter_ = VK_FILTER_LINEAR;
+    // the level the command buffers are being recorded for
+    uint32_t recording_level_ = 0;
+    // the level each swapchain image was last submitted with
+    std::vector<uint32_t> image_levels_;
+    VDeleter<VkRenderPass> overlay_renderpass_{device_, vkDestroyRenderPass};
+    std::vector<VDeleter<VkFramebuffer>> overlay_framebuffers_;
+
+    // the post-processing of Settings::post_effects: the pixel effects are subpasses of the scene render
+    // pass after the shading, the filters render passes of their own after it
+    std::vector<PostEffect> pixel_effects_;
+    std::vector<PostEffect> filter_effects_;
+    // what the scene render pass leaves its result in: the scene target, or the input of the first filter
+    RenderGraph::Resource scene_output_ = 0;
+    // the shading and the pixel effects write them in turns, the next subpass reads them as input attachment.
+    // In the 16 bit float post_format_, they only live in the scene render pass
+    RenderGraph::Resource post_targets_[2] = {0, 0};
+    uint32_t post_target_count_ = 0;
+    VkFormat post_format_ = VK_FORMAT_UNDEFINED;
+    // the filter of the same index samples it
+    std::vector<RenderGraph::Resource> filter_inputs_;
+    std::vector<RenderGraph::Pass> filter_passes_;
+    std::vector<VDeleter<VkRenderPass>> filter_renderpasses_;
+    // per filter and swapchain image: filter * images + image
+    std::vector<VDeleter<VkFramebuffer>> filter_framebuffers_;
+    VDeleter<VkDescriptorSetLayout> post_set_layout_{device_, vkDestroyDescriptorSetLayout};
+    VDeleter<VkDescriptorSetLayout> filter_set_layout_{device_, vkDestroyDescriptorSetLayout};
+    VDeleter<VkDescriptorPool> post_descriptor_pool_{device_, vkDestroyDescriptorPool};
+    // the input attachment of each post target, then the sampled input of each filter
+    std::vector<VkDescriptorSet> post_sets_;
+    VDeleter<VkSampler> filter_sampler_{device_, vkDestroySampler};
+    // 2D array views of the filter inputs for post_filter.frag, the graph views a single layer as 2D
+    std::vector<VDeleter<VkImageView>> filter_views_;
+    VDeleter<VkPipelineLayout> post_pipeline_layout_{device_, vkDestroyPipelineLayout};
+    VDeleter<VkPipelineLayout> filter_pipeline_layout_{device_, vkDestroyPipelineLayout};
+    // the pixel effects, then the filters
+    std::vector<VDeleter<VkPipeline>> post_pipelines_;
+
+    // per swapchain image, for what the recording of its frame needs on the side. Reset once the last
+    // frame of the image is done, a steady state frame allocates nothing from the heap
+    std::vector<LinearArena> frame_arenas_;
+
+    // the scene on the GPU, culled by a compute pass into one indirect draw per triangle
+    VDeleter<VkBuffer> drawable_buffer_{device_, vkDestroyBuffer};
+    VDeleter<VkDeviceMemory> drawable_memory_{device_, vkFreeMemory};
+    std::vector<VDeleter<VkBuffer>> draw_command_buffers_;
+    std::vector<VDeleter<VkDeviceMemory>> draw_command_memory_;
+    VDeleter<VkDescriptorSetLayout> cull_set_layout_{device_, vkDestroyDescriptorSetLayout};
+    VDeleter<VkDescriptorPool> descriptor_pool_{device_, vkDestroyDescriptorPool};
+    std::vector<VkDescriptorSet> cull_sets_;
+    // per swapchain image, persistently mapped and written once the last frame of the image is done
+    // the scene pipelines get it in a set together with the lights of their clusters
+    std::vector<VDeleter<VkBuffer>> view_buffers_;
+    std::vector<VDeleter<VkDeviceMemory>> view_memory_;
+    std::vector<void*> view_mapped_;
+    VDeleter<VkDescriptorSetLayout> view_set_layout_{device_, vkDestroyDescriptorSetLayout};
+    std::vector<VkDescriptorSet> view_sets_;
+    VDeleter<VkPipelineLayout> cull_pipeline_layout_{device_, vkDestroyPipelineLayout};
+    VDeleter<VkPipeline> cull_pipeline_{device_, vkDestroyPipeline};
+
+    // clustered lighting: a compute pass bins the lights into a grid of screen tiles and depth slices,
+    // per swapchain image a list of light indices per cluster, which the shading only loops over
+    std::vector<Light> lights_;
+    LightCullParams light_params_ = {};
+    VDeleter<VkBuffer> light_buffer_{device_, vkDestroyBuffer};
+    VDeleter<VkDeviceMemory> light_memory_{device_, vkFreeMemory};
+    std::vector<VDeleter<VkBuffer>> light_grid_buffers_;
+    std::vector<VDeleter<VkDeviceMemory>> light_grid_memory_;
+    std::vector<VDeleter<VkBuffer>> light_index_buffers_;
+    std::vector<VDeleter<VkDeviceMemory>> light_index_memory_;
+    // indices used, cleared before the binning
+    std::vector<VDeleter<VkBuffer>> light_counter_buffers_;
+    std::vector<VDeleter<VkDeviceMemory>> light_counter_memory_;
+    VDeleter<VkDescriptorSetLayout> light_set_layout_{device_, vkDestroyDescriptorSetLayout};
+    std::vector<VkDescriptorSet> light_sets_;
+    VDeleter<VkPipelineLayout> light_pipeline_layout_{device_, vkDestroyPipelineLayout};
+    VDeleter<VkPipeline> light_cull_pipeline_{device_, vkDestroyPipeline};
+
+    // cascaded shadow maps of the sun, one layer per cascade: the static casters are cached in an image
+    // of their own, which keeps the layers of the cascades that didn't move; the particles are drawn
+    // into a transient one every frame and the shading takes the nearer caster of both
+    VkFormat shadow_format_ = VK_FORMAT_UNDEFINED;
+    VDeleter<VkImage> shadow_cache_image_{device_, vkDestroyImage};
+    VDeleter<VkDeviceMemory> shadow_cache_memory_{device_, vkFreeMemory};
+    VDeleter<VkImageView> shadow_cache_view_{device_, vkDestroyImageView};
+    // per cascade the layer of the cache, then of the dynamic map
+    std::vector<VDeleter<VkImageView>> shadow_layer_views_;
+    std::vector<VDeleter<VkFramebuffer>> shadow_framebuffers_;
+    VDeleter<VkRenderPass> shadow_renderpass_{device_, vkDestroyRenderPass};
+    VDeleter<VkSampler> shadow_sampler_{device_, vkDestroySampler};
+    // per swapchain image and persistently mapped like the view, written once the last frame of the image is
+    // done: the cascades, and per cascade the indirect draws of the clear and of the static casters, which
+    // have no instances if it is cached
+    std::vector<VDeleter<VkBuffer>> shadow_frame_buffers_;
+    std::vector<VDeleter<VkDeviceMemory>> shadow_frame_memory_;
+    std::vector<void*> shadow_frame_mapped_;
+    std::vector<VDeleter<VkBuffer>> shadow_draw_buffers_;
+    std::vector<VDeleter<VkDeviceMemory>> shadow_draw_memory_;
+    std::vector<void*> shadow_draw_mapped_;
+    // the shadow pass binds it at set 0, the shading at set 1
+    VDeleter<VkDescriptorSetLayout> shadow_set_layout_{device_, vkDestroyDescriptorSetLayout};
+    VDeleter<VkDescriptorPool> shadow_descriptor_pool_{device_, vkDestroyDescriptorPool};
+    std::vector<VkDescriptorSet> shadow_sets_;
+    VDeleter<VkPipelineLayout> shadow_pipeline_layout_{device_, vkDestroyPipelineLayout};
+    VDeleter<VkPipeline> shadow_clear_pipeline_{device_, vkDestroyPipeline};
+    VDeleter<VkPipeline> shadow_pipeline_{device_, vkDestroyPipeline};
+    VDeleter<VkPipeline> particle_shadow_pipeline_{device_, vkDestroyPipeline};
+    // where the static casters of each cascade were drawn into the cache (x, y per cascade)
+    std::vector<float> shadow_origins_;
+    // redraw all cascades with the next frame, as after a change of the static scene
+    bool shadow_cache_stale_ = true;
+
+    // the streamed world: a pool of cell slots drawn after the scene, one instance per drawable.
+    // Cells which finished loading are decoded into the upload ring and copied into their slots
+    // by a command buffer of the frame, submitted on the graphics queue before the frame's draws
+    WorldStreamer world_;
+    UploadRing upload_ring_;
+    VDeleter<VkBuffer> world_buffer_{device_, vkDestroyBuffer};
+    VDeleter<VkDeviceMemory> world_memory_{device_, vkFreeMemory};
+    VDeleter<VkBuffer> upload_buffer_{device_, vkDestroyBuffer};
+    VDeleter<VkDeviceMemory> upload_memory_{device_, vkFreeMemory};
+    VDeleter<VkCommandPool> upload_command_pool_{device_, vkDestroyCommandPool};
+    // per swapchain image, recorded again by every frame which has something to copy
+    std::vector<VkCommandBuffer> upload_command_buffers_;
+    std::vector<uint32_t> world_clears_;
+    std::vector<CellUpload> world_uploads_;
+    VDeleter<VkPipeline> world_pipeline_{device_, vkDestroyPipeline};
+    VDeleter<VkPipeline> world_prepass_pipeline_{device_, vkDestroyPipeline};
+
+    // the particles: the state stays on the compute queue, each frame appends the live ones
+    // to the vertices of its swapchain image and counts them in an indirect draw
+    VDeleter<VkBuffer> particle_buffer_{device_, vkDestroyBuffer};
+    VDeleter<VkDeviceMemory> particle_memory_{device_, vkFreeMemory};
+    VDeleter<VkBuffer> particle_counter_buffer_{device_, vkDestroyBuffer};
+    VDeleter<VkDeviceMemory> particle_counter_memory_{device_, vkFreeMemory};
+    // the scene rasterized into a coarse depth map, which the particles collide with
+    std::vector<float> collision_depth_;
+    VDeleter<VkBuffer> collision_depth_buffer_{device_, vkDestroyBuffer};
+    VDeleter<VkDeviceMemory> collision_depth_memory_{device_, vkFreeMemory};
+    std::vector<VDeleter<VkBuffer>> particle_vertex_buffers_;
+    std::vector<VDeleter<VkDeviceMemory>> particle_vertex_memory_;
+    std::vector<VDeleter<VkBuffer>> particle_args_buffers_;
+    std::vector<VDeleter<VkDeviceMemory>> particle_args_memory_;
+    VDeleter<VkDescriptorSetLayout> particle_set_layout_{device_, vkDestroyDescriptorSetLayout};
+    std::vector<VkDescriptorSet> particle_sets_;
+    // shared by the compute pipelines and the one drawing the particles
+    VDeleter<VkPipelineLayout> particle_pipeline_layout_{device_, vkDestroyPipelineLayout};
+    VDeleter<VkPipeline> particle_emit_pipeline_{device_, vkDestroyPipeline};
+    VDeleter<VkPipeline> particle_simulate_pipeline_{device_, vkDestroyPipeline};
+    VDeleter<VkPipeline> particle_draw_pipeline_{device_, vkDestroyPipeline};
+    ParticleParams particle_params_ = {};
+
+    // two-phase occlusion culling on the graphics queue, instead of the culling pass: the drawables
+    // which were visible in the last frame are drawn into a depth buffer of their own, which is
+    // reduced to a pyramid of the farthest depths; the others are tested against it. What passes
+    // is drawn together with them and is the set of occluders of the next frame
+    VkFormat occlusion_depth_format_ = VK_FORMAT_UNDEFINED;
+    VkExtent2D pyramid_extent_ = {0, 0};
+    uint32_t pyramid_levels_ = 0;
+    VDeleter<VkBuffer> visibility_buffer_{device_, vkDestroyBuffer};
+    VDeleter<VkDeviceMemory> visibility_memory_{device_, vkFreeMemory};
+    std::vector<VDeleter<VkBuffer>> occluder_command_buffers_;
+    std::vector<VDeleter<VkDeviceMemory>> occluder_command_memory_;
+    // persistently mapped, read once the last frame of the image is done
+    std::vector<VDeleter<VkBuffer>> occlusion_stats_buffers_;
+    std::vector<VDeleter<VkDeviceMemory>> occlusion_stats_memory_;
+    std::vector<void*> occlusion_stats_mapped_;
+    VDeleter<VkRenderPass> occluder_renderpass_{device_, vkDestroyRenderPass};
+    VDeleter<VkFramebuffer> occluder_framebuffer_{device_, vkDestroyFramebuffer};
+    VDeleter<VkPipeline> occluder_pipeline_{device_, vkDestroyPipeline};
+    // the drawables front to back
+    std::vector<uint32_t> occluder_order_;
+    VDeleter<VkDescriptorSetLayout> occlusion_set_layout_{device_, vkDestroyDescriptorSetLayout};
+    VDeleter<VkDescriptorSetLayout> pyramid_set_layout_{device_, vkDestroyDescriptorSetLayout};
+    VDeleter<VkDescriptorPool> occlusion_descriptor_pool_{device_, vkDestroyDescriptorPool};
+    // per swapchain image, one for each phase
+    std::vector<VkDescriptorSet> occlusion_sets_;
+    // per level of the pyramid
+    std::vector<VDeleter<VkImageView>> pyramid_views_;
+    std::vector<VkDescriptorSet> pyramid_sets_;
+    VDeleter<VkSampler> pyramid_sampler_{device_, vkDestroySampler};
+    VDeleter<VkPipelineLayout> occlusion_pipeline_layout_{device_, vkDestroyPipelineLayout};
+    VDeleter<VkPipelineLayout> pyramid_pipeline_layout_{device_, vkDestroyPipelineLayout};
+    // specialized for each phase
+    std::vector<VDeleter<VkPipeline>> occlusion_pipelines_;
+    VDeleter<VkPipeline> pyramid_pipeline_{device_, vkDestroyPipeline};
+
+    // the draws and dispatches of the passes, built once and recorded for every swapchain image
+    CommandStream cull_commands_;
+    CommandStream prepass_commands_;
+    CommandStream scene_commands_;
+    CommandStream light_reset_commands_;
+    CommandStream light_cull_commands_;
+    CommandStream particle_emit_commands_;
+    CommandStream particle_simulate_commands_;
+    // drawn after the scene
+    CommandStream particle_draw_commands_;
+    // what the indices of the streams refer to, per swapchain image
+    std::vector<CommandBindings> command_bindings_;
+
+    // the scene render pass in buckets: ranges of the sorted draws of each subpass, the world and
+    // the effects drawn after the scene. The primary command buffer of an image is recorded again
+    // with its buckets, when one of them changed
+    CommandCache command_cache_;
+    std::vector<CommandStream> prepass_bucket_commands_;
+    std::vector<CommandStream> scene_bucket_commands_;
+    // of the streams of the buckets, prepass first, and of the bindings of each swapchain image
+    std::vector<uint64_t> bucket_stream_hashes_;
+    std::vector<uint64_t> binding_hashes_;
+
+    // the frame as written by a capture (F12), filled while the objects are created
+    FrameCapture frame_capture_;
+    bool capture_requested_ = false;
+
+    // one pipeline statistics query per command buffer to measure overdraw
+    VDeleter<VkQueryPool> stats_query_pool_{device_, vkDestroyQueryPool};
+    bool pipeline_statistics_supported_ = false;
+
+    // the viewpoints rendered in one pass, see Settings::views. With multiview_ the render pass
+    // has a view per layer, otherwise every draw has view_instances_ instances, one per layer
+    uint32_t views_ = 1;
+    bool multiview_ = false;
+    uint32_t view_instances_ = 1;
+    // what the device enabled for several views: VK_KHR_multiview with its views at most,
+    // VK_EXT_shader_viewport_index_layer for the instanced fallback
+    uint32_t max_multiview_views_ = 0;
+    bool layered_supported_ = false;
+
+    // begin/end timestamps of the compute and the graphics command buffer,
+    // of the particle passes and of the light culling, per swapchain image
+    VDeleter<VkQueryPool> timestamp_query_pool_{device_, vkDestroyQueryPool};
+    bool timestamps_supported_ = false;
+    float timestamp_period_ = 1.0f;
+    uint64_t last_graphics_timestamps_[2] = {0, 0};
+
+    // if the command buffer of the image was submitted before, so its queries have results
+    std::vector<bool> queries_used_;
+
+    // VK_KHR_get_physical_device_properties2 on the instance, VK_EXT_memory_budget on the device
+    bool properties2_supported_ = false;
+    // VK_KHR_external_memory_capabilities on the instance as well, for the device UUIDs
+    bool device_id_supported_ = false;
+    bool memory_budget_supported_ = false;
+    MemoryBudget memory_budget_;
+    // streamable resources, evicted when a heap runs out of budget
+    ResidencyManager residency_{memory_budget_};
+    // allocations which failed make room in the residency manager, from any init thread
+    std::mutex residency_mutex_;
+
+    Settings settings_;
+    DeviceProfile profile_;
+    // the profile was guessed for a fast startup, measure the device at shutdown
+    bool calibration_pending_ = false;
+    std::chrono::steady_clock::time_point init_start_;
+    std::vector<Drawable> drawables_;
+    FrameStats frame_stats_;
+    // moves the camera at a fixed rate on a thread of its own, the frames interpolate its states
+    Simulation simulation_;
+
+    // images which may be acquired at the same time
+    uint32_t max_acquired_images_ = 1;
+    // declared after everything it uses, so it is stopped first
+    SubmitThread submit_thread_;
+    // creates what the first frame can do without while the frames run, see initVulkan
+    std::thread background_init_;
+    std::atomic<bool> background_done_{false};
+    std::exception_ptr background_error_;
+
+
+    // validation messages are deduplicated and rate-limited (per second)
+    log::MessageFilter validation_filter_{20};
 
     GLFWwindow *window_;
     const int width_ = 800;
@@ -86,6 +587,8 @@ class Vulkan {
 #else
     const bool enable_validation_ = true;
 #endif
+    // the layers were there, they allocate behind our calls
+    bool validation_enabled_ = false;
 
 
     void initWindow();
@@ -114,6 +617,21 @@ class Vulkan {
 
     bool isDeviceSuitable(VkPhysicalDevice const &device);
 
+    uint64_t scoreDevice(VkPhysicalDevice const &device);
+
+    std::string deviceUuid(VkPhysicalDevice device);
+
+    void loadDeviceProfile();
+
+    // without measuring, the profile is only derived from the device properties
+    void calibrateDevice(DeviceProfile &profile, bool measure);
+
+    void loadShaders();
+
+    void createPipelineCache();
+
+    void savePipelineCache();
+
     // load extension function "vkCreateDebugReportCallbackEXT"
     static VkResult
     CreateDebugReportCallbackEXT(VkInstance instance, const VkDebugReportCallbackCreateInfoEXT *pCreateInfo,
@@ -170,8 +688,62 @@ class Vulkan {
 
     void createShaderModule(const std::vector<char> &code, VDeleter<VkShaderModule> &shaderModule);
 
+    void createImage(uint32_t width, uint32_t height, VkFormat format, VkSampleCountFlagBits samples,
+                     VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties,
+                     VDeleter<VkImage> &image, VDeleter<VkDeviceMemory> &memory, uint32_t layers = 1);
+
+    void createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect, VDeleter<VkImageView> &view);
+
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
+                      bool concurrent, VDeleter<VkBuffer> &buffer, VDeleter<VkDeviceMemory> &memory);
+
+    uint32_t findMemoryType(uint32_t type_filter, VkMemoryPropertyFlags properties);
+
+    bool findMemoryType(uint32_t type_filter, VkMemoryPropertyFlags properties, uint32_t &type_index);
+
+    VkResult allocateMemory(VkMemoryAllocateInfo const& info, VDeleter<VkDeviceMemory> &memory);
+
+    VkFormat findSupportedFormat(const std::vector<VkFormat> &candidates, VkImageTiling tiling,
+                                 VkFormatFeatureFlags features);
+
+    VkFormat findDepthFormat();
+
+    VkSampleCountFlagBits chooseSampleCount(uint32_t requested);
+
+    void createRenderGraph();
+
+    void createSceneBuffers();
+
+    void createLightBuffers();
+
+    void createParticleBuffers();
+
+    void createOcclusionBuffers();
+
+    void createWorldBuffers();
+
+    void submitTransfer(std::function<void(VkCommandBuffer)> const& record, std::string const& what);
+
+    // record and submit a command buffer, waiting for the queue
+    void submitOnce(VkQueue queue, uint32_t queue_family, std::function<void(VkCommandBuffer)> const& record,
+                    std::string const& what);
+
+    void createDescriptorSets();
+
+    void createComputePipeline();
+
+    void createOcclusionCulling();
+
     void createRenderpass();
 
+    void createShadowMaps();
+
+    void createShadowRenderpass();
+
+    void createShadowFramebuffers();
+
+    void createShadowPipelines(VkGraphicsPipelineCreateInfo const& scene_info);
+
 
     void createFramebuffers();
 
@@ -179,9 +751,122 @@ class Vulkan {
 
     void createCommandBuffers();
 
+    void createCommandStreams();
+
+    // the buckets of the scene render pass, after the streams
+    void createCommandBuckets();
+
+    // the primary command buffer of the image at the resolution level, after the buckets it executes
+    void recordCommandBuffer(uint32_t image_index, uint32_t level);
+
+    void recordParticleEmitPass(VkCommandBuffer cmd, uint32_t image_index);
+
+    void recordParticleSimulatePass(VkCommandBuffer cmd, uint32_t image_index);
+
+    void recordCullPass(VkCommandBuffer cmd, uint32_t image_index);
+
+    void recordLightResetPass(VkCommandBuffer cmd, uint32_t image_index);
+
+    void recordLightCullPass(VkCommandBuffer cmd, uint32_t image_index);
+
+    void recordOcclusionPass(VkCommandBuffer cmd, uint32_t image_index, uint32_t phase);
+
+    void recordOccluderPass(VkCommandBuffer cmd, uint32_t image_index);
+
+    void recordDepthPyramidPass(VkCommandBuffer cmd);
+
+    void recordShadowPass(VkCommandBuffer cmd, uint32_t image_index);
+
+    void recordScenePass(VkCommandBuffer cmd, uint32_t image_index);
+
+    // the state a bucket of the scene render pass starts with, it inherits none
+    void beginSceneBucket(VkCommandBuffer cmd, uint32_t image_index, uint32_t level);
+
+    // viewport and scissor of the part of the targets rendered at the level
+    void setRenderArea(VkCommandBuffer cmd, uint32_t level);
+
+    // the triangle of the pixel effect or the filter (indexed after the pixel effects) over each view
+    void recordPostDraw(VkCommandBuffer cmd, uint32_t level, uint32_t effect);
+
+    void recordFilterPass(VkCommandBuffer cmd, uint32_t image_index, uint32_t filter);
+
+    // the input of the next filter, or the scene target after the last one
+    RenderGraph::Resource filterOutput(uint32_t filter) const;
+
+    // the resident slots of the world pool, with the scene pipeline of the subpass
+    void recordWorldDraw(VkCommandBuffer cmd, uint32_t image_index, VkPipeline pipeline);
+
+    // changes with the slots recordWorldDraw draws
+    uint64_t worldDrawHash() const;
+
+    void recordUpscalePass(VkCommandBuffer cmd, uint32_t image_index);
+
+    void recordOverlayPass(VkCommandBuffer cmd, uint32_t image_index);
+
+    // the part of the scene target rendered at the level of dynamic resolution
+    VkExtent2D renderExtent(uint32_t level) const;
+
+    // the part of the swapchain images a view covers, at the full resolution
+    VkExtent2D viewExtent() const;
+
+    // if the swapchain images can be blitted into, for the dynamic resolution and the views
+    bool canBlitToSwapchain() const;
+
+    void chooseViews();
+
+    // the vertex shader of the views for the scene shader, e.g. shaders/first.vert.multiview.spv
+    std::string viewShader(std::string const& name) const;
+
+    // the one covering all views, the same as camera with a single view
+    Camera coveringCamera(Camera const& camera) const;
+
+    void writeViews(uint32_t image_index, Camera const& camera);
+
     void createSemaphores();
 
-    void drawFrame();
+    void createReadback();
+
+    // queue: where the atlases are uploaded, VK_NULL_HANDLE to submit the upload with the next frame
+    void createOverlay(VkQueue queue);
+
+    // hand what the background init created to the frames, once it is done
+    void collectBackgroundInit();
+
+    // descriptor sets and pipelines of the post-processing, once the render passes are there
+    void createPostProcessing();
+
+    void createQueryPool();
+
+    void createScene();
+
+    void createLights();
+
+    void createCollisionDepth();
+
+    void createWorld();
+
+    bool drawFrame();
+
+    // the copies of the streamed world for the frame, VK_NULL_HANDLE if there are none
+    VkCommandBuffer streamWorld(uint32_t image_index, Camera const& camera);
+
+    // the fence is signaled once the frame is done with everything of the image
+    FrameSubmission frameSubmission(uint32_t image_index, VkSemaphore image_available, VkCommandBuffer upload,
+                                    VkFence fence);
+
+    void processFrameResult(FrameResult const& result);
+
+    void collectFrameStats(uint32_t image_index);
+
+    void checkFrameAllocations(uint64_t allocations);
+
+    void updateShadowCascades(uint32_t image_index, Camera const& camera);
+
+    void reportStats(double elapsed, uint64_t frames);
+
+    void updateOverlay(std::vector<std::string> const& lines);
+
+    void writeCapture();
 };
 }
 
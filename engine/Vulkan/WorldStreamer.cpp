@@ -0,0 +1,300 @@
+#include "WorldStreamer.h"
+#include "FrameArena.h"
+#include "../Log.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <utility>
+
+namespace engine {
+
+namespace {
+
+const char world_magic[4] = {'V', 'E', 'W', 'D'};
+const uint32_t world_file_version = 1;
+const uint32_t no_cell = std::numeric_limits<uint32_t>::max();
+
+// the decoded drawables, see engine::Drawable
+const float min_scale = 0.02f;
+const float max_scale = 0.12f;
+const float min_depth = 0.05f;
+const float max_depth = 0.95f;
+const uint32_t floats_per_drawable = 4;
+
+// how far ahead the velocity of the camera is followed, in seconds
+const float lookahead = 0.75f;
+// how fast the estimated velocity follows the camera, per update
+const float velocity_smoothing = 0.2f;
+
+// distance of the point to the segment from a to b
+float segmentDistance(float px, float py, float ax, float ay, float bx, float by) {
+  float dx = bx - ax;
+  float dy = by - ay;
+  float length2 = dx * dx + dy * dy;
+  float t = length2 > 0.0f ? std::min(1.0f, std::max(0.0f, ((px - ax) * dx + (py - ay) * dy) / length2)) : 0.0f;
+  float ex = px - (ax + t * dx);
+  float ey = py - (ay + t * dy);
+  return std::sqrt(ex * ex + ey * ey);
+}
+
+}
+
+bool WorldStreamer::generate(std::string const& path, uint32_t cells_x, uint32_t cells_y, float cell_size,
+                             uint32_t max_cell_drawables) {
+  // always the same world, so runs stay comparable
+  std::mt19937 rng(1234);
+  std::uniform_int_distribution<uint32_t> count(std::max(1u, max_cell_drawables / 4), max_cell_drawables);
+  std::uniform_int_distribution<uint32_t> coordinate(0, 0xffff);
+  std::uniform_int_distribution<uint32_t> fraction(0, 0xff);
+
+  WorldFileHeader header = {};
+  memcpy(header.magic, world_magic, sizeof(world_magic));
+  header.version = world_file_version;
+  header.cells_x = cells_x;
+  header.cells_y = cells_y;
+  header.cell_size = cell_size;
+  header.max_cell_drawables = max_cell_drawables;
+
+  std::vector<WorldCell> cells(cells_x * cells_y);
+  std::vector<PackedDrawable> drawables;
+  uint64_t offset = sizeof(header) + sizeof(WorldCell) * cells.size();
+  for (auto& cell : cells) {
+    cell.offset = offset + sizeof(PackedDrawable) * drawables.size();
+    cell.count = count(rng);
+    for (uint32_t i = 0; i < cell.count; i++) {
+      PackedDrawable drawable = {uint16_t(coordinate(rng)), uint16_t(coordinate(rng)), uint8_t(fraction(rng)),
+                                 uint8_t(fraction(rng))};
+      drawables.push_back(drawable);
+    }
+  }
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file.write(reinterpret_cast<char const*>(&header), sizeof(header));
+  file.write(reinterpret_cast<char const*>(cells.data()), sizeof(WorldCell) * cells.size());
+  file.write(reinterpret_cast<char const*>(drawables.data()), sizeof(PackedDrawable) * drawables.size());
+  return file.good();
+}
+
+void WorldStreamer::open(std::string const& path, uint64_t memory_cap, uint32_t queue_depth, uint32_t threads,
+                         bool force_threads) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.read(reinterpret_cast<char*>(&header_), sizeof(header_)) ||
+      memcmp(header_.magic, world_magic, sizeof(world_magic)) != 0 || header_.version != world_file_version) {
+    throw std::runtime_error("Failed to read world " + path + ", delete it to generate a new one");
+  }
+  cells_.resize(header_.cells_x * header_.cells_y);
+  if (!file.read(reinterpret_cast<char*>(cells_.data()), sizeof(WorldCell) * cells_.size())) {
+    throw std::runtime_error("Failed to read the cells of world " + path);
+  }
+  for (auto& cell : cells_) {
+    cell.count = std::min(cell.count, header_.max_cell_drawables);
+  }
+
+  // more slots than cells would never be used
+  uint64_t slots = std::max<uint64_t>(1, std::min<uint64_t>(memory_cap / slotSize(), cells_.size()));
+  cell_states_.assign(cells_.size(), Unloaded);
+  slot_cells_.assign(slots, no_cell);
+  free_slots_.clear();
+  for (uint32_t slot = uint32_t(slots); slot > 0; slot--) {
+    free_slots_.push_back(slot - 1);
+  }
+
+  reader_.open(path, queue_depth, threads, force_threads);
+  reads_.resize(reader_.capacity());
+  free_reads_.clear();
+  for (uint32_t read = reader_.capacity(); read > 0; read--) {
+    reads_[read - 1].data.resize(sizeof(PackedDrawable) * header_.max_cell_drawables);
+    free_reads_.push_back(read - 1);
+  }
+  decode_queue_.clear();
+  decode_queue_.reserve(reads_.size());
+  resident_ = 0;
+
+  LOG_INFO("Opened world " << path << ": " << header_.cells_x << "x" << header_.cells_y << " cells, "
+           << slots << " resident at most (" << (slots * slotSize()) / 1024 << " KiB).");
+}
+
+uint64_t WorldStreamer::slotSize() const {
+  return uint64_t(header_.max_cell_drawables) * floats_per_drawable * sizeof(float);
+}
+
+bool WorldStreamer::slotResident(uint32_t slot) const {
+  uint32_t cell = slot_cells_[slot];
+  return cell != no_cell && cell_states_[cell] == Resident;
+}
+
+void WorldStreamer::update(Camera const& camera, double time, UploadRing& ring, std::vector<uint32_t>& clears,
+                           std::vector<CellUpload>& uploads) {
+  if (last_time_ >= 0.0 && time > last_time_) {
+    float elapsed = float(time - last_time_);
+    for (int i = 0; i < 2; i++) {
+      float velocity = (camera.position[i] - last_position_[i]) / elapsed;
+      velocity_[i] += (velocity - velocity_[i]) * velocity_smoothing;
+    }
+  }
+  last_position_[0] = camera.position[0];
+  last_position_[1] = camera.position[1];
+  last_time_ = time;
+
+  ReadCompletion completion;
+  while (reader_.complete(completion)) {
+    uint32_t index = uint32_t(completion.user);
+    Read& read = reads_[index];
+    int64_t expected = sizeof(PackedDrawable) * cells_[read.cell].count;
+    if (completion.result != expected) {
+      LOG_WARNING("Failed to read world cell " << read.cell << " (" << completion.result << " of " << expected
+                  << " bytes), leaving it out.");
+      failed_reads_++;
+      cell_states_[read.cell] = Failed;
+      slot_cells_[read.slot] = no_cell;
+      free_slots_.push_back(read.slot);
+      free_reads_.push_back(index);
+      continue;
+    }
+    bytes_read_ += uint64_t(expected);
+    decode_queue_.push_back(index);
+  }
+
+  // in the order they finished, until the ring is full for this frame
+  size_t decoded = 0;
+  for (; decoded < decode_queue_.size(); decoded++) {
+    Read const& read = reads_[decode_queue_[decoded]];
+    uint64_t offset;
+    void* data;
+    if (!ring.allocate(slotSize(), sizeof(float) * floats_per_drawable, offset, data)) {
+      break;
+    }
+    decode(read, data);
+    uploads.push_back(CellUpload{offset, read.slot});
+    cell_states_[read.cell] = Resident;
+    resident_++;
+    loads_++;
+    free_reads_.push_back(decode_queue_[decoded]);
+  }
+  decode_queue_.erase(decode_queue_.begin(), decode_queue_.begin() + decoded);
+
+  // ranked by the distance to the path of the camera, from where it is to where it is heading
+  float from[2] = {camera.position[0], camera.position[1]};
+  float to[2] = {from[0] + velocity_[0] * lookahead, from[1] + velocity_[1] * lookahead};
+  float cell_size = header_.cell_size;
+  float world_x = -0.5f * header_.cells_x * cell_size;
+  float world_y = -0.5f * header_.cells_y * cell_size;
+  auto distance = [&](uint32_t cell) {
+    float x = world_x + (float(cell % header_.cells_x) + 0.5f) * cell_size;
+    float y = world_y + (float(cell / header_.cells_x) + 0.5f) * cell_size;
+    return segmentDistance(x, y, from[0], from[1], to[0], to[1]);
+  };
+
+  // what the window shows at both ends of the path, and a cell around it
+  float extent = 1.0f / std::max(camera.zoom, 1e-3f) + cell_size;
+  auto cellRange = [&](float low, float high, float origin, uint32_t cells, int32_t& first, int32_t& last) {
+    first = std::max(0, int32_t(std::floor((low - origin) / cell_size)));
+    last = std::min(int32_t(cells) - 1, int32_t(std::floor((high - origin) / cell_size)));
+  };
+  int32_t first_x, last_x, first_y, last_y;
+  cellRange(std::min(from[0], to[0]) - extent, std::max(from[0], to[0]) + extent, world_x, header_.cells_x,
+            first_x, last_x);
+  cellRange(std::min(from[1], to[1]) - extent, std::max(from[1], to[1]) + extent, world_y, header_.cells_y,
+            first_y, last_y);
+
+  // the ranking only lives for this update
+  ScratchScope scratch;
+  ArenaVector<std::pair<float, uint32_t>> missing(scratch.arena());
+  if (first_x <= last_x && first_y <= last_y) {
+    missing.reserve(size_t(last_x - first_x + 1) * size_t(last_y - first_y + 1));
+  }
+  for (int32_t y = first_y; y <= last_y; y++) {
+    for (int32_t x = first_x; x <= last_x; x++) {
+      uint32_t cell = uint32_t(y) * header_.cells_x + uint32_t(x);
+      if (cell_states_[cell] == Unloaded) {
+        missing.push_back(std::make_pair(distance(cell), cell));
+      }
+    }
+  }
+  if (missing.empty()) {
+    reader_.submit();
+    return;
+  }
+  std::sort(missing.begin(), missing.end());
+
+  // the resident cells farthest away first, they make room for nearer ones under the memory cap
+  ArenaVector<std::pair<float, uint32_t>> evictable(scratch.arena());
+  if (free_slots_.size() < missing.size()) {
+    evictable.reserve(slot_cells_.size());
+    for (uint32_t slot = 0; slot < slot_cells_.size(); slot++) {
+      uint32_t cell = slot_cells_[slot];
+      if (cell != no_cell && cell_states_[cell] == Resident) {
+        evictable.push_back(std::make_pair(distance(cell), slot));
+      }
+    }
+    std::sort(evictable.begin(), evictable.end(), std::greater<std::pair<float, uint32_t>>());
+  }
+  size_t next_eviction = 0;
+
+  for (auto const& candidate : missing) {
+    if (free_reads_.empty()) {
+      break;
+    }
+    uint32_t slot;
+    if (!free_slots_.empty()) {
+      slot = free_slots_.back();
+      free_slots_.pop_back();
+    } else if (next_eviction < evictable.size() && evictable[next_eviction].first > candidate.first) {
+      slot = evictable[next_eviction++].second;
+      uint32_t evicted = slot_cells_[slot];
+      cell_states_[evicted] = Unloaded;
+      resident_--;
+      evictions_++;
+      // drawn until the new cell is copied over it otherwise
+      clears.push_back(slot);
+    } else {
+      // everything resident is nearer
+      break;
+    }
+
+    uint32_t index = free_reads_.back();
+    free_reads_.pop_back();
+    Read& read = reads_[index];
+    read.cell = candidate.second;
+    read.slot = slot;
+    slot_cells_[slot] = read.cell;
+    cell_states_[read.cell] = Loading;
+
+    ReadRequest request = {};
+    request.offset = cells_[read.cell].offset;
+    request.size = uint32_t(sizeof(PackedDrawable) * cells_[read.cell].count);
+    request.data = read.data.data();
+    request.user = index;
+    reader_.read(request);
+  }
+  // one system call for all reads of the frame
+  reader_.submit();
+}
+
+void WorldStreamer::decode(Read const& read, void* destination) const {
+  float* drawables = static_cast<float*>(destination);
+  float cell_size = header_.cell_size;
+  float origin_x = (float(read.cell % header_.cells_x) - 0.5f * header_.cells_x) * cell_size;
+  float origin_y = (float(read.cell / header_.cells_x) - 0.5f * header_.cells_y) * cell_size;
+
+  uint32_t count = cells_[read.cell].count;
+  for (uint32_t i = 0; i < count; i++) {
+    PackedDrawable packed;
+    memcpy(&packed, read.data.data() + sizeof(PackedDrawable) * i, sizeof(packed));
+    float* drawable = drawables + floats_per_drawable * i;
+    drawable[0] = origin_x + packed.x / 65535.0f * cell_size;
+    drawable[1] = origin_y + packed.y / 65535.0f * cell_size;
+    drawable[2] = min_scale + packed.scale / 255.0f * (max_scale - min_scale);
+    drawable[3] = min_depth + packed.depth / 255.0f * (max_depth - min_depth);
+  }
+  // the rest of the slot isn't drawn, scale 0
+  memset(drawables + floats_per_drawable * count, 0,
+         sizeof(float) * floats_per_drawable * (header_.max_cell_drawables - count));
+}
+
+}
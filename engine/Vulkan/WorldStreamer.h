@@ -0,0 +1,146 @@
+#ifndef VULKAN_ENGINE_WORLDSTREAMER_H
+#define VULKAN_ENGINE_WORLDSTREAMER_H
+
+#include "AsyncReader.h"
+#include "Simulation.h"
+#include "UploadRing.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace engine {
+
+// The start of a world file, followed by a WorldCell per cell (row by row) and their packed drawables
+struct WorldFileHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t cells_x;
+  uint32_t cells_y;
+  // cells are squares of this size in the scene, the world is centered on its origin
+  float cell_size;
+  uint32_t max_cell_drawables;
+};
+
+struct WorldCell {
+  uint64_t offset;
+  uint32_t count;
+  uint32_t padding;
+};
+
+// A drawable as stored, in fixed point within its cell
+struct PackedDrawable {
+  uint16_t x;
+  uint16_t y;
+  uint8_t scale;
+  uint8_t depth;
+};
+
+// Copy of a decoded cell from the upload ring into its slot of the pool
+struct CellUpload {
+  uint64_t ring_offset;
+  uint32_t slot;
+};
+
+/*
+ * Streams the cells of a world too large to be resident around the camera
+ *
+ * The GPU keeps a pool of slots of max_cell_drawables drawables each (an
+ * unused drawable has scale 0), sized by a memory cap. Every frame the cells
+ * around the camera and around where its velocity takes it next are ranked
+ * by their distance to that path, the nearest missing ones are read
+ * asynchronously into slots which are free or hold cells farther away, and
+ * the reads which completed are decoded into the upload ring for the copies
+ * of the frame. The file index is read once when it is opened, the frames
+ * themselves never wait for the disk. Only for the thread rendering the frames.
+ */
+class WorldStreamer {
+  public:
+    // a world of random triangles, false if it couldn't be written
+    static bool generate(std::string const& path, uint32_t cells_x, uint32_t cells_y, float cell_size,
+                         uint32_t max_cell_drawables);
+
+    // reads the index, throws if the file is missing or not a world file
+    void open(std::string const& path, uint64_t memory_cap, uint32_t queue_depth, uint32_t threads,
+              bool force_threads);
+
+    bool isOpen() const { return reader_.isOpen(); }
+
+    uint32_t slots() const { return uint32_t(slot_cells_.size()); }
+
+    uint32_t slotDrawables() const { return header_.max_cell_drawables; }
+
+    // a cell was copied into the slot, the others hold nothing to draw
+    bool slotResident(uint32_t slot) const;
+
+    // bytes of a slot in the pool, of Drawable
+    uint64_t slotSize() const;
+
+    /*
+     * Rank the cells for the camera at the time (seconds), start reads for the nearest
+     * missing ones and decode finished reads into the ring. Slots to clear (cells evicted
+     * without a replacement yet) and the copies to record are appended
+     */
+    void update(Camera const& camera, double time, UploadRing& ring, std::vector<uint32_t>& clears,
+                std::vector<CellUpload>& uploads);
+
+    uint32_t residentCells() const { return resident_; }
+
+    uint32_t loadingCells() const { return reader_.inFlight() + uint32_t(decode_queue_.size()); }
+
+    uint64_t loads() const { return loads_; }
+
+    uint64_t evictions() const { return evictions_; }
+
+    uint64_t failedReads() const { return failed_reads_; }
+
+    uint64_t bytesRead() const { return bytes_read_; }
+
+    AsyncReader const& reader() const { return reader_; }
+
+  private:
+    enum CellState : uint8_t {
+      Unloaded,
+      // read into a buffer, or decoded but not yet copied
+      Loading,
+      Resident,
+      // the read failed, it isn't tried again
+      Failed,
+    };
+
+    struct Read {
+      uint32_t cell;
+      uint32_t slot;
+      std::vector<char> data;
+    };
+
+    WorldFileHeader header_ = {};
+    std::vector<WorldCell> cells_;
+    std::vector<uint8_t> cell_states_;
+    // the cell in each slot, or none
+    std::vector<uint32_t> slot_cells_;
+    std::vector<uint32_t> free_slots_;
+    // one per read in flight, by its index
+    std::vector<Read> reads_;
+    std::vector<uint32_t> free_reads_;
+    // finished reads waiting for room in the upload ring
+    std::vector<uint32_t> decode_queue_;
+    AsyncReader reader_;
+
+    // the camera of the last update, for its velocity
+    float last_position_[2] = {0.0f, 0.0f};
+    double last_time_ = -1.0;
+    float velocity_[2] = {0.0f, 0.0f};
+
+    uint32_t resident_ = 0;
+    uint64_t loads_ = 0;
+    uint64_t evictions_ = 0;
+    uint64_t failed_reads_ = 0;
+    uint64_t bytes_read_ = 0;
+
+    void decode(Read const& read, void* destination) const;
+};
+
+}
+
+#endif //VULKAN_ENGINE_WORLDSTREAMER_H
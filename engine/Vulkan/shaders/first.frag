@@ -1,10 +1,16 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
 
 layout(location = 0) in vec3 fragColor;
+// in the scene, before the view
+layout(location = 1) in vec2 fragPosition;
 layout(location = 0) out vec4 outColor;
 
+#include "lighting.glsl"
 
+// without shadows, and in frame captures, the sun reaches everything
 void main() {
-    outColor = vec4(fragColor, 1.0);
-}
\ No newline at end of file
+  vec3 light_sum = ambient + sun_color + pointLighting(fragPosition, gl_FragCoord.z);
+  outColor = vec4(fragColor * light_sum, 1.0);
+}
@@ -1,10 +1,23 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+#include "views.glsl"
+
 layout(location = 0) out vec3 fragColor;
+// in the scene, for the lighting
+layout(location = 1) out vec2 fragPosition;
 
+// placement of the triangle, see engine::Drawable
+layout(push_constant) uniform Drawable {
+  vec2 offset;
+  float scale;
+  float depth;
+} drawable;
 
+// the depth pre-pass and the shading pass have to produce bit-identical depth
 out gl_PerVertex {
-        vec4 gl_Position;
+        invariant vec4 gl_Position;
 };
 
 vec2 positions[3] = vec2[](
@@ -19,6 +32,10 @@ vec3 colors[3] = vec3[](
 );
 
 void main() {
-  gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
+  vec2 position = positions[gl_VertexIndex] * drawable.scale + drawable.offset;
+  vec3 camera = viewCamera();
+  gl_Position = vec4((position - camera.xy) * camera.z, drawable.depth, 1.0);
+  writeViewLayer();
   fragColor = colors[gl_VertexIndex];
+  fragPosition = position;
 }
\ No newline at end of file
@@ -0,0 +1,56 @@
+// The lighting of the scene, included by first.frag and shadowed.frag:
+// the camera, the point lights and their clusters in set 0, and the sun
+
+// the camera, see engine::View
+layout(std430, set = 0, binding = 0) readonly buffer View {
+  vec2 offset;
+  float zoom;
+} view;
+
+// see engine::Light
+struct Light {
+  vec2 position;
+  float depth;
+  float radius;
+  vec3 color;
+  float intensity;
+};
+
+layout(std430, set = 0, binding = 1) readonly buffer Lights {
+  Light lights[];
+};
+
+// written by lights.comp: per cluster the offset and the count of its lights
+layout(std430, set = 0, binding = 2) readonly buffer Clusters {
+  uvec2 clusters[];
+};
+
+layout(std430, set = 0, binding = 3) readonly buffer LightIndices {
+  uint light_indices[];
+};
+
+// the grid of lights.comp
+const uint tiles_x = 16;
+const uint tiles_y = 16;
+const uint slices = 16;
+// so what no light reaches isn't black
+const float ambient = 0.15;
+// the directional light, its direction is engine's sun_direction
+const vec3 sun_color = vec3(0.45, 0.42, 0.38);
+
+// the point lights reaching the fragment, the depth is linear, there is no perspective
+vec3 pointLighting(vec2 position, float depth) {
+  vec2 ndc = (position - view.offset) * view.zoom;
+  uvec2 tile = uvec2(clamp((ndc * 0.5 + 0.5) * vec2(tiles_x, tiles_y), vec2(0.0), vec2(tiles_x - 1, tiles_y - 1)));
+  uint slice = min(uint(depth * slices), slices - 1);
+  uvec2 cluster = clusters[(slice * tiles_y + tile.y) * tiles_x + tile.x];
+
+  vec3 point = vec3(position, depth);
+  vec3 light_sum = vec3(0.0);
+  for (uint i = 0; i < cluster.y; i++) {
+    Light light = lights[light_indices[cluster.x + i]];
+    float falloff = max(0.0, 1.0 - length(vec3(light.position, light.depth) - point) / light.radius);
+    light_sum += light.color * light.intensity * falloff * falloff;
+  }
+  return light_sum;
+}
@@ -0,0 +1,33 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// OverlayVertex in Overlay.h
+struct Vertex {
+  vec2 position;
+  vec2 uv;
+  uint color;
+  uint padding;
+};
+
+layout(std430, binding = 0) readonly buffer Vertices {
+  Vertex vertices[];
+};
+
+// 2 / extent, pixels to normalized device coordinates
+layout(push_constant) uniform Params {
+  vec2 scale;
+};
+
+layout(location = 0) out vec2 fragUv;
+layout(location = 1) out vec4 fragColor;
+
+out gl_PerVertex {
+  vec4 gl_Position;
+};
+
+void main() {
+  Vertex vertex = vertices[gl_VertexIndex];
+  gl_Position = vec4(vertex.position * scale - 1.0, 0.0, 1.0);
+  fragUv = vertex.uv;
+  fragColor = unpackUnorm4x8(vertex.color);
+}
@@ -0,0 +1,11 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// the particles glow, they aren't lit like the scene in first.frag
+layout(location = 0) in vec3 fragColor;
+layout(location = 0) out vec4 outColor;
+
+
+void main() {
+    outColor = vec4(fragColor, 1.0);
+}
\ No newline at end of file
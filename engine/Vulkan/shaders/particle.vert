@@ -0,0 +1,29 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+#define VIEW_BINDING binding = 5
+#include "views.glsl"
+
+layout(location = 0) out vec3 fragColor;
+
+// written by particle_simulate.comp, as many as the indirect draw has vertices
+layout(std430, binding = 3) readonly buffer Vertices {
+  vec4 vertices[];
+};
+
+out gl_PerVertex {
+  vec4 gl_Position;
+  float gl_PointSize;
+};
+
+void main() {
+  vec4 particle = vertices[gl_VertexIndex];
+  vec3 camera = viewCamera();
+  gl_Position = vec4((particle.xy - camera.xy) * camera.z, particle.z, 1.0);
+  writeViewLayer();
+  // larger points would need the largePoints feature
+  gl_PointSize = 1.0;
+  // hot when young, fading to dark red
+  fragColor = mix(vec3(1.0, 0.9, 0.5), vec3(0.6, 0.1, 0.0), particle.w);
+}
@@ -0,0 +1,36 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+const uint cascade_count = 4;
+
+// where the cascades are this frame, see engine::ShadowFrame
+layout(std430, set = 0, binding = 0) readonly buffer ShadowFrame {
+  vec2 light_shift;
+  vec4 cascades[cascade_count];
+} shadow;
+
+// written by particle_simulate.comp, as many as the indirect draw has vertices
+layout(std430, set = 0, binding = 4) readonly buffer Vertices {
+  vec4 vertices[];
+};
+
+// the cascade (layer) of the draw
+layout(push_constant) uniform Cascade {
+  uint index;
+} cascade;
+
+out gl_PerVertex {
+  vec4 gl_Position;
+  float gl_PointSize;
+};
+
+void main() {
+  vec4 particle = vertices[gl_VertexIndex];
+  vec4 placement = shadow.cascades[cascade.index];
+  gl_Position = vec4((particle.xy + shadow.light_shift * particle.z - placement.xy) / placement.z, particle.z, 1.0);
+  gl_PointSize = 1.0;
+  // the copies for the views of the scene (see particle_emit.comp) are outside of the clip volume
+  if (gl_InstanceIndex > 0) {
+    gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+  }
+}
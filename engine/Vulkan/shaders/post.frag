@@ -0,0 +1,45 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// one of the pixel effects of engine::PostEffect, each is a subpass of its own
+layout(constant_id = 0) const uint effect = 0;
+const uint tonemap = 0;
+const uint color_grade = 1;
+const uint vignette = 2;
+
+// what the subpass before wrote at this pixel, in the layer of the view
+layout(input_attachment_index = 0, set = 0, binding = 0) uniform subpassInput previous;
+
+// see engine::PostParams
+layout(push_constant) uniform Params {
+  // the rendered pixels of a view
+  vec2 extent;
+} params;
+
+layout(location = 0) out vec4 outColor;
+
+// the luminance is white at this, brighter is burnt out
+const float white_point = 4.0;
+
+float luminance(vec3 color) {
+  return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+void main() {
+  vec3 color = subpassLoad(previous).rgb;
+  if (effect == tonemap) {
+    // extended Reinhard on the luminance, which keeps the hue
+    float luma = luminance(color);
+    float mapped = luma * (1.0 + luma / (white_point * white_point)) / (1.0 + luma);
+    color *= luma > 0.0 ? mapped / luma : 0.0;
+  } else if (effect == color_grade) {
+    color = (color - 0.5) * 1.1 + 0.5;
+    color = mix(vec3(luminance(color)), color, 1.15);
+    color = max(color * vec3(1.03, 1.0, 0.95), 0.0);
+  } else if (effect == vignette) {
+    // 0 in the center, 1 in the corners
+    float corner = length(gl_FragCoord.xy / params.extent - 0.5) * 1.41421356;
+    color *= 1.0 - 0.4 * smoothstep(0.4, 1.0, corner);
+  }
+  outColor = vec4(color, 1.0);
+}
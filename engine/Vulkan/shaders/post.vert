@@ -0,0 +1,20 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+#include "views.glsl"
+
+// the layer of the view, which post_filter.frag samples
+layout(location = 0) flat out int fragLayer;
+
+out gl_PerVertex {
+  vec4 gl_Position;
+};
+
+// a triangle covering the whole target, once per view with LAYERED
+void main() {
+  vec2 uv = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+  gl_Position = vec4(uv * 2.0 - 1.0, 0.0, 1.0);
+  fragLayer = viewLayer();
+  writeViewLayer();
+}
@@ -0,0 +1,65 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// FXAA, the filter of engine::PostEffect: needs the neighbouring pixels,
+// so it samples the result of the scene render pass in a render pass of its own
+layout(set = 0, binding = 0) uniform sampler2DArray source;
+
+// see engine::PostParams
+layout(push_constant) uniform Params {
+  // the rendered pixels of a view, the rest of the source is stale with dynamic resolution
+  vec2 extent;
+} params;
+
+layout(location = 0) flat in int fragLayer;
+layout(location = 0) out vec4 outColor;
+
+// contrast below which there is no edge: relative to the brightest neighbour, and at all
+const float edge_threshold = 1.0 / 8.0;
+const float edge_threshold_min = 1.0 / 32.0;
+// how far along the edge is blended, in pixels
+const float span_max = 8.0;
+const float reduce_min = 1.0 / 128.0;
+const float reduce_mul = 1.0 / 8.0;
+
+vec2 texel;
+vec2 max_uv;
+
+vec3 fetch(vec2 uv) {
+  return textureLod(source, vec3(min(uv, max_uv), fragLayer), 0.0).rgb;
+}
+
+float luminance(vec3 color) {
+  return dot(color, vec3(0.299, 0.587, 0.114));
+}
+
+void main() {
+  texel = 1.0 / vec2(textureSize(source, 0).xy);
+  max_uv = (params.extent - 0.5) * texel;
+  vec2 uv = gl_FragCoord.xy * texel;
+
+  vec3 center = fetch(uv);
+  float luma_m = luminance(center);
+  float luma_nw = luminance(fetch(uv + vec2(-1.0, -1.0) * texel));
+  float luma_ne = luminance(fetch(uv + vec2(1.0, -1.0) * texel));
+  float luma_sw = luminance(fetch(uv + vec2(-1.0, 1.0) * texel));
+  float luma_se = luminance(fetch(uv + vec2(1.0, 1.0) * texel));
+  float luma_min = min(luma_m, min(min(luma_nw, luma_ne), min(luma_sw, luma_se)));
+  float luma_max = max(luma_m, max(max(luma_nw, luma_ne), max(luma_sw, luma_se)));
+  if (luma_max - luma_min < max(edge_threshold_min, luma_max * edge_threshold)) {
+    outColor = vec4(center, 1.0);
+    return;
+  }
+
+  // across the gradient is along the edge
+  vec2 direction = vec2(-((luma_nw + luma_ne) - (luma_sw + luma_se)), (luma_nw + luma_sw) - (luma_ne + luma_se));
+  float reduce = max((luma_nw + luma_ne + luma_sw + luma_se) * 0.25 * reduce_mul, reduce_min);
+  float scale = 1.0 / (min(abs(direction.x), abs(direction.y)) + reduce);
+  direction = clamp(direction * scale, -span_max, span_max) * texel;
+
+  vec3 inner = 0.5 * (fetch(uv + direction * (1.0 / 3.0 - 0.5)) + fetch(uv + direction * (2.0 / 3.0 - 0.5)));
+  vec3 outer = 0.5 * inner + 0.25 * (fetch(uv - direction * 0.5) + fetch(uv + direction * 0.5));
+  // the wider blend ran off the edge if it leaves the range of the neighbourhood
+  float luma_outer = luminance(outer);
+  outColor = vec4(luma_outer < luma_min || luma_outer > luma_max ? inner : outer, 1.0);
+}
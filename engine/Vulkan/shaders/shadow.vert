@@ -0,0 +1,55 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// see engine::Drawable
+struct Drawable {
+  vec2 offset;
+  float scale;
+  float depth;
+};
+
+const uint cascade_count = 4;
+
+// where the cascades are this frame, see engine::ShadowFrame
+layout(std430, set = 0, binding = 0) readonly buffer ShadowFrame {
+  vec2 light_shift;
+  vec4 cascades[cascade_count];
+} shadow;
+
+// the whole scene, one instance per drawable
+layout(std430, set = 0, binding = 3) readonly buffer Drawables {
+  Drawable drawables[];
+};
+
+// the cascade (layer) of the draw
+layout(push_constant) uniform Cascade {
+  uint index;
+} cascade;
+
+// clears the cached map with a triangle over all of it at the far plane instead of drawing casters,
+// so a cascade which didn't move costs nothing but an empty indirect draw
+layout(constant_id = 0) const bool clear_map = false;
+
+out gl_PerVertex {
+  vec4 gl_Position;
+};
+
+// the triangles of first.vert
+vec2 positions[3] = vec2[](
+        vec2(0.0, -0.5),
+        vec2(0.5, 0.5),
+        vec2(-0.5, 0.5)
+);
+
+void main() {
+  if (clear_map) {
+    vec2 corner = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+    gl_Position = vec4(corner * 2.0 - 1.0, 1.0, 1.0);
+    return;
+  }
+  Drawable drawable = drawables[gl_InstanceIndex];
+  vec2 position = positions[gl_VertexIndex] * drawable.scale + drawable.offset;
+  vec4 placement = shadow.cascades[cascade.index];
+  gl_Position = vec4((position + shadow.light_shift * drawable.depth - placement.xy) / placement.z,
+                     drawable.depth, 1.0);
+}
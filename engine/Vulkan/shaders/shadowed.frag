@@ -0,0 +1,47 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+layout(location = 0) in vec3 fragColor;
+// in the scene, before the view
+layout(location = 1) in vec2 fragPosition;
+layout(location = 0) out vec4 outColor;
+
+#include "lighting.glsl"
+
+const uint cascade_count = 4;
+// keeps the surfaces from shadowing themselves, in depth
+const float shadow_bias = 0.002;
+
+// where the cascades are this frame, see engine::ShadowFrame
+layout(std430, set = 1, binding = 0) readonly buffer ShadowFrame {
+  // moves a point of the scene along the sun to depth 0, per unit of depth
+  vec2 light_shift;
+  // origin in shadow space and half extent
+  vec4 cascades[cascade_count];
+} shadow;
+
+// the static casters, cached over frames, and the dynamic ones of this frame
+layout(set = 1, binding = 1) uniform sampler2DArray static_shadows;
+layout(set = 1, binding = 2) uniform sampler2DArray dynamic_shadows;
+
+// 1 if the sun reaches the fragment, looked up in the finest cascade covering it
+float sunlight(vec2 position, float depth) {
+  vec2 shadow_position = position + shadow.light_shift * depth;
+  for (uint c = 0; c < cascade_count; c++) {
+    vec2 uv = (shadow_position - shadow.cascades[c].xy) / shadow.cascades[c].z;
+    if (all(lessThan(abs(uv), vec2(1.0)))) {
+      vec3 coord = vec3(uv * 0.5 + 0.5, float(c));
+      float caster = min(texture(static_shadows, coord).r, texture(dynamic_shadows, coord).r);
+      return depth <= caster + shadow_bias ? 1.0 : 0.0;
+    }
+  }
+  // beyond the coarsest cascade nothing casts
+  return 1.0;
+}
+
+void main() {
+  float depth = gl_FragCoord.z;
+  vec3 light_sum = ambient + sun_color * sunlight(fragPosition, depth) + pointLighting(fragPosition, depth);
+  outColor = vec4(fragColor * light_sum, 1.0);
+}
@@ -0,0 +1,65 @@
+// The cameras of the vertex shaders of the scene, included by first.vert, world.vert, particle.vert and post.vert
+// before anything else, in place of a declaration of the view buffer of their own
+//
+// Compiled once for a single view, and twice more for several views in one pass (see Settings::views):
+// with MULTIVIEW the render pass runs the shader once per view and says which in gl_ViewIndex, with
+// LAYERED every draw has view_count times the instances and the shader writes the layer of its view.
+#if defined(MULTIVIEW)
+#extension GL_EXT_multiview : require
+#elif defined(LAYERED)
+#extension GL_ARB_shader_viewport_layer_array : require
+#endif
+
+// where the view buffer is bound, particle.vert has a set of its own
+#ifndef VIEW_BINDING
+#define VIEW_BINDING set = 0, binding = 0
+#endif
+
+// the camera, see engine::View: the one covering all views, then the one of every view
+layout(std430, VIEW_BINDING) readonly buffer View {
+  vec2 offset;
+  float zoom;
+  // offset in xy, zoom in z
+  vec4 views[];
+} view;
+
+// the instances of a view in a draw are view_count apart with LAYERED, see view_count_constant
+layout(constant_id = 1) const uint view_count = 1;
+
+// the offset (xy) and the zoom (z) the vertex is seen with
+vec3 viewCamera() {
+#if defined(MULTIVIEW)
+  return view.views[gl_ViewIndex].xyz;
+#elif defined(LAYERED)
+  return view.views[uint(gl_InstanceIndex) % view_count].xyz;
+#else
+  return vec3(view.offset, view.zoom);
+#endif
+}
+
+// gl_InstanceIndex without the copies of the views
+uint drawInstance() {
+#if defined(LAYERED)
+  return uint(gl_InstanceIndex) / view_count;
+#else
+  return uint(gl_InstanceIndex);
+#endif
+}
+
+// the layer of the targets the vertex is drawn into
+int viewLayer() {
+#if defined(MULTIVIEW)
+  return int(gl_ViewIndex);
+#elif defined(LAYERED)
+  return int(uint(gl_InstanceIndex) % view_count);
+#else
+  return 0;
+#endif
+}
+
+// the layer of the view, a multiview render pass picks it itself
+void writeViewLayer() {
+#if defined(LAYERED)
+  gl_Layer = viewLayer();
+#endif
+}
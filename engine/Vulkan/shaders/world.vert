@@ -0,0 +1,48 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+#include "views.glsl"
+
+layout(location = 0) out vec3 fragColor;
+// in the scene, for the lighting
+layout(location = 1) out vec2 fragPosition;
+
+// see engine::Drawable
+struct Drawable {
+  vec2 offset;
+  float scale;
+  float depth;
+};
+
+// the slots of the streamed world cells, one instance per drawable, unused ones have scale 0
+layout(std430, set = 0, binding = 4) readonly buffer WorldDrawables {
+  Drawable drawables[];
+};
+
+// the depth pre-pass and the shading pass have to produce bit-identical depth
+out gl_PerVertex {
+        invariant vec4 gl_Position;
+};
+
+// the triangles of first.vert, in the colors of the world
+vec2 positions[3] = vec2[](
+        vec2(0.0, -0.5),
+        vec2(0.5, 0.5),
+        vec2(-0.5, 0.5)
+);
+vec3 colors[3] = vec3[](
+        vec3(0.9, 0.8, 0.3),
+        vec3(0.3, 0.8, 0.9),
+        vec3(0.8, 0.3, 0.9)
+);
+
+void main() {
+  Drawable drawable = drawables[drawInstance()];
+  vec2 position = positions[gl_VertexIndex] * drawable.scale + drawable.offset;
+  vec3 camera = viewCamera();
+  gl_Position = vec4((position - camera.xy) * camera.z, drawable.depth, 1.0);
+  writeViewLayer();
+  fragColor = colors[gl_VertexIndex];
+  fragPosition = position;
+}
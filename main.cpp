@@ -1,13 +1,19 @@
 #include "engine/Vulkan/Vulkan.h"
+#include "engine/Log.h"
 
 
-#include <iostream>
+#include <algorithm>
+#include <cstdlib>
 #include <stdexcept>
 #include <functional>
+#include <string>
 #include <vector>
 
 class Application {
   public:
+    explicit Application(engine::Settings const& settings)
+            : engine(settings) { }
+
     void run() {
       engine.init();
       engine.mainLoop();
@@ -19,12 +25,94 @@ class Application {
 };
 
 int main() {
-  Application app;
+  engine::Settings settings;
+  if (const char* device = std::getenv("VULKAN_ENGINE_DEVICE")) {
+    settings.device = device;
+  }
+  if (std::getenv("VULKAN_ENGINE_RECALIBRATE")) {
+    settings.recalibrate = true;
+  }
+  // <ppm|png|raw>[:<every n-th frame>], e.g. png:60
+  if (const char* readback = std::getenv("VULKAN_ENGINE_READBACK")) {
+    std::string value = readback;
+    std::string format = value.substr(0, value.find(':'));
+    settings.readback_format = format == "png" ? engine::ImageFileFormat::Png :
+                               format == "raw" ? engine::ImageFileFormat::Raw : engine::ImageFileFormat::Ppm;
+    settings.readback_interval = value.find(':') != std::string::npos ?
+                                 std::max(1, std::atoi(value.c_str() + value.find(':') + 1)) : 1;
+  }
+
+  // capacity of the particle system, 0 disables it
+  if (const char* particles = std::getenv("VULKAN_ENGINE_PARTICLES")) {
+    settings.particle_count = uint32_t(std::max(0, std::atoi(particles)));
+  }
+  // point lights of the scene, to see what the shading costs as they grow
+  if (const char* lights = std::getenv("VULKAN_ENGINE_LIGHTS")) {
+    settings.light_count = uint32_t(std::max(0, std::atoi(lights)));
+  }
+  // ticks per second of the simulation
+  if (const char* rate = std::getenv("VULKAN_ENGINE_SIMULATION_RATE")) {
+    settings.simulation_rate = std::max(1.0, std::atof(rate));
+  }
+  // GPU milliseconds per frame to hold by lowering the resolution
+  if (const char* target = std::getenv("VULKAN_ENGINE_DYNAMIC_RESOLUTION")) {
+    settings.dynamic_resolution = true;
+    settings.frame_time_target = std::atof(target) > 0.0 ? std::atof(target) : settings.frame_time_target;
+  }
+  if (std::getenv("VULKAN_ENGINE_NO_OVERLAY")) {
+    settings.overlay = false;
+  }
+  if (std::getenv("VULKAN_ENGINE_NO_OCCLUSION_CULLING")) {
+    settings.occlusion_culling = false;
+  }
+  if (std::getenv("VULKAN_ENGINE_NO_SHADOWS")) {
+    settings.shadows = false;
+  }
+  // the file of the streamed world, generated if it is missing
+  if (const char* world = std::getenv("VULKAN_ENGINE_WORLD")) {
+    settings.world_path = world;
+  }
+  if (std::getenv("VULKAN_ENGINE_NO_WORLD")) {
+    settings.world_path.clear();
+  }
+  // read the world with threads even if the kernel has io_uring, to compare them
+  if (std::getenv("VULKAN_ENGINE_WORLD_THREADS")) {
+    settings.world_threads = true;
+  }
+  // any heap allocation of a frame in steady state is an error, see Settings::strict_allocations
+  if (std::getenv("VULKAN_ENGINE_STRICT_ALLOCATIONS")) {
+    settings.strict_allocations = true;
+  }
+
+  // the post-processing, comma separated, e.g. tonemap,grade,vignette,fxaa
+  if (const char* post = std::getenv("VULKAN_ENGINE_POST")) {
+    std::string value = post;
+    size_t begin = 0;
+    while (begin <= value.size()) {
+      size_t end = std::min(value.find(',', begin), value.size());
+      std::string name = value.substr(begin, end - begin);
+      if (name == "tonemap") {
+        settings.post_effects.push_back(engine::PostEffect::Tonemap);
+      } else if (name == "grade") {
+        settings.post_effects.push_back(engine::PostEffect::ColorGrade);
+      } else if (name == "vignette") {
+        settings.post_effects.push_back(engine::PostEffect::Vignette);
+      } else if (name == "fxaa") {
+        settings.post_effects.push_back(engine::PostEffect::Fxaa);
+      } else if (!name.empty()) {
+        LOG_WARNING("Unknown post effect " << name << ", ignored.");
+      }
+      begin = end + 1;
+    }
+  }
+
+  Application app(settings);
 
   try {
     app.run();
   } catch (const std::runtime_error& e) {
-    std::cerr << e.what() << std::endl;
+    LOG_ERROR(e.what());
+    engine::log::Logger::instance().flush();
     return EXIT_FAILURE;
   }
 
@@ -0,0 +1,864 @@
+/*
+ * Executes a frame capture of the engine (F12) again, headlessly, and
+ * reports how long the GPU and the CPU took for the frame and its passes
+ *
+ * usage: vulkan_replay <capture.vkcap> [iterations] [ppm|png|raw]
+ *
+ * With a file format the presented image of the last iteration is read back
+ * and written next to the capture, to compare it with the windowed run.
+ * Needs no window and no presentation support, so it runs on CI machines
+ * with a CPU-only Vulkan implementation. VULKAN_ENGINE_DEVICE selects the
+ * device by a part of its name, like for the engine.
+ */
+
+#include "../engine/Vulkan/VDeleter.h"
+#include "../engine/Vulkan/Capture.h"
+#include "../engine/Vulkan/Readback.h"
+#include "../engine/Log.h"
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+using engine::FrameCapture;
+using engine::CapturePipeline;
+using engine::CommandBindings;
+using engine::Readback;
+
+// iterations which are run but not measured, the first ones include the lazy driver work
+const uint32_t warmup_iterations = 5;
+
+void reportTimings(std::string const& name, std::vector<double> samples) {
+  if (samples.empty()) {
+    return;
+  }
+  std::sort(samples.begin(), samples.end());
+  double sum = 0.0;
+  for (double sample : samples) {
+    sum += sample;
+  }
+  LOG_INFO(name << ": min " << samples.front() << " ms, median " << samples[samples.size() / 2]
+                << " ms, mean " << sum / samples.size() << " ms, max " << samples.back() << " ms");
+}
+
+bool hasStencil(VkFormat format) {
+  return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT ||
+         format == VK_FORMAT_D16_UNORM_S8_UINT;
+}
+
+class Replay {
+  public:
+    explicit Replay(FrameCapture const& capture)
+            : capture_(capture) { }
+
+    void init() {
+      createInstance();
+      selectPhysicalDevice();
+      createLogicalDevice();
+      createCommandPool();
+      createBuffers();
+      createDescriptorSets();
+      createRenderpass();
+      createPipelines();
+      createFramebuffer();
+      createQueryPool();
+      recordCommandBuffer();
+    }
+
+    void run(uint32_t iterations) {
+      VkSubmitInfo submit_info = {};
+      submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+      submit_info.commandBufferCount = 1;
+      submit_info.pCommandBuffers = &command_buffer_;
+
+      size_t pass_count = capture_.passes.size();
+      std::vector<double> frame_gpu_ms;
+      std::vector<double> frame_cpu_ms;
+      std::vector<std::vector<double>> pass_gpu_ms(pass_count);
+      std::vector<uint64_t> timestamps(2 * pass_count);
+      double ms_per_tick = timestamp_period_ / 1e6;
+
+      for (uint32_t i = 0; i < warmup_iterations + iterations; i++) {
+        auto start = std::chrono::steady_clock::now();
+        vkResetFences(device_, 1, &fence_);
+        if (vkQueueSubmit(queue_, 1, &submit_info, fence_) != VK_SUCCESS) {
+          throw std::runtime_error("Failed to submit the replayed frame");
+        }
+        vkWaitForFences(device_, 1, &fence_, VK_TRUE, std::numeric_limits<uint64_t>::max());
+        std::chrono::duration<double, std::milli> cpu_ms = std::chrono::steady_clock::now() - start;
+
+        if (i < warmup_iterations) {
+          continue;
+        }
+        frame_cpu_ms.push_back(cpu_ms.count());
+
+        if (!timestamps_supported_ ||
+            vkGetQueryPoolResults(device_, query_pool_, 0, timestamps.size(), sizeof(uint64_t) * timestamps.size(),
+                                  timestamps.data(), sizeof(uint64_t),
+                                  VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT) != VK_SUCCESS) {
+          continue;
+        }
+        frame_gpu_ms.push_back((timestamps.back() - timestamps.front()) * ms_per_tick);
+        for (size_t p = 0; p < pass_count; p++) {
+          pass_gpu_ms[p].push_back((timestamps[2 * p + 1] - timestamps[2 * p]) * ms_per_tick);
+        }
+      }
+
+      LOG_INFO("Replayed " << iterations << " iterations (" << capture_.extent.width << "x"
+                           << capture_.extent.height << ") on " << device_name_ << ":");
+      reportTimings("frame (cpu, submit to fence)", frame_cpu_ms);
+      if (!timestamps_supported_) {
+        LOG_WARNING("The queue has no timestamps, only cpu timings are available.");
+        return;
+      }
+      reportTimings("frame (gpu)", frame_gpu_ms);
+      for (size_t p = 0; p < pass_count; p++) {
+        reportTimings("pass " + capture_.passes[p].name + " (gpu)", pass_gpu_ms[p]);
+      }
+    }
+
+    // the image which the engine presented, after the last iteration
+    void readBack(engine::ImageFileFormat format, std::string const& prefix) {
+      if (present_attachment_ < 0) {
+        throw std::runtime_error("The capture has no presented image to read back");
+      }
+      VkFormat image_format = capture_.renderpass.attachments[present_attachment_].format;
+      readback_.init(physical_device_, queue_family_, capture_.extent, image_format, 1, format, prefix, 1);
+
+      VkSubmitInfo submit_info = {};
+      submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+      submit_info.commandBufferCount = 1;
+      VkFence fence;
+      VkCommandBuffer cmd = readback_.request(images_[present_attachment_], VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                                              0, fence);
+      submit_info.pCommandBuffers = &cmd;
+      if (vkQueueSubmit(queue_, 1, &submit_info, fence) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to submit the readback");
+      }
+      vkQueueWaitIdle(queue_);
+      readback_.finish();
+      if (readback_.written() == 0) {
+        throw std::runtime_error("Failed to write the read back image");
+      }
+    }
+
+  private:
+    FrameCapture const& capture_;
+
+    VDeleter<VkInstance> instance_{vkDestroyInstance};
+    VDeleter<VkDevice> device_{vkDestroyDevice};
+    VkPhysicalDevice physical_device_ = VK_NULL_HANDLE;
+    std::string device_name_;
+    uint32_t queue_family_ = 0;
+    VkQueue queue_ = VK_NULL_HANDLE;
+    bool timestamps_supported_ = false;
+    float timestamp_period_ = 1.0f;
+
+    VDeleter<VkCommandPool> command_pool_{device_, vkDestroyCommandPool};
+    VkCommandBuffer command_buffer_ = VK_NULL_HANDLE;
+    VDeleter<VkFence> fence_{device_, vkDestroyFence};
+    VDeleter<VkQueryPool> query_pool_{device_, vkDestroyQueryPool};
+
+    std::vector<VDeleter<VkBuffer>> buffers_;
+    std::vector<VDeleter<VkDeviceMemory>> buffer_memory_;
+    VDeleter<VkDescriptorPool> descriptor_pool_{device_, vkDestroyDescriptorPool};
+    // one per descriptor set and one per pipeline, with as many bindings as they have buffers
+    std::vector<VDeleter<VkDescriptorSetLayout>> set_layouts_;
+    std::vector<VDeleter<VkDescriptorSetLayout>> pipeline_set_layouts_;
+    std::vector<VkDescriptorSet> descriptor_sets_;
+
+    VDeleter<VkRenderPass> renderpass_{device_, vkDestroyRenderPass};
+    std::map<std::string, VDeleter<VkShaderModule>> shader_modules_;
+    std::vector<VDeleter<VkPipelineLayout>> pipeline_layouts_;
+    std::vector<VDeleter<VkPipeline>> pipelines_;
+
+    std::vector<VDeleter<VkImage>> images_;
+    std::vector<VDeleter<VkDeviceMemory>> image_memory_;
+    std::vector<VDeleter<VkImageView>> image_views_;
+    VDeleter<VkFramebuffer> framebuffer_{device_, vkDestroyFramebuffer};
+    // the attachment which was the swapchain image, -1 if there is none
+    int present_attachment_ = -1;
+    Readback readback_{device_};
+
+    void createInstance() {
+      VkApplicationInfo app_info = {};
+      app_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+      app_info.pApplicationName = "vulkan_replay";
+      app_info.apiVersion = VK_API_VERSION_1_0;
+
+      VkInstanceCreateInfo info = {};
+      info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+      info.pApplicationInfo = &app_info;
+      if (vkCreateInstance(&info, nullptr, instance_.replace()) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create instance");
+      }
+    }
+
+    /*
+     * The first device with a queue for graphics and compute, the captured
+     * passes run on it one after another
+     */
+    void selectPhysicalDevice() {
+      uint32_t count = 0;
+      vkEnumeratePhysicalDevices(instance_, &count, nullptr);
+      std::vector<VkPhysicalDevice> devices(count);
+      vkEnumeratePhysicalDevices(instance_, &count, devices.data());
+
+      const char* requested = std::getenv("VULKAN_ENGINE_DEVICE");
+      for (auto const& device : devices) {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(device, &properties);
+        if (requested && !strstr(properties.deviceName, requested)) {
+          continue;
+        }
+
+        uint32_t family_count = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(device, &family_count, nullptr);
+        std::vector<VkQueueFamilyProperties> families(family_count);
+        vkGetPhysicalDeviceQueueFamilyProperties(device, &family_count, families.data());
+        VkQueueFlags needed = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT;
+        for (uint32_t i = 0; i < family_count; i++) {
+          if (families[i].queueCount > 0 && (families[i].queueFlags & needed) == needed) {
+            physical_device_ = device;
+            device_name_ = properties.deviceName;
+            queue_family_ = i;
+            timestamps_supported_ = families[i].timestampValidBits > 0;
+            timestamp_period_ = properties.limits.timestampPeriod;
+            return;
+          }
+        }
+      }
+      throw std::runtime_error("No device with a graphics and compute queue found");
+    }
+
+    void createLogicalDevice() {
+      float priority = 1.0f;
+      VkDeviceQueueCreateInfo queue_info = {};
+      queue_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+      queue_info.queueFamilyIndex = queue_family_;
+      queue_info.queueCount = 1;
+      queue_info.pQueuePriorities = &priority;
+
+      VkPhysicalDeviceFeatures features = {};
+      VkDeviceCreateInfo info = {};
+      info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+      info.queueCreateInfoCount = 1;
+      info.pQueueCreateInfos = &queue_info;
+      info.pEnabledFeatures = &features;
+      if (vkCreateDevice(physical_device_, &info, nullptr, device_.replace()) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create logical device");
+      }
+      vkGetDeviceQueue(device_, queue_family_, 0, &queue_);
+    }
+
+    void createCommandPool() {
+      VkCommandPoolCreateInfo info = {};
+      info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+      info.queueFamilyIndex = queue_family_;
+      if (vkCreateCommandPool(device_, &info, nullptr, command_pool_.replace()) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create command pool");
+      }
+
+      VkCommandBufferAllocateInfo alloc_info = {};
+      alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+      alloc_info.commandPool = command_pool_;
+      alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+      alloc_info.commandBufferCount = 1;
+      if (vkAllocateCommandBuffers(device_, &alloc_info, &command_buffer_) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate command buffer");
+      }
+
+      VkFenceCreateInfo fence_info = {};
+      fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+      if (vkCreateFence(device_, &fence_info, nullptr, fence_.replace()) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create fence");
+      }
+    }
+
+    uint32_t findMemoryType(uint32_t type_filter, VkMemoryPropertyFlags properties) {
+      VkPhysicalDeviceMemoryProperties memory_properties;
+      vkGetPhysicalDeviceMemoryProperties(physical_device_, &memory_properties);
+      for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++) {
+        if ((type_filter & (1 << i)) &&
+            (memory_properties.memoryTypes[i].propertyFlags & properties) == properties) {
+          return i;
+        }
+      }
+      throw std::runtime_error("failed to find suitable memory type!");
+    }
+
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
+                      VDeleter<VkBuffer>& buffer, VDeleter<VkDeviceMemory>& memory) {
+      VkBufferCreateInfo info = {};
+      info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+      info.size = size;
+      info.usage = usage;
+      info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+      if (vkCreateBuffer(device_, &info, nullptr, buffer.replace()) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create buffer");
+      }
+
+      VkMemoryRequirements requirements;
+      vkGetBufferMemoryRequirements(device_, buffer, &requirements);
+      VkMemoryAllocateInfo alloc_info = {};
+      alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+      alloc_info.allocationSize = requirements.size;
+      alloc_info.memoryTypeIndex = findMemoryType(requirements.memoryTypeBits, properties);
+      if (vkAllocateMemory(device_, &alloc_info, nullptr, memory.replace()) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate buffer memory");
+      }
+      vkBindBufferMemory(device_, buffer, memory, 0);
+    }
+
+    /*
+     * Device local buffers with the captured contents, uploaded once
+     * Buffers without contents are written by the frame itself, they start as zeros
+     */
+    void createBuffers() {
+      size_t count = capture_.buffers.size();
+      buffers_.resize(count, VDeleter<VkBuffer>{device_, vkDestroyBuffer});
+      buffer_memory_.resize(count, VDeleter<VkDeviceMemory>{device_, vkFreeMemory});
+      std::vector<VDeleter<VkBuffer>> staging_buffers(count, VDeleter<VkBuffer>{device_, vkDestroyBuffer});
+      std::vector<VDeleter<VkDeviceMemory>> staging_memory(count, VDeleter<VkDeviceMemory>{device_, vkFreeMemory});
+
+      VkCommandBufferBeginInfo begin_info = {};
+      begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+      begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+      vkBeginCommandBuffer(command_buffer_, &begin_info);
+
+      for (size_t i = 0; i < count; i++) {
+        engine::CaptureBuffer const& buffer = capture_.buffers[i];
+        createBuffer(buffer.size, buffer.usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffers_[i], buffer_memory_[i]);
+        if (buffer.data.empty()) {
+          vkCmdFillBuffer(command_buffer_, buffers_[i], 0, VK_WHOLE_SIZE, 0);
+          continue;
+        }
+
+        VkDeviceSize size = std::min<VkDeviceSize>(buffer.size, buffer.data.size());
+        createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                     staging_buffers[i], staging_memory[i]);
+        void* data;
+        vkMapMemory(device_, staging_memory[i], 0, size, 0, &data);
+        memcpy(data, buffer.data.data(), size);
+        vkUnmapMemory(device_, staging_memory[i]);
+
+        VkBufferCopy region = {};
+        region.size = size;
+        vkCmdCopyBuffer(command_buffer_, staging_buffers[i], buffers_[i], 1, &region);
+      }
+
+      VkMemoryBarrier barrier = {};
+      barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+      barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+      vkCmdPipelineBarrier(command_buffer_, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                           0, 1, &barrier, 0, nullptr, 0, nullptr);
+      vkEndCommandBuffer(command_buffer_);
+
+      VkSubmitInfo submit_info = {};
+      submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+      submit_info.commandBufferCount = 1;
+      submit_info.pCommandBuffers = &command_buffer_;
+      if (vkQueueSubmit(queue_, 1, &submit_info, VK_NULL_HANDLE) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to submit buffer upload");
+      }
+      vkQueueWaitIdle(queue_);
+      vkResetCommandPool(device_, command_pool_, 0);
+    }
+
+    // set layouts with the same number of storage buffers are compatible
+    void createSetLayout(uint32_t binding_count, VDeleter<VkDescriptorSetLayout>& layout) {
+      std::vector<VkDescriptorSetLayoutBinding> bindings(binding_count);
+      for (uint32_t b = 0; b < binding_count; b++) {
+        bindings[b] = {};
+        bindings[b].binding = b;
+        bindings[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[b].descriptorCount = 1;
+        bindings[b].stageFlags = VK_SHADER_STAGE_ALL;
+      }
+
+      VkDescriptorSetLayoutCreateInfo info = {};
+      info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+      info.bindingCount = binding_count;
+      info.pBindings = bindings.data();
+      if (vkCreateDescriptorSetLayout(device_, &info, nullptr, layout.replace()) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create descriptor set layout");
+      }
+    }
+
+    void createDescriptorSets() {
+      size_t count = capture_.descriptor_sets.size();
+      if (count == 0) {
+        return;
+      }
+
+      uint32_t binding_count = 0;
+      set_layouts_.resize(count, VDeleter<VkDescriptorSetLayout>{device_, vkDestroyDescriptorSetLayout});
+      std::vector<VkDescriptorSetLayout> layouts(count);
+      for (size_t i = 0; i < count; i++) {
+        createSetLayout(capture_.descriptor_sets[i].buffers.size(), set_layouts_[i]);
+        layouts[i] = set_layouts_[i];
+        binding_count += capture_.descriptor_sets[i].buffers.size();
+      }
+
+      VkDescriptorPoolSize pool_size = {};
+      pool_size.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      pool_size.descriptorCount = std::max(binding_count, 1u);
+      VkDescriptorPoolCreateInfo pool_info = {};
+      pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+      pool_info.maxSets = count;
+      pool_info.poolSizeCount = 1;
+      pool_info.pPoolSizes = &pool_size;
+      if (vkCreateDescriptorPool(device_, &pool_info, nullptr, descriptor_pool_.replace()) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create descriptor pool");
+      }
+
+      VkDescriptorSetAllocateInfo alloc_info = {};
+      alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+      alloc_info.descriptorPool = descriptor_pool_;
+      alloc_info.descriptorSetCount = count;
+      alloc_info.pSetLayouts = layouts.data();
+      descriptor_sets_.resize(count);
+      if (vkAllocateDescriptorSets(device_, &alloc_info, descriptor_sets_.data()) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate descriptor sets");
+      }
+
+      for (size_t i = 0; i < count; i++) {
+        std::vector<uint32_t> const& buffers = capture_.descriptor_sets[i].buffers;
+        std::vector<VkDescriptorBufferInfo> buffer_infos(buffers.size());
+        std::vector<VkWriteDescriptorSet> writes(buffers.size());
+        for (size_t b = 0; b < buffers.size(); b++) {
+          if (buffers[b] >= buffers_.size()) {
+            throw std::runtime_error("Descriptor set references a buffer which is not in the capture");
+          }
+          buffer_infos[b] = {};
+          buffer_infos[b].buffer = buffers_[buffers[b]];
+          buffer_infos[b].range = VK_WHOLE_SIZE;
+          writes[b] = {};
+          writes[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+          writes[b].dstSet = descriptor_sets_[i];
+          writes[b].dstBinding = b;
+          writes[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+          writes[b].descriptorCount = 1;
+          writes[b].pBufferInfo = &buffer_infos[b];
+        }
+        vkUpdateDescriptorSets(device_, writes.size(), writes.data(), 0, nullptr);
+      }
+    }
+
+    /*
+     * The captured render pass, but rendering into images of our own:
+     * nothing is presented and nothing is kept from the frame before
+     */
+    void createRenderpass() {
+      engine::CaptureRenderPass const& captured = capture_.renderpass;
+      std::vector<VkAttachmentDescription> attachments = captured.attachments;
+      for (size_t i = 0; i < attachments.size(); i++) {
+        attachments[i].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        if (attachments[i].finalLayout == VK_IMAGE_LAYOUT_PRESENT_SRC_KHR) {
+          attachments[i].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+          present_attachment_ = i;
+        }
+      }
+
+      std::vector<VkSubpassDescription> subpasses(captured.subpasses.size());
+      for (size_t i = 0; i < subpasses.size(); i++) {
+        engine::CaptureSubpass const& subpass = captured.subpasses[i];
+        subpasses[i] = {};
+        subpasses[i].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpasses[i].colorAttachmentCount = subpass.colors.size();
+        subpasses[i].pColorAttachments = subpass.colors.data();
+        subpasses[i].pResolveAttachments = subpass.resolves.empty() ? nullptr : subpass.resolves.data();
+        subpasses[i].pDepthStencilAttachment = subpass.has_depth ? &subpass.depth : nullptr;
+      }
+
+      VkRenderPassCreateInfo info = {};
+      info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+      info.attachmentCount = attachments.size();
+      info.pAttachments = attachments.data();
+      info.subpassCount = subpasses.size();
+      info.pSubpasses = subpasses.data();
+      info.dependencyCount = captured.dependencies.size();
+      info.pDependencies = captured.dependencies.data();
+      if (vkCreateRenderPass(device_, &info, nullptr, renderpass_.replace()) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create render pass");
+      }
+    }
+
+    VkShaderModule shaderModule(std::string const& name) {
+      auto existing = shader_modules_.find(name);
+      if (existing != shader_modules_.end()) {
+        return existing->second;
+      }
+
+      for (auto const& shader : capture_.shaders) {
+        if (shader.first != name) {
+          continue;
+        }
+        VkShaderModuleCreateInfo info = {};
+        info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+        info.codeSize = shader.second.size();
+        // SPIR-V wants 4 byte alignment, which the allocator of the vector gives us
+        info.pCode = reinterpret_cast<const uint32_t*>(shader.second.data());
+        VDeleter<VkShaderModule>& module = shader_modules_.insert(
+                std::make_pair(name, VDeleter<VkShaderModule>{device_, vkDestroyShaderModule})).first->second;
+        if (vkCreateShaderModule(device_, &info, nullptr, module.replace()) != VK_SUCCESS) {
+          throw std::runtime_error("Failed to create shader module " + name);
+        }
+        return module;
+      }
+      throw std::runtime_error("Shader " + name + " is not in the capture");
+    }
+
+    /*
+     * Everything the engine doesn't vary is set like the engine does:
+     * no vertex input, one viewport covering the frame, no blending
+     */
+    void createGraphicsPipeline(CapturePipeline const& captured, VkPipelineLayout layout,
+                                VDeleter<VkPipeline>& pipeline) {
+      std::vector<VkPipelineShaderStageCreateInfo> stages;
+      VkPipelineShaderStageCreateInfo stage = {};
+      stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+      stage.pName = "main";
+      stage.stage = VK_SHADER_STAGE_VERTEX_BIT;
+      stage.module = shaderModule(captured.vertex_shader);
+      stages.push_back(stage);
+      if (!captured.fragment_shader.empty()) {
+        stage.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+        stage.module = shaderModule(captured.fragment_shader);
+        stages.push_back(stage);
+      }
+
+      VkPipelineVertexInputStateCreateInfo vertex_input_info = {};
+      vertex_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+      VkPipelineInputAssemblyStateCreateInfo input_assembly = {};
+      input_assembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+      input_assembly.topology = captured.topology;
+
+      VkViewport viewport = {};
+      viewport.width = float(capture_.extent.width);
+      viewport.height = float(capture_.extent.height);
+      viewport.maxDepth = 1.0f;
+      VkRect2D scissor = {};
+      scissor.extent = capture_.extent;
+      VkPipelineViewportStateCreateInfo viewport_state = {};
+      viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+      viewport_state.viewportCount = 1;
+      viewport_state.pViewports = &viewport;
+      viewport_state.scissorCount = 1;
+      viewport_state.pScissors = &scissor;
+
+      VkPipelineRasterizationStateCreateInfo rasterizer_info = {};
+      rasterizer_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+      rasterizer_info.polygonMode = VK_POLYGON_MODE_FILL;
+      rasterizer_info.lineWidth = 1.0f;
+      rasterizer_info.cullMode = captured.cull_mode;
+      rasterizer_info.frontFace = captured.front_face;
+
+      VkPipelineMultisampleStateCreateInfo multisampling = {};
+      multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+      multisampling.rasterizationSamples = captured.samples;
+      multisampling.minSampleShading = 1.0f;
+
+      VkPipelineDepthStencilStateCreateInfo depth_stencil_info = {};
+      depth_stencil_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+      depth_stencil_info.depthTestEnable = captured.depth_test;
+      depth_stencil_info.depthWriteEnable = captured.depth_write;
+      depth_stencil_info.depthCompareOp = captured.depth_compare;
+
+      VkPipelineColorBlendAttachmentState color_blend_attach = {};
+      color_blend_attach.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                                          VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+      std::vector<VkPipelineColorBlendAttachmentState> blend_attachments(captured.color_attachments,
+                                                                         color_blend_attach);
+      VkPipelineColorBlendStateCreateInfo color_blend_info = {};
+      color_blend_info.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+      color_blend_info.attachmentCount = blend_attachments.size();
+      color_blend_info.pAttachments = blend_attachments.data();
+
+      VkGraphicsPipelineCreateInfo info = {};
+      info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+      info.stageCount = stages.size();
+      info.pStages = stages.data();
+      info.pVertexInputState = &vertex_input_info;
+      info.pInputAssemblyState = &input_assembly;
+      info.pViewportState = &viewport_state;
+      info.pRasterizationState = &rasterizer_info;
+      info.pMultisampleState = &multisampling;
+      info.pDepthStencilState = &depth_stencil_info;
+      info.pColorBlendState = &color_blend_info;
+      info.layout = layout;
+      info.renderPass = renderpass_;
+      info.subpass = captured.subpass;
+      info.basePipelineIndex = -1;
+      if (vkCreateGraphicsPipelines(device_, VK_NULL_HANDLE, 1, &info, nullptr, pipeline.replace()) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create graphics pipeline");
+      }
+    }
+
+    void createPipelines() {
+      size_t count = capture_.pipelines.size();
+      pipeline_set_layouts_.resize(count, VDeleter<VkDescriptorSetLayout>{device_, vkDestroyDescriptorSetLayout});
+      pipeline_layouts_.resize(count, VDeleter<VkPipelineLayout>{device_, vkDestroyPipelineLayout});
+      pipelines_.resize(count, VDeleter<VkPipeline>{device_, vkDestroyPipeline});
+
+      for (size_t i = 0; i < count; i++) {
+        CapturePipeline const& captured = capture_.pipelines[i];
+        bool compute = captured.bind_point == VK_PIPELINE_BIND_POINT_COMPUTE;
+        if (compute ? captured.compute_shader.empty() : captured.vertex_shader.empty()) {
+          // not used by the captured frame
+          continue;
+        }
+
+        VkPushConstantRange push_constant_range = {};
+        push_constant_range.stageFlags = captured.push_constant_stages;
+        push_constant_range.size = captured.push_constant_size;
+
+        VkPipelineLayoutCreateInfo layout_info = {};
+        layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        if (captured.set_bindings > 0) {
+          createSetLayout(captured.set_bindings, pipeline_set_layouts_[i]);
+          layout_info.setLayoutCount = 1;
+          layout_info.pSetLayouts = &pipeline_set_layouts_[i];
+        }
+        if (captured.push_constant_size > 0) {
+          layout_info.pushConstantRangeCount = 1;
+          layout_info.pPushConstantRanges = &push_constant_range;
+        }
+        if (vkCreatePipelineLayout(device_, &layout_info, nullptr, pipeline_layouts_[i].replace()) != VK_SUCCESS) {
+          throw std::runtime_error("Failed to create pipeline layout");
+        }
+
+        if (!compute) {
+          createGraphicsPipeline(captured, pipeline_layouts_[i], pipelines_[i]);
+          continue;
+        }
+
+        VkComputePipelineCreateInfo info = {};
+        info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        info.stage.module = shaderModule(captured.compute_shader);
+        info.stage.pName = "main";
+        info.layout = pipeline_layouts_[i];
+        info.basePipelineIndex = -1;
+        if (vkCreateComputePipelines(device_, VK_NULL_HANDLE, 1, &info, nullptr, pipelines_[i].replace()) != VK_SUCCESS) {
+          throw std::runtime_error("Failed to create compute pipeline");
+        }
+      }
+    }
+
+    void createFramebuffer() {
+      std::vector<VkAttachmentDescription> const& attachments = capture_.renderpass.attachments;
+      size_t count = attachments.size();
+      images_.resize(count, VDeleter<VkImage>{device_, vkDestroyImage});
+      image_memory_.resize(count, VDeleter<VkDeviceMemory>{device_, vkFreeMemory});
+      image_views_.resize(count, VDeleter<VkImageView>{device_, vkDestroyImageView});
+
+      std::vector<bool> depth(count, false);
+      for (auto const& subpass : capture_.renderpass.subpasses) {
+        if (subpass.has_depth && subpass.depth.attachment < count) {
+          depth[subpass.depth.attachment] = true;
+        }
+      }
+
+      std::vector<VkImageView> views(count);
+      for (size_t i = 0; i < count; i++) {
+        VkImageCreateInfo info = {};
+        info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        info.imageType = VK_IMAGE_TYPE_2D;
+        info.extent = {capture_.extent.width, capture_.extent.height, 1};
+        info.mipLevels = 1;
+        info.arrayLayers = 1;
+        info.format = attachments[i].format;
+        info.tiling = VK_IMAGE_TILING_OPTIMAL;
+        info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        info.usage = depth[i] ? VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT : VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+        if (int(i) == present_attachment_) {
+          info.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        }
+        info.samples = attachments[i].samples;
+        info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        if (vkCreateImage(device_, &info, nullptr, images_[i].replace()) != VK_SUCCESS) {
+          throw std::runtime_error("Failed to create attachment image");
+        }
+
+        VkMemoryRequirements requirements;
+        vkGetImageMemoryRequirements(device_, images_[i], &requirements);
+        VkMemoryAllocateInfo alloc_info = {};
+        alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        alloc_info.allocationSize = requirements.size;
+        alloc_info.memoryTypeIndex = findMemoryType(requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        if (vkAllocateMemory(device_, &alloc_info, nullptr, image_memory_[i].replace()) != VK_SUCCESS) {
+          throw std::runtime_error("Failed to allocate attachment memory");
+        }
+        vkBindImageMemory(device_, images_[i], image_memory_[i], 0);
+
+        VkImageViewCreateInfo view_info = {};
+        view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        view_info.image = images_[i];
+        view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        view_info.format = attachments[i].format;
+        view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        if (depth[i]) {
+          view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+          if (hasStencil(attachments[i].format)) {
+            view_info.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
+          }
+        }
+        view_info.subresourceRange.levelCount = 1;
+        view_info.subresourceRange.layerCount = 1;
+        if (vkCreateImageView(device_, &view_info, nullptr, image_views_[i].replace()) != VK_SUCCESS) {
+          throw std::runtime_error("Failed to create attachment image view");
+        }
+        views[i] = image_views_[i];
+      }
+
+      VkFramebufferCreateInfo info = {};
+      info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+      info.renderPass = renderpass_;
+      info.attachmentCount = views.size();
+      info.pAttachments = views.data();
+      info.width = capture_.extent.width;
+      info.height = capture_.extent.height;
+      info.layers = 1;
+      if (vkCreateFramebuffer(device_, &info, nullptr, framebuffer_.replace()) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create framebuffer");
+      }
+    }
+
+    // begin and end of every pass
+    void createQueryPool() {
+      if (!timestamps_supported_) {
+        return;
+      }
+      VkQueryPoolCreateInfo info = {};
+      info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+      info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+      info.queryCount = 2 * capture_.passes.size();
+      if (vkCreateQueryPool(device_, &info, nullptr, query_pool_.replace()) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create query pool");
+      }
+    }
+
+    /*
+     * The passes in capture order, each one waits for everything before it
+     * A full barrier is more than the engine's render graph needs, but the
+     * capture doesn't have the dependencies, and it is the same every iteration
+     */
+    void recordCommandBuffer() {
+      CommandBindings bindings;
+      for (size_t i = 0; i < pipelines_.size(); i++) {
+        bindings.pipelines.push_back(pipelines_[i]);
+        bindings.layouts.push_back(pipeline_layouts_[i]);
+        bindings.bind_points.push_back(capture_.pipelines[i].bind_point);
+      }
+      bindings.descriptor_sets = descriptor_sets_;
+      for (auto const& buffer : buffers_) {
+        bindings.buffers.push_back(buffer);
+      }
+
+      VkCommandBufferBeginInfo begin_info = {};
+      begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+      if (vkBeginCommandBuffer(command_buffer_, &begin_info) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to start recording command buffer");
+      }
+      if (timestamps_supported_) {
+        vkCmdResetQueryPool(command_buffer_, query_pool_, 0, 2 * capture_.passes.size());
+      }
+
+      VkMemoryBarrier barrier = {};
+      barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+      barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+      barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+      for (size_t p = 0; p < capture_.passes.size(); p++) {
+        engine::CapturePass const& pass = capture_.passes[p];
+        if (timestamps_supported_) {
+          vkCmdWriteTimestamp(command_buffer_, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool_, 2 * p);
+        }
+
+        if (!pass.renderpass) {
+          for (auto const& stream : pass.streams) {
+            stream.record(command_buffer_, bindings);
+          }
+        } else {
+          VkRenderPassBeginInfo render_info = {};
+          render_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+          render_info.renderPass = renderpass_;
+          render_info.framebuffer = framebuffer_;
+          render_info.renderArea.extent = capture_.extent;
+          render_info.clearValueCount = capture_.renderpass.clear_values.size();
+          render_info.pClearValues = capture_.renderpass.clear_values.data();
+          vkCmdBeginRenderPass(command_buffer_, &render_info, VK_SUBPASS_CONTENTS_INLINE);
+          for (size_t s = 0; s < pass.streams.size(); s++) {
+            if (s > 0) {
+              vkCmdNextSubpass(command_buffer_, VK_SUBPASS_CONTENTS_INLINE);
+            }
+            pass.streams[s].record(command_buffer_, bindings);
+          }
+          vkCmdEndRenderPass(command_buffer_);
+        }
+
+        if (timestamps_supported_) {
+          vkCmdWriteTimestamp(command_buffer_, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool_, 2 * p + 1);
+        }
+        vkCmdPipelineBarrier(command_buffer_, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                             0, 1, &barrier, 0, nullptr, 0, nullptr);
+      }
+
+      if (vkEndCommandBuffer(command_buffer_) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to record command buffer");
+      }
+    }
+};
+
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    LOG_ERROR("usage: " << argv[0] << " <capture.vkcap> [iterations] [ppm|png|raw]");
+    engine::log::Logger::instance().flush();
+    return EXIT_FAILURE;
+  }
+
+  try {
+    uint32_t iterations = argc > 2 ? std::stoul(argv[2]) : 100;
+    FrameCapture capture = engine::readFrameCapture(argv[1]);
+    Replay replay(capture);
+    replay.init();
+    replay.run(iterations);
+
+    if (argc > 3) {
+      std::string format = argv[3];
+      if (format != "png" && format != "raw") {
+        format = "ppm";
+      }
+      std::string path = argv[1];
+      std::string prefix = path.substr(0, path.rfind(".vkcap")) + "-replay";
+      replay.readBack(format == "png" ? engine::ImageFileFormat::Png :
+                      format == "raw" ? engine::ImageFileFormat::Raw : engine::ImageFileFormat::Ppm, prefix);
+      LOG_INFO("Wrote the last frame to " << prefix << "-000000." << format);
+    }
+  } catch (const std::exception& e) {
+    LOG_ERROR(e.what());
+    engine::log::Logger::instance().flush();
+    return EXIT_FAILURE;
+  }
+
+  engine::log::Logger::instance().flush();
+  return EXIT_SUCCESS;
+}